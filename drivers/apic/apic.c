@@ -0,0 +1,287 @@
+#include <apic/apic.h>
+#include <acpi.h>
+#include <cpu.h>
+#include <interrupts/interrupts.h>
+#include <memory_mapper.h>
+#include <pit/pit.h>
+#include <sched.h>
+#include <vgaio.h>
+
+// Local APIC registers (byte offsets)
+#define LAPIC_ID            0x020
+#define LAPIC_VERSION       0x030
+#define LAPIC_TPR           0x080
+#define LAPIC_EOI           0x0B0
+#define LAPIC_SVR           0x0F0
+#define LAPIC_ICR_LOW       0x300
+#define LAPIC_ICR_HIGH      0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE    (1U << 8)
+#define LAPIC_ICR_PENDING   (1U << 12)
+#define LAPIC_LVT_MASKED    (1U << 16)
+#define LAPIC_TIMER_PERIODIC (1U << 17)
+#define LAPIC_TIMER_DIV_16  0x3
+#define APIC_BASE_ENABLE    (1ULL << 11)
+
+#define LAPIC_CALIBRATE_MS  10
+
+// IOAPIC registers
+#define IOAPIC_REGSEL       0x00
+#define IOAPIC_WINDOW       0x10
+#define IOAPIC_VERSION      0x01
+#define IOAPIC_REDIR(n)     (0x10 + 2 * (n))
+
+#define IOAPIC_ACTIVE_LOW   (1U << 13)
+#define IOAPIC_LEVEL        (1U << 15)
+#define IOAPIC_MASKED       (1U << 16)
+
+// MPS INTI flags from the MADT overrides
+#define MPS_POLARITY_MASK   0x3
+#define MPS_POLARITY_LOW    0x3
+#define MPS_TRIGGER_MASK    0xC
+#define MPS_TRIGGER_LEVEL   0xC
+
+#define ISA_IRQ_COUNT       16
+
+typedef struct {
+    volatile u32* base;
+    u32 gsi_base;
+    u32 pins;
+} ioapic_t;
+
+static volatile u32* g_lapic = NULL;
+static ioapic_t g_ioapics[ACPI_MAX_IOAPICS];
+static u32 g_ioapic_count = 0;
+static u32 g_timer_hz = 0;
+static volatile u64 g_timer_ticks = 0;
+
+static inline u32 lapic_read(u32 reg) {
+    return g_lapic[reg / 4];
+}
+
+static inline void lapic_write(u32 reg, u32 value) {
+    g_lapic[reg / 4] = value;
+}
+
+static u32 ioapic_read(ioapic_t* io, u32 reg) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    return io->base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(ioapic_t* io, u32 reg, u32 value) {
+    io->base[IOAPIC_REGSEL / 4] = reg;
+    io->base[IOAPIC_WINDOW / 4] = value;
+}
+
+static void lapic_enable(void) {
+    wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+int apic_init(void) {
+    const acpi_madt_t* madt = acpi_madt();
+    if (!madt || !madt->lapic_phys) return -1;
+
+    // Spurious interrupts must not be acknowledged; the stub just returns
+    extern void apic_spurious_handler(void);
+    register_interrupt_handler(APIC_SPURIOUS_VECTOR, &apic_spurious_handler);
+    extern void apic_wake_handler(void);
+    register_interrupt_handler(APIC_WAKE_VECTOR, &apic_wake_handler);
+    extern void apic_tlb_handler(void);
+    register_interrupt_handler(APIC_TLB_VECTOR, &apic_tlb_handler);
+
+    g_lapic = (volatile u32*)(uintptr_t)madt->lapic_phys;
+    lapic_enable();
+
+    for (u32 i = 0; i < madt->ioapic_count; i++) {
+        ioapic_t* io = &g_ioapics[g_ioapic_count];
+        io->base = (volatile u32*)(uintptr_t)madt->ioapics[i].phys;
+        io->gsi_base = madt->ioapics[i].gsi_base;
+        io->pins = ((ioapic_read(io, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+        for (u32 pin = 0; pin < io->pins; pin++) {
+            ioapic_write(io, IOAPIC_REDIR(pin), IOAPIC_MASKED);
+            ioapic_write(io, IOAPIC_REDIR(pin) + 1, 0);
+        }
+        g_ioapic_count++;
+    }
+
+    vga_printf("[APIC] LAPIC %u (version 0x%x), %u IOAPIC(s)\n",
+              apic_id(), lapic_read(LAPIC_VERSION) & 0xFF, g_ioapic_count);
+    return 0;
+}
+
+void apic_init_ap(void) {
+    if (g_lapic) lapic_enable();
+}
+
+int apic_available(void) {
+    return g_lapic != NULL;
+}
+
+u32 apic_ioapic_count(void) {
+    return g_ioapic_count;
+}
+
+u32 apic_id(void) {
+    return g_lapic ? lapic_read(LAPIC_ID) >> 24 : 0;
+}
+
+void apic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+void apic_send_ipi(u32 dest_apic_id, u32 icr) {
+    lapic_write(LAPIC_ICR_HIGH, dest_apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ volatile ("pause");
+    }
+}
+
+void apic_send_wake(u32 dest_apic_id) {
+    if (g_lapic) apic_send_ipi(dest_apic_id, APIC_WAKE_VECTOR);
+}
+
+// ISA IRQs are edge-triggered and active high unless an override says so.
+// Returns -1 for an IRQ whose identity-mapped pin was taken over by another
+// source (IRQ2's pin usually carries the PIT).
+static int ioapic_isa_gsi(u8 irq, u32* flags) {
+    const acpi_madt_t* madt = acpi_madt();
+    *flags = 0;
+    int claimed = 0;
+    for (u32 i = 0; madt && i < madt->override_count; i++) {
+        const acpi_irq_override_t* ov = &madt->overrides[i];
+        if (ov->source == irq) {
+            if ((ov->flags & MPS_POLARITY_MASK) == MPS_POLARITY_LOW) *flags |= IOAPIC_ACTIVE_LOW;
+            if ((ov->flags & MPS_TRIGGER_MASK) == MPS_TRIGGER_LEVEL) *flags |= IOAPIC_LEVEL;
+            return (int)ov->gsi;
+        }
+        if (ov->gsi == irq) claimed = 1;
+    }
+    return claimed ? -1 : irq;
+}
+
+static ioapic_t* ioapic_for_gsi(u32 gsi, u32* pin) {
+    for (u32 i = 0; i < g_ioapic_count; i++) {
+        ioapic_t* io = &g_ioapics[i];
+        if (gsi >= io->gsi_base && gsi < io->gsi_base + io->pins) {
+            *pin = gsi - io->gsi_base;
+            return io;
+        }
+    }
+    return NULL;
+}
+
+static ioapic_t* ioapic_for_irq(u8 irq, u32* flags, u32* pin) {
+    if (irq >= ISA_IRQ_COUNT) return NULL;
+    int gsi = ioapic_isa_gsi(irq, flags);
+    return gsi < 0 ? NULL : ioapic_for_gsi((u32)gsi, pin);
+}
+
+int ioapic_route_irq(u8 irq, u8 vector, u32 dest_apic_id) {
+    u32 flags;
+    u32 pin;
+    ioapic_t* io = ioapic_for_irq(irq, &flags, &pin);
+    if (!io) return -1;
+    ioapic_write(io, IOAPIC_REDIR(pin) + 1, dest_apic_id << 24);
+    ioapic_write(io, IOAPIC_REDIR(pin), vector | flags | IOAPIC_MASKED);
+    return 0;
+}
+
+static void ioapic_set_masked(u8 irq, int masked) {
+    u32 flags;
+    u32 pin;
+    ioapic_t* io = ioapic_for_irq(irq, &flags, &pin);
+    if (!io) return;
+    u32 low = ioapic_read(io, IOAPIC_REDIR(pin));
+    low = masked ? (low | IOAPIC_MASKED) : (low & ~IOAPIC_MASKED);
+    ioapic_write(io, IOAPIC_REDIR(pin), low);
+}
+
+void ioapic_unmask_irq(u8 irq) {
+    ioapic_set_masked(irq, 0);
+}
+
+void ioapic_mask_irq(u8 irq) {
+    ioapic_set_masked(irq, 1);
+}
+
+// Count LAPIC timer ticks (divide by 16) across a whole number of PIT ticks.
+static u32 apic_timer_calibrate(void) {
+    u64 start = pit_ticks();
+    while (pit_ticks() == start) __asm__ volatile ("hlt");
+
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFFU);
+    start = pit_ticks();
+    u64 pit_wait = ((u64)pit_get_hz() * LAPIC_CALIBRATE_MS) / 1000ULL;
+    while (pit_ticks() - start < pit_wait) __asm__ volatile ("hlt");
+    u32 elapsed = 0xFFFFFFFFU - lapic_read(LAPIC_TIMER_CURRENT);
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+
+    return elapsed / LAPIC_CALIBRATE_MS;
+}
+
+int apic_timer_start(u32 hz) {
+    if (!g_lapic || hz == 0 || pit_get_hz() == 0) return -1;
+    u64 flags;
+    __asm__ volatile ("pushfq; pop %0" : "=r"(flags));
+    if (!(flags & (1ULL << 9))) return -1;
+
+    u32 per_ms = apic_timer_calibrate();
+    u32 count = (u32)(((u64)per_ms * 1000ULL) / hz);
+    if (count == 0) return -1;
+
+    extern void apic_timer_handler(void);
+    register_interrupt_handler(APIC_TIMER_VECTOR, &apic_timer_handler);
+
+    g_timer_hz = hz;
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV_16);
+    lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+    lapic_write(LAPIC_TIMER_INITIAL, count);
+    vga_printf("[APIC] Timer at %u Hz (%u ticks/ms)\n", hz, per_ms);
+    return 0;
+}
+
+void apic_timer_pause(void) {
+    if (g_timer_hz) lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC | LAPIC_LVT_MASKED);
+}
+
+void apic_timer_resume(void) {
+    if (g_timer_hz) lapic_write(LAPIC_LVT_TIMER, APIC_TIMER_VECTOR | LAPIC_TIMER_PERIODIC);
+}
+
+int apic_timer_active(void) {
+    return g_timer_hz != 0;
+}
+
+void handle_apic_timer(void) {
+    g_timer_ticks++;
+    apic_eoi();
+    // May switch to another process; this one resumes here later
+    sched_tick();
+}
+
+void handle_apic_tlb(void) {
+    mm_tlb_poll();
+    apic_eoi();
+}
+
+void apic_debug_info(void) {
+    if (!g_lapic) {
+        vga_printf("APIC: not in use\n");
+        return;
+    }
+    vga_printf("LAPIC: id=%u base=0x%llx timer=%u Hz ticks=%llu\n", apic_id(),
+              (u64)(uintptr_t)g_lapic, g_timer_hz, g_timer_ticks);
+    for (u32 i = 0; i < g_ioapic_count; i++) {
+        vga_printf("IOAPIC %u: base=0x%llx gsi=%u-%u\n", i, (u64)(uintptr_t)g_ioapics[i].base,
+                  g_ioapics[i].gsi_base, g_ioapics[i].gsi_base + g_ioapics[i].pins - 1);
+    }
+}
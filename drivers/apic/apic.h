@@ -0,0 +1,63 @@
+#ifndef APIC_H
+#define APIC_H
+
+#include <cldtypes.h>
+
+// Local APIC and IOAPIC driver. Addresses come from the ACPI MADT and are
+// reached through the identity map. ISA IRQ n is routed to vector 32 + n,
+// the same vectors the remapped 8259 uses, so handlers do not care which
+// controller delivered them; the MADT interrupt source overrides pick the
+// IOAPIC pin and its polarity/trigger mode.
+#define APIC_IRQ_BASE_VECTOR  32
+#define APIC_TIMER_VECTOR     0x30
+#define APIC_WAKE_VECTOR      0x31  // IPI that only ends a hlt
+#define APIC_TLB_VECTOR       0x32  // Kernel TLB shootdown (memory_mapper.h)
+#define APIC_SPURIOUS_VECTOR  0xFF
+
+// Interrupt command register delivery modes
+#define APIC_ICR_INIT         0x00000500
+#define APIC_ICR_STARTUP      0x00000600
+#define APIC_ICR_LEVEL_ASSERT 0x00004000
+
+// Enable the boot CPU's LAPIC and mask every IOAPIC pin. Needs acpi_init.
+// Returns 0 on success, -1 if there is no usable MADT.
+int apic_init(void);
+
+// Software-enable the calling application processor's LAPIC.
+void apic_init_ap(void);
+
+int apic_available(void);
+u32 apic_ioapic_count(void);
+u32 apic_id(void);
+
+// Acknowledge the interrupt being serviced on this CPU.
+void apic_eoi(void);
+
+// Send an IPI and wait until the LAPIC has accepted it.
+void apic_send_ipi(u32 apic_id, u32 icr);
+
+// Wake a halted CPU with APIC_WAKE_VECTOR.
+void apic_send_wake(u32 apic_id);
+
+// Route ISA IRQ `irq` to `vector` on the CPU with `dest_apic_id`, masked.
+int ioapic_route_irq(u8 irq, u8 vector, u32 dest_apic_id);
+void ioapic_unmask_irq(u8 irq);
+void ioapic_mask_irq(u8 irq);
+
+// Periodic LAPIC timer on APIC_TIMER_VECTOR, calibrated against the PIT.
+// Needs the PIT running and interrupts enabled. Each tick drives sched_tick
+// on this CPU. Returns 0 on success.
+int apic_timer_start(u32 hz);
+int apic_timer_active(void);
+
+// Mask/unmask the timer interrupt around tickless idle; it keeps counting.
+void apic_timer_pause(void);
+void apic_timer_resume(void);
+
+// Timer and TLB shootdown vector trampolines (called from the ASM stubs)
+void handle_apic_timer(void);
+void handle_apic_tlb(void);
+
+void apic_debug_info(void);
+
+#endif // APIC_H
@@ -1,12 +1,27 @@
 #include "cldramfs.h"
 #include <kmalloc.h>
+#include <karena.h>
 #include <string.h>
 #include <vgaio.h>
 #include <elf_loader.h>
+#include <spinlock.h>
 
 Node *ramfs_root = NULL;
 Node *ramfs_cwd = NULL;
 
+// The tree lock covers directory structure: children arrays, names, parent
+// links and ramfs_cwd. Lookups share it; anything that adds, removes or
+// renames takes it exclusively. It does not pin nodes or guard file
+// contents: a Node* handed out stays valid until something removes it,
+// which only the shell's rm, rmdir and mv do.
+static rwlock_t ramfs_lock = RWLOCK_INIT("ramfs");
+
+// Scratch space for names of directories created during a lookup and for
+// splitting command arguments. Only used with the tree lock held for
+// writing. Requests longer than the buffer spill to the heap for that call.
+KARENA_DEFINE(path_arena, 1024);
+KARENA_DEFINE(cmd_arena, 1024);
+
 static u32 hex_to_u32(const char *hex_str, u32 len) {
     u32 result = 0;
     for (u32 i = 0; i < len; i++) {
@@ -64,18 +79,19 @@ Node* cldramfs_create_node(const char *name, NodeType type, Node *parent) {
     return node;
 }
 
-Node* cldramfs_find_child(Node *dir, const char *name) {
+static Node* find_child_locked(Node *dir, const char *name, u32 len) {
     if (!dir || dir->type != DIR_NODE || !name) return NULL;
     
     for (u32 i = 0; i < dir->child_count; i++) {
-        if (strcmp(dir->children[i]->name, name) == 0) {
+        const char *child = dir->children[i]->name;
+        if (strncmp(child, name, len) == 0 && child[len] == '\0') {
             return dir->children[i];
         }
     }
     return NULL;
 }
 
-void cldramfs_add_child(Node *parent, Node *child) {
+static void add_child_locked(Node *parent, Node *child) {
     if (!parent || parent->type != DIR_NODE || !child) return;
     
     if (parent->child_count >= parent->child_capacity) {
@@ -93,113 +109,168 @@ void cldramfs_add_child(Node *parent, Node *child) {
     parent->children[parent->child_count++] = child;
 }
 
-Node* cldramfs_resolve_path_dir(const char *path, int create_missing) {
-    if (!path) return NULL;
-    
-    Node *cur = (path[0] == '/') ? ramfs_root : ramfs_cwd;
-    
-    // Create a copy of the path for tokenization
-    u32 path_len = strlen(path);
-    char *temp = (char*)kmalloc(path_len + 1);
-    if (!temp) return NULL;
-    strcpy(temp, path);
-    
-    char *tok = temp;
-    char *next = NULL;
-    
-    while (tok && *tok) {
-        // Find next separator
-        next = strchr(tok, '/');
-        if (next) {
-            *next = '\0';
-            next++;
+static void unlink_child_locked(Node *parent, Node *child) {
+    if (!parent) return;
+    for (u32 i = 0; i < parent->child_count; i++) {
+        if (parent->children[i] == child) {
+            for (u32 j = i; j < parent->child_count - 1; j++) {
+                parent->children[j] = parent->children[j + 1];
+            }
+            parent->child_count--;
+            break;
         }
-        
-        // Skip empty tokens
-        if (*tok == '\0') {
-            tok = next;
-            continue;
+    }
+}
+
+static Node* create_dir_locked(Node *parent, const char *name, u32 len) {
+    karena_mark_t mark = karena_begin(&path_arena);
+    char *temp = (char*)karena_alloc(&path_arena, len + 1);
+    Node *dir = NULL;
+    if (temp) {
+        memcpy(temp, name, len);
+        temp[len] = '\0';
+        dir = cldramfs_create_node(temp, DIR_NODE, parent);
+        if (dir) {
+            add_child_locked(parent, dir);
         }
+    }
+    karena_reset(&path_arena, mark);
+    return dir;
+}
+
+// Walk the first `len` bytes of path. Tokens are compared in place, so
+// lookups need no scratch memory and can run side by side.
+static Node* resolve_dir_locked(const char *path, u32 len, int create_missing) {
+    Node *cur = (len > 0 && path[0] == '/') ? ramfs_root : ramfs_cwd;
+    u32 i = 0;
+    
+    while (i < len) {
+        // Skip empty tokens
+        while (i < len && path[i] == '/') i++;
+        const char *tok = path + i;
+        while (i < len && path[i] != '/') i++;
+        u32 tok_len = (u32)(path + i - tok);
+        if (tok_len == 0) break;
         
-        if (strcmp(tok, "..") == 0) {
+        if (tok_len == 2 && tok[0] == '.' && tok[1] == '.') {
             if (cur->parent) {
                 cur = cur->parent;
             }
-        } else if (strcmp(tok, ".") != 0) {
-            Node *child = cldramfs_find_child(cur, tok);
-            if (!child) {
-                if (create_missing) {
-                    child = cldramfs_create_node(tok, DIR_NODE, cur);
-                    if (child) {
-                        cldramfs_add_child(cur, child);
-                    }
-                } else {
-                    kfree(temp);
-                    return NULL;
-                }
+        } else if (tok_len != 1 || tok[0] != '.') {
+            Node *child = find_child_locked(cur, tok, tok_len);
+            if (!child && create_missing) {
+                child = create_dir_locked(cur, tok, tok_len);
             }
             if (!child || child->type != DIR_NODE) {
-                kfree(temp);
                 return NULL;
             }
             cur = child;
         }
-        
-        tok = next;
     }
     
-    kfree(temp);
     return cur;
 }
 
-Node* cldramfs_resolve_path_file(const char *path, int create_dirs) {
+static Node* resolve_file_locked(const char *path, int create_dirs) {
     if (!path || !*path) return NULL;
     
-    u32 path_len = strlen(path);
-    char *temp = (char*)kmalloc(path_len + 1);
-    if (!temp) return NULL;
-    strcpy(temp, path);
-    
-    char *last_slash = strrchr(temp, '/');
+    const char *last_slash = strrchr(path, '/');
     Node *dir;
-    char *fname;
+    const char *fname;
     
     if (last_slash) {
-        *last_slash = '\0';
         fname = last_slash + 1;
-        if (temp[0] == '\0' && path[0] == '/') {
+        if (last_slash == path) {
             dir = ramfs_root;
         } else {
-            dir = cldramfs_resolve_path_dir(temp, create_dirs);
+            dir = resolve_dir_locked(path, (u32)(last_slash - path), create_dirs);
         }
     } else {
         dir = ramfs_cwd;
-        fname = temp;
+        fname = path;
     }
     
-    if (!dir || !fname || !*fname) {
-        kfree(temp);
+    if (!dir || !*fname) {
         return NULL;
     }
     
-    Node *file = cldramfs_find_child(dir, fname);
+    Node *file = find_child_locked(dir, fname, strlen(fname));
     if (!file && create_dirs) {
         file = cldramfs_create_node(fname, FILE_NODE, dir);
         if (file) {
-            cldramfs_add_child(dir, file);
+            add_child_locked(dir, file);
         }
     }
+    return file;
+}
+
+Node* cldramfs_find_child(Node *dir, const char *name) {
+    if (!name) return NULL;
+    read_lock(&ramfs_lock);
+    Node *child = find_child_locked(dir, name, strlen(name));
+    read_unlock(&ramfs_lock);
+    return child;
+}
+
+void cldramfs_add_child(Node *parent, Node *child) {
+    write_lock(&ramfs_lock);
+    add_child_locked(parent, child);
+    write_unlock(&ramfs_lock);
+}
+
+Node* cldramfs_resolve_path_dir(const char *path, int create_missing) {
+    if (!path) return NULL;
     
-    kfree(temp);
+    Node *dir;
+    if (create_missing) {
+        write_lock(&ramfs_lock);
+        dir = resolve_dir_locked(path, strlen(path), 1);
+        write_unlock(&ramfs_lock);
+    } else {
+        read_lock(&ramfs_lock);
+        dir = resolve_dir_locked(path, strlen(path), 0);
+        read_unlock(&ramfs_lock);
+    }
+    return dir;
+}
+
+Node* cldramfs_resolve_path_file(const char *path, int create_dirs) {
+    Node *file;
+    if (create_dirs) {
+        write_lock(&ramfs_lock);
+        file = resolve_file_locked(path, 1);
+        write_unlock(&ramfs_lock);
+    } else {
+        read_lock(&ramfs_lock);
+        file = resolve_file_locked(path, 0);
+        read_unlock(&ramfs_lock);
+    }
     return file;
 }
 
+i64 cldramfs_read_file(const char *path, u32 offset, void *buf, u32 len) {
+    i64 copied = -1;
+    read_lock(&ramfs_lock);
+    Node *file = resolve_file_locked(path, 0);
+    if (file && file->type == FILE_NODE) {
+        copied = 0;
+        if (file->content && offset < file->content_size) {
+            u32 avail = file->content_size - offset;
+            copied = len < avail ? len : avail;
+            if (copied > 0) memcpy(buf, file->content + offset, (size_t)copied);
+        }
+    }
+    read_unlock(&ramfs_lock);
+    return copied;
+}
+
 int cldramfs_load_cpio(void *cpio_data, u32 cpio_size) {
     if (!cpio_data || cpio_size == 0) return -1;
     
     u8 *data = (u8*)cpio_data;
     u32 offset = 0;
     
+    write_lock(&ramfs_lock);
     while (offset < cpio_size) {
         struct cpio_header *header = (struct cpio_header*)(data + offset);
         
@@ -236,9 +307,9 @@ int cldramfs_load_cpio(void *cpio_data, u32 cpio_size) {
         int is_dir = (mode & 0040000) != 0;  // S_IFDIR
         
         if (is_dir) {
-            cldramfs_resolve_path_dir(filename, 1);
+            resolve_dir_locked(filename, strlen(filename), 1);
         } else {
-            Node *file = cldramfs_resolve_path_file(filename, 1);
+            Node *file = resolve_file_locked(filename, 1);
             if (file && filesize > 0) {
                 kfree(file->content);
                 file->content = (char*)kmalloc(filesize + 1);
@@ -255,10 +326,12 @@ int cldramfs_load_cpio(void *cpio_data, u32 cpio_size) {
         offset += filesize;
         offset = (offset + 3) & ~3;
     }
+    write_unlock(&ramfs_lock);
     
     return 0;
 }
 
+// The node must already be unlinked from the tree.
 void cldramfs_free_node(Node *node) {
     if (!node) return;
     
@@ -277,8 +350,10 @@ void cldramfs_free_node(Node *node) {
 
 // Shell command implementations
 void cldramfs_cmd_ls(const char *arg) {
-    Node *dir = arg ? cldramfs_resolve_path_dir(arg, 0) : ramfs_cwd;
+    read_lock(&ramfs_lock);
+    Node *dir = arg ? resolve_dir_locked(arg, strlen(arg), 0) : ramfs_cwd;
     if (!dir || dir->type != DIR_NODE) {
+        read_unlock(&ramfs_lock);
         vga_printf("Not a directory\n");
         return;
     }
@@ -289,21 +364,20 @@ void cldramfs_cmd_ls(const char *arg) {
                    child->type == DIR_NODE ? "DIR" : "FILE", 
                    child->name);
     }
+    read_unlock(&ramfs_lock);
 }
 
 void cldramfs_cmd_cd(const char *arg) {
-    if (!arg) {
-        ramfs_cwd = ramfs_root;
-        return;
+    write_lock(&ramfs_lock);
+    Node *dir = arg ? resolve_dir_locked(arg, strlen(arg), 0) : ramfs_root;
+    if (dir && dir->type == DIR_NODE) {
+        ramfs_cwd = dir;
     }
+    write_unlock(&ramfs_lock);
     
-    Node *dir = cldramfs_resolve_path_dir(arg, 0);
     if (!dir || dir->type != DIR_NODE) {
         vga_printf("Directory not found\n");
-        return;
     }
-    
-    ramfs_cwd = dir;
 }
 
 void cldramfs_cmd_mkdir(const char *arg) {
@@ -319,23 +393,19 @@ void cldramfs_cmd_touch(const char *arg) {
 void cldramfs_cmd_cat(const char *arg) {
     if (!arg) return;
     
-    Node *file = cldramfs_resolve_path_file(arg, 0);
+    read_lock(&ramfs_lock);
+    Node *file = resolve_file_locked(arg, 0);
     if (!file) {
         vga_printf("cat: %s: No such file or directory\n", arg);
-        return;
-    }
-    
-    if (file->type != FILE_NODE) {
+    } else if (file->type != FILE_NODE) {
         vga_printf("cat: %s: Is a directory\n", arg);
-        return;
-    }
-    
-    if (file->content) {
+    } else if (file->content) {
         vga_printf("%s", file->content);
         if (file->content_size > 0 && file->content[file->content_size - 1] != '\n') {
             vga_printf("\n");
         }
     }
+    read_unlock(&ramfs_lock);
 }
 
 static int echo_hex_value(char c) {
@@ -411,16 +481,18 @@ void cldramfs_cmd_echo(const char *args) {
 }
 
 
-void cldramfs_cmd_rm(const char *arg) {
+static void cmd_rm_locked(const char *arg) {
     if (!arg) {
         vga_printf("rm: missing file operand\n");
         return;
     }
     
-    u32 path_len = strlen(arg);
-    char *temp = (char*)kmalloc(path_len + 1);
-    if (!temp) return;
-    strcpy(temp, arg);
+    karena_mark_t mark = karena_begin(&cmd_arena);
+    char *temp = karena_strdup(&cmd_arena, arg);
+    if (!temp) {
+        karena_reset(&cmd_arena, mark);
+        return;
+    }
     
     char *last_slash = strrchr(temp, '/');
     Node *dir;
@@ -428,7 +500,7 @@ void cldramfs_cmd_rm(const char *arg) {
     
     if (last_slash) {
         *last_slash = '\0';
-        dir = cldramfs_resolve_path_dir(temp, 0);
+        dir = resolve_dir_locked(temp, strlen(temp), 0);
         fname = last_slash + 1;
     } else {
         dir = ramfs_cwd;
@@ -437,44 +509,36 @@ void cldramfs_cmd_rm(const char *arg) {
     
     if (!dir) {
         vga_printf("rm: cannot remove '%s': No such file or directory\n", arg);
-        kfree(temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
     
-    Node *file = cldramfs_find_child(dir, fname);
+    Node *file = find_child_locked(dir, fname, strlen(fname));
     if (!file) {
         vga_printf("rm: cannot remove '%s': No such file or directory\n", arg);
-        kfree(temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
     
     if (file->type == DIR_NODE) {
         vga_printf("rm: cannot remove '%s': Is a directory\n", arg);
-        kfree(temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
     
-    for (u32 i = 0; i < dir->child_count; i++) {
-        if (dir->children[i] == file) {
-            for (u32 j = i; j < dir->child_count - 1; j++) {
-                dir->children[j] = dir->children[j + 1];
-            }
-            dir->child_count--;
-            break;
-        }
-    }
+    unlink_child_locked(dir, file);
     
     cldramfs_free_node(file);
-    kfree(temp);
+    karena_reset(&cmd_arena, mark);
 }
 
-void cldramfs_cmd_rmdir(const char *arg) {
+static void cmd_rmdir_locked(const char *arg) {
     if (!arg) {
         vga_printf("rmdir: missing operand\n");
         return;
     }
     
-    Node *dir = cldramfs_resolve_path_dir(arg, 0);
+    Node *dir = resolve_dir_locked(arg, strlen(arg), 0);
     if (!dir) {
         vga_printf("rmdir: failed to remove '%s': No such file or directory\n", arg);
         return;
@@ -495,32 +559,23 @@ void cldramfs_cmd_rmdir(const char *arg) {
         return;
     }
     
-    Node *parent = dir->parent;
-    if (parent) {
-        for (u32 i = 0; i < parent->child_count; i++) {
-            if (parent->children[i] == dir) {
-                for (u32 j = i; j < parent->child_count - 1; j++) {
-                    parent->children[j] = parent->children[j + 1];
-                }
-                parent->child_count--;
-                break;
-            }
-        }
-    }
+    unlink_child_locked(dir->parent, dir);
     
     cldramfs_free_node(dir);
 }
 
-void cldramfs_cmd_mv(const char *src, const char *dst) {
+static void cmd_mv_locked(const char *src, const char *dst) {
     if (!src || !dst) {
         vga_printf("mv: missing file operand\n");
         return;
     }
     
-    u32 src_len = strlen(src);
-    char *src_temp = (char*)kmalloc(src_len + 1);
-    if (!src_temp) return;
-    strcpy(src_temp, src);
+    karena_mark_t mark = karena_begin(&cmd_arena);
+    char *src_temp = karena_strdup(&cmd_arena, src);
+    if (!src_temp) {
+        karena_reset(&cmd_arena, mark);
+        return;
+    }
     
     char *src_last_slash = strrchr(src_temp, '/');
     Node *src_dir;
@@ -528,7 +583,7 @@ void cldramfs_cmd_mv(const char *src, const char *dst) {
     
     if (src_last_slash) {
         *src_last_slash = '\0';
-        src_dir = cldramfs_resolve_path_dir(src_temp, 0);
+        src_dir = resolve_dir_locked(src_temp, strlen(src_temp), 0);
         src_fname = src_last_slash + 1;
     } else {
         src_dir = ramfs_cwd;
@@ -537,24 +592,22 @@ void cldramfs_cmd_mv(const char *src, const char *dst) {
     
     if (!src_dir) {
         vga_printf("mv: cannot stat '%s': No such file or directory\n", src);
-        kfree(src_temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
     
-    Node *src_node = cldramfs_find_child(src_dir, src_fname);
+    Node *src_node = find_child_locked(src_dir, src_fname, strlen(src_fname));
     if (!src_node) {
         vga_printf("mv: cannot stat '%s': No such file or directory\n", src);
-        kfree(src_temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
     
-    u32 dst_len = strlen(dst);
-    char *dst_temp = (char*)kmalloc(dst_len + 1);
+    char *dst_temp = karena_strdup(&cmd_arena, dst);
     if (!dst_temp) {
-        kfree(src_temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
-    strcpy(dst_temp, dst);
     
     char *dst_last_slash = strrchr(dst_temp, '/');
     Node *dst_dir;
@@ -562,7 +615,7 @@ void cldramfs_cmd_mv(const char *src, const char *dst) {
     
     if (dst_last_slash) {
         *dst_last_slash = '\0';
-        dst_dir = cldramfs_resolve_path_dir(dst_temp, 0);
+        dst_dir = resolve_dir_locked(dst_temp, strlen(dst_temp), 0);
         dst_fname = dst_last_slash + 1;
     } else {
         dst_dir = ramfs_cwd;
@@ -571,20 +624,11 @@ void cldramfs_cmd_mv(const char *src, const char *dst) {
     
     if (!dst_dir) {
         vga_printf("mv: cannot move '%s' to '%s': No such file or directory\n", src, dst);
-        kfree(src_temp);
-        kfree(dst_temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
     
-    for (u32 i = 0; i < src_dir->child_count; i++) {
-        if (src_dir->children[i] == src_node) {
-            for (u32 j = i; j < src_dir->child_count - 1; j++) {
-                src_dir->children[j] = src_dir->children[j + 1];
-            }
-            src_dir->child_count--;
-            break;
-        }
-    }
+    unlink_child_locked(src_dir, src_node);
     
     kfree(src_node->name);
     u32 new_name_len = strlen(dst_fname);
@@ -594,22 +638,23 @@ void cldramfs_cmd_mv(const char *src, const char *dst) {
     }
     src_node->parent = dst_dir;
     
-    cldramfs_add_child(dst_dir, src_node);
+    add_child_locked(dst_dir, src_node);
     
-    kfree(src_temp);
-    kfree(dst_temp);
+    karena_reset(&cmd_arena, mark);
 }
 
-void cldramfs_cmd_cp(const char *src, const char *dst) {
+static void cmd_cp_locked(const char *src, const char *dst) {
     if (!src || !dst) {
         vga_printf("cp: missing file operand\n");
         return;
     }
     
-    u32 src_len = strlen(src);
-    char *src_temp = (char*)kmalloc(src_len + 1);
-    if (!src_temp) return;
-    strcpy(src_temp, src);
+    karena_mark_t mark = karena_begin(&cmd_arena);
+    char *src_temp = karena_strdup(&cmd_arena, src);
+    if (!src_temp) {
+        karena_reset(&cmd_arena, mark);
+        return;
+    }
     
     char *src_last_slash = strrchr(src_temp, '/');
     Node *src_dir;
@@ -617,7 +662,7 @@ void cldramfs_cmd_cp(const char *src, const char *dst) {
     
     if (src_last_slash) {
         *src_last_slash = '\0';
-        src_dir = cldramfs_resolve_path_dir(src_temp, 0);
+        src_dir = resolve_dir_locked(src_temp, strlen(src_temp), 0);
         src_fname = src_last_slash + 1;
     } else {
         src_dir = ramfs_cwd;
@@ -626,27 +671,27 @@ void cldramfs_cmd_cp(const char *src, const char *dst) {
     
     if (!src_dir) {
         vga_printf("cp: cannot stat '%s': No such file or directory\n", src);
-        kfree(src_temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
     
-    Node *src_node = cldramfs_find_child(src_dir, src_fname);
+    Node *src_node = find_child_locked(src_dir, src_fname, strlen(src_fname));
     if (!src_node) {
         vga_printf("cp: cannot stat '%s': No such file or directory\n", src);
-        kfree(src_temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
     
     if (src_node->type == DIR_NODE) {
         vga_printf("cp: omitting directory '%s'\n", src);
-        kfree(src_temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
     
-    Node *dst_node = cldramfs_resolve_path_file(dst, 1);
+    Node *dst_node = resolve_file_locked(dst, 1);
     if (!dst_node) {
         vga_printf("cp: cannot create '%s'\n", dst);
-        kfree(src_temp);
+        karena_reset(&cmd_arena, mark);
         return;
     }
     
@@ -666,29 +711,73 @@ void cldramfs_cmd_cp(const char *src, const char *dst) {
         }
     }
     
-    kfree(src_temp);
+    karena_reset(&cmd_arena, mark);
+}
+
+// Commands that change the tree hold the lock for writing throughout
+void cldramfs_cmd_rm(const char *arg) {
+    write_lock(&ramfs_lock);
+    cmd_rm_locked(arg);
+    write_unlock(&ramfs_lock);
+}
+
+void cldramfs_cmd_rmdir(const char *arg) {
+    write_lock(&ramfs_lock);
+    cmd_rmdir_locked(arg);
+    write_unlock(&ramfs_lock);
+}
+
+void cldramfs_cmd_mv(const char *src, const char *dst) {
+    write_lock(&ramfs_lock);
+    cmd_mv_locked(src, dst);
+    write_unlock(&ramfs_lock);
+}
+
+void cldramfs_cmd_cp(const char *src, const char *dst) {
+    write_lock(&ramfs_lock);
+    cmd_cp_locked(src, dst);
+    write_unlock(&ramfs_lock);
 }
 
 void cldramfs_cmd_exec(const char *arg) {
     if (!arg || strlen(arg) == 0) {
         vga_printf("exec: missing ELF file name\n");
-        vga_printf("usage: exec <filename.o>\n");
+        vga_printf("usage: exec <filename.o> [&]\n");
         return;
     }
     
-    // Find the file in ramfs
-    Node *file_node = cldramfs_resolve_path_file(arg, 0);
+    // A trailing '&' starts the program in the background
+    char path[256];
+    strncpy(path, arg, sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    int background = 0;
+    u32 len = strlen(path);
+    while (len > 0 && (path[len - 1] == ' ' || path[len - 1] == '\t')) path[--len] = '\0';
+    if (len > 0 && path[len - 1] == '&') {
+        background = 1;
+        path[--len] = '\0';
+        while (len > 0 && (path[len - 1] == ' ' || path[len - 1] == '\t')) path[--len] = '\0';
+    }
+    arg = path;
+    
+    // Find the file in ramfs. The image is copied out by elf_load, so the
+    // lock is not needed once the program runs.
+    read_lock(&ramfs_lock);
+    Node *file_node = resolve_file_locked(arg, 0);
     if (!file_node) {
+        read_unlock(&ramfs_lock);
         vga_printf("exec: file '%s' not found\n", arg);
         return;
     }
     
     if (file_node->type != FILE_NODE) {
+        read_unlock(&ramfs_lock);
         vga_printf("exec: '%s' is not a file\n", arg);
         return;
     }
     
     if (!file_node->content || file_node->content_size == 0) {
+        read_unlock(&ramfs_lock);
         vga_printf("exec: file '%s' is empty\n", arg);
         return;
     }
@@ -696,15 +785,26 @@ void cldramfs_cmd_exec(const char *arg) {
     // Load the ELF file
     loaded_elf_t loaded_elf;
     int result = elf_load(file_node->content, file_node->content_size, &loaded_elf);
+    read_unlock(&ramfs_lock);
     if (result != 0) {
         vga_printf("exec: failed to load ELF file '%s'\n", arg);
         return;
     }
     
+    if (background) {
+        u32 pid = elf_spawn(&loaded_elf, arg);
+        if (pid) vga_printf("[%u] %s\n", pid, arg);
+        else {
+            vga_printf("exec: failed to start '%s'\n", arg);
+            elf_unload(&loaded_elf);
+        }
+        return;
+    }
+    
     // Execute the ELF file
     result = elf_execute(&loaded_elf, arg);
     vga_printf("Program exited with code: %d\n", result);
     
-    // Clean up
-    // elf_unload(&loaded_elf);  // COMMENTED FOR NOW TO TEST
+    // Frees the staging copy if the program never started
+    elf_unload(&loaded_elf);
 }
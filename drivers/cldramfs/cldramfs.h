@@ -47,6 +47,9 @@ void cldramfs_add_child(Node *parent, Node *child);
 Node* cldramfs_resolve_path_dir(const char *path, int create_missing);
 Node* cldramfs_resolve_path_file(const char *path, int create_dirs);
 void cldramfs_free_node(Node *node);
+// Copy up to len bytes of the file at path, from offset on, into buf.
+// Returns the bytes copied (0 past the end), or -1 if path is not a file.
+i64 cldramfs_read_file(const char *path, u32 offset, void *buf, u32 len);
 
 // Shell command implementations  
 void cldramfs_cmd_ls(const char *arg);
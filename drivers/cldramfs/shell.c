@@ -6,11 +6,22 @@
 #include <gui/gui.h>
 #include <fb/fb_console.h>
 #include <shell_control.h>
-#include <deferred.h>
 #include <lua_vm.h>
 #include <kmalloc.h>
+#include <karena.h>
 #include <kheap.h>
 #include <sysinfo.h>
+#include <kbench.h>
+#include <kstack.h>
+#include <sched.h>
+#include <deferred.h>
+#include <smp.h>
+#include <task.h>
+#include <spinlock.h>
+#include <syscalls.h>
+#include <ktimer.h>
+#include <clock.h>
+#include <apic/apic.h>
 
 // External TTY functions
 extern void tty_global_init(void);
@@ -27,10 +38,15 @@ typedef struct {
     u32 len;
     u32 cap;
     int failed;
+    karena_mark_t mark;
 } shell_redirect_capture_t;
 
 static shell_redirect_capture_t redirect_capture = {0};
 
+// Captured command output only lives until it is written to the target
+// file, so it is grown inside a scratch arena instead of the heap.
+KARENA_DEFINE(redirect_arena, 16384);
+
 void cldramfs_shell_init(void) {
     // Note: ramfs should already be initialized by now
     tty_global_init();
@@ -264,15 +280,12 @@ static void shell_redirect_putchar(char c) {
 
     if (redirect_capture.len + 1 >= redirect_capture.cap) {
         u32 new_cap = redirect_capture.cap ? redirect_capture.cap * 2 : 256;
-        char *new_data = (char*)kmalloc(new_cap);
+        char *new_data = (char*)karena_grow(&redirect_arena, redirect_capture.data,
+                                            redirect_capture.cap, new_cap);
         if (!new_data) {
             redirect_capture.failed = 1;
             return;
         }
-        if (redirect_capture.data) {
-            memcpy(new_data, redirect_capture.data, redirect_capture.len);
-            kfree(redirect_capture.data);
-        }
         redirect_capture.data = new_data;
         redirect_capture.cap = new_cap;
     }
@@ -282,6 +295,7 @@ static void shell_redirect_putchar(char c) {
 }
 
 static void shell_redirect_begin(void) {
+    redirect_capture.mark = karena_begin(&redirect_arena);
     redirect_capture.data = NULL;
     redirect_capture.len = 0;
     redirect_capture.cap = 0;
@@ -289,9 +303,7 @@ static void shell_redirect_begin(void) {
 }
 
 static void shell_redirect_end(void) {
-    if (redirect_capture.data) {
-        kfree(redirect_capture.data);
-    }
+    karena_reset(&redirect_arena, redirect_capture.mark);
     redirect_capture.data = NULL;
     redirect_capture.len = 0;
     redirect_capture.cap = 0;
@@ -519,9 +531,8 @@ int cldramfs_shell_process_command(const char *command_line) {
                 if (!task->argv) { kfree(task); vga_printf("lua: oom\n"); return 0; }
                 for (int i=0;i<tcount;i++){ u32 n=strlen(tokens[i]); task->argv[i]=(char*)kmalloc(n+1); if(task->argv[i]) strcpy(task->argv[i], tokens[i]); }
                 u32 pn = strlen(tokens[0]); task->path = (char*)kmalloc(pn+1); if (task->path) strcpy(task->path, tokens[0]);
-                // Pause only after scheduling succeeds, otherwise input stays usable.
-                extern void cld_luavm_run_deferred_with_args(void *arg);
-                if (!task->path || deferred_schedule(cld_luavm_run_deferred_with_args, task) != 0) {
+                // Pause only after the script starts, otherwise input stays usable.
+                if (!task->path || sched_spawn(task->path, cld_luavm_thread_with_args, task, CLD_LUAVM_STACK_SIZE) == 0) {
                     vga_printf("lua: failed to schedule\n");
                     if (task) {
                         if (task->path) kfree(task->path);
@@ -548,9 +559,17 @@ int cldramfs_shell_process_command(const char *command_line) {
         vga_printf("  cp <src> <dst>      - Copy file\n");
         vga_printf("  mv <src> <dst>      - Move/rename file\n");
         vga_printf("  echo [text]         - Print text to stdout\n");
-        vga_printf("  exec <file.o>       - Execute ELF relocatable file\n");
+        vga_printf("  exec <file.o> [&]   - Execute ELF relocatable file (& = background)\n");
         vga_printf("  lua <script.lua>    - Run Lua script\n");
         vga_printf("  sysinfo <topic>     - Show kernel or memory information\n");
+        vga_printf("  heapstat [on|off]   - Heap profile, toggle allocation tracking\n");
+        vga_printf("  kstacks             - Kernel stack sizes and peak usage\n");
+        vga_printf("  ps                  - List processes, scheduler and deferred work counters\n");
+        vga_printf("  cpus                - List processors, interrupt controllers and task pool\n");
+        vga_printf("  timers              - Show clock, armed timers and idle statistics\n");
+        vga_printf("  locks               - Show lock contention counters\n");
+        vga_printf("  syscalls [reset|trace <0-2>] - Syscall counts and cycles, trace level\n");
+        vga_printf("  bench [name|list]   - Run kernel microbenchmarks\n");
         vga_printf("  guictl <command>    - Manage GUI (guictl help)\n");
         vga_printf("  snake               - Open Snake in GUI\n");
         vga_printf("  cmd > file          - Redirect command output to file\n");
@@ -603,6 +622,67 @@ int cldramfs_shell_process_command(const char *command_line) {
             print_sysinfo_help();
         }
     }
+    else if (strncmp(cmd, "heapstat", 8) == 0 && (cmd[8] == '\0' || cmd[8] == ' ' || cmd[8] == '\t')) {
+        char *arg = find_arg(cmd);
+        if (!arg || !*arg) {
+            kmalloc_heapstat(10);
+        } else if (strcmp(arg, "on") == 0) {
+            kmalloc_set_tracking(1);
+            vga_printf("heapstat: tracking new allocations\n");
+        } else if (strcmp(arg, "off") == 0) {
+            kmalloc_set_tracking(0);
+            vga_printf("heapstat: tracking off\n");
+        } else {
+            vga_printf("Usage: heapstat [on|off]\n");
+        }
+    }
+    else if (strcmp(cmd, "kstacks") == 0) {
+        kstack_debug_info();
+    }
+    else if (strcmp(cmd, "ps") == 0) {
+        sched_debug_info();
+        deferred_debug_info();
+    }
+    else if (strcmp(cmd, "timers") == 0) {
+        clock_debug_info();
+        ktimer_debug_info();
+    }
+    else if (strcmp(cmd, "cpus") == 0) {
+        smp_debug_info();
+        apic_debug_info();
+        task_debug_info();
+    }
+    else if (strcmp(cmd, "locks") == 0) {
+        lock_debug_info();
+    }
+    else if (strncmp(cmd, "syscalls", 8) == 0 && (cmd[8] == '\0' || cmd[8] == ' ' || cmd[8] == '\t')) {
+        char *arg = find_arg(cmd);
+        if (!arg || !*arg) {
+            syscall_debug_info();
+        } else if (strcmp(arg, "reset") == 0) {
+            syscall_reset_stats();
+            vga_printf("syscalls: counters cleared\n");
+        } else if (strncmp(arg, "trace ", 6) == 0 && arg[6] >= '0' && arg[6] <= '9' && arg[7] == '\0') {
+            if (syscall_set_trace_level((u32)(arg[6] - '0')) == 0) {
+                vga_printf("syscalls: trace level %u\n", syscall_trace_level());
+            } else {
+                vga_printf("syscalls: built with trace levels up to %u\n", (u32)SYSCALL_TRACE_MAX);
+            }
+        } else {
+            vga_printf("Usage: syscalls [reset|trace <0-2>]\n");
+        }
+    }
+    else if (strncmp(cmd, "bench", 5) == 0 && (cmd[5] == '\0' || cmd[5] == ' ' || cmd[5] == '\t')) {
+        char *arg = find_arg(cmd);
+        if (!arg || !*arg || strcmp(arg, "all") == 0) {
+            kbench_run_all();
+        } else if (strcmp(arg, "list") == 0) {
+            kbench_list();
+        } else if (kbench_run(arg) != 0) {
+            vga_printf("bench: unknown benchmark '%s'\n", arg);
+            kbench_list();
+        }
+    }
     else if ((strncmp(cmd, "guictl", 6) == 0 && (cmd[6] == '\0' || cmd[6] == ' ' || cmd[6] == '\t')) ||
              (strncmp(cmd, "guistl", 6) == 0 && (cmd[6] == '\0' || cmd[6] == ' ' || cmd[6] == '\t'))) {
         char *arg = find_arg(cmd);
@@ -681,9 +761,8 @@ int cldramfs_shell_process_command(const char *command_line) {
                 u32 pn = strlen(fullpath); task->path = (char*)kmalloc(pn+1); if (task->path) strcpy(task->path, fullpath);
                 task->argv[0] = (char*)kmalloc(pn+1); if (task->argv[0]) strcpy(task->argv[0], fullpath);
                 for (int j=0;j<tcount;j++) { u32 n=strlen(tokens[j]); task->argv[j+1]=(char*)kmalloc(n+1); if(task->argv[j+1]) strcpy(task->argv[j+1], tokens[j]); }
-                // Pause only after scheduling succeeds, otherwise input stays usable.
-                extern void cld_luavm_run_deferred_with_args(void *arg);
-                if (!task->path || !task->argv[0] || deferred_schedule(cld_luavm_run_deferred_with_args, task) != 0) {
+                // Pause only after the script starts, otherwise input stays usable.
+                if (!task->path || !task->argv[0] || sched_spawn(task->path, cld_luavm_thread_with_args, task, CLD_LUAVM_STACK_SIZE) == 0) {
                     vga_printf("lua: failed to schedule\n");
                     if (task) {
                         if (task->path) kfree(task->path);
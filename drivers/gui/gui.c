@@ -6,9 +6,11 @@
 #include <cldramfs/cldramfs.h>
 #include <cldramfs/tty.h>
 #include <kmalloc.h>
+#include <pmm.h>
 #include <lua_vm.h>
 #include <deferred.h>
 #include <pit/pit.h>
+#include <ktimer.h>
 #include <string.h>
 #include <stdio.h>
 #include "gui.h"
@@ -58,10 +60,12 @@ static gui_app_t apps[APP_COUNT];
 
 static u8 fb_bpp = 0;
 static u8 *gui_backbuf = 0;
+static u64 gui_backbuf_phys = 0;    // For pmm_free_contiguous
 static u32 gui_back_pitch = 0;
 static volatile int gui_frame_dirty = 0;
 static volatile int gui_frame_scheduled = 0;
 static u64 gui_next_frame_tick = 0;
+static ktimer_t gui_frame_timer;
 static volatile int gui_composing = 0;
 static u32 gui_target_fps = GUI_DEFAULT_TARGET_FPS;
 
@@ -260,17 +264,6 @@ static void gui_clear_all(void) {
     else draw_rect_rgb(0, 0, scr_w, scr_h, gui_bg);
 }
 
-static u64 gui_irq_save(void) {
-    u64 flags = 0;
-    __asm__ volatile("pushfq; popq %0; cli" : "=r"(flags) :: "memory");
-    return flags;
-}
-
-static void gui_irq_restore(u64 flags) {
-    if (flags & (1ULL << 9)) __asm__ volatile("sti" ::: "memory");
-    else __asm__ volatile("cli" ::: "memory");
-}
-
 static u64 gui_frame_interval_ticks(void) {
     u32 hz = pit_get_hz();
     if (!hz) hz = 1000;
@@ -281,8 +274,9 @@ static u64 gui_frame_interval_ticks(void) {
 static void gui_render_frame_now(void) {
     if (!gui_active) return;
 
+    // The mouse callback must not move windows halfway through a frame
+    u64 flags = gui_window_lock();
     if (gui_backbuf && gui_back_pitch) {
-        u64 flags = gui_irq_save();
         fb_set_render_target(gui_backbuf, scr_w, scr_h, gui_back_pitch);
         gui_composing = 1;
         gui_clear_all();
@@ -293,7 +287,6 @@ static void gui_render_frame_now(void) {
         gui_composing = 0;
         fb_clear_render_target();
         fb_present_buffer(gui_backbuf, scr_w, scr_h, gui_back_pitch);
-        gui_irq_restore(flags);
     } else {
         gui_composing = 1;
         gui_clear_all();
@@ -303,15 +296,26 @@ static void gui_render_frame_now(void) {
         gui_cursor_draw(cursor_x, cursor_y);
         gui_composing = 0;
     }
+    gui_window_unlock(flags);
 }
 
+static void gui_schedule_frame_if_due(void);
+static void gui_deferred_render_frame(void *arg);
+
+// Rendering yields to input handling queued in the meantime
+static deferred_work_t gui_frame_work =
+    DEFERRED_WORK_INIT(gui_deferred_render_frame, 0, DEFERRED_PRIO_LOW);
+
 static void gui_deferred_render_frame(void *arg) {
     (void)arg;
     gui_frame_scheduled = 0;
     if (!gui_active || !gui_frame_dirty) return;
 
     u64 now = pit_ticks();
-    if (now < gui_next_frame_tick) return;
+    if (now < gui_next_frame_tick) {
+        gui_schedule_frame_if_due();
+        return;
+    }
     gui_frame_dirty = 0;
     gui_next_frame_tick = now + gui_frame_interval_ticks();
     gui_render_frame_now();
@@ -319,13 +323,19 @@ static void gui_deferred_render_frame(void *arg) {
 
 static void gui_schedule_frame_if_due(void) {
     if (!gui_active || !gui_frame_dirty || gui_frame_scheduled) return;
-    if (pit_ticks() < gui_next_frame_tick) return;
-    if (deferred_schedule(gui_deferred_render_frame, 0) == 0) {
-        gui_frame_scheduled = 1;
+    if (pit_ticks() < gui_next_frame_tick) {
+        // Not due yet: wake up exactly when the frame interval is over
+        if (!ktimer_pending(&gui_frame_timer)) {
+            ktimer_start_at(&gui_frame_timer, gui_next_frame_tick);
+        }
+        return;
     }
+    deferred_queue(&gui_frame_work);
+    gui_frame_scheduled = 1;
 }
 
-static void gui_pit_tick(void) {
+static void gui_frame_timer_fired(void* arg) {
+    (void)arg;
     gui_schedule_frame_if_due();
 }
 
@@ -497,7 +507,7 @@ static void app_default_size(app_kind_t kind, u32 *w, u32 *h) {
     if (*h + GUI_BAR_HEIGHT + 20 > scr_h) *h = scr_h > GUI_BAR_HEIGHT + 20 ? scr_h - GUI_BAR_HEIGHT - 20 : scr_h;
 }
 
-static gui_window_t *open_app(app_kind_t kind, const char *title, u32 flags) {
+static gui_window_t *open_app_locked(app_kind_t kind, const char *title, u32 flags) {
     gui_app_t *app = &apps[kind];
     if (app->win) {
         gui_window_restore(app->win);
@@ -535,6 +545,13 @@ static gui_window_t *open_app(app_kind_t kind, const char *title, u32 flags) {
     return app->win;
 }
 
+static gui_window_t *open_app(app_kind_t kind, const char *title, u32 flags) {
+    u64 irq = gui_window_lock();
+    gui_window_t *win = open_app_locked(kind, title, flags);
+    gui_window_unlock(irq);
+    return win;
+}
+
 static void resize_viewer_to_image(gui_app_t *app) {
     if (!app || !app->win || app->kind != APP_VIEWER) return;
     u32 iw = 0, ih = 0;
@@ -625,7 +642,7 @@ static void handle_bar_action(int action, int clicked_window_id) {
     update_terminal_sink();
 }
 
-static void gui_mouse_cb(int dx, int dy, u8 buttons) {
+static void gui_mouse_event(int dx, int dy, u8 buttons) {
     if (!gui_active) return;
 
     u32 old_cursor_x = cursor_x;
@@ -693,6 +710,12 @@ static void gui_mouse_cb(int dx, int dy, u8 buttons) {
     last_buttons = buttons;
 }
 
+static void gui_mouse_cb(int dx, int dy, u8 buttons) {
+    u64 flags = gui_window_lock();
+    gui_mouse_event(dx, dy, buttons);
+    gui_window_unlock(flags);
+}
+
 void gui_open_snake(void) {
     if (!fb_console_present()) return;
     fb_get_resolution(&scr_w, &scr_h);
@@ -715,10 +738,14 @@ void gui_open_editor_file(const char *path) {
 void gui_run_lua_in_terminal(const char *path) {
     if (!fb_console_present() || !path || !*path) return;
     fb_get_resolution(&scr_w, &scr_h);
-    gui_window_t *win = open_app(APP_TERMINAL, "Terminal", 0);
+    u64 flags = gui_window_lock();
+    gui_window_t *win = open_app_locked(APP_TERMINAL, "Terminal", 0);
+    if (win) {
+        gui_window_focus(win);
+        update_terminal_sink();
+    }
+    gui_window_unlock(flags);
     if (!win) return;
-    gui_window_focus(win);
-    update_terminal_sink();
 
     char cmd[320];
     snprintf(cmd, sizeof(cmd), "lua %s", path);
@@ -732,12 +759,15 @@ void gui_run_lua_in_terminal(const char *path) {
 
 void gui_close_terminal(void) {
     gui_app_t *app = &apps[APP_TERMINAL];
-    if (app->win) {
+    u64 flags = gui_window_lock();
+    int closed = app->win != 0;
+    if (closed) {
         gui_window_destroy(app->win);
         update_terminal_sink();
-        if (gui_active) {
-            gui_render_desktop();
-        }
+    }
+    gui_window_unlock(flags);
+    if (closed && gui_active) {
+        gui_render_desktop();
     }
 }
 
@@ -776,7 +806,7 @@ const char *gui_wallpaper_error(void) {
     return gui_wallpaper_last_error();
 }
 
-static void gui_key_handler(u8 scancode, int is_extended, int is_pressed) {
+static void gui_key_event(u8 scancode, int is_extended, int is_pressed) {
     if (scancode == 0x2A || scancode == 0x36) key_shift = is_pressed ? 1 : 0;
     if (!gui_active || !is_pressed) return;
 
@@ -813,6 +843,12 @@ static void gui_key_handler(u8 scancode, int is_extended, int is_pressed) {
     }
 }
 
+static void gui_key_handler(u8 scancode, int is_extended, int is_pressed) {
+    u64 flags = gui_window_lock();
+    gui_key_event(scancode, is_extended, is_pressed);
+    gui_window_unlock(flags);
+}
+
 void gui_start(void) {
     if (gui_active) return;
     if (!fb_console_present()) return;
@@ -831,11 +867,13 @@ void gui_start(void) {
         return;
     }
     gui_back_pitch = scr_w * (u32)fb_bpp;
-    gui_backbuf = (u8*)kmalloc((size_t)((u64)gui_back_pitch * (u64)scr_h));
-    if (!gui_backbuf) {
+    // The back buffer is one aligned physically contiguous block
+    gui_backbuf_phys = pmm_alloc_contiguous((u64)gui_back_pitch * (u64)scr_h);
+    if (!gui_backbuf_phys) {
         shell_resume();
         return;
     }
+    gui_backbuf = (u8*)pmm_phys_to_virt(gui_backbuf_phys);
 
     for (int i = 0; i < APP_COUNT; i++) {
         apps[i].kind = (app_kind_t)i;
@@ -853,7 +891,7 @@ void gui_start(void) {
     gui_next_frame_tick = pit_ticks();
     gui_frame_dirty = 0;
     gui_frame_scheduled = 0;
-    (void)pit_add_callback(gui_pit_tick);
+    ktimer_init(&gui_frame_timer, gui_frame_timer_fired, 0);
     gui_force_frame();
     ps2_mouse_set_callback(gui_mouse_cb);
     ps2_set_key_callback(gui_key_handler);
@@ -864,17 +902,20 @@ void gui_start(void) {
 static void gui_stop(void) {
     if (!gui_active) return;
     gui_active = 0;
-    pit_remove_callback(gui_pit_tick);
+    ktimer_cancel(&gui_frame_timer);
     ps2_mouse_set_callback(0);
     ps2_set_key_callback(0);
     fb_clear_render_target();
     gui_term_detach();
+    u64 flags = gui_window_lock();
     gui_window_destroy_all();
+    gui_window_unlock(flags);
     vga_clear_screen();
     shell_resume();
     if (gui_backbuf) {
-        kfree(gui_backbuf);
+        pmm_free_contiguous(gui_backbuf_phys, (u64)gui_back_pitch * (u64)scr_h);
         gui_backbuf = 0;
+        gui_backbuf_phys = 0;
         gui_back_pitch = 0;
     }
     gui_frame_dirty = 0;
@@ -3,10 +3,11 @@
 #include <fb/fb_console.h>
 #include <kmalloc.h>
 #include <pit/pit.h>
+#include <ktimer.h>
 #include <ps2.h>
 
 // Simple tick-based Snake game rendered inside a GUI window content rect.
-// - Uses PIT ticks for timing via pit_set_callback()
+// - Steps on a periodic kernel timer
 // - Arrow keys change direction; Space pauses; R resets.
 
 // Pixel rect (within window content)
@@ -33,8 +34,7 @@ static int ax = 0, ay = 0;
 
 // Timing
 static u32 step_ms = 90;  // time per step in ms (faster)
-static u32 step_ticks = 0; // PIT ticks per step
-static u32 tick_accum = 0;
+static ktimer_t step_timer;
 
 // Colors
 static const u8 COL_BG[3]   = { 0x20, 0x20, 0x22 };
@@ -203,8 +203,8 @@ static void step_snake(void) {
     }
 }
 
-static void on_pit_tick(void) {
-    if (step_ticks == 0) return;
+static void on_step_timer(void* arg) {
+    (void)arg;
     // Handle game-over delay timing
     if (game_over) {
         if (pit_ticks() >= game_over_until) {
@@ -214,16 +214,8 @@ static void on_pit_tick(void) {
         }
         return;
     }
-    tick_accum++;
-    if (tick_accum >= step_ticks) {
-        tick_accum -= step_ticks;
-        step_snake();
-        if (!game_over) {
-            gui_request_redraw();
-        } else {
-            gui_request_redraw();
-        }
-    }
+    step_snake();
+    gui_request_redraw();
 }
 
 void gui_snake_init(u32 px, u32 py, u32 pw, u32 ph) {
@@ -239,16 +231,12 @@ void gui_snake_init(u32 px, u32 py, u32 pw, u32 ph) {
     sx = (int*)kmalloc((size_t)cap * sizeof(int));
     sy = (int*)kmalloc((size_t)cap * sizeof(int));
     if (!sx || !sy) return;
-    // Timing setup
-    u32 hz = pit_get_hz();
-    if (hz == 0) hz = 1000;
-    step_ticks = (step_ms * hz) / 1000u; if (step_ticks == 0) step_ticks = 1;
-    tick_accum = 0;
     // Game state
     reset_game();
     gui_request_redraw();
-    // Attach PIT callback
-    pit_set_callback(on_pit_tick);
+    // Start stepping
+    ktimer_init(&step_timer, on_step_timer, 0);
+    ktimer_start(&step_timer, step_ms, step_ms);
 }
 
 void gui_snake_move(u32 px, u32 py) {
@@ -287,9 +275,9 @@ void gui_snake_handle_key(u8 sc, int is_extended, int is_pressed) {
 }
 
 void gui_snake_free(void) {
-    // Detach callback first to stop IRQ drawing
-    pit_set_callback(0);
+    // Stop the timer first to stop IRQ drawing
+    ktimer_cancel(&step_timer);
     if (sx) { kfree(sx); sx = 0; }
     if (sy) { kfree(sy); sy = 0; }
-    cap = grid_w = grid_h = 0; len = 0; head = 0; tick_accum = 0;
+    cap = grid_w = grid_h = 0; len = 0; head = 0;
 }
@@ -3,6 +3,8 @@
 #include <fb/fb_console.h>
 #include <cldramfs/cldramfs.h>
 #include <kmalloc.h>
+#include <task.h>
+#include <smp.h>
 #include <string.h>
 #include <stdio.h>
 
@@ -13,8 +15,12 @@ static u8  g_wp_bpp = 0;      // framebuffer bytes per pixel at preparation time
 
 static gui_png_t g_png;
 
-// Temporary line buffer (one scanline in framebuffer format)
-static u8* g_linebuf = 0;        // size: g_wp_w * g_wp_bpp
+// Full-screen draws split the rows into one band per CPU on the task pool
+#define WALLPAPER_MAX_BANDS 8
+
+// Temporary line buffers (one scanline in framebuffer format per band)
+static u8* g_linebuf = 0;        // size: g_wp_bands * g_wp_w * g_wp_bpp
+static u32 g_wp_bands = 1;
 
 static int g_wp_ready = 0;
 static char g_wp_last_error[128] = "no wallpaper load attempted";
@@ -68,9 +74,12 @@ int gui_wallpaper_load(const char* path) {
         return 0;
     }
 
-    // Allocate/reallocate single-line buffer for blitting
+    // Allocate/reallocate one line buffer per band for blitting
+    g_wp_bands = smp_cpu_count();
+    if (g_wp_bands == 0) g_wp_bands = 1;
+    if (g_wp_bands > WALLPAPER_MAX_BANDS) g_wp_bands = WALLPAPER_MAX_BANDS;
     if (g_linebuf) { kfree(g_linebuf); g_linebuf = 0; }
-    g_linebuf = (u8*)kmalloc((size_t)((u64)g_wp_w * (u64)g_wp_bpp));
+    g_linebuf = (u8*)kmalloc((size_t)((u64)g_wp_bands * g_wp_w * g_wp_bpp));
     if (!g_linebuf) {
         // Unable to allocate even a single line; give up on wallpaper
         g_wp_ready = 0;
@@ -100,12 +109,33 @@ static void build_scaled_row_into(u32 dst_y, u32 dst_x, u32 dst_w, u8* out_row)
     }
 }
 
+typedef struct {
+    u32 y0, y1;
+    u8* row;
+} wallpaper_band_t;
+
+static void wallpaper_draw_band(void* arg) {
+    wallpaper_band_t* band = (wallpaper_band_t*)arg;
+    for (u32 y = band->y0; y < band->y1; y++) {
+        build_scaled_row_into(y, 0, g_wp_w, band->row);
+        fb_blit(0, y, g_wp_w, 1, band->row);
+    }
+}
+
 void gui_wallpaper_draw_fullscreen(void) {
     if (!gui_wallpaper_is_loaded()) return;
-    for (u32 y = 0; y < g_wp_h; y++) {
-        build_scaled_row_into(y, 0, g_wp_w, g_linebuf);
-        fb_blit(0, y, g_wp_w, 1, g_linebuf);
+    // Rows are independent and blit to disjoint framebuffer lines
+    task_t tasks[WALLPAPER_MAX_BANDS];
+    wallpaper_band_t bands[WALLPAPER_MAX_BANDS];
+    u32 rows = (g_wp_h + g_wp_bands - 1) / g_wp_bands;
+    for (u32 i = 0; i < g_wp_bands; i++) {
+        u32 y0 = i * rows;
+        bands[i].y0 = y0 < g_wp_h ? y0 : g_wp_h;
+        bands[i].y1 = y0 + rows < g_wp_h ? y0 + rows : g_wp_h;
+        bands[i].row = g_linebuf + (u64)i * g_wp_w * g_wp_bpp;
+        task_spawn(&tasks[i], wallpaper_draw_band, &bands[i]);
     }
+    for (u32 i = 0; i < g_wp_bands; i++) task_wait(&tasks[i]);
 }
 
 void gui_wallpaper_redraw_rect(u32 x, u32 y, u32 w, u32 h) {
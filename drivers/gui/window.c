@@ -3,6 +3,7 @@
 #include <cldramfs/tty.h>
 #include <fb/fb_console.h>
 #include <ps2.h>
+#include <spinlock.h>
 #include <string.h>
 
 #define TITLE_H             24
@@ -21,6 +22,8 @@ typedef enum {
     DRAG_RESIZE
 } drag_mode_t;
 
+// Everything below up to win_style is guarded by wm_lock (window.h)
+static rspinlock_t wm_lock = RSPINLOCK_INIT("windows");
 static gui_window_t windows[GUI_WINDOW_MAX];
 static int z_order[GUI_WINDOW_MAX];
 static int z_count = 0;
@@ -242,6 +245,14 @@ static void notify_resize(gui_window_t *win) {
     if (win->cb.move) win->cb.move(win, x, y, win->cb.ctx);
 }
 
+u64 gui_window_lock(void) {
+    return rspin_lock_irqsave(&wm_lock);
+}
+
+void gui_window_unlock(u64 flags) {
+    rspin_unlock_irqrestore(&wm_lock, flags);
+}
+
 void gui_window_manager_init(void) {
     for (int i = 0; i < GUI_WINDOW_MAX; i++) {
         windows[i].used = 0;
@@ -72,6 +72,14 @@ struct gui_window {
     gui_window_callbacks_t cb;
 };
 
+// The window table, z-order and drag state are changed both from the PS/2
+// mouse and keyboard callbacks, which run in interrupt context, and from the
+// main loop. Hold the window manager lock around any sequence of calls made
+// outside those callbacks. It is recursive, so window callbacks may call
+// back in, and keeps interrupts off while held.
+u64 gui_window_lock(void);
+void gui_window_unlock(u64 flags);
+
 void gui_window_manager_init(void);
 void gui_window_set_style(const gui_window_style_t *style);
 gui_window_t* gui_window_create(const char *title, u32 x, u32 y, u32 w, u32 h, u32 flags, gui_window_callbacks_t cb);
@@ -1,45 +1,72 @@
 #include <pit/pit.h>
 #include <portio.h>
-#include <pic.h>
 #include <interrupts/interrupts.h>
+#include <sched.h>
+#include <apic/apic.h>
+#include <ktimer.h>
+#include <clock.h>
+#include <vdso.h>
 
 // PIT ports
 #define PIT_CH0_DATA 0x40
 #define PIT_CMD      0x43
 
+#define PIT_FREQ           1193182
+#define PIT_CMD_PERIODIC   0x36     // Channel 0, lobyte/hibyte, mode 3 (square wave)
+#define PIT_CMD_ONESHOT    0x30     // Channel 0, lobyte/hibyte, mode 0 (terminal count)
+#define PIT_CMD_READBACK   0xC2     // Read-back: latch count and status of channel 0
+#define PIT_STATUS_OUT     0x80
+
 static volatile u64 g_ticks = 0;
 static u32 g_hz = 0;
-static pit_tick_cb_t g_cb = 0;
+static u32 g_divisor = 0;
+
+// Tickless idle state: length of the pending one-shot in ticks (0 when the
+// PIT is periodic), PIT counts left over from early wakeups, and whether an
+// IRQ0 for an already accounted one-shot is still on its way.
+static u64 g_oneshot_ticks = 0;
+static u32 g_oneshot_carry = 0;
+static u8 g_oneshot_absorb = 0;
 
-#define PIT_EXTRA_CALLBACKS 8
-static pit_tick_cb_t g_extra_cbs[PIT_EXTRA_CALLBACKS] = {0};
+static void pit_program(u8 cmd, u32 count) {
+    outb(PIT_CMD, cmd);
+    outb(PIT_CH0_DATA, (u8)(count & 0xFF));
+    outb(PIT_CH0_DATA, (u8)((count >> 8) & 0xFF));
+}
 
 void handle_pit(void) {
-    g_ticks++;
-    if (g_cb) {
-        g_cb();
+    if (g_oneshot_ticks) {
+        g_ticks += g_oneshot_ticks;
+        g_oneshot_ticks = 0;
+        pit_program(PIT_CMD_PERIODIC, g_divisor);
+    } else if (g_oneshot_absorb) {
+        g_oneshot_absorb = 0;
+    } else {
+        g_ticks++;
     }
-    for (int i = 0; i < PIT_EXTRA_CALLBACKS; i++) {
-        if (g_extra_cbs[i]) g_extra_cbs[i]();
+    vdso_set_ticks(g_ticks);
+    ktimer_run_expired(g_ticks);
+    irq_eoi(0);
+    // Once the LAPIC timer runs it drives the scheduler instead
+    if (!apic_timer_active()) {
+        // May switch to another process; this one resumes here later
+        sched_tick();
     }
-    pic_send_eoi(0);
 }
 
 void pit_init(u32 hz) {
     if (hz == 0) hz = 1000; // default 1 kHz
     g_hz = hz;
-    u32 divisor = 1193182 / hz;
+    u32 divisor = PIT_FREQ / hz;
     if (divisor == 0) divisor = 1;
-    // Command: channel 0, access lobyte/hibyte, mode 3 (square wave), binary
-    outb(PIT_CMD, 0x36);
-    outb(PIT_CH0_DATA, (u8)(divisor & 0xFF));
-    outb(PIT_CH0_DATA, (u8)((divisor >> 8) & 0xFF));
+    if (divisor > 0xFFFF) divisor = 0xFFFF;
+    g_divisor = divisor;
+    pit_program(PIT_CMD_PERIODIC, divisor);
 
     // Register IRQ0 handler (vector 32)
     extern void irq0_handler(void);
     register_interrupt_handler(32, &irq0_handler);
-    // Enable IRQ0 on PIC
-    pic_enable_irq(0);
+    irq_unmask(0);
 }
 
 u64 pit_ticks(void) {
@@ -50,38 +77,49 @@ u32 pit_get_hz(void) {
     return g_hz;
 }
 
-void pit_set_callback(pit_tick_cb_t cb) {
-    g_cb = cb;
-}
+int pit_oneshot_begin(u64 ticks) {
+    if (g_divisor == 0 || g_oneshot_ticks) return 0;
+    u64 max_ticks = 0xFFFFULL / g_divisor;
+    if (ticks > max_ticks) ticks = max_ticks;
+    if (ticks <= 1) return 0;
 
-int pit_add_callback(pit_tick_cb_t cb) {
-    if (!cb) return -1;
-    for (int i = 0; i < PIT_EXTRA_CALLBACKS; i++) {
-        if (g_extra_cbs[i] == cb) return 0;
-    }
-    for (int i = 0; i < PIT_EXTRA_CALLBACKS; i++) {
-        if (!g_extra_cbs[i]) {
-            g_extra_cbs[i] = cb;
-            return 0;
-        }
-    }
-    return -2;
+    g_oneshot_ticks = ticks;
+    pit_program(PIT_CMD_ONESHOT, (u32)(ticks * g_divisor));
+    return 1;
 }
 
-void pit_remove_callback(pit_tick_cb_t cb) {
-    if (!cb) return;
-    for (int i = 0; i < PIT_EXTRA_CALLBACKS; i++) {
-        if (g_extra_cbs[i] == cb) g_extra_cbs[i] = 0;
+void pit_oneshot_end(void) {
+    u64 programmed = g_oneshot_ticks;
+    if (!programmed) return;       // IRQ0 already accounted for it
+
+    outb(PIT_CMD, PIT_CMD_READBACK);
+    u8 status = inb(PIT_CH0_DATA);
+    u32 left = inb(PIT_CH0_DATA);
+    left |= (u32)inb(PIT_CH0_DATA) << 8;
+
+    u64 elapsed;
+    if (status & PIT_STATUS_OUT) {
+        // Expired with the interrupt still pending behind our cli
+        elapsed = programmed;
+        g_oneshot_absorb = 1;
+    } else {
+        u32 counts = (u32)(programmed * g_divisor) - left + g_oneshot_carry;
+        elapsed = counts / g_divisor;
+        g_oneshot_carry = counts % g_divisor;
     }
+    g_ticks += elapsed;
+    g_oneshot_ticks = 0;
+    pit_program(PIT_CMD_PERIODIC, g_divisor);
+    vdso_set_ticks(g_ticks);
+    ktimer_run_expired(g_ticks);
 }
 
 void sleep_ms(u64 ms) {
     if (g_hz == 0) return;
-    u64 start = g_ticks;
+    u64 deadline = clock_ns() + ms * 1000000ULL;
     u64 target_ticks = (ms * g_hz) / 1000ULL;
     if (target_ticks == 0) target_ticks = 1; // minimum 1 tick
-    u64 until = start + target_ticks;
-    while (g_ticks < until) {
-        __asm__ volatile ("hlt");
-    }
+    sched_sleep_ticks(target_ticks);
+    // The first tick may have been partly over already; finish on the TSC
+    while (clock_ns() < deadline) sched_sleep_ticks(1);
 }
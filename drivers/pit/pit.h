@@ -7,15 +7,17 @@ void pit_init(u32 hz);
 u64 pit_ticks(void);
 void sleep_ms(u64 ms);
 
+// Tickless idle: replace the periodic tick with a one-shot of up to `ticks`
+// (capped at what the 16-bit counter holds). Returns 0 if the periodic tick
+// has to keep running.
+// pit_oneshot_end, called with interrupts still disabled after the wakeup,
+// accounts the ticks that passed and restores the periodic tick.
+int pit_oneshot_begin(u64 ticks);
+void pit_oneshot_end(void);
+
 // Query configured PIT frequency (Hz)
 u32 pit_get_hz(void);
 
-// Optional per-tick callbacks (called from IRQ0 handler).
-typedef void (*pit_tick_cb_t)(void);
-void pit_set_callback(pit_tick_cb_t cb);
-int pit_add_callback(pit_tick_cb_t cb);
-void pit_remove_callback(pit_tick_cb_t cb);
-
 // IRQ0 handler trampoline (called from ASM stub)
 void handle_pit(void);
 
@@ -574,7 +574,8 @@ MAX_RELEASE_CHECK_RATE   default: 4095 unless not HAVE_MMAP
 /* Error handling - use VGA output for debugging */
 extern int vga_printf(const char *fmt, ...);
 #define ABORT do { vga_printf("DLMALLOC ABORT\n"); __asm__ volatile("cli; hlt"); } while (0)
-#define MALLOC_FAILURE_ACTION ABORT
+/* Let allocation failures return NULL so kmalloc can try the next mspace */
+#define MALLOC_FAILURE_ACTION
 
 #define ENOMEM 12
 #define EINVAL 22
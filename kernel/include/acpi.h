@@ -0,0 +1,64 @@
+#ifndef ACPI_H
+#define ACPI_H
+
+#include <cldtypes.h>
+
+// Just enough ACPI to find the processors and interrupt controllers: the
+// RSDP comes from the multiboot2 ACPI tags (or a BIOS area scan), the
+// RSDT/XSDT leads to the MADT, and the MADT entries are flattened into
+// acpi_madt_t. Tables are read through the identity map.
+#define ACPI_MAX_CPUS 64
+#define ACPI_MAX_IOAPICS 8
+#define ACPI_MAX_OVERRIDES 16
+
+typedef struct acpi_sdt_header {
+    char signature[4];
+    u32 length;
+    u8 revision;
+    u8 checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    u32 oem_revision;
+    u32 creator_id;
+    u32 creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct {
+    u8 acpi_id;
+    u8 apic_id;
+} acpi_cpu_t;
+
+typedef struct {
+    u8 id;
+    u32 phys;
+    u32 gsi_base;
+} acpi_ioapic_t;
+
+// ISA IRQ `source` is wired to global system interrupt `gsi`
+typedef struct {
+    u8 source;
+    u32 gsi;
+    u16 flags;              // MPS INTI polarity (bits 0-1) and trigger (bits 2-3)
+} acpi_irq_override_t;
+
+typedef struct {
+    u64 lapic_phys;
+    u8 has_8259;            // PCAT_COMPAT: legacy PICs are present
+    u32 cpu_count;
+    acpi_cpu_t cpus[ACPI_MAX_CPUS];
+    u32 ioapic_count;
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+    u32 override_count;
+    acpi_irq_override_t overrides[ACPI_MAX_OVERRIDES];
+} acpi_madt_t;
+
+// Locate and parse the MADT. Returns 0 on success.
+int acpi_init(u32 mb2_info);
+
+// Parsed MADT, or NULL if acpi_init failed.
+const acpi_madt_t* acpi_madt(void);
+
+// Table with the given signature from the RSDT/XSDT, or NULL.
+acpi_sdt_header_t* acpi_find_table(const char* signature);
+
+#endif // ACPI_H
@@ -0,0 +1,38 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <cldtypes.h>
+
+// Monotonic clock on the timestamp counter. clock_init measures the TSC
+// frequency against the HPET main counter when ACPI lists one, otherwise
+// against PIT ticks; afterwards clock_ns is a single rdtsc and a multiply
+// instead of the 1 ms PIT granularity. Before calibration clock_ns falls
+// back to pit_ticks(), and it stays continuous across the switch.
+
+// Read the timestamp counter (serialized against earlier loads).
+static inline u64 clock_cycles(void) {
+    u32 lo, hi;
+    __asm__ volatile ("lfence; rdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((u64)hi << 32) | lo;
+}
+
+// Calibrate the TSC. Needs the PIT running and interrupts enabled when
+// there is no HPET. Returns 0 on success.
+int clock_init(void);
+
+// Nanoseconds since the PIT was started.
+u64 clock_ns(void);
+
+// Convert a TSC delta; 0 until calibrated.
+u64 clock_cycles_to_ns(u64 cycles);
+
+u64 clock_tsc_hz(void);
+
+// The terms of clock_ns after calibration, for readers outside the kernel:
+// ns = ns_base + ((tsc - tsc_base) * ns_mult >> 32). All 0 before.
+void clock_params(u64* tsc_base, u64* ns_base, u64* ns_mult);
+int clock_tsc_invariant(void);
+
+void clock_debug_info(void);
+
+#endif // CLOCK_H
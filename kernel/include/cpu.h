@@ -0,0 +1,85 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <cldtypes.h>
+
+static inline void cpuid(u32 leaf, u32 subleaf, u32* eax, u32* ebx, u32* ecx, u32* edx) {
+    __asm__ volatile ("cpuid"
+                      : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                      : "a"(leaf), "c"(subleaf));
+}
+
+static inline u32 cpuid_max_extended_leaf(void) {
+    u32 a, b, c, d;
+    cpuid(0x80000000U, 0, &a, &b, &c, &d);
+    return a;
+}
+
+// CPUID.80000001H:EDX[26] - 1 GiB pages in the PDPT
+static inline u8 cpu_has_pdpe1gb(void) {
+    if (cpuid_max_extended_leaf() < 0x80000001U) return 0;
+    u32 a, b, c, d;
+    cpuid(0x80000001U, 0, &a, &b, &c, &d);
+    return (d >> 26) & 1;
+}
+
+
+// CPUID.80000007H:EDX[8] - TSC runs at a constant rate in all P/C-states
+static inline u8 cpu_has_invariant_tsc(void) {
+    if (cpuid_max_extended_leaf() < 0x80000007U) return 0;
+    u32 a, b, c, d;
+    cpuid(0x80000007U, 0, &a, &b, &c, &d);
+    return (d >> 8) & 1;
+}
+
+static inline u64 read_cr0(void) {
+    u64 v;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(u64 v) {
+    __asm__ volatile ("mov %0, %%cr0" :: "r"(v) : "memory");
+}
+
+static inline u64 read_cr3(void) {
+    u64 v;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr3(u64 v) {
+    __asm__ volatile ("mov %0, %%cr3" :: "r"(v) : "memory");
+}
+
+static inline u64 read_cr4(void) {
+    u64 v;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(u64 v) {
+    __asm__ volatile ("mov %0, %%cr4" :: "r"(v) : "memory");
+}
+
+static inline u64 rdmsr(u32 msr) {
+    u32 lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((u64)hi << 32) | lo;
+}
+
+static inline void wrmsr(u32 msr, u64 v) {
+    __asm__ volatile ("wrmsr" :: "c"(msr), "a"((u32)v), "d"((u32)(v >> 32)) : "memory");
+}
+
+#define MSR_APIC_BASE       0x1B
+#define MSR_EFER            0xC0000080
+#define MSR_STAR            0xC0000081
+#define MSR_LSTAR           0xC0000082
+#define MSR_FMASK           0xC0000084
+#define MSR_GS_BASE         0xC0000101
+#define MSR_KERNEL_GS_BASE  0xC0000102
+
+#define EFER_SCE  (1ULL << 0)     // SYSCALL/SYSRET enable
+
+#endif // CPU_H
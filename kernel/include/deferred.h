@@ -3,20 +3,53 @@
 
 #include <cldtypes.h>
 
+// Work deferred from interrupt handlers to the kernel main loop. Each
+// priority level is an intrusive multi-producer/single-consumer queue
+// (Vyukov style): queueing is one atomic exchange, so it is safe from IRQ
+// context and from any CPU, and never fails because the caller owns the
+// deferred_work_t. The consumer drains higher priorities first and looks
+// at them again after every item, so input is never stuck behind a
+// backlog of rendering work.
+
 typedef void (*deferred_fn_t)(void *arg);
 
-// Schedule a function to run outside interrupt context.
-// Returns 0 on success, non-zero if queue full.
-int deferred_schedule(deferred_fn_t fn, void *arg);
+typedef enum {
+    DEFERRED_PRIO_HIGH = 0,     // Input handling
+    DEFERRED_PRIO_LOW,          // Rendering and other bulk work
+    DEFERRED_PRIO_COUNT
+} deferred_prio_t;
+
+typedef struct deferred_work {
+    struct deferred_work *volatile next;
+    deferred_fn_t fn;
+    void *arg;
+    u8 prio;
+    volatile u8 queued;         // Set while on a queue
+} deferred_work_t;
+
+#define DEFERRED_WORK_INIT(fn, arg, prio) { NULL, (fn), (arg), (prio), 0 }
+
+void deferred_init_work(deferred_work_t *work, deferred_fn_t fn, void *arg, deferred_prio_t prio);
 
-// Process one pending deferred task, if any.
-void deferred_process_one(void);
+// Queue work to run outside interrupt context. Returns 1 if it was queued,
+// 0 if it was already pending (it then runs once). The flag is cleared just
+// before fn runs, so fn may queue its own work again.
+int deferred_queue(deferred_work_t *work);
 
-// Process all pending tasks.
+static inline int deferred_work_pending(const deferred_work_t *work) {
+    return work->queued;
+}
+
+// Process one pending item, highest priority first. Returns 1 if one ran.
+// Only one CPU consumes at a time; other callers return without work.
+int deferred_process_one(void);
+
+// Process all pending items.
 void deferred_process_all(void);
 
-// Whether there are tasks pending.
+// Whether there are items pending.
 int deferred_has_pending(void);
 
-#endif // DEFERRED_H
+void deferred_debug_info(void);
 
+#endif // DEFERRED_H
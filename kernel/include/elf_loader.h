@@ -2,6 +2,7 @@
 #define ELF_LOADER_H
 
 #include <cldtypes.h>
+#include <memory_mapper.h>
 
 // ELF header constants
 #define EI_NIDENT 16
@@ -99,11 +100,21 @@ typedef struct {
     i64 r_addend;
 } __attribute__((packed)) elf64_rela_t;
 
+// User address space layout of a program. The image is linked for
+// USER_IMAGE_BASE; the rest of the first 2M holds pages the kernel maps
+// in: the vDSO pages at VDSO_USER_BASE (vdso.h) and the syscall rings at
+// URING_USER_BASE (uring.h).
+#define USER_EXIT_STUB   USER_SPACE_BASE                 // _start returns here
+#define USER_IMAGE_BASE  (USER_SPACE_BASE + 0x200000)
+#define USER_STACK_TOP   (USER_SPACE_TOP - PAGE_4K)      // Top page left unmapped
+#define USER_STACK_SIZE  (64 * 1024)
+
 // Loaded ELF structure
 typedef struct {
     void* base_addr;        // Base address where ELF is loaded
-    void* exec_base;        // Base address of executable sections
+    void* exec_base;        // Relocated sections, laid out as at USER_IMAGE_BASE
     u64 size;              // Total size allocated
+    u64 image_size;        // Bytes from USER_IMAGE_BASE to the end of the last section
     u64 entry_point;       // Entry point offset from exec_base
     elf64_ehdr_t* header;  // ELF header
     elf64_shdr_t* sections; // Section headers
@@ -111,14 +122,17 @@ typedef struct {
 } loaded_elf_t;
 
 // ELF loader functions
+// Relocate into a kernel staging copy; nothing runs from it.
 int elf_load(const void* elf_data, u64 size, loaded_elf_t* loaded);
+// Free the staging copy. Safe to call again after elf_spawn.
 void elf_unload(loaded_elf_t* loaded);
+// Start the program in ring 3 in an address space of its own and return
+// its pid (0 on failure). On success the image has been copied into the
+// new space and the staging copy is freed.
+u32 elf_spawn(loaded_elf_t* loaded, const char* program_name);
+// elf_spawn and wait for the program to exit; returns its exit status.
 int elf_execute(loaded_elf_t* loaded, const char* program_name);
 
-// Executable memory allocation
-void* kmalloc_executable(size_t size);
-void kfree_executable(void* ptr);
-
 // Helper functions
 #define ELF64_ST_BIND(i) ((i) >> 4)
 #define ELF64_ST_TYPE(i) ((i) & 0xf)
@@ -12,6 +12,17 @@ void interrupts_init(void);
 // Register an interrupt handler
 void register_interrupt_handler(u8 interrupt_num, interrupt_handler_t handler);
 
+// ISA IRQ lines. irq_init brings up the 8259 (remapped, all masked) and,
+// unless built with IRQ_CONTROLLER=pic, switches delivery to the IOAPIC and
+// leaves the 8259 masked. Either way IRQ n arrives on vector 32 + n; drivers
+// unmask and acknowledge through these calls instead of talking to a
+// controller directly.
+void irq_init(void);
+void irq_unmask(u8 irq);
+void irq_mask(u8 irq);
+void irq_eoi(u8 irq);
+int irq_using_apic(void);
+
 // Enable/disable interrupts globally
 void interrupts_enable(void);
 void interrupts_disable(void);
@@ -19,6 +30,24 @@ void interrupts_disable(void);
 // Common interrupt handlers
 void default_interrupt_handler(void);
 
+// Registers saved by the exception stubs (interrupt_handlers.asm), lowest
+// address first
+typedef struct {
+    u64 r15, r14, r13, r12, r11, r10, r9, r8;
+    u64 rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    u64 vector, error_code;
+    u64 rip, cs, rflags, rsp, ss;               // Pushed by the CPU
+} exception_frame_t;
+
+#define EXCEPTION_VECTORS 21
+
+// Entry points for vectors 0-20; 9 and 15 are never raised.
+extern void (*const exception_stubs[EXCEPTION_VECTORS])(void);
+
+// Called by the stubs. A fault in user mode ends the program with status
+// 128 + vector; a fault in the kernel goes to the panic handlers below.
+void exception_dispatch(exception_frame_t* frame);
+
 // CPU Exception handlers
 void division_error_handler(void);
 void debug_exception_handler(void);
@@ -0,0 +1,57 @@
+#ifndef KARENA_H
+#define KARENA_H
+
+#include <cldtypes.h>
+
+// Scoped bump allocator for short-lived scratch memory. Each call site owns
+// a static arena; karena_begin takes a mark, karena_alloc bumps a pointer
+// and karena_reset rolls everything after the mark back in O(1). Marks nest
+// in LIFO order, so a nested user on the same path can share an arena.
+// Requests that do not fit the static buffer spill into kmalloc'd chunks,
+// which are released when the outermost scope resets.
+//
+// Arenas do no locking: use each one under a lock the caller holds, and
+// never from interrupt handlers, since spills go through kmalloc.
+
+typedef struct karena_chunk {
+    struct karena_chunk* next;
+    size_t size;
+} karena_chunk_t;
+
+typedef struct {
+    const char* name;
+    u8* buf;
+    size_t size;
+    size_t used;
+    size_t high_water;
+    u32 depth;                  // Open karena_begin scopes
+    karena_chunk_t* spill;      // Overflow chunks, freed at depth 0
+    u64 spill_count;
+    void* last;                 // Most recent allocation, for karena_grow
+    size_t last_size;
+} karena_t;
+
+typedef struct {
+    size_t used;
+    void* last;
+    size_t last_size;
+} karena_mark_t;
+
+#define KARENA_ALIGN 16
+
+// Define a file-local arena backed by a static buffer of `bytes`.
+#define KARENA_DEFINE(var, bytes) \
+    static u8 var##_storage[bytes] __attribute__((aligned(KARENA_ALIGN))); \
+    static karena_t var = { #var, var##_storage, (bytes), 0, 0, 0, NULL, 0, NULL, 0 }
+
+karena_mark_t karena_begin(karena_t* arena);
+void* karena_alloc(karena_t* arena, size_t size);
+
+// Resize the most recent allocation. Grows in place while it is still the
+// top of the arena; otherwise copies into a fresh block.
+void* karena_grow(karena_t* arena, void* ptr, size_t old_size, size_t new_size);
+
+char* karena_strdup(karena_t* arena, const char* str);
+void karena_reset(karena_t* arena, karena_mark_t mark);
+
+#endif // KARENA_H
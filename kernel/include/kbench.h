@@ -0,0 +1,24 @@
+#ifndef KBENCH_H
+#define KBENCH_H
+
+#include <cldtypes.h>
+#include <clock.h>
+
+typedef void (*kbench_fn_t)(void);
+
+typedef struct {
+    const char* name;
+    const char* description;
+    kbench_fn_t run;
+} kbench_entry_t;
+
+// Print one result line: total cycles and cycles per operation, plus the
+// time per operation once the TSC is calibrated.
+void kbench_report(const char* label, u64 ops, u64 cycles);
+
+// Run a benchmark by name. Returns 0 on success, -1 if unknown.
+int kbench_run(const char* name);
+void kbench_run_all(void);
+void kbench_list(void);
+
+#endif // KBENCH_H
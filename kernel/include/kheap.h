@@ -4,12 +4,13 @@
 #include <cldtypes.h>
 #include <memory_info.h>
 
-#define KHEAP_MAX_SEGMENTS MEMORY_INFO_MAX
+#define KHEAP_MAX_SEGMENTS 64
 
 typedef struct kheap_segment {
     void* base_virt;
     u64 base_phys;
     size_t size;
+    u32 order;          // Buddy order of the backing physical block
 } kheap_segment_t;
 
 typedef struct kheap_info {
@@ -19,12 +20,27 @@ typedef struct kheap_info {
     size_t used_size;
     size_t segment_count;
     kheap_segment_t segments[KHEAP_MAX_SEGMENTS];
+    u64 grow_count;         // Segments added by kheap_grow after boot
+    u64 init_cycles;        // TSC cycles spent mapping the boot heap
+    u64 init_table_pages;   // Page-table pages used by the boot heap mapping
+    u64 init_size;          // Bytes mapped by kheap_init
     u8 initialized;
 } kheap_info_t;
 
-// Initialize kernel heap with dynamic sizing based on available memory
+// Heap mapped at boot unless built with KHEAP_EAGER
+#define KHEAP_INITIAL_SIZE (8ULL << 20)
+
+// Initialize kernel heap from blocks of the physical frame allocator.
+// Only KHEAP_INITIAL_SIZE is mapped up front (all free memory but a reserve
+// when built with KHEAP_EAGER); pmm_init must have run and minfo is no
+// longer consulted.
 u8 kheap_init(struct memory_info* minfo);
 
+// sbrk-style growth: map one more frame-allocator block of at least
+// min_bytes into the heap window as a new segment. The block size grows with
+// the heap. Returns the segment, or NULL when out of memory.
+kheap_segment_t* kheap_grow(size_t min_bytes);
+
 // Get kernel heap information
 kheap_info_t* kheap_get_info(void);
 
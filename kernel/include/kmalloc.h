@@ -22,4 +22,28 @@ u64 kmalloc_get_kernel_heap_base(void);
 
 void kmalloc_debug_info(void);
 
+// Toggle the size-class slab front end for small allocations. Objects that
+// were handed out while enabled are still freed through their slab.
+void kmalloc_set_slab_enabled(int enabled);
+int kmalloc_slab_enabled(void);
+
+typedef struct {
+    u64 alloc_calls;
+    u64 free_calls;
+    u64 failed_allocs;
+    u64 bytes_allocated;    // Cumulative usable bytes handed out
+} kmalloc_stats_t;
+
+// Allocation-site tracking: while enabled, every allocation records its
+// caller and size class until it is freed. Off by default.
+void kmalloc_set_tracking(int enabled);
+int kmalloc_tracking_enabled(void);
+
+void kmalloc_get_stats(kmalloc_stats_t* out);
+size_t kmalloc_largest_free_block(void);
+
+// Print heap usage, fragmentation, call rates and the top_sites callers
+// holding the most live memory (at most 16).
+void kmalloc_heapstat(u32 top_sites);
+
 #endif // KMALLOC_H
\ No newline at end of file
@@ -0,0 +1,44 @@
+#ifndef KSTACK_H
+#define KSTACK_H
+
+#include <cldtypes.h>
+
+// Per-task kernel stacks. Each stack lives in its own slot of a dedicated
+// virtual window with unmapped guard pages below it, so an overflow faults
+// instead of silently running into a neighbour. Stacks are painted with
+// KSTACK_POISON when created; kstack_high_water scans for the deepest word
+// that was overwritten to report the peak usage.
+#define KSTACK_DEFAULT_SIZE (64 * 1024)
+#define KSTACK_MAX_SIZE (512 * 1024)
+#define KSTACK_MAX_COUNT 64
+#define KSTACK_POISON 0x5354414B5354414BULL     // "KATSKATS"
+
+typedef struct kstack {
+    u64 base;               // Lowest mapped address
+    u64 top;                // One past the highest address; initial rsp
+    size_t size;
+    u64 phys;               // 0 for the boot stack, which is not ours to free
+    const char* owner;
+    u8 in_use;
+} kstack_t;
+
+// Register the boot stack from the linker script and paint its unused part.
+void kstack_init(void);
+
+// Map a new stack of `size` bytes (rounded up to 4 KiB, 0 for the default).
+// Returns NULL when no slot or memory is available.
+kstack_t* kstack_alloc(size_t size, const char* owner);
+void kstack_free(kstack_t* stack);
+
+// Deepest usage seen so far, in bytes.
+size_t kstack_high_water(const kstack_t* stack);
+
+// Stack whose guard pages contain addr, or NULL.
+kstack_t* kstack_guard_owner(u64 addr);
+
+// Run fn(arg) on `stack` and switch back when it returns (kstack_switch.asm).
+long kstack_call(u64 stack_top, long (*fn)(void*), void* arg);
+
+void kstack_debug_info(void);
+
+#endif // KSTACK_H
@@ -0,0 +1,63 @@
+#ifndef KTIMER_H
+#define KTIMER_H
+
+#include <cldtypes.h>
+
+// Kernel timers. Armed timers hang off a hierarchical timing wheel: four
+// levels of 64 buckets, each level 64 times coarser than the one below, so
+// arming and cancelling are O(1) and a clock tick only touches the bucket
+// that is due (plus an occasional cascade of one coarser bucket into finer
+// ones). The wheel spans 2^24 ticks; later deadlines park in the top level
+// and are re-filed when it comes round. ktimer_idle stops the periodic tick
+// and programs a one-shot for the next deadline instead of waking up every
+// millisecond. Callbacks run in interrupt context with interrupts disabled
+// and must not block. The ktimer_t is owned by the caller and must stay
+// valid while it is armed.
+#define KTIMER_WHEEL_BITS   6
+#define KTIMER_WHEEL_SLOTS  (1U << KTIMER_WHEEL_BITS)
+#define KTIMER_WHEEL_LEVELS 4
+#define KTIMER_NEVER (~0ULL)
+
+typedef void (*ktimer_fn_t)(void* arg);
+
+typedef struct ktimer {
+    u64 deadline;           // PIT tick at which fn runs
+    u64 period;             // Re-arm interval in ticks, 0 for one-shot
+    ktimer_fn_t fn;
+    void* arg;
+    struct ktimer* next;    // Bucket list links
+    struct ktimer** pprev;
+    u32 slot;               // Wheel bucket + 1, 0 while not armed
+} ktimer_t;
+
+void ktimer_init(ktimer_t* timer, ktimer_fn_t fn, void* arg);
+
+// Arm (or re-arm) to fire after delay_ms, then every period_ms if non-zero.
+void ktimer_start(ktimer_t* timer, u64 delay_ms, u64 period_ms);
+
+// Arm as a one-shot for an absolute pit_ticks() value.
+void ktimer_start_at(ktimer_t* timer, u64 deadline);
+
+// Disarm. Returns 1 if the timer was pending.
+int ktimer_cancel(ktimer_t* timer);
+
+static inline int ktimer_pending(const ktimer_t* timer) {
+    return timer->slot != 0;
+}
+
+// Earliest tick at which the wheel has work, or KTIMER_NEVER. Exact for
+// deadlines within the next 64 ticks; for later ones it is the tick their
+// bucket cascades, which is never after the deadline itself.
+u64 ktimer_next_deadline(void);
+
+// Run every timer due at `now`. Called from the PIT interrupt. Costs the
+// number of expired and cascaded timers, not the number armed.
+void ktimer_run_expired(u64 now);
+
+// Halt until the next interrupt with the periodic ticks stopped until the
+// next timer deadline. Call with interrupts disabled; returns the same way.
+void ktimer_idle(void);
+
+void ktimer_debug_info(void);
+
+#endif // KTIMER_H
@@ -8,6 +8,7 @@
 
 #define PAGE_4K   0x1000ULL
 #define PAGE_2M   0x200000ULL
+#define PAGE_1G   0x40000000ULL
 
 /* x86_64 PTE flags */
 #define PTE_PRESENT      (1ULL << 0)
@@ -19,6 +20,7 @@
 #define PTE_DIRTY        (1ULL << 6)
 #define PTE_HUGE         (1ULL << 7)
 #define PTE_GLOBAL       (1ULL << 8)
+#define PTE_OWNED        (1ULL << 9)    /* Software bit: frame is freed with its address space */
 #define PTE_NX           (1ULL << 63)
 
 /* Initialize mapper and reserve physical block for page-tables.
@@ -34,10 +36,96 @@ u64 mm_init(struct memory_info* minfo, u64 table_virt_base);
  */
 u8 mm_enable_virtual_tables(void);
 
-/* Map/unmap. Return 1 on success, 0 on failure. */
+/* Map/unmap. Return 1 on success, 0 on failure.
+ * page_size is PAGE_4K, PAGE_2M or PAGE_1G; PTE_HUGE alone implies 2M.
+ * 1G pages are only accepted when mm_has_1g_pages() reports CPU support.
+ * Page tables come from the bootstrap block first and from the frame
+ * allocator once it is exhausted; mm_unmap releases tables left empty.
+ */
 u8 mm_map(u64 virtual_addr, u64 physical_addr, u64 flags, size_t page_size);
 u8 mm_unmap(u64 virtual_addr, size_t page_size);
 
+/* Batched range versions. Each page table is walked once for the whole
+ * range and TLB invalidations are coalesced: invlpg per page for small
+ * changes, a single flush of the address space for large ones.
+ * mm_map_range uses 2M/1G pages wherever alignment allows if PTE_HUGE is
+ * set in flags, 4K pages otherwise; on failure earlier pages stay mapped.
+ * mm_unmap_range frees emptied tables and skips partially covered large
+ * pages. Addresses and size must be 4K aligned.
+ */
+u8 mm_map_range(u64 virtual_addr, u64 physical_addr, u64 size, u64 flags);
+u8 mm_unmap_range(u64 virtual_addr, u64 size);
+
+/* Invalidation counters: single-page invlpg and whole-space flushes. */
+void mm_tlb_stats(u64 *page_flushes, u64 *full_flushes);
+
+/* Every CPU caches the kernel tables. A change that removes or replaces a
+ * kernel mapping, or empties a kernel table, is shot down before the call
+ * returns: every other online CPU gets an APIC_TLB_VECTOR IPI, flushes its
+ * TLB and is waited for. Only then are emptied tables freed, so the caller
+ * may release the frames it unmapped. Processes only run on the boot CPU,
+ * so user spaces need no shootdown.
+ *
+ * mm_tlb_poll flushes this CPU if a shootdown is waiting for it. The IPI
+ * handler calls it, and so does every spin-wait, so that a CPU spinning
+ * with interrupts off still answers.
+ */
+void mm_tlb_poll(void);
+u64 mm_tlb_shootdowns(void);
+
+/* Whether the CPU supports 1 GiB pages (CPUID pdpe1gb). */
+u8 mm_has_1g_pages(void);
+
+/* Number of page-table pages currently allocated from the frame allocator. */
+u64 mm_table_pages_from_pmm(void);
+
+/* Number of page-table pages currently in use, including the PML4. */
+u64 mm_table_pages_in_use(void);
+
+/* Per-process address spaces. A space has a PML4 of its own whose entry 0
+ * (the identity map) and kernel half (256..511) point at the kernel's
+ * tables, so every kernel mapping is shared and kernel pointers stay valid
+ * across a CR3 switch; none of those entries carry PTE_USER. User pages are
+ * 4K and live in entries 1..255, between USER_SPACE_BASE and USER_SPACE_TOP.
+ * mm_init creates every kernel-half PDPT up front, so the copied entries
+ * stay valid however the kernel mappings change later.
+ */
+#define USER_SPACE_BASE  0x0000008000000000ULL
+#define USER_SPACE_TOP   0x0000800000000000ULL
+
+typedef struct mm_space {
+    u64 pml4_phys;          /* 0 when there is no space */
+    u64 owned_pages;        /* Frames freed by mm_space_destroy */
+} mm_space_t;
+
+/* Returns 1 on success, 0 on failure. */
+u8 mm_space_create(mm_space_t *space);
+
+/* Free every PTE_OWNED frame and every user page table, then the PML4.
+ * Costs O(mapped pages). The space must not be active on any CPU.
+ */
+void mm_space_destroy(mm_space_t *space);
+
+/* Map zeroed frames of its own over [va, va + size) with PTE_USER and
+ * PTE_OWNED added to flags. On failure earlier pages stay mapped and are
+ * released by mm_space_destroy.
+ */
+u8 mm_space_alloc(mm_space_t *space, u64 va, u64 size, u64 flags);
+
+/* Map physical memory the space does not own (shared pages). */
+u8 mm_space_map(mm_space_t *space, u64 va, u64 pa, u64 size, u64 flags);
+
+/* Physical address behind a user virtual address, or 0. */
+u64 mm_space_translate(const mm_space_t *space, u64 va);
+
+/* Whether every page of [va, va + size) is mapped for user access, and
+ * writable if write is set. Used to validate pointers passed to syscalls.
+ */
+u8 mm_space_check(const mm_space_t *space, u64 va, u64 size, u8 write);
+
+/* Load CR3 for space, or for the kernel's own tables when space is NULL. */
+void mm_space_activate(mm_space_t *space);
+
 /* Helpers */
 static inline u8 is_canonical(u64 addr) {
     u64 mask = 0xFFFFULL << 48;
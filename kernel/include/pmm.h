@@ -0,0 +1,53 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include <cldtypes.h>
+#include <memory_info.h>
+
+// Buddy allocator for physical page frames. Order 0 is a single 4 KiB
+// frame, order 9 a 2 MiB block and order 18 a 1 GiB block; every block is
+// naturally aligned to its own size.
+#define PMM_PAGE_SHIFT 12
+#define PMM_PAGE_SIZE (1ULL << PMM_PAGE_SHIFT)
+#define PMM_MAX_ORDER 18
+#define PMM_ORDER_2M 9
+#define PMM_ORDER_1G 18
+
+// Only RAM reachable through the boot identity map is managed, so a frame's
+// physical address is also its kernel virtual address.
+#define PMM_PHYS_LIMIT (16ULL << 30)
+
+// Take ownership of all system RAM left in minfo. Must run after the page
+// tables are live (free lists are threaded through the free frames).
+// The consumed regions are emptied. Returns 1 on success, 0 on failure.
+u8 pmm_init(struct memory_info* minfo);
+
+// Allocate 2^order contiguous frames aligned to their size.
+// Returns the physical address, or 0 when no block is available.
+u64 pmm_alloc_pages(u32 order);
+
+// Return a block obtained from pmm_alloc_pages with the same order.
+void pmm_free_pages(u64 phys, u32 order);
+
+// Allocate a physically contiguous range aligned to the next power of two
+// of its size; the unused tail of that block is released immediately.
+// Free it with pmm_free_contiguous and the same byte count.
+u64 pmm_alloc_contiguous(u64 bytes);
+void pmm_free_contiguous(u64 phys, u64 bytes);
+
+// Smallest order whose block holds `bytes`, or PMM_MAX_ORDER + 1 if too big.
+u32 pmm_order_for_size(u64 bytes);
+
+u64 pmm_total_bytes(void);
+u64 pmm_free_bytes(void);
+
+// Largest order that currently has a free block, or -1 when empty.
+int pmm_largest_free_order(void);
+
+void pmm_debug_info(void);
+
+static inline void* pmm_phys_to_virt(u64 phys) {
+    return (void*)(uintptr_t)phys;
+}
+
+#endif // PMM_H
@@ -2,6 +2,8 @@
 #define PROCESS_H
 
 #include <cldtypes.h>
+#include <smp.h>
+#include <memory_mapper.h>
 
 #define MAX_PROCESSES 32
 #define PROCESS_NAME_LEN 64
@@ -9,11 +11,15 @@
 // Process states
 typedef enum {
     PROCESS_UNUSED = 0,
-    PROCESS_RUNNING,
+    PROCESS_READY,                 // On the run queue, waiting for the CPU
+    PROCESS_RUNNING,               // Currently on the CPU
+    PROCESS_BLOCKED,               // Off the CPU until sched_wake
     PROCESS_EXITED
 } process_state_t;
 
-// Execution context for process switching
+// Execution context for process switching. Only the callee-saved registers,
+// rsp, rip and rflags are live across sched_context_switch; rdi and rsi are
+// loaded as well so a new process starts with its entry arguments.
 typedef struct {
     u64 rax, rbx, rcx, rdx;
     u64 rsi, rdi, rbp, rsp;
@@ -23,7 +29,7 @@ typedef struct {
 } execution_context_t;
 
 // Process control block
-typedef struct {
+typedef struct process {
     u32 pid;
     process_state_t state;
     char name[PROCESS_NAME_LEN];
@@ -31,26 +37,31 @@ typedef struct {
     void* return_address;           // Where to return control after exit
     void* stack_pointer;            // Saved stack pointer of caller
     u64 exit_status;               // Exit status when process exits
-    void* elf_base;                // Base address for cleanup
-    u64 elf_size;                  // Size for cleanup
+    mm_space_t space;              // User address space; pml4_phys 0 for kernel threads
+    struct uring* uring;           // Batched syscall rings, NULL until set up
     u32 parent_pid;                // Parent process PID
-    execution_context_t saved_context; // Saved context for parent restoration
+    execution_context_t context;   // Saved registers while switched out
+    struct kstack* kstack;         // Kernel stack the program runs on
+    u64 kstack_peak;               // Deepest stack usage seen at exit
+    struct process* run_next;      // Circular run queue link
+    u32 slice_left;                // Ticks left in the current time slice
+    u64 run_ticks;                 // Ticks spent on the CPU
+    u64 switches;                  // Times switched in
+    u8 fpu_state[512] __attribute__((aligned(16))); // FXSAVE image
 } process_t;
 
 // Process management functions
 void process_init(void);
-u32 process_create(const char* name, void* entry_point, void* return_addr, void* elf_base, u64 elf_size);
+u32 process_create(const char* name, void* entry_point, void* return_addr);
 void process_exit(u32 pid, u64 status);
 process_t* process_get(u32 pid);
 process_t* process_get_current(void);
-void process_set_current(u32 pid);
 
-// Context switching functions
-void process_save_context(u32 pid, execution_context_t* context);
-void process_restore_context(u32 pid);
-void process_exit_and_restore_parent(u32 pid, u64 status);
+// Call fn on every live entry (state != PROCESS_UNUSED) with the process
+// table locked and interrupts off; fn must not create or look up processes.
+void process_for_each(void (*fn)(process_t* proc));
 
-// Global current process ID
-extern u32 current_pid;
+// Process running on this CPU, maintained by the scheduler
+#define current_pid (this_cpu()->running_pid)
 
 #endif // PROCESS_H
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <cldtypes.h>
+#include <process.h>
+#include <smp.h>
+
+// Preemptive round-robin scheduler. Every runnable process sits on one
+// circular run queue; the PIT tick charges the running process and switches
+// to the next ready one once its slice is used up. The boot thread (the
+// shell's main loop) is pid 0 and is always runnable, so the queue is never
+// empty. Switches save the callee-saved registers into the process's
+// execution_context_t and the FPU/SSE state with FXSAVE.
+#define SCHED_TIMESLICE_TICKS 10
+#define SCHED_DEFAULT_STACK (64 * 1024)
+
+typedef long (*sched_fn_t)(void* arg);
+
+// Adopt the running boot thread as pid 0. Call after process_init.
+void sched_init(void);
+
+// Give an existing process entry a stack and put it on the run queue; it
+// starts in fn(arg) and exits with fn's return value. stack_size 0 picks
+// SCHED_DEFAULT_STACK. Returns 0 on success.
+int sched_start(u32 pid, sched_fn_t fn, void* arg, size_t stack_size);
+
+// process_create + sched_start. Returns the new pid, or 0 on failure.
+u32 sched_spawn(const char* name, sched_fn_t fn, void* arg, size_t stack_size);
+
+// Give up the rest of the current slice.
+void sched_yield(void);
+
+// Yield if another process is ready, otherwise halt until the next
+// interrupt with the periodic tick stopped until the next timer deadline.
+void sched_idle_wait(void);
+
+// Block the calling process for `ticks` PIT ticks. Other processes run
+// meanwhile; with nothing else ready the CPU sleeps until the wakeup timer.
+void sched_sleep_ticks(u64 ticks);
+
+// Make a blocked process ready again. Safe from interrupt context.
+void sched_wake(process_t* proc);
+
+// Terminate the calling process. Its stack is released by sched_reap.
+void sched_exit(long status) __attribute__((noreturn));
+
+// Wait for pid to exit and return its status (-1 if it does not exist).
+long sched_wait(u32 pid);
+
+// Free the stacks of exited processes and unlink them from the run queue.
+void sched_reap(void);
+
+// Called from the PIT interrupt after EOI.
+void sched_tick(void);
+
+// Preemption is held off while this CPU's count is non-zero. Every lock in
+// spinlock.h raises it while held, so a lock holder is never switched out;
+// a switch that came due meanwhile runs on enable.
+#define sched_preempt_count (this_cpu()->preempt_count)
+
+static inline void sched_preempt_disable(void) {
+    sched_preempt_count++;
+    __asm__ volatile ("" ::: "memory");
+}
+
+void sched_preempt_enable(void);
+
+u64 sched_switch_count(void);
+void sched_debug_info(void);
+
+// Save the current context into `from` and resume `to` (sched_switch.asm).
+void sched_context_switch(execution_context_t* from, execution_context_t* to,
+                          void* from_fpu, const void* to_fpu);
+
+#endif // SCHED_H
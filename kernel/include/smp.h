@@ -0,0 +1,79 @@
+#ifndef SMP_H
+#define SMP_H
+
+#include <cldtypes.h>
+
+// Per-CPU state and application processor bring-up. Every CPU owns a cpu_t
+// holding its GDT, TSS, boot stack and scheduler state; the GS base MSR
+// points at it so this_cpu() is a single %gs-relative load. While a CPU runs
+// user code the kernel's GS base waits in KERNEL_GS_BASE, and every entry
+// from user mode swaps it back in with swapgs. The boot CPU is entry 0 and
+// is set up first thing in kernel_main. smp_init starts the other processors
+// listed in the ACPI MADT with INIT-SIPI-SIPI through a real-mode trampoline
+// copied to SMP_TRAMPOLINE_PHYS; they load their own tables and become
+// task pool workers (task.h).
+#define SMP_MAX_CPUS 16
+#define SMP_TRAMPOLINE_PHYS 0x8000
+#define SMP_AP_STACK_SIZE (16 * 1024)
+
+#define GDT_ENTRIES 8
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+// SYSRET loads SS and CS from consecutive entries, data first
+#define GDT_USER_DATA   0x18
+#define GDT_USER_CODE   0x20
+#define GDT_TSS         0x28            // 16-byte descriptor, entries 5 and 6
+
+// Field offsets used by the syscall entry stub (syscall_handler.asm)
+#define CPU_OFFSET_SYSCALL_RSP 8
+#define CPU_OFFSET_USER_RSP    16
+
+// 64-bit task state segment. Only rsp0, the stack the CPU switches to on an
+// interrupt from user mode, and the I/O map base are used.
+typedef struct tss {
+    u32 reserved0;
+    u64 rsp0;
+    u64 rsp1;
+    u64 rsp2;
+    u64 reserved1;
+    u64 ist[7];
+    u64 reserved2;
+    u16 reserved3;
+    u16 iomap_base;
+} __attribute__((packed)) tss_t;
+
+typedef struct cpu {
+    struct cpu* self;               // Read through %gs:0; must stay first
+    u64 syscall_rsp;                // Kernel stack for SYSCALL from user mode
+    u64 user_rsp;                   // Scratch for the user stack pointer
+    u32 index;                      // 0 is the boot CPU
+    u32 apic_id;
+    u32 running_pid;                // Process running on this CPU
+    volatile u32 preempt_count;     // sched_preempt_disable nesting depth
+    volatile u8 online;
+    volatile u64 tlb_gen;           // Last kernel TLB shootdown flushed here
+    char name[8];
+    struct kstack* kstack;          // NULL on the boot CPU, which keeps the boot stack
+    u64 gdt[GDT_ENTRIES] __attribute__((aligned(16)));
+    tss_t tss __attribute__((aligned(16)));
+} cpu_t;
+
+static inline cpu_t* this_cpu(void) {
+    cpu_t* cpu;
+    __asm__ volatile ("movq %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// Load the boot CPU's GDT and GS base. Must run before anything calls
+// this_cpu(), i.e. before the process table is touched.
+void smp_init_bsp(void);
+
+// Start the application processors from the MADT. Needs apic_init, the PIT
+// and interrupts, since the IPI sequence waits on sleep_ms.
+void smp_init(void);
+
+u32 smp_cpu_count(void);
+cpu_t* smp_cpu(u32 index);
+void smp_debug_info(void);
+
+#endif // SMP_H
@@ -0,0 +1,95 @@
+#ifndef SPINLOCK_H
+#define SPINLOCK_H
+
+#include <cldtypes.h>
+#include <sched.h>
+#include <smp.h>
+
+// Kernel locks for state shared between CPUs.
+//
+// spinlock_t is a ticket lock: waiters take a ticket and spin until it is
+// served, so they get the lock in arrival order and one CPU cannot starve
+// the others. rwlock_t lets readers share the lock; a waiting writer holds
+// new readers off so a stream of lookups cannot starve it. rspinlock_t can
+// be taken again by the CPU that already holds it, for code that re-enters
+// itself (the console prints through itself, the window manager calls back
+// into the apps that called it).
+//
+// Every lock holds off preemption while held, so the holder is never
+// switched out for a process that then spins on the same lock. The plain
+// variants leave interrupts alone and must not be taken from an interrupt
+// handler; use the _irqsave variants for state an interrupt handler also
+// touches. A lock is never held across anything that blocks.
+//
+// Each lock counts acquisitions, contended acquisitions and the pause
+// iterations spent waiting; locks register themselves on first use and
+// lock_debug_info lists them.
+
+typedef struct lock_stats {
+    const char* name;
+    u64 acquisitions;
+    u64 contended;                  // Acquisitions that had to wait
+    u64 spins;                      // pause iterations spent waiting
+    struct lock_stats* next;        // Registry of used locks
+    volatile u8 registered;
+} lock_stats_t;
+
+#define LOCK_STATS_INIT(name) { (name), 0, 0, 0, NULL, 0 }
+
+typedef struct spinlock {
+    volatile u32 next;              // Next ticket to hand out
+    volatile u32 serving;           // Ticket that owns the lock
+    lock_stats_t stats;
+} spinlock_t;
+
+#define SPINLOCK_INIT(name) { 0, 0, LOCK_STATS_INIT(name) }
+
+typedef struct rwlock {
+    volatile u32 state;             // RWLOCK_WRITER or the number of readers
+    volatile u32 writers_waiting;
+    lock_stats_t stats;
+} rwlock_t;
+
+#define RWLOCK_WRITER 0x80000000U
+#define RWLOCK_INIT(name) { 0, 0, LOCK_STATS_INIT(name) }
+
+typedef struct rspinlock {
+    spinlock_t lock;
+    volatile u32 owner;             // Holding CPU index + 1, 0 when free
+    u32 depth;
+} rspinlock_t;
+
+#define RSPINLOCK_INIT(name) { SPINLOCK_INIT(name), 0, 0 }
+
+void spin_init(spinlock_t* lock, const char* name);
+void spin_lock(spinlock_t* lock);
+void spin_unlock(spinlock_t* lock);
+
+// Returns 1 with the lock held, 0 if it was taken.
+int spin_trylock(spinlock_t* lock);
+
+// Disable interrupts, then lock. Returns the previous RFLAGS for
+// spin_unlock_irqrestore.
+u64 spin_lock_irqsave(spinlock_t* lock);
+void spin_unlock_irqrestore(spinlock_t* lock, u64 flags);
+
+static inline int spin_is_locked(const spinlock_t* lock) {
+    return __atomic_load_n(&lock->next, __ATOMIC_RELAXED) !=
+           __atomic_load_n(&lock->serving, __ATOMIC_RELAXED);
+}
+
+void rwlock_init(rwlock_t* lock, const char* name);
+void read_lock(rwlock_t* lock);
+void read_unlock(rwlock_t* lock);
+void write_lock(rwlock_t* lock);
+void write_unlock(rwlock_t* lock);
+
+void rspin_lock(rspinlock_t* lock);
+void rspin_unlock(rspinlock_t* lock);
+u64 rspin_lock_irqsave(rspinlock_t* lock);
+void rspin_unlock_irqrestore(rspinlock_t* lock, u64 flags);
+
+// Print the counters of every lock taken so far.
+void lock_debug_info(void);
+
+#endif // SPINLOCK_H
@@ -47,4 +47,16 @@ static inline long syscall3(u32 syscall_num, long arg1, long arg2, long arg3) {
     return ret;
 }
 
+// Same through the SYSCALL instruction, which clobbers rcx and r11
+static inline long fast_syscall0(u32 syscall_num) {
+    long ret;
+    __asm__ volatile (
+        "syscall"
+        : "=a" (ret)
+        : "a" ((long)syscall_num)
+        : "memory", "rcx", "r11"
+    );
+    return ret;
+}
+
 #endif // SYSCALL_TEST_H
\ No newline at end of file
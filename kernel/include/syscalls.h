@@ -13,35 +13,68 @@
 #define SYSCALL_OPEN       5
 #define SYSCALL_CLOSE      6
 #define SYSCALL_GETPID     20
+#define SYSCALL_URING_SETUP 32     // See uring.h
+#define SYSCALL_URING_ENTER 33
 
 // Syscall handler function pointer type
 // Takes 6 arguments (rdi, rsi, rdx, rcx, r8, r9) and returns long
 typedef long (*syscall_handler_t)(long arg1, long arg2, long arg3, long arg4, long arg5, long arg6);
 
+// Trace levels for the syscall layer. SYSCALL_TRACE_MAX (make
+// SYSCALL_TRACE=n) caps what is compiled in; the runtime level set with
+// syscall_set_trace_level picks from that and defaults to errors only.
+#define SYSCALL_TRACE_OFF    0
+#define SYSCALL_TRACE_ERRORS 1      // Bad syscall numbers and failing stubs
+#define SYSCALL_TRACE_CALLS  2      // Every call with its arguments and result
+
+#ifndef SYSCALL_TRACE_MAX
+#define SYSCALL_TRACE_MAX SYSCALL_TRACE_CALLS
+#endif
+
 // Syscall registration structure
 struct syscall_entry {
     syscall_handler_t handler;
     const char* name;           // For debugging/logging
     u8 arg_count;              // Number of arguments expected
+    u64 calls;                  // Times dispatched
+    u64 cycles;                 // TSC cycles spent in the handler
 };
 
 // Initialize the syscall system
 void syscalls_init(void);
 
+// Enable the SYSCALL instruction on this CPU (EFER.SCE, STAR, LSTAR, FMASK).
+// syscalls_init does this for the boot CPU; application processors call it
+// during bring-up. Both `int 0x80` and `syscall` reach syscall_dispatch.
+// With `syscall`, the fourth argument is passed in r10 because the
+// instruction itself overwrites rcx (return address) and r11 (RFLAGS).
+void syscalls_init_cpu(void);
+
 // Register a new syscall
 int register_syscall(u32 syscall_num, syscall_handler_t handler, const char* name, u8 arg_count);
 
 // Get syscall info for debugging
 const struct syscall_entry* get_syscall_info(u32 syscall_num);
 
+// Returns 0, or -1 if the level is above what was compiled in.
+int syscall_set_trace_level(u32 level);
+u32 syscall_trace_level(void);
+
+// Print call counts and cycles per syscall; reset clears them.
+void syscall_debug_info(void);
+void syscall_reset_stats(void);
+
+// Whether [ptr, ptr + size) may be read (or written, if write is set) by
+// the calling process. Always true for callers without an address space of
+// their own (kernel threads), whose pointers are kernel pointers.
+u8 syscall_user_ok(long ptr, long size, u8 write);
+
 // Default syscall handlers for demonstration
 long sys_write(long fd, long buf, long count, long unused1, long unused2, long unused3);
 long sys_read(long fd, long buf, long count, long unused1, long unused2, long unused3);
 long sys_exit(long status, long unused1, long unused2, long unused3, long unused4, long unused5);
 long sys_getpid(long unused1, long unused2, long unused3, long unused4, long unused5, long unused6);
-
-// Program exit handling for ELF programs
-extern volatile long program_exit_status;
-extern volatile int program_should_exit;
+long sys_uring_setup(long entries, long unused1, long unused2, long unused3, long unused4, long unused5);
+long sys_uring_enter(long to_submit, long min_complete, long unused1, long unused2, long unused3, long unused4);
 
 #endif // SYSCALLS_H
\ No newline at end of file
@@ -0,0 +1,51 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include <cldtypes.h>
+
+// Work-stealing pool for CPU-bound kernel jobs. Each CPU owns a Chase-Lev
+// deque: task_spawn pushes onto the caller's CPU, the owner pops from the
+// same end (newest first, still warm in cache) and idle CPUs steal the
+// oldest task from the other end. Application processors run
+// task_worker_loop and sleep in hlt until a spawn wakes them with an IPI.
+// On the boot CPU, spawned tasks are also drained by a low-priority
+// deferred work item, so with a single CPU they still run from the kernel
+// main loop, and task_wait runs other tasks instead of spinning.
+//
+// Tasks run on any CPU with the interrupt state of whoever picks them up:
+// off on application processors, usually on for the boot CPU. They must
+// not block or touch the scheduler, which only runs on the boot CPU. The
+// allocators, the page mapper and the console are locked (spinlock.h) and
+// safe to use; kernel unmaps are shot down on every CPU (memory_mapper.h),
+// and a shootdown waits for a long task on an application processor.
+#define TASK_DEQUE_SIZE 256
+
+typedef void (*task_fn_t)(void* arg);
+
+typedef struct task {
+    task_fn_t fn;
+    void* arg;
+    volatile u32 done;
+} task_t;
+
+// Queue fn(arg) on this CPU's deque. The task_t is owned by the caller and
+// must stay valid until task_wait returns. Runs inline if the deque is full.
+void task_spawn(task_t* task, task_fn_t fn, void* arg);
+
+// Wait for a spawned task, running queued or stolen tasks meanwhile.
+void task_wait(task_t* task);
+
+static inline int task_done(const task_t* task) {
+    return __atomic_load_n(&task->done, __ATOMIC_ACQUIRE) != 0;
+}
+
+// Run one task from this CPU's deque or stolen from another. Returns 1 if
+// one ran.
+int task_run_one(void);
+
+// Worker loop for application processors. Does not return.
+void task_worker_loop(void) __attribute__((noreturn));
+
+void task_debug_info(void);
+
+#endif // TASK_H
@@ -0,0 +1,89 @@
+#ifndef URING_H
+#define URING_H
+
+#include <cldtypes.h>
+#include <memory_mapper.h>
+
+// Batched syscall rings. A process sets up one pair of rings shared with
+// the kernel (SYSCALL_URING_SETUP): it queues operations in the submission
+// ring and hands the kernel any number of them with one SYSCALL_URING_ENTER,
+// which also waits for completions if asked to. Each operation's result is
+// posted to the completion ring with the user_data it was submitted with.
+//
+// The process writes sq_tail and cq_head; the kernel writes sq_head and
+// cq_tail and keeps its own copies of both, so a program can only confuse
+// itself. Operations are run in submission order. Sleeps complete
+// asynchronously: they stay pending across calls and are posted once due,
+// possibly after completions of later operations. The kernel never takes
+// an entry it has no completion slot for, so the completion ring cannot
+// overflow; uring_enter then returns fewer than to_submit.
+//
+// The layout below is ABI for programs/ (offsets in the comments).
+
+#define URING_MAX_ENTRIES 256       // Submission ring size limit
+#define URING_MAX_FILES   16        // Open files per ring
+#define URING_FD_BASE     3         // First fd handed out by URING_OP_OPEN
+#define URING_OFF_CURRENT 0xFFFFFFFFU   // Read from the file position
+#define URING_PATH_MAX    256
+
+// Where the rings appear in a process with an address space of its own
+#define URING_USER_BASE   (USER_SPACE_BASE + 0x100000)
+
+typedef enum {
+    URING_OP_NOP = 0,
+    URING_OP_WRITE,                 // fd, addr, len: as SYSCALL_WRITE
+    URING_OP_READ,                  // fd, addr, len, off: file opened here, or as SYSCALL_READ
+    URING_OP_OPEN,                  // addr, len: cldramfs path; res is the fd
+    URING_OP_CLOSE,                 // fd
+    URING_OP_SLEEP,                 // len: milliseconds
+    URING_OP_COUNT
+} uring_op_t;
+
+// Submission queue entry, 32 bytes
+typedef struct uring_sqe {
+    u8 opcode;                      // 0
+    u8 flags;                       // 1, must be 0
+    u16 reserved;                   // 2
+    i32 fd;                         // 4
+    u64 addr;                       // 8
+    u32 len;                        // 16
+    u32 off;                        // 20
+    u64 user_data;                  // 24, copied to the completion
+} uring_sqe_t;
+
+// Completion queue entry, 16 bytes
+typedef struct uring_cqe {
+    u64 user_data;                  // 0
+    i64 res;                        // 8, operation result or -1
+} uring_cqe_t;
+
+// Start of the shared region; the entry arrays follow at sq_off and cq_off
+typedef struct uring_header {
+    u32 sq_head;                    // 0, kernel
+    u32 sq_tail;                    // 4, program
+    u32 sq_mask;                    // 8
+    u32 sq_entries;                 // 12
+    u32 cq_head;                    // 16, program
+    u32 cq_tail;                    // 20, kernel
+    u32 cq_mask;                    // 24
+    u32 cq_entries;                 // 28, twice sq_entries
+    u32 sq_off;                     // 32
+    u32 cq_off;                     // 36
+    u32 reserved[6];
+} uring_header_t;
+
+struct process;
+
+// Set up the rings of proc with entries rounded up to a power of two.
+// Returns the header address as proc sees it, or -1.
+long uring_setup(struct process* proc, u32 entries);
+
+// Take up to to_submit entries, then wait until at least min_complete
+// completions are ready or no operation is left pending. Returns the number
+// of entries taken, or -1 without rings.
+long uring_enter(struct process* proc, u32 to_submit, u32 min_complete);
+
+// Free the rings, the open files and pending sleeps of an exited process.
+void uring_destroy(struct process* proc);
+
+#endif // URING_H
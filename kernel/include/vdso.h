@@ -0,0 +1,48 @@
+#ifndef VDSO_H
+#define VDSO_H
+
+#include <cldtypes.h>
+#include <memory_mapper.h>
+
+// Read-only pages the kernel maps into every program so that hot queries
+// need no trap. The clock page is one frame shared by all programs; the
+// kernel stores the tick count on every PIT tick and the TSC calibration
+// once at boot. The process page right after it is a frame of the
+// program's own holding its pid.
+//
+// With a calibrated TSC, nanoseconds since boot are
+// ns_base + ((rdtsc - tsc_base) * ns_mult >> 32), as clock_ns computes
+// them; otherwise (tsc_hz == 0) only ticks / tick_hz is available.
+// programs/vdso.inc has the user side. Offsets are ABI.
+
+#define VDSO_USER_BASE  (USER_SPACE_BASE + PAGE_4K)     // Clock page
+#define VDSO_PROC_BASE  (VDSO_USER_BASE + PAGE_4K)      // Process page
+
+typedef struct vdso_data {
+    volatile u64 ticks;             // 0, pit_ticks()
+    u64 tick_hz;                    // 8
+    u64 tsc_hz;                     // 16, 0 if the TSC is not calibrated
+    u64 ns_mult;                    // 24, ns per TSC cycle, 32.32 fixed point
+    u64 tsc_base;                   // 32
+    u64 ns_base;                    // 40
+} vdso_data_t;
+
+typedef struct vdso_proc {
+    u32 pid;                        // 0
+    u32 parent_pid;                 // 4
+} vdso_proc_t;
+
+// Allocate the clock page. Call after clock_init.
+void vdso_init(void);
+
+// Publish the tick count; called by the PIT driver.
+void vdso_set_ticks(u64 ticks);
+
+// Kernel view of the clock page, or NULL before vdso_init.
+const vdso_data_t* vdso_data(void);
+
+// Map the clock page and a new process page into space. Returns 0 on
+// success; a process page already mapped is freed with the space.
+int vdso_map(mm_space_t* space, u32 pid, u32 parent_pid);
+
+#endif // VDSO_H
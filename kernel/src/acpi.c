@@ -0,0 +1,185 @@
+#include <acpi.h>
+#include <multiboot/multiboot2.h>
+#include <vgaio.h>
+#include <string.h>
+
+#define MADT_LAPIC          0
+#define MADT_IOAPIC         1
+#define MADT_OVERRIDE       2
+#define MADT_LAPIC_ADDR     5
+#define MADT_LAPIC_ENABLED  0x1
+#define MADT_PCAT_COMPAT    0x1
+
+typedef struct {
+    char signature[8];
+    u8 checksum;
+    char oem_id[6];
+    u8 revision;
+    u32 rsdt_addr;
+    // ACPI 2.0+
+    u32 length;
+    u64 xsdt_addr;
+    u8 ext_checksum;
+    u8 reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    acpi_sdt_header_t header;
+    u32 lapic_addr;
+    u32 flags;
+} __attribute__((packed)) acpi_madt_header_t;
+
+static acpi_sdt_header_t* g_root = NULL;
+static u8 g_root_is_xsdt = 0;
+static acpi_madt_t g_madt;
+static u8 g_madt_valid = 0;
+
+static u8 acpi_checksum(const void* data, size_t len) {
+    const u8* p = (const u8*)data;
+    u8 sum = 0;
+    for (size_t i = 0; i < len; i++) sum += p[i];
+    return sum;
+}
+
+static acpi_rsdp_t* acpi_rsdp_from_mb2(u32 mb2_info) {
+    struct multiboot_tag* tag = multiboot2_find_tag(mb2_info, MULTIBOOT_TAG_TYPE_ACPI_NEW);
+    if (!tag) tag = multiboot2_find_tag(mb2_info, MULTIBOOT_TAG_TYPE_ACPI_OLD);
+    if (!tag) return NULL;
+    // The tag carries a copy of the RSDP right after its 8-byte header
+    return (acpi_rsdp_t*)((u8*)tag + 8);
+}
+
+// The RSDP sits on a 16-byte boundary in the first KiB of the EBDA or in
+// the BIOS ROM area.
+static acpi_rsdp_t* acpi_rsdp_scan(u64 start, u64 end) {
+    for (u64 addr = start; addr + 20 <= end; addr += 16) {
+        acpi_rsdp_t* rsdp = (acpi_rsdp_t*)(uintptr_t)addr;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && acpi_checksum(rsdp, 20) == 0) {
+            return rsdp;
+        }
+    }
+    return NULL;
+}
+
+static acpi_rsdp_t* acpi_find_rsdp(u32 mb2_info) {
+    acpi_rsdp_t* rsdp = acpi_rsdp_from_mb2(mb2_info);
+    if (rsdp) return rsdp;
+    // BIOS data area word 0x40E holds the EBDA segment. Hide the constant
+    // address from the compiler, which assumes nothing lives near NULL.
+    u64 bda = 0x400;
+    __asm__ ("" : "+r"(bda));
+    u64 ebda = (u64)(*(volatile u16*)(uintptr_t)(bda + 0x0E)) << 4;
+    if (ebda) {
+        rsdp = acpi_rsdp_scan(ebda, ebda + 1024);
+        if (rsdp) return rsdp;
+    }
+    return acpi_rsdp_scan(0xE0000, 0x100000);
+}
+
+acpi_sdt_header_t* acpi_find_table(const char* signature) {
+    if (!g_root) return NULL;
+    size_t entry_size = g_root_is_xsdt ? 8 : 4;
+    size_t count = (g_root->length - sizeof(acpi_sdt_header_t)) / entry_size;
+    u8* entries = (u8*)g_root + sizeof(acpi_sdt_header_t);
+
+    for (size_t i = 0; i < count; i++) {
+        u64 phys;
+        if (g_root_is_xsdt) {
+            memcpy(&phys, entries + i * 8, 8);
+        } else {
+            u32 phys32;
+            memcpy(&phys32, entries + i * 4, 4);
+            phys = phys32;
+        }
+        acpi_sdt_header_t* table = (acpi_sdt_header_t*)(uintptr_t)phys;
+        if (memcmp(table->signature, signature, 4) == 0 &&
+            acpi_checksum(table, table->length) == 0) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+static void acpi_parse_madt(const acpi_madt_header_t* madt) {
+    memset(&g_madt, 0, sizeof(g_madt));
+    g_madt.lapic_phys = madt->lapic_addr;
+    g_madt.has_8259 = (madt->flags & MADT_PCAT_COMPAT) != 0;
+
+    const u8* p = (const u8*)madt + sizeof(acpi_madt_header_t);
+    const u8* end = (const u8*)madt + madt->header.length;
+    while (p + 2 <= end && p[1] >= 2 && p + p[1] <= end) {
+        u8 type = p[0];
+        switch (type) {
+            case MADT_LAPIC: {
+                u32 flags;
+                memcpy(&flags, p + 4, 4);
+                if ((flags & MADT_LAPIC_ENABLED) &&
+                    g_madt.cpu_count < ACPI_MAX_CPUS) {
+                    g_madt.cpus[g_madt.cpu_count].acpi_id = p[2];
+                    g_madt.cpus[g_madt.cpu_count].apic_id = p[3];
+                    g_madt.cpu_count++;
+                }
+                break;
+            }
+            case MADT_IOAPIC:
+                if (g_madt.ioapic_count < ACPI_MAX_IOAPICS) {
+                    acpi_ioapic_t* io = &g_madt.ioapics[g_madt.ioapic_count++];
+                    io->id = p[2];
+                    memcpy(&io->phys, p + 4, 4);
+                    memcpy(&io->gsi_base, p + 8, 4);
+                }
+                break;
+            case MADT_OVERRIDE:
+                if (g_madt.override_count < ACPI_MAX_OVERRIDES) {
+                    acpi_irq_override_t* ov = &g_madt.overrides[g_madt.override_count++];
+                    ov->source = p[3];
+                    memcpy(&ov->gsi, p + 4, 4);
+                    memcpy(&ov->flags, p + 8, 2);
+                }
+                break;
+            case MADT_LAPIC_ADDR:
+                memcpy(&g_madt.lapic_phys, p + 4, 8);
+                break;
+            default:
+                break;
+        }
+        p += p[1];
+    }
+}
+
+int acpi_init(u32 mb2_info) {
+    acpi_rsdp_t* rsdp = acpi_find_rsdp(mb2_info);
+    if (!rsdp) {
+        vga_printf("[ACPI] RSDP not found\n");
+        return -1;
+    }
+
+    if (rsdp->revision >= 2 && rsdp->xsdt_addr) {
+        g_root = (acpi_sdt_header_t*)(uintptr_t)rsdp->xsdt_addr;
+        g_root_is_xsdt = 1;
+    } else {
+        g_root = (acpi_sdt_header_t*)(uintptr_t)rsdp->rsdt_addr;
+        g_root_is_xsdt = 0;
+    }
+    if (acpi_checksum(g_root, g_root->length) != 0) {
+        vga_printf("[ACPI] Bad %s checksum\n", g_root_is_xsdt ? "XSDT" : "RSDT");
+        g_root = NULL;
+        return -1;
+    }
+
+    acpi_madt_header_t* madt = (acpi_madt_header_t*)acpi_find_table("APIC");
+    if (!madt) {
+        vga_printf("[ACPI] No MADT\n");
+        return -1;
+    }
+    acpi_parse_madt(madt);
+    g_madt_valid = 1;
+
+    vga_printf("[ACPI] MADT: %u CPUs, %u IOAPICs, LAPIC at 0x%llx\n",
+              g_madt.cpu_count, g_madt.ioapic_count, g_madt.lapic_phys);
+    return 0;
+}
+
+const acpi_madt_t* acpi_madt(void) {
+    return g_madt_valid ? &g_madt : NULL;
+}
@@ -0,0 +1,104 @@
+; ap_trampoline.asm - Real-mode entry for application processors
+;
+; smp_init copies ap_trampoline_start..ap_trampoline_end to physical
+; TRAMPOLINE_BASE (SMP_TRAMPOLINE_PHYS in smp.h) and points the startup IPI
+; at it. The code runs from that copy, so every absolute address is computed
+; with TRAMP() relative to the copy rather than the link address.
+; The AP walks real mode -> protected mode -> long mode on a private GDT,
+; switches to the kernel page tables and stack from the parameter block and
+; calls entry(cpu) in the higher half.
+
+%define TRAMPOLINE_BASE 0x8000
+%define TRAMP(label) (TRAMPOLINE_BASE + (label) - ap_trampoline_start)
+
+%define CR0_PE      (1 << 0)
+%define CR0_PG      (1 << 31)
+%define CR4_PAE     (1 << 5)
+%define EFER_MSR    0xC0000080
+%define EFER_LME    (1 << 8)
+
+section .rodata
+align 16
+
+global ap_trampoline_start
+global ap_trampoline_end
+global ap_trampoline_params
+
+BITS 16
+ap_trampoline_start:
+    cli
+    cld
+    xor     ax, ax
+    mov     ds, ax
+    mov     es, ax
+    mov     ss, ax
+
+    lgdt    [TRAMP(tramp_gdt_ptr)]
+    mov     eax, cr0
+    or      eax, CR0_PE
+    mov     cr0, eax
+    jmp     dword 0x08:TRAMP(ap_protected_mode)
+
+BITS 32
+ap_protected_mode:
+    mov     ax, 0x10
+    mov     ds, ax
+    mov     es, ax
+    mov     ss, ax
+
+    mov     eax, cr4
+    or      eax, CR4_PAE
+    mov     cr4, eax
+
+    ; Kernel PML4 (checked to be below 4 GiB by smp_init)
+    mov     eax, [TRAMP(ap_trampoline_params)]
+    mov     cr3, eax
+
+    mov     ecx, EFER_MSR
+    rdmsr
+    or      eax, EFER_LME
+    wrmsr
+
+    mov     eax, cr0
+    or      eax, CR0_PG
+    mov     cr0, eax
+    jmp     0x18:TRAMP(ap_long_mode)
+
+BITS 64
+ap_long_mode:
+    mov     ax, 0x10
+    mov     ds, ax
+    mov     es, ax
+    mov     ss, ax
+
+    mov     rsp, [TRAMP(ap_trampoline_params) + 8]
+    and     rsp, -16
+    mov     rdi, [TRAMP(ap_trampoline_params) + 24]
+    mov     rax, [TRAMP(ap_trampoline_params) + 16]
+    call    rax
+
+.halt:
+    cli
+    hlt
+    jmp     .halt
+
+align 8
+tramp_gdt:
+    dq 0x0000000000000000       ; null
+    dq 0x00CF9A000000FFFF       ; 0x08: 32-bit code
+    dq 0x00CF92000000FFFF       ; 0x10: data
+    dq 0x00AF9A000000FFFF       ; 0x18: 64-bit code
+tramp_gdt_end:
+
+tramp_gdt_ptr:
+    dw tramp_gdt_end - tramp_gdt - 1
+    dd TRAMP(tramp_gdt)
+
+; ap_boot_params_t in smp.c
+align 8
+ap_trampoline_params:
+    dq 0                        ; cr3
+    dq 0                        ; stack top
+    dq 0                        ; entry
+    dq 0                        ; cpu
+ap_trampoline_end:
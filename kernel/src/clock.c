@@ -0,0 +1,152 @@
+#include <clock.h>
+#include <acpi.h>
+#include <cpu.h>
+#include <pit/pit.h>
+#include <vgaio.h>
+
+#define CLOCK_CALIBRATE_MS  20
+#define NS_PER_SEC          1000000000ULL
+#define FS_PER_SEC          1000000000000000ULL
+
+// HPET registers (byte offsets)
+#define HPET_CAPABILITIES   0x000
+#define HPET_CONFIG         0x010
+#define HPET_COUNTER        0x0F0
+
+#define HPET_CAP_COUNT_64   (1ULL << 13)
+#define HPET_CONFIG_ENABLE  (1ULL << 0)
+
+typedef struct {
+    acpi_sdt_header_t header;
+    u32 event_timer_block_id;
+    u8 address_space;
+    u8 register_bit_width;
+    u8 register_bit_offset;
+    u8 reserved;
+    u64 address;
+    u8 hpet_number;
+    u16 minimum_tick;
+    u8 page_protection;
+} __attribute__((packed)) acpi_hpet_t;
+
+static u64 g_tsc_hz = 0;
+static u64 g_ns_mult = 0;       // ns per cycle in 32.32 fixed point
+static u64 g_tsc_base = 0;
+static u64 g_ns_base = 0;
+static u8 g_invariant = 0;
+static const char* g_source = "none";
+
+static u64 clock_pit_ns(void) {
+    u32 hz = pit_get_hz();
+    if (hz == 0) return 0;
+    return (u64)(((u128)pit_ticks() * NS_PER_SEC) / hz);
+}
+
+static u64 hpet_read(volatile u64* hpet, u32 reg) {
+    return hpet[reg / 8];
+}
+
+// Spin on the HPET main counter: it needs no interrupts and has a much
+// finer period than the PIT tick.
+static u64 clock_calibrate_hpet(void) {
+    acpi_hpet_t* table = (acpi_hpet_t*)acpi_find_table("HPET");
+    if (!table || table->address_space != 0 || !table->address) return 0;
+
+    volatile u64* hpet = (volatile u64*)(uintptr_t)table->address;
+    u64 caps = hpet_read(hpet, HPET_CAPABILITIES);
+    u64 period_fs = caps >> 32;
+    if (period_fs == 0 || period_fs > 100000000ULL) return 0;
+    u64 mask = (caps & HPET_CAP_COUNT_64) ? ~0ULL : 0xFFFFFFFFULL;
+
+    hpet[HPET_CONFIG / 8] = hpet_read(hpet, HPET_CONFIG) | HPET_CONFIG_ENABLE;
+
+    u64 wait = (CLOCK_CALIBRATE_MS * (FS_PER_SEC / 1000ULL)) / period_fs;
+    u64 start = hpet_read(hpet, HPET_COUNTER);
+    u64 tsc0 = clock_cycles();
+    u64 elapsed;
+    do {
+        __asm__ volatile ("pause");
+        elapsed = (hpet_read(hpet, HPET_COUNTER) - start) & mask;
+    } while (elapsed < wait);
+    u64 tsc1 = clock_cycles();
+
+    g_source = "HPET";
+    return (u64)(((u128)(tsc1 - tsc0) * FS_PER_SEC) / ((u128)elapsed * period_fs));
+}
+
+// Count cycles across a whole number of PIT ticks, starting on a tick edge.
+static u64 clock_calibrate_pit(void) {
+    u32 hz = pit_get_hz();
+    if (hz == 0) return 0;
+    u64 flags;
+    __asm__ volatile ("pushfq; pop %0" : "=r"(flags));
+    if (!(flags & (1ULL << 9))) return 0;
+
+    u64 start = pit_ticks();
+    while (pit_ticks() == start) __asm__ volatile ("hlt");
+
+    start = pit_ticks();
+    u64 tsc0 = clock_cycles();
+    u64 wait = ((u64)hz * CLOCK_CALIBRATE_MS) / 1000ULL;
+    if (wait == 0) wait = 1;
+    while (pit_ticks() - start < wait) __asm__ volatile ("hlt");
+    u64 tsc1 = clock_cycles();
+    u64 ticks = pit_ticks() - start;
+
+    g_source = "PIT";
+    return ((tsc1 - tsc0) * hz) / ticks;
+}
+
+int clock_init(void) {
+    g_invariant = cpu_has_invariant_tsc();
+
+    u64 hz = clock_calibrate_hpet();
+    if (!hz) hz = clock_calibrate_pit();
+    if (!hz) {
+        vga_printf("[CLOCK] TSC calibration failed, using PIT ticks\n");
+        return -1;
+    }
+
+    // Continue from the PIT time so clock_ns never steps backwards
+    g_ns_base = clock_pit_ns();
+    g_tsc_base = clock_cycles();
+    g_ns_mult = (u64)((NS_PER_SEC << 32) / hz);
+    g_tsc_hz = hz;
+
+    vga_printf("[CLOCK] TSC %llu kHz (calibrated against %s)%s\n",
+              hz / 1000ULL, g_source, g_invariant ? "" : ", not invariant");
+    return 0;
+}
+
+u64 clock_cycles_to_ns(u64 cycles) {
+    return (u64)(((u128)cycles * g_ns_mult) >> 32);
+}
+
+u64 clock_ns(void) {
+    if (!g_tsc_hz) return clock_pit_ns();
+    return g_ns_base + clock_cycles_to_ns(clock_cycles() - g_tsc_base);
+}
+
+u64 clock_tsc_hz(void) {
+    return g_tsc_hz;
+}
+
+void clock_params(u64* tsc_base, u64* ns_base, u64* ns_mult) {
+    *tsc_base = g_tsc_hz ? g_tsc_base : 0;
+    *ns_base = g_tsc_hz ? g_ns_base : 0;
+    *ns_mult = g_ns_mult;
+}
+
+int clock_tsc_invariant(void) {
+    return g_invariant;
+}
+
+void clock_debug_info(void) {
+    if (!g_tsc_hz) {
+        vga_printf("Clock: PIT ticks (TSC not calibrated)\n");
+        return;
+    }
+    u64 ns = clock_ns();
+    vga_printf("Clock: TSC %llu Hz via %s, %s, uptime %llu us\n",
+              g_tsc_hz, g_source, g_invariant ? "invariant" : "not invariant", ns / 1000ULL);
+}
@@ -1,44 +1,120 @@
 #include <deferred.h>
-#include <kmalloc.h>
+#include <vgaio.h>
 
 typedef struct {
-    deferred_fn_t fn;
-    void *arg;
-} deferred_item_t;
-
-#define DEFERRED_Q_SIZE 16
-static deferred_item_t queue[DEFERRED_Q_SIZE];
-static volatile u32 q_head = 0; // next pop
-static volatile u32 q_tail = 0; // next push
-
-static u32 q_next(u32 idx) { return (u32)((idx + 1) % DEFERRED_Q_SIZE); }
-
-int deferred_schedule(deferred_fn_t fn, void *arg) {
-    if (!fn) return -1;
-    u32 next_tail = q_next(q_tail);
-    if (next_tail == q_head) {
-        return -2; // full
+    deferred_work_t *volatile tail;     // Last pushed node, swapped by producers
+    deferred_work_t *head;              // Oldest node, owned by the consumer
+    deferred_work_t stub;               // Keeps the list non-empty
+    u64 queued;
+    u64 run;
+} deferred_queue_t;
+
+#define DEFERRED_QUEUE_INIT(q) { &(q).stub, &(q).stub, DEFERRED_WORK_INIT(NULL, NULL, 0), 0, 0 }
+
+static deferred_queue_t g_queues[DEFERRED_PRIO_COUNT] = {
+    DEFERRED_QUEUE_INIT(g_queues[DEFERRED_PRIO_HIGH]),
+    DEFERRED_QUEUE_INIT(g_queues[DEFERRED_PRIO_LOW]),
+};
+
+// Single-consumer guard. Producers never lock, and this is deliberately a
+// try-flag rather than a spinlock: work items may block or switch (a shell
+// command waiting for its process), which no lock holder may do.
+static volatile u8 g_consuming = 0;
+
+void deferred_init_work(deferred_work_t *work, deferred_fn_t fn, void *arg, deferred_prio_t prio) {
+    work->next = NULL;
+    work->fn = fn;
+    work->arg = arg;
+    work->prio = (u8)prio;
+    work->queued = 0;
+}
+
+static void queue_push(deferred_queue_t *q, deferred_work_t *work) {
+    __atomic_store_n(&work->next, NULL, __ATOMIC_RELAXED);
+    deferred_work_t *prev = __atomic_exchange_n(&q->tail, work, __ATOMIC_ACQ_REL);
+    // Between the exchange and this store the consumer sees the list cut
+    // short at prev and simply finds the item on its next pass
+    __atomic_store_n(&prev->next, work, __ATOMIC_RELEASE);
+}
+
+static deferred_work_t *queue_pop(deferred_queue_t *q) {
+    deferred_work_t *head = q->head;
+    deferred_work_t *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+    if (head == &q->stub) {
+        if (!next) return NULL;
+        q->head = next;
+        head = next;
+        next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    }
+    if (next) {
+        q->head = next;
+        return head;
+    }
+    // head looks like the last node; a producer may be mid-push behind it
+    if (head != __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)) return NULL;
+    queue_push(q, &q->stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if (next) {
+        q->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+static int queue_empty(deferred_queue_t *q) {
+    return q->head == &q->stub && __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == &q->stub;
+}
+
+int deferred_queue(deferred_work_t *work) {
+    if (!work || !work->fn || work->prio >= DEFERRED_PRIO_COUNT) return 0;
+    if (__atomic_exchange_n(&work->queued, 1, __ATOMIC_ACQ_REL)) return 0;
+    deferred_queue_t *q = &g_queues[work->prio];
+    __atomic_fetch_add(&q->queued, 1, __ATOMIC_RELAXED);
+    queue_push(q, work);
+    return 1;
+}
+
+static int deferred_run_next(void) {
+    for (u32 prio = 0; prio < DEFERRED_PRIO_COUNT; prio++) {
+        deferred_queue_t *q = &g_queues[prio];
+        deferred_work_t *work = queue_pop(q);
+        if (!work) continue;
+        q->run++;
+        __atomic_store_n(&work->queued, 0, __ATOMIC_RELEASE);
+        work->fn(work->arg);
+        return 1;
     }
-    queue[q_tail].fn = fn;
-    queue[q_tail].arg = arg;
-    q_tail = next_tail;
     return 0;
 }
 
-void deferred_process_one(void) {
-    if (q_head == q_tail) return; // empty
-    deferred_item_t it = queue[q_head];
-    q_head = q_next(q_head);
-    if (it.fn) it.fn(it.arg);
+int deferred_process_one(void) {
+    if (__atomic_exchange_n(&g_consuming, 1, __ATOMIC_ACQUIRE)) return 0;
+    int ran = deferred_run_next();
+    __atomic_store_n(&g_consuming, 0, __ATOMIC_RELEASE);
+    return ran;
 }
 
 void deferred_process_all(void) {
-    while (q_head != q_tail) {
-        deferred_process_one();
-    }
+    if (__atomic_exchange_n(&g_consuming, 1, __ATOMIC_ACQUIRE)) return;
+    // Each round starts over at the highest priority
+    while (deferred_run_next()) {}
+    __atomic_store_n(&g_consuming, 0, __ATOMIC_RELEASE);
 }
 
 int deferred_has_pending(void) {
-    return q_head != q_tail;
+    for (u32 prio = 0; prio < DEFERRED_PRIO_COUNT; prio++) {
+        if (!queue_empty(&g_queues[prio])) return 1;
+    }
+    return 0;
 }
 
+void deferred_debug_info(void) {
+    static const char *const names[DEFERRED_PRIO_COUNT] = { "high", "low" };
+    vga_printf("Deferred work:\n");
+    for (u32 prio = 0; prio < DEFERRED_PRIO_COUNT; prio++) {
+        deferred_queue_t *q = &g_queues[prio];
+        vga_printf("  %s: queued=%llu run=%llu%s\n", names[prio], q->queued, q->run,
+                  queue_empty(q) ? "" : " (pending)");
+    }
+}
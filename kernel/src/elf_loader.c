@@ -2,21 +2,24 @@
 #include <kmalloc.h>
 #include <string.h>
 #include <vgaio.h>
-#include <interrupts/interrupts.h>
-#include <syscalls.h>
 #include <process.h>
+#include <kstack.h>
+#include <sched.h>
+#include <pmm.h>
+#include <vdso.h>
+
+// Drops to ring 3; see syscall_handler.asm
+extern void user_enter(u64 rip, u64 rsp) __attribute__((noreturn));
+
+// mov edi, eax; mov eax, 1 (exit); int 0x80; ud2
+static const u8 elf_exit_stub[] = { 0x89, 0xC7, 0xB8, 0x01, 0x00, 0x00, 0x00, 0xCD, 0x80, 0x0F, 0x0B };
+// One read-only frame shared by every program
+static u64 elf_exit_stub_phys = 0;
 
 // Debug output control
 // #define ELF_DEBUG   // Uncomment for detailed ELF loading debug
 // #define ELF_EXEC_DEBUG   // Uncomment for detailed execution debug
 
-// Add small delay to prevent timing-related crashes
-static inline void small_delay(void) {
-    for (volatile int i = 0; i < 1000; i++) {
-        __asm__ volatile("nop");
-    }
-}
-
 static int elf_validate_header(const elf64_ehdr_t* header) {
     // Check ELF magic number
     if (header->e_ident[0] != 0x7F ||
@@ -76,7 +79,10 @@ static int elf_apply_relocations(loaded_elf_t* loaded, elf64_shdr_t* rela_sectio
     elf64_shdr_t* symtab_section = &loaded->sections[rela_section->sh_link];
     elf64_sym_t* symbols = (elf64_sym_t*)((u8*)loaded->base_addr + symtab_section->sh_offset);
     
+    // Patched in the staging copy, but addresses are those the program
+    // sees at USER_IMAGE_BASE
     u8* target_data = (u8*)loaded->exec_base + target_section->sh_addr;
+    u64 target_addr = USER_IMAGE_BASE + target_section->sh_addr;
     
     vga_printf("[ELF] Applying %u relocations to section %s\n", 
                num_relocations, elf_get_section_name(loaded, target_section->sh_name));
@@ -92,7 +98,7 @@ static int elf_apply_relocations(loaded_elf_t* loaded, elf64_shdr_t* rela_sectio
         // For relocatable files, symbol values are section-relative
         if (symbol->st_shndx != 0 && symbol->st_shndx < loaded->header->e_shnum) {
             elf64_shdr_t* sym_section = &loaded->sections[symbol->st_shndx];
-            symbol_value += (u64)loaded->exec_base + sym_section->sh_addr;
+            symbol_value += USER_IMAGE_BASE + sym_section->sh_addr;
         }
         
         u8* patch_location = target_data + rel->r_offset;
@@ -106,7 +112,7 @@ static int elf_apply_relocations(loaded_elf_t* loaded, elf64_shdr_t* rela_sectio
             }
             case R_X86_64_PC32: {
                 // PC-relative 32-bit
-                u64 patch_addr = (u64)patch_location;
+                u64 patch_addr = target_addr + rel->r_offset;
                 i64 value = (i64)(symbol_value + rel->r_addend - patch_addr);
                 if (value < -0x80000000LL || value > 0x7FFFFFFFLL) {
                     vga_printf("[ELF] PC32 relocation out of range\n");
@@ -159,30 +165,31 @@ int elf_load(const void* elf_data, u64 size, loaded_elf_t* loaded) {
     vga_printf("[ELF] Loading relocatable ELF file (%u sections)\n", header->e_shnum);
 #endif
     
-    // Calculate total size needed for all allocated sections
+    // Every allocated section starts on a page of its own so it can be
+    // mapped with its own protection
     const elf64_shdr_t* sections = (const elf64_shdr_t*)((const u8*)elf_data + header->e_shoff);
-    u64 total_size = 0;
-    u64 max_align = 1;
+    u64 image_size = 0;
     
     for (u16 i = 0; i < header->e_shnum; i++) {
         if (sections[i].sh_flags & SHF_ALLOC) {
-            if (sections[i].sh_addralign > max_align) {
-                max_align = sections[i].sh_addralign;
-            }
-            u64 section_end = sections[i].sh_size;
-            if (section_end > total_size) {
-                total_size = section_end;
+            if (sections[i].sh_addralign > PAGE_4K) {
+                vga_printf("[ELF] Section alignment %llu not supported\n", sections[i].sh_addralign);
+                return -1;
             }
+            image_size += (sections[i].sh_size + PAGE_4K - 1) & ~(PAGE_4K - 1);
         }
     }
+    if (image_size > USER_STACK_TOP - USER_STACK_SIZE - USER_IMAGE_BASE) {
+        vga_printf("[ELF] Image too large (%llu bytes)\n", image_size);
+        return -1;
+    }
     
-    // Add space for the ELF data itself
-    total_size += size + max_align;
+    // The ELF data itself, then the sections
+    u64 total_size = size + 16 + image_size;
     
-    // Allocate executable memory
-    void* base = kmalloc_executable(total_size);
+    void* base = kmalloc(total_size);
     if (!base) {
-        vga_printf("[ELF] Failed to allocate %llu bytes executable memory\n", total_size);
+        vga_printf("[ELF] Failed to allocate %llu bytes\n", total_size);
         return -1;
     }
     
@@ -196,6 +203,7 @@ int elf_load(const void* elf_data, u64 size, loaded_elf_t* loaded) {
     // Initialize loaded structure
     loaded->base_addr = base;
     loaded->size = total_size;
+    loaded->image_size = 0;
     loaded->header = (elf64_ehdr_t*)base;
     loaded->sections = (elf64_shdr_t*)((u8*)base + header->e_shoff);
     loaded->entry_point = 0;
@@ -209,8 +217,7 @@ int elf_load(const void* elf_data, u64 size, loaded_elf_t* loaded) {
     }
     
     // Allocate space for sections and update their addresses
-    u8* section_base = (u8*)base + size;
-    section_base = (u8*)(((u64)section_base + max_align - 1) & ~(max_align - 1));
+    u8* section_base = (u8*)(((u64)base + size + 15) & ~15ULL);
     
     // Store the executable base address
     loaded->exec_base = section_base;
@@ -220,10 +227,7 @@ int elf_load(const void* elf_data, u64 size, loaded_elf_t* loaded) {
         elf64_shdr_t* section = &loaded->sections[i];
         
         if (section->sh_flags & SHF_ALLOC) {
-            // Align section
-            if (section->sh_addralign > 1) {
-                current_offset = (current_offset + section->sh_addralign - 1) & ~(section->sh_addralign - 1);
-            }
+            current_offset = (current_offset + PAGE_4K - 1) & ~(PAGE_4K - 1);
             
             // Set section address
             section->sh_addr = current_offset;
@@ -247,6 +251,7 @@ int elf_load(const void* elf_data, u64 size, loaded_elf_t* loaded) {
             current_offset += section->sh_size;
         }
     }
+    loaded->image_size = current_offset;
     
     // Apply relocations
     for (u16 i = 0; i < header->e_shnum; i++) {
@@ -284,10 +289,11 @@ int elf_load(const void* elf_data, u64 size, loaded_elf_t* loaded) {
 
 void elf_unload(loaded_elf_t* loaded) {
     if (loaded && loaded->base_addr) {
-        kfree_executable(loaded->base_addr);
+        kfree(loaded->base_addr);
         loaded->base_addr = NULL;
         loaded->exec_base = NULL;
         loaded->size = 0;
+        loaded->image_size = 0;
         loaded->entry_point = 0;
         loaded->header = NULL;
         loaded->sections = NULL;
@@ -295,115 +301,128 @@ void elf_unload(loaded_elf_t* loaded) {
     }
 }
 
-int elf_execute(loaded_elf_t* loaded, const char* program_name) {
-    if (!loaded || !loaded->base_addr) {
-        vga_printf("[ELF] Invalid loaded ELF or no base address\n");
+// Copy into the space's frames, which are only contiguous within a page.
+static void elf_copy_to_user(mm_space_t* space, u64 va, const u8* src, u64 size) {
+    while (size > 0) {
+        u64 chunk = PAGE_4K - (va & (PAGE_4K - 1));
+        if (chunk > size) chunk = size;
+        memcpy(pmm_phys_to_virt(mm_space_translate(space, va)), src, chunk);
+        va += chunk;
+        src += chunk;
+        size -= chunk;
+    }
+}
+
+static u64 elf_get_exit_stub(void) {
+    u64 phys = __atomic_load_n(&elf_exit_stub_phys, __ATOMIC_ACQUIRE);
+    if (phys) return phys;
+    phys = pmm_alloc_pages(0);
+    if (!phys) return 0;
+    u8* page = (u8*)pmm_phys_to_virt(phys);
+    memset(page, 0, PAGE_4K);
+    memcpy(page, elf_exit_stub, sizeof(elf_exit_stub));
+    u64 expected = 0;
+    if (!__atomic_compare_exchange_n(&elf_exit_stub_phys, &expected, phys, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        pmm_free_pages(phys, 0);
+        phys = expected;
+    }
+    return phys;
+}
+
+// Sections, stack, exit stub and vDSO. Whatever was mapped before a
+// failure is freed with the space.
+static int elf_build_space(loaded_elf_t* loaded, process_t* proc) {
+    mm_space_t* space = &proc->space;
+    for (u16 i = 0; i < loaded->header->e_shnum; i++) {
+        elf64_shdr_t* section = &loaded->sections[i];
+        if (!(section->sh_flags & SHF_ALLOC) || section->sh_size == 0) continue;
+        
+        // No NX without EFER.NXE, so only writes are restricted
+        u64 va = USER_IMAGE_BASE + section->sh_addr;
+        u64 pages = (section->sh_size + PAGE_4K - 1) & ~(PAGE_4K - 1);
+        u64 flags = (section->sh_flags & SHF_WRITE) ? PTE_RW : 0;
+        if (!mm_space_alloc(space, va, pages, flags)) return -1;
+        // NOBITS sections are already zero
+        if (section->sh_type == SHT_PROGBITS) {
+            elf_copy_to_user(space, va, (u8*)loaded->exec_base + section->sh_addr, section->sh_size);
+        }
+    }
+    
+    if (!mm_space_alloc(space, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_SIZE, PTE_RW)) {
         return -1;
     }
     
-#ifdef ELF_EXEC_DEBUG
-    vga_printf("[ELF] Executing at offset 0x%llx\n", loaded->entry_point);
-#endif
+    u64 stub = elf_get_exit_stub();
+    if (!stub || !mm_space_map(space, USER_EXIT_STUB, stub, PAGE_4K, 0)) return -1;
+    if (vdso_map(space, proc->pid, proc->parent_pid) != 0) return -1;
     
-    // Calculate absolute address using exec_base
-    void* entry_addr = (u8*)loaded->exec_base + loaded->entry_point;
+    // _start is entered as if called from the exit stub, so returning from
+    // it exits with its return value
+    u64 ret_addr = USER_EXIT_STUB;
+    elf_copy_to_user(space, USER_STACK_TOP - 8, (const u8*)&ret_addr, sizeof(ret_addr));
+    return 0;
+}
+
+static long elf_enter_user(void* entry) {
+    user_enter((u64)(uintptr_t)entry, USER_STACK_TOP - 8);
+}
+
+u32 elf_spawn(loaded_elf_t* loaded, const char* program_name) {
+    if (!loaded || !loaded->base_addr) {
+        vga_printf("[ELF] Invalid loaded ELF or no base address\n");
+        return 0;
+    }
     
-#ifdef ELF_EXEC_DEBUG
-    vga_printf("[ELF] base_addr=0x%llx exec_base=0x%llx entry_point=0x%llx\n", 
-               (u64)loaded->base_addr, (u64)loaded->exec_base, loaded->entry_point);
-    vga_printf("[ELF] Calling entry point at 0x%llx\n", (u64)entry_addr);
-#endif
+    void* entry_addr = (void*)(uintptr_t)(USER_IMAGE_BASE + loaded->entry_point);
     
-    // Save the current execution context (this is the shell/parent context)
-    // In a real implementation, we'd save all CPU registers here
-    // For now, we'll just save basic info
 #ifdef ELF_EXEC_DEBUG
-    vga_printf("[ELF] Saving parent context (PID %u)\n", current_pid);
+    vga_printf("[ELF] base_addr=0x%llx image_size=%llu entry=0x%llx\n",
+               (u64)loaded->base_addr, loaded->image_size, (u64)entry_addr);
 #endif
     
     // Create a process for this program
-    u32 pid = process_create(program_name, entry_addr, NULL, loaded->base_addr, loaded->size);
+    u32 pid = process_create(program_name, entry_addr, NULL);
     if (pid == 0) {
         vga_printf("[ELF] Failed to create process\n");
-        return -1;
+        return 0;
     }
+    process_t* proc = process_get(pid);
     
-    // Switch to the new process
-    process_set_current(pid);
-    
-    // Enable interrupts for syscalls
-    interrupts_enable();
-    
-    // Clear exit flags
-    program_should_exit = 0;
-    program_exit_status = 0;
-    
-#ifdef ELF_EXEC_DEBUG
-    vga_printf("[ELF] About to execute program with PID %u...\n", pid);
-#endif
-    
-    // Execute the program
-    typedef int (*elf_func_t)(void);
-    elf_func_t elf_function = (elf_func_t)entry_addr;
-    
-    int result = 0;
-    
-#ifdef ELF_EXEC_DEBUG
-    vga_printf("[ELF] Starting program execution...\n");
-#endif
-    
-    // Call the program function normally
-    result = elf_function();
-    
-#ifdef ELF_EXEC_DEBUG
-    vga_printf("[ELF] Program %u completed with result: %d\n", pid, result);
-#endif
-    
-    // Check if program called sys_exit during execution
-    if (program_should_exit) {
-        result = (int)program_exit_status;
-        vga_printf("[ELF] Program %u exited via sys_exit with status: %d\n", pid, result);
-        small_delay();  // Prevent timing-related crash
-        // Process was already cleaned up by sys_exit
-        // Memory was already freed, so mark it as NULL to prevent double-free
-        loaded->base_addr = NULL;
-        small_delay();  // Prevent timing-related crash
-        loaded->exec_base = NULL;
-        small_delay();  // Prevent timing-related crash
-    } else {
-        vga_printf("[ELF] Program %u returned normally with status: %d\n", pid, result);
-        process_exit_and_restore_parent(pid, result);
-        // Memory was freed by process_exit, mark as NULL
-        loaded->base_addr = NULL;
-        loaded->exec_base = NULL;
+    if (!mm_space_create(&proc->space) || elf_build_space(loaded, proc) != 0) {
+        vga_printf("[ELF] Failed to build address space\n");
+        mm_space_destroy(&proc->space);
+        process_exit(pid, (u64)-1);
+        return 0;
     }
     
-#ifdef ELF_EXEC_DEBUG
-    vga_printf("[ELF] Cleaning up program %u\n", pid);
-#endif
-    
-    // Clear exit flags for next program
-    program_should_exit = 0;
-    program_exit_status = 0;
+    // Each program enters ring 3 from its own guard-paged kernel stack,
+    // which also takes its syscalls and interrupts
+    if (sched_start(pid, elf_enter_user, entry_addr, KSTACK_DEFAULT_SIZE) != 0) {
+        vga_printf("[ELF] Failed to allocate kernel stack\n");
+        mm_space_destroy(&proc->space);
+        process_exit(pid, (u64)-1);
+        return 0;
+    }
     
-    // Return control to kernel/shell
-    current_pid = 0;
+    // The program has its own copy now
+    elf_unload(loaded);
     
 #ifdef ELF_EXEC_DEBUG
-    vga_printf("[ELF] *** ABOUT TO RETURN TO SHELL - result=%d ***\n", result);
-    vga_printf("[ELF] *** CURRENT PID IS NOW: %u ***\n", current_pid);
+    vga_printf("[ELF] Started program with PID %u\n", pid);
 #endif
     
-    return result;
+    return pid;
 }
 
-// Executable memory allocator
-// For now, just use regular kmalloc since heap pages should be executable
-// TODO: Implement proper executable heap if needed
-void* kmalloc_executable(size_t size) {
-    return kmalloc(size);
-}
-
-void kfree_executable(void* ptr) {
-    kfree(ptr);
+int elf_execute(loaded_elf_t* loaded, const char* program_name) {
+    u32 pid = elf_spawn(loaded, program_name);
+    if (pid == 0) {
+        return -1;
+    }
+    
+    // Other processes keep running while we wait
+    int result = (int)sched_wait(pid);
+    vga_printf("[ELF] Program %u exited with status: %d\n", pid, result);
+    return result;
 }
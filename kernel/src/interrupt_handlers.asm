@@ -3,12 +3,32 @@ global irq0_handler
 global irq1_handler
 global irq12_handler
 global default_handler
+global apic_timer_handler
+global apic_spurious_handler
+global apic_wake_handler
+global apic_tlb_handler
+global exception_stubs
 extern handle_pit
 extern handle_ps2
 extern handle_ps2_mouse
 extern default_interrupt_handler
+extern handle_apic_timer
+extern handle_apic_tlb
+extern apic_eoi
+extern exception_dispatch
+
+; An interrupt from user mode arrives with the user GS base loaded; swap the
+; kernel's in so this_cpu() works, and back out again before iretq.
+; %1 is the offset of the saved CS from rsp.
+%macro SWAPGS_IF_USER 1
+    test byte [rsp + %1], 3
+    jz %%kernel
+    swapgs
+%%kernel:
+%endmacro
 
 irq0_handler:
+    SWAPGS_IF_USER 8
     ; Save all registers
     push rax
     push rbx
@@ -46,9 +66,11 @@ irq0_handler:
     pop rbx
     pop rax
     
+    SWAPGS_IF_USER 8
     iretq
 
 irq1_handler:
+    SWAPGS_IF_USER 8
     ; Save all registers
     push rax
     push rbx
@@ -87,9 +109,11 @@ irq1_handler:
     pop rax
     
     ; Return from interrupt
+    SWAPGS_IF_USER 8
     iretq
 
 irq12_handler:
+    SWAPGS_IF_USER 8
     ; Save all registers
     push rax
     push rbx
@@ -128,9 +152,11 @@ irq12_handler:
     pop rax
     
     ; Return from interrupt
+    SWAPGS_IF_USER 8
     iretq
 
 default_handler:
+    SWAPGS_IF_USER 8
     ; Save registers
     push rax
     push rbx
@@ -168,4 +194,199 @@ default_handler:
     pop rbx
     pop rax
     
+    SWAPGS_IF_USER 8
+    iretq
+
+apic_timer_handler:
+    SWAPGS_IF_USER 8
+    ; Save all registers
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+    
+    ; Call LAPIC timer C handler
+    call handle_apic_timer
+    
+    ; Restore all registers
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    
+    SWAPGS_IF_USER 8
+    iretq
+
+apic_spurious_handler:
+    ; Spurious LAPIC interrupts set no in-service bit, so no EOI
+    iretq
+
+apic_wake_handler:
+    SWAPGS_IF_USER 8
+    ; Wakeup IPI: the interrupted hlt is all it was for, just acknowledge
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+
+    call apic_eoi
+
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+
+    SWAPGS_IF_USER 8
+    iretq
+
+apic_tlb_handler:
+    SWAPGS_IF_USER 8
+    ; Shootdown IPI: flush this CPU's TLB and acknowledge
+    push rax
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push r8
+    push r9
+    push r10
+    push r11
+
+    call handle_apic_tlb
+
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rax
+
+    SWAPGS_IF_USER 8
+    iretq
+
+; CPU exceptions 0-20. Each stub pushes a zero where the CPU pushes no error
+; code, then the vector, so exception_dispatch sees one frame layout
+; (exception_frame_t). Faults in user mode kill the program; faults in the
+; kernel panic as before.
+%macro EXCEPTION_NOERR 1
+exception_stub_%1:
+    push 0
+    push %1
+    jmp exception_common
+%endmacro
+
+%macro EXCEPTION_ERR 1
+exception_stub_%1:
+    push %1
+    jmp exception_common
+%endmacro
+
+EXCEPTION_NOERR 0
+EXCEPTION_NOERR 1
+EXCEPTION_NOERR 2
+EXCEPTION_NOERR 3
+EXCEPTION_NOERR 4
+EXCEPTION_NOERR 5
+EXCEPTION_NOERR 6
+EXCEPTION_NOERR 7
+EXCEPTION_ERR   8
+EXCEPTION_NOERR 9
+EXCEPTION_ERR   10
+EXCEPTION_ERR   11
+EXCEPTION_ERR   12
+EXCEPTION_ERR   13
+EXCEPTION_ERR   14
+EXCEPTION_NOERR 15
+EXCEPTION_NOERR 16
+EXCEPTION_ERR   17
+EXCEPTION_NOERR 18
+EXCEPTION_NOERR 19
+EXCEPTION_NOERR 20
+
+exception_common:
+    ; [rsp] vector, [rsp + 8] error code, [rsp + 24] saved CS
+    SWAPGS_IF_USER 24
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+
+    ; 22 quadwords on a 16-byte aligned frame keep the call aligned
+    cld
+    mov rdi, rsp
+    call exception_dispatch
+
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    SWAPGS_IF_USER 24
+    add rsp, 16         ; Vector and error code
     iretq
+
+section .rodata
+align 8
+exception_stubs:
+    dq exception_stub_0, exception_stub_1, exception_stub_2, exception_stub_3
+    dq exception_stub_4, exception_stub_5, exception_stub_6, exception_stub_7
+    dq exception_stub_8, exception_stub_9, exception_stub_10, exception_stub_11
+    dq exception_stub_12, exception_stub_13, exception_stub_14, exception_stub_15
+    dq exception_stub_16, exception_stub_17, exception_stub_18, exception_stub_19
+    dq exception_stub_20
@@ -1,9 +1,16 @@
 #include <interrupts/interrupts.h>
 #include <idt.h>
 #include <pic.h>
+#include <apic/apic.h>
 #include <vgaio.h>
+#include <kstack.h>
+#include <process.h>
+#include <sched.h>
+
+#define IRQ_CASCADE 2
 
 static interrupt_handler_t interrupt_handlers[256];
+static u8 irq_apic = 0;
 
 void interrupts_init(void) {
     // Initialize PIC
@@ -24,6 +31,58 @@ void register_interrupt_handler(u8 interrupt_num, interrupt_handler_t handler) {
     set_idt_entry(interrupt_num, handler, 0x08, 0x8e);
 }
 
+void irq_init(void) {
+    pic_init();
+    if (apic_init() != 0) {
+        vga_printf("[IRQ] No MADT, using the 8259 PIC\n");
+        return;
+    }
+#ifdef IRQ_LEGACY_PIC
+    vga_printf("[IRQ] Using the 8259 PIC (IRQ_CONTROLLER=pic)\n");
+#else
+    if (apic_ioapic_count() == 0) {
+        vga_printf("[IRQ] No IOAPIC, using the 8259 PIC\n");
+        return;
+    }
+    // Everything goes to the boot CPU for now; lines stay masked until
+    // their driver calls irq_unmask
+    u32 dest = apic_id();
+    for (u8 irq = 0; irq < 16; irq++) {
+        if (irq != IRQ_CASCADE) ioapic_route_irq(irq, APIC_IRQ_BASE_VECTOR + irq, dest);
+    }
+    irq_apic = 1;
+    vga_printf("[IRQ] Using the IOAPIC, 8259 PIC masked\n");
+#endif
+}
+
+void irq_unmask(u8 irq) {
+    if (!irq_apic) {
+        pic_enable_irq(irq);
+    } else if (irq != IRQ_CASCADE) {
+        ioapic_unmask_irq(irq);
+    }
+}
+
+void irq_mask(u8 irq) {
+    if (!irq_apic) {
+        pic_disable_irq(irq);
+    } else if (irq != IRQ_CASCADE) {
+        ioapic_mask_irq(irq);
+    }
+}
+
+void irq_eoi(u8 irq) {
+    if (irq_apic) {
+        apic_eoi();
+    } else {
+        pic_send_eoi(irq);
+    }
+}
+
+int irq_using_apic(void) {
+    return irq_apic;
+}
+
 void interrupts_enable(void) {
     __asm__ volatile("sti");
 }
@@ -33,8 +92,45 @@ void interrupts_disable(void) {
 }
 
 void default_interrupt_handler(void) {
-    // Send EOI to PIC for any unhandled interrupt
-    pic_send_eoi(0);  // Will handle both master and slave
+    // Acknowledge unhandled interrupts at whichever controller is delivering
+    irq_eoi(0);
+}
+
+static const char* const exception_names[EXCEPTION_VECTORS] = {
+    "Division by zero", "Debug", "NMI", "Breakpoint", "Overflow",
+    "Bound range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS",
+    "Segment not present", "Stack segment fault", "General protection fault",
+    "Page fault", "Reserved", "x87 floating point", "Alignment check",
+    "Machine check", "SIMD floating point", "Virtualization",
+};
+
+static void (*const exception_panics[EXCEPTION_VECTORS])(void) = {
+    division_error_handler, debug_exception_handler, nmi_handler,
+    breakpoint_handler, overflow_handler, bound_range_exceeded_handler,
+    invalid_opcode_handler, device_not_available_handler, double_fault_handler,
+    default_interrupt_handler, invalid_tss_handler, segment_not_present_handler,
+    stack_segment_fault_handler, general_protection_fault_handler,
+    page_fault_handler, default_interrupt_handler, x87_floating_point_handler,
+    alignment_check_handler, machine_check_handler, simd_floating_point_handler,
+    virtualization_exception_handler,
+};
+
+void exception_dispatch(exception_frame_t* frame) {
+    u64 vector = frame->vector < EXCEPTION_VECTORS ? frame->vector : 0;
+    // NMI and machine checks are not the program's doing
+    if ((frame->cs & 3) && vector != 2 && vector != 18) {
+        u64 cr2;
+        __asm__ volatile("mov %%cr2, %0" : "=r" (cr2));
+        process_t* proc = process_get_current();
+        vga_printf("[PROCESS] %u (%s) killed: %s at 0x%llx",
+                   current_pid, proc ? proc->name : "?", exception_names[vector], frame->rip);
+        if (vector == 14) vga_printf(", address 0x%llx", cr2);
+        vga_printf(" (error 0x%llx)\n", frame->error_code);
+        // Its address space and stacks are reclaimed by sched_reap
+        sched_exit((long)(128 + vector));
+    }
+    exception_panics[vector]();
 }
 
 // CPU Exception handlers
@@ -109,6 +205,10 @@ void page_fault_handler(void) {
     __asm__ volatile("mov %%cr2, %0" : "=r" (cr2));
     vga_printf("\n*** KERNEL PANIC: Page Fault Exception (14) ***\n");
     vga_printf("Fault address: 0x%llx\n", cr2);
+    kstack_t* stack = kstack_guard_owner(cr2);
+    if (stack) {
+        vga_printf("Kernel stack overflow: %s (%llu KB)\n", stack->owner, (u64)stack->size / 1024);
+    }
     __asm__ volatile("cli; hlt");
 }
 
@@ -0,0 +1,82 @@
+#include <karena.h>
+#include <kmalloc.h>
+#include <string.h>
+
+static size_t karena_align(size_t size) {
+    return (size + KARENA_ALIGN - 1) & ~(size_t)(KARENA_ALIGN - 1);
+}
+
+karena_mark_t karena_begin(karena_t* arena) {
+    karena_mark_t mark = { arena->used, arena->last, arena->last_size };
+    arena->depth++;
+    return mark;
+}
+
+static void* karena_spill(karena_t* arena, size_t size) {
+    size_t header = karena_align(sizeof(karena_chunk_t));
+    karena_chunk_t* chunk = (karena_chunk_t*)kmalloc(header + size);
+    if (!chunk) return NULL;
+    chunk->next = arena->spill;
+    chunk->size = size;
+    arena->spill = chunk;
+    arena->spill_count++;
+    return (u8*)chunk + header;
+}
+
+void* karena_alloc(karena_t* arena, size_t size) {
+    size_t aligned = karena_align(size ? size : 1);
+    void* ptr;
+    if (aligned <= arena->size - arena->used) {
+        ptr = arena->buf + arena->used;
+        arena->used += aligned;
+        if (arena->used > arena->high_water) arena->high_water = arena->used;
+    } else {
+        ptr = karena_spill(arena, aligned);
+        if (!ptr) return NULL;
+    }
+    arena->last = ptr;
+    arena->last_size = aligned;
+    return ptr;
+}
+
+void* karena_grow(karena_t* arena, void* ptr, size_t old_size, size_t new_size) {
+    if (!ptr) return karena_alloc(arena, new_size);
+    size_t aligned = karena_align(new_size);
+    if (ptr == arena->last && aligned <= arena->last_size) return ptr;
+
+    u8* p = (u8*)ptr;
+    if (ptr == arena->last && p >= arena->buf && p < arena->buf + arena->size &&
+        p + arena->last_size == arena->buf + arena->used &&
+        aligned - arena->last_size <= arena->size - arena->used) {
+        arena->used += aligned - arena->last_size;
+        arena->last_size = aligned;
+        if (arena->used > arena->high_water) arena->high_water = arena->used;
+        return ptr;
+    }
+
+    void* fresh = karena_alloc(arena, new_size);
+    if (!fresh) return NULL;
+    memcpy(fresh, ptr, old_size < new_size ? old_size : new_size);
+    return fresh;
+}
+
+char* karena_strdup(karena_t* arena, const char* str) {
+    size_t len = strlen(str);
+    char* copy = (char*)karena_alloc(arena, len + 1);
+    if (copy) memcpy(copy, str, len + 1);
+    return copy;
+}
+
+void karena_reset(karena_t* arena, karena_mark_t mark) {
+    arena->used = mark.used;
+    arena->last = mark.last;
+    arena->last_size = mark.last_size;
+    if (arena->depth) arena->depth--;
+    if (arena->depth == 0) {
+        while (arena->spill) {
+            karena_chunk_t* chunk = arena->spill;
+            arena->spill = chunk->next;
+            kfree(chunk);
+        }
+    }
+}
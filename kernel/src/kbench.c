@@ -0,0 +1,359 @@
+#include <kbench.h>
+#include <kmalloc.h>
+#include <memory_mapper.h>
+#include <pmm.h>
+#include <sched.h>
+#include <smp.h>
+#include <task.h>
+#include <vgaio.h>
+#include <string.h>
+
+// Small mixed-size workload used by the allocator benchmarks.
+#define KBENCH_ALLOC_BATCH 256
+#define KBENCH_ALLOC_ROUNDS 64
+#define KBENCH_FRAGMENT_BLOCKS 2048
+
+static const size_t kbench_small_sizes[] = { 16, 24, 40, 64, 96, 128, 200, 256, 512, 1024 };
+#define KBENCH_SMALL_SIZE_COUNT (sizeof(kbench_small_sizes) / sizeof(kbench_small_sizes[0]))
+
+static void* kbench_ptrs[KBENCH_ALLOC_BATCH];
+static void* kbench_fragments[KBENCH_FRAGMENT_BLOCKS];
+
+void kbench_report(const char* label, u64 ops, u64 cycles) {
+    u64 per_op = ops ? cycles / ops : 0;
+    if (!clock_tsc_hz()) {
+        vga_printf("  %s: %llu ops, %llu cycles, %llu cycles/op\n", label, ops, cycles, per_op);
+        return;
+    }
+    u64 ns = clock_cycles_to_ns(cycles);
+    vga_printf("  %s: %llu ops, %llu cycles, %llu cycles/op, %llu us, %llu ns/op\n",
+              label, ops, cycles, per_op, ns / 1000ULL, ops ? ns / ops : 0);
+}
+
+// Fragment the segment free list: allocate many blocks and free every other
+// one, leaving a long chain of small holes in front of the large free block.
+static int kbench_fragment_heap(void) {
+    int saved = kmalloc_slab_enabled();
+    kmalloc_set_slab_enabled(0);
+    for (u32 i = 0; i < KBENCH_FRAGMENT_BLOCKS; i++) {
+        kbench_fragments[i] = kmalloc(48 + (i % 7) * 16);
+        if (!kbench_fragments[i]) {
+            kmalloc_set_slab_enabled(saved);
+            return -1;
+        }
+    }
+    for (u32 i = 0; i < KBENCH_FRAGMENT_BLOCKS; i += 2) {
+        kfree(kbench_fragments[i]);
+        kbench_fragments[i] = NULL;
+    }
+    kmalloc_set_slab_enabled(saved);
+    return 0;
+}
+
+static void kbench_release_fragments(void) {
+    for (u32 i = 0; i < KBENCH_FRAGMENT_BLOCKS; i++) {
+        if (kbench_fragments[i]) kfree(kbench_fragments[i]);
+        kbench_fragments[i] = NULL;
+    }
+}
+
+static u64 kbench_alloc_free_rounds(void) {
+    u64 start = clock_cycles();
+    for (u32 round = 0; round < KBENCH_ALLOC_ROUNDS; round++) {
+        for (u32 i = 0; i < KBENCH_ALLOC_BATCH; i++) {
+            kbench_ptrs[i] = kmalloc(kbench_small_sizes[(i + round) % KBENCH_SMALL_SIZE_COUNT]);
+        }
+        // Free in an interleaved order so the allocator cannot rely on LIFO reuse
+        for (u32 i = 0; i < KBENCH_ALLOC_BATCH; i += 2) kfree(kbench_ptrs[i]);
+        for (u32 i = 1; i < KBENCH_ALLOC_BATCH; i += 2) kfree(kbench_ptrs[i]);
+    }
+    return clock_cycles() - start;
+}
+
+static void kbench_kmalloc(void) {
+    const u64 ops = (u64)KBENCH_ALLOC_ROUNDS * KBENCH_ALLOC_BATCH;
+    int saved = kmalloc_slab_enabled();
+
+    if (kbench_fragment_heap() != 0) {
+        vga_printf("  kmalloc: out of memory while fragmenting heap\n");
+        kbench_release_fragments();
+        return;
+    }
+
+    kmalloc_set_slab_enabled(0);
+    u64 list_cycles = kbench_alloc_free_rounds();
+    kmalloc_set_slab_enabled(1);
+    u64 slab_cycles = kbench_alloc_free_rounds();
+    kmalloc_set_slab_enabled(saved);
+
+    kbench_release_fragments();
+
+    kbench_report("first-fit list (kmalloc+kfree)", ops, list_cycles);
+    kbench_report("slab classes   (kmalloc+kfree)", ops, slab_cycles);
+    if (slab_cycles) {
+        vga_printf("  speedup: %llux\n", list_cycles / slab_cycles);
+    }
+}
+
+// Buffer growth pattern seen in lodepng and the Lua VM: a buffer grows in
+// small fixed steps and is trimmed once the final size is known.
+#define KBENCH_GROW_STEP 512
+#define KBENCH_GROW_LIMIT (128 * 1024)
+#define KBENCH_GROW_ROUNDS 8
+
+// The pre-in-place behaviour: always allocate, copy and free.
+static void* kbench_realloc_copy(void* ptr, size_t old_size, size_t size) {
+    void* new_ptr = kmalloc(size);
+    if (!new_ptr) return NULL;
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    kfree(ptr);
+    return new_ptr;
+}
+
+static u64 kbench_grow_rounds(int copy, u64* moved) {
+    u64 start = clock_cycles();
+    for (u32 round = 0; round < KBENCH_GROW_ROUNDS; round++) {
+        size_t cur = KBENCH_GROW_STEP;
+        char* buf = (char*)kmalloc(cur);
+        if (!buf) return 0;
+        while (cur < KBENCH_GROW_LIMIT) {
+            size_t next = cur + KBENCH_GROW_STEP;
+            char* grown = copy ? (char*)kbench_realloc_copy(buf, cur, next)
+                               : (char*)krealloc(buf, next);
+            if (!grown) {
+                kfree(buf);
+                return 0;
+            }
+            if (grown != buf) (*moved)++;
+            buf = grown;
+            buf[next - 1] = (char)next;
+            cur = next;
+        }
+        // Shrink back to the final payload size, as lodepng does
+        char* shrunk = copy ? (char*)kbench_realloc_copy(buf, cur, cur / 2)
+                            : (char*)krealloc(buf, cur / 2);
+        if (shrunk) buf = shrunk;
+        kfree(buf);
+    }
+    return clock_cycles() - start;
+}
+
+static void kbench_krealloc(void) {
+    const u64 ops = (u64)KBENCH_GROW_ROUNDS * (KBENCH_GROW_LIMIT / KBENCH_GROW_STEP);
+    u64 copy_moved = 0;
+    u64 inplace_moved = 0;
+
+    u64 copy_cycles = kbench_grow_rounds(1, &copy_moved);
+    u64 inplace_cycles = kbench_grow_rounds(0, &inplace_moved);
+    if (!copy_cycles || !inplace_cycles) {
+        vga_printf("  krealloc: out of memory while growing buffer\n");
+        return;
+    }
+
+    kbench_report("alloc+copy+free", ops, copy_cycles);
+    kbench_report("krealloc       ", ops, inplace_cycles);
+    vga_printf("  moved: %llu vs %llu of %llu resizes\n", copy_moved, inplace_moved, ops);
+    if (inplace_cycles) {
+        vga_printf("  speedup: %llux\n", copy_cycles / inplace_cycles);
+    }
+}
+
+// Page mapping: map, touch and unmap a 16 MiB window in 4K pages, one call
+// per page versus one batched range call.
+#define KBENCH_MAP_VIRT 0xFFFFB00000000000ULL
+#define KBENCH_MAP_ORDER 12
+#define KBENCH_MAP_PAGES (1ULL << KBENCH_MAP_ORDER)
+#define KBENCH_MAP_ROUNDS 4
+
+static void kbench_touch_pages(void) {
+    for (u64 i = 0; i < KBENCH_MAP_PAGES; i++) {
+        (void)*(volatile u8*)(KBENCH_MAP_VIRT + i * PAGE_4K);
+    }
+}
+
+static void kbench_mmap(void) {
+    const u64 ops = KBENCH_MAP_ROUNDS * KBENCH_MAP_PAGES;
+    u64 phys = pmm_alloc_pages(KBENCH_MAP_ORDER);
+    if (!phys) {
+        vga_printf("  mmap: out of physical memory\n");
+        return;
+    }
+
+    u64 inv0, full0, inv1, full1, inv2, full2;
+    mm_tlb_stats(&inv0, &full0);
+    u64 start = clock_cycles();
+    for (u32 round = 0; round < KBENCH_MAP_ROUNDS; round++) {
+        for (u64 i = 0; i < KBENCH_MAP_PAGES; i++) {
+            mm_map(KBENCH_MAP_VIRT + i * PAGE_4K, phys + i * PAGE_4K, PTE_RW, PAGE_4K);
+        }
+        kbench_touch_pages();
+        for (u64 i = 0; i < KBENCH_MAP_PAGES; i++) {
+            mm_unmap(KBENCH_MAP_VIRT + i * PAGE_4K, PAGE_4K);
+        }
+    }
+    u64 single_cycles = clock_cycles() - start;
+    mm_tlb_stats(&inv1, &full1);
+
+    start = clock_cycles();
+    for (u32 round = 0; round < KBENCH_MAP_ROUNDS; round++) {
+        mm_map_range(KBENCH_MAP_VIRT, phys, KBENCH_MAP_PAGES * PAGE_4K, PTE_RW);
+        kbench_touch_pages();
+        mm_unmap_range(KBENCH_MAP_VIRT, KBENCH_MAP_PAGES * PAGE_4K);
+    }
+    u64 range_cycles = clock_cycles() - start;
+    mm_tlb_stats(&inv2, &full2);
+
+    pmm_free_pages(phys, KBENCH_MAP_ORDER);
+
+    kbench_report("mm_map/mm_unmap per page", ops, single_cycles);
+    vga_printf("    invlpg=%llu full flushes=%llu\n", inv1 - inv0, full1 - full0);
+    kbench_report("mm_map_range/unmap_range", ops, range_cycles);
+    vga_printf("    invlpg=%llu full flushes=%llu\n", inv2 - inv1, full2 - full1);
+    if (range_cycles) {
+        vga_printf("  speedup: %llux\n", single_cycles / range_cycles);
+    }
+}
+
+// Context switch latency: two processes hand the CPU back and forth with
+// sched_yield, so every yield is one full switch including FXSAVE/FXRSTOR.
+#define KBENCH_SWITCH_ROUNDS 10000
+
+static volatile u32 kbench_pong_count;
+
+static long kbench_pong(void* arg) {
+    (void)arg;
+    while (kbench_pong_count < KBENCH_SWITCH_ROUNDS) {
+        kbench_pong_count++;
+        sched_yield();
+    }
+    return 0;
+}
+
+static void kbench_ctxswitch(void) {
+    kbench_pong_count = 0;
+    u32 pid = sched_spawn("kbench-pong", kbench_pong, NULL, 0);
+    if (!pid) {
+        vga_printf("  ctxswitch: cannot spawn partner process\n");
+        return;
+    }
+
+    u64 switches0 = sched_switch_count();
+    u64 start = clock_cycles();
+    while (kbench_pong_count < KBENCH_SWITCH_ROUNDS) {
+        sched_yield();
+    }
+    u64 cycles = clock_cycles() - start;
+    u64 switches = sched_switch_count() - switches0;
+    sched_wait(pid);
+
+    kbench_report("sched_yield ping-pong", switches, cycles);
+}
+
+// Task pool fan-out: hash a 4 MiB buffer in 256 KiB chunks, inline versus
+// one task per chunk. Scales with the CPUs serving the pool.
+#define KBENCH_TASK_ORDER 10
+#define KBENCH_TASK_CHUNKS 16
+#define KBENCH_TASK_ROUNDS 8
+
+typedef struct {
+    const u64* data;
+    u64 words;
+    u64 hash;
+} kbench_chunk_t;
+
+static kbench_chunk_t kbench_chunks[KBENCH_TASK_CHUNKS];
+static task_t kbench_task_slots[KBENCH_TASK_CHUNKS];
+
+static void kbench_hash_chunk(void* arg) {
+    kbench_chunk_t* chunk = (kbench_chunk_t*)arg;
+    u64 hash = 0xCBF29CE484222325ULL;
+    for (u64 i = 0; i < chunk->words; i++) {
+        hash = (hash ^ chunk->data[i]) * 0x100000001B3ULL;
+    }
+    chunk->hash = hash;
+}
+
+static u64 kbench_chunk_hashes(void) {
+    u64 combined = 0;
+    for (u32 c = 0; c < KBENCH_TASK_CHUNKS; c++) combined ^= kbench_chunks[c].hash + c;
+    return combined;
+}
+
+static void kbench_tasks(void) {
+    const u64 ops = (u64)KBENCH_TASK_ROUNDS * KBENCH_TASK_CHUNKS;
+    u64 phys = pmm_alloc_pages(KBENCH_TASK_ORDER);
+    if (!phys) {
+        vga_printf("  tasks: out of physical memory\n");
+        return;
+    }
+
+    u64* data = (u64*)(uintptr_t)phys;
+    u64 words = (PAGE_4K << KBENCH_TASK_ORDER) / sizeof(u64);
+    for (u64 i = 0; i < words; i++) data[i] = i * 0x9E3779B97F4A7C15ULL;
+    for (u32 c = 0; c < KBENCH_TASK_CHUNKS; c++) {
+        kbench_chunks[c].data = data + c * (words / KBENCH_TASK_CHUNKS);
+        kbench_chunks[c].words = words / KBENCH_TASK_CHUNKS;
+    }
+
+    u64 start = clock_cycles();
+    for (u32 round = 0; round < KBENCH_TASK_ROUNDS; round++) {
+        for (u32 c = 0; c < KBENCH_TASK_CHUNKS; c++) kbench_hash_chunk(&kbench_chunks[c]);
+    }
+    u64 inline_cycles = clock_cycles() - start;
+    u64 expected = kbench_chunk_hashes();
+
+    start = clock_cycles();
+    for (u32 round = 0; round < KBENCH_TASK_ROUNDS; round++) {
+        for (u32 c = 0; c < KBENCH_TASK_CHUNKS; c++) {
+            task_spawn(&kbench_task_slots[c], kbench_hash_chunk, &kbench_chunks[c]);
+        }
+        for (u32 c = 0; c < KBENCH_TASK_CHUNKS; c++) task_wait(&kbench_task_slots[c]);
+    }
+    u64 task_cycles = clock_cycles() - start;
+    u64 got = kbench_chunk_hashes();
+
+    pmm_free_pages(phys, KBENCH_TASK_ORDER);
+
+    kbench_report("inline          ", ops, inline_cycles);
+    kbench_report("task_spawn/wait ", ops, task_cycles);
+    vga_printf("  cpus: %u%s\n", smp_cpu_count(), got == expected ? "" : ", HASH MISMATCH");
+    if (task_cycles) {
+        vga_printf("  speedup: %llu.%llux\n", inline_cycles / task_cycles,
+                  (inline_cycles * 10 / task_cycles) % 10);
+    }
+}
+
+static const kbench_entry_t kbench_table[] = {
+    { "kmalloc", "small kmalloc/kfree pairs on a fragmented heap, list vs slab", kbench_kmalloc },
+    { "krealloc", "grow a buffer to 128 KB in 512 B steps, copy vs in-place", kbench_krealloc },
+    { "mmap", "map/touch/unmap 16 MB of 4K pages, per-page calls vs batched range", kbench_mmap },
+    { "ctxswitch", "context switch latency, two processes yielding to each other", kbench_ctxswitch },
+    { "tasks", "hash 4 MB in 16 chunks, inline vs fanned out over the task pool", kbench_tasks },
+};
+
+#define KBENCH_COUNT (sizeof(kbench_table) / sizeof(kbench_table[0]))
+
+int kbench_run(const char* name) {
+    for (u32 i = 0; i < KBENCH_COUNT; i++) {
+        if (strcmp(kbench_table[i].name, name) == 0) {
+            vga_printf("[BENCH] %s\n", kbench_table[i].name);
+            kbench_table[i].run();
+            return 0;
+        }
+    }
+    return -1;
+}
+
+void kbench_run_all(void) {
+    for (u32 i = 0; i < KBENCH_COUNT; i++) {
+        vga_printf("[BENCH] %s\n", kbench_table[i].name);
+        kbench_table[i].run();
+    }
+}
+
+void kbench_list(void) {
+    vga_printf("Available benchmarks:\n");
+    for (u32 i = 0; i < KBENCH_COUNT; i++) {
+        vga_printf("  %s - %s\n", kbench_table[i].name, kbench_table[i].description);
+    }
+}
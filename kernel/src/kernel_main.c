@@ -3,13 +3,14 @@
 #include <vgaio.h>
 #include <interrupts/interrupts.h>
 #include <ps2.h>
-#include <pic.h>
 #include <idt.h>
 #include <multiboot/multiboot2.h>
 #include <memory_info.h>
 #include <ldinfo.h>
 
 #include <memory_mapper.h>
+#include <pmm.h>
+#include <kstack.h>
 #include <cldtest.h>
 #include <dlmalloc/malloc.h>
 #include <kmalloc.h>
@@ -22,9 +23,15 @@
 #include <syscall_test.h>
 #include <elf_loader.h>
 #include <process.h>
+#include <sched.h>
+#include <acpi.h>
+#include <smp.h>
 #include <deferred.h>
 #include <fb/fb_console.h>
 #include <pit/pit.h>
+#include <apic/apic.h>
+#include <clock.h>
+#include <vdso.h>
 
 // Shell integration globals
 static int shell_active = 0;
@@ -33,6 +40,10 @@ static volatile int shell_capture_ready = 0;
 static volatile int shell_input_pending = 0;
 static volatile int shell_input_from_gui = 0;
 
+static void shell_deferred_handle_input(void *arg);
+static deferred_work_t shell_input_work =
+    DEFERRED_WORK_INIT(shell_deferred_handle_input, 0, DEFERRED_PRIO_HIGH);
+
 static void shell_deferred_handle_input(void *arg) {
     (void)arg;
     if (shell_input_from_gui) {
@@ -48,11 +59,7 @@ static void shell_schedule_input_source(int from_gui) {
     if (shell_input_pending) return;
     shell_input_from_gui = from_gui;
     shell_input_pending = 1;
-    if (deferred_schedule(shell_deferred_handle_input, 0) != 0) {
-        shell_input_from_gui = 0;
-        shell_input_pending = 0;
-        vga_printf("shell: command queue full\n");
-    }
+    deferred_queue(&shell_input_work);
 }
 
 void shell_schedule_input(void) {
@@ -77,7 +84,7 @@ void shell_key_handler(u8 scancode, int is_extended, int is_pressed) {
 
 void handle_ps2(void) {
     ps2_handler();
-    pic_send_eoi(1); // Send EOI for IRQ1
+    irq_eoi(1);
 }
 
 void shell_pause(void) {
@@ -113,7 +120,7 @@ int shell_capture_is_ready(void) {
 // Mouse IRQ12 handler trampoline
 void handle_ps2_mouse(void) {
     ps2_mouse_handler();
-    pic_send_eoi(12);
+    irq_eoi(12);
 }
 
 // External declaration for syscall interrupt handler (from assembly)
@@ -181,6 +188,8 @@ void kernel_main(volatile u32 magic, u32 mb2_info) {
         __asm__ volatile ("mov %0, %%cr4" :: "r"(cr4) : "memory");
         __asm__ volatile ("fninit");
     }
+    // Per-CPU GDT and GS base for the boot CPU; this_cpu() works from here
+    smp_init_bsp();
     // Initialize framebuffer console as early as possible; disables VGA writes if present
     fb_console_init_from_mb2(mb2_info);
     vga_attr(0x0B);
@@ -218,12 +227,11 @@ void kernel_main(volatile u32 magic, u32 mb2_info) {
         __asm__ volatile("cli; hlt");
     }
 
-    // Identity mapping - using physical page table access
-    for (u64 addr = 0; addr < (16ULL << 30); addr += (2ULL << 20)) {
-        if (!mm_map(addr, addr, PTE_RW | PTE_HUGE, PAGE_2M)) {
-            vga_printf("identity map failure at 0x%llx\n", addr);
-            __asm__ volatile("cli; hlt");
-        }
+    // Identity mapping - using physical page table access. With 1G pages
+    // this is 16 PDPT entries instead of 8192 PD entries across 8 directories.
+    if (!mm_map_range(0, 0, 16ULL << 30, PTE_RW | PTE_HUGE)) {
+        vga_printf("identity map failure\n");
+        __asm__ volatile("cli; hlt");
     }
 
     // Kernel virtual mapping - using physical page table access
@@ -231,11 +239,9 @@ void kernel_main(volatile u32 magic, u32 mb2_info) {
     u64 kernel_virt = 0xFFFFFFFF80000000ULL; // KERNEL_VMA
     u64 kernel_size = 4ULL << 20; // e.g. 4 MiB kernel
 
-    for (u64 off = 0; off < kernel_size; off += 0x1000) {
-        if (!mm_map(kernel_virt + off, kernel_phys + off, PTE_RW | PTE_PRESENT, PAGE_4K)) {
-            vga_printf("kernel heap map failure\n");
-            __asm__ volatile("cli; hlt");
-        }
+    if (!mm_map_range(kernel_virt, kernel_phys, kernel_size, PTE_RW | PTE_PRESENT)) {
+        vga_printf("kernel heap map failure\n");
+        __asm__ volatile("cli; hlt");
     }
 
 
@@ -253,55 +259,53 @@ void kernel_main(volatile u32 magic, u32 mb2_info) {
         __asm__ volatile("cli; hlt");
     }
 
+    // Hand the remaining RAM to the physical frame allocator; its free lists
+    // are reached through the identity map set up above
+    if (!pmm_init(&minfo)) {
+        vga_printf("physical frame allocator initialization failed\n");
+        __asm__ volatile("cli; hlt");
+    }
+
     // Initialize kmalloc heap now that virtual mapping is complete
     kmalloc_init(&minfo);
     vga_printf("Dynamic memory allocator initialized\n");
 
+    // Paint the boot stack so its peak usage can be measured later
+    kstack_init();
+
+    // Processor and interrupt controller tables; the APs start later
+    acpi_init(mb2_info);
+
     // Initialize framebuffer console if available (PSF font loaded later from ramfs)
     fb_console_init_from_mb2(mb2_info);
         
     extern void irq1_handler(void);
 
-    // interrupt system (PIC + IDT)
-    pic_init();
+    // interrupt system (PIC or IOAPIC + IDT)
+    irq_init();
     
-    // Set up specific CPU exception handlers (0-31)
-    set_idt_entry(0, &division_error_handler, 0x08, 0x8e);              // Division by zero
-    set_idt_entry(1, &debug_exception_handler, 0x08, 0x8e);             // Debug
-    set_idt_entry(2, &nmi_handler, 0x08, 0x8e);                         // NMI
-    set_idt_entry(3, &breakpoint_handler, 0x08, 0x8e);                  // Breakpoint
-    set_idt_entry(4, &overflow_handler, 0x08, 0x8e);                    // Overflow
-    set_idt_entry(5, &bound_range_exceeded_handler, 0x08, 0x8e);        // Bound range exceeded
-    set_idt_entry(6, &invalid_opcode_handler, 0x08, 0x8e);              // Invalid opcode
-    set_idt_entry(7, &device_not_available_handler, 0x08, 0x8e);        // Device not available
-    set_idt_entry(8, &double_fault_handler, 0x08, 0x8e);                // Double fault
-    // Skip 9 (coprocessor segment overrun - obsolete)
-    set_idt_entry(10, &invalid_tss_handler, 0x08, 0x8e);                // Invalid TSS
-    set_idt_entry(11, &segment_not_present_handler, 0x08, 0x8e);        // Segment not present
-    set_idt_entry(12, &stack_segment_fault_handler, 0x08, 0x8e);        // Stack segment fault
-    set_idt_entry(13, &general_protection_fault_handler, 0x08, 0x8e);   // General protection fault
-    set_idt_entry(14, &page_fault_handler, 0x08, 0x8e);                 // Page fault
-    // Skip 15 (reserved)
-    set_idt_entry(16, &x87_floating_point_handler, 0x08, 0x8e);         // x87 FPU error
-    set_idt_entry(17, &alignment_check_handler, 0x08, 0x8e);            // Alignment check
-    set_idt_entry(18, &machine_check_handler, 0x08, 0x8e);              // Machine check
-    set_idt_entry(19, &simd_floating_point_handler, 0x08, 0x8e);        // SIMD FPU error
-    set_idt_entry(20, &virtualization_exception_handler, 0x08, 0x8e);   // Virtualization
+    // CPU exceptions 0-20 go through the stubs, which end a faulting user
+    // program and hand kernel faults to the panic handlers
+    for (int i = 0; i < EXCEPTION_VECTORS; i++) {
+        if (i == 9 || i == 15) continue;    // Coprocessor segment overrun (obsolete), reserved
+        set_idt_entry(i, exception_stubs[i], 0x08, 0x8e);
+    }
     
     // Set remaining exception handlers (21-31) to default
     for (int i = 21; i < 32; i++) {
         set_idt_entry(i, &default_interrupt_handler, 0x08, 0x8e);
     }
     
-    // Set up PIC interrupt handlers (32-47)
+    // Set up IRQ handlers (32-47); the stub acknowledges and returns
+    extern void default_handler(void);
     for (int i = 32; i < 48; i++) {
-        set_idt_entry(i, &default_interrupt_handler, 0x08, 0x8e);
+        set_idt_entry(i, &default_handler, 0x08, 0x8e);
     }
     
     idt_load();
     
     // Set up syscall interrupt (0x80)
-    set_idt_entry(0x80, &syscall_interrupt_handler, 0x08, 0x8E);  // 0x8E = DPL 0 (kernel accessible)
+    set_idt_entry(0x80, &syscall_interrupt_handler, 0x08, 0xEE);  // 0xEE = DPL 3 (callable from user mode)
     
     // Set up process exit interrupt (INT 3 - breakpoint)
     set_idt_entry(3, &default_interrupt_handler, 0x08, 0x8E);
@@ -311,6 +315,7 @@ void kernel_main(volatile u32 magic, u32 mb2_info) {
     
     // Initialize process management system
     process_init();
+    sched_init();
     
     register_interrupt_handler(33, &irq1_handler);  // IRQ1 (keyboard) = interrupt 33
     extern void irq12_handler(void);
@@ -321,14 +326,24 @@ void kernel_main(volatile u32 magic, u32 mb2_info) {
     
     // Initialize PIT timer at 1000 Hz and enable IRQ0
     pit_init(1000);
-    pic_enable_irq(1);
-    // Unmask cascade line and mouse on the slave PIC
-    pic_enable_irq(2);
-    pic_enable_irq(12);
+    irq_unmask(1);
+    // Cascade line (PIC only) and mouse
+    irq_unmask(2);
+    irq_unmask(12);
     
     vga_printf("Interrupts initialized\n");
     interrupts_enable();
     vga_printf("Keyboard enabled\n");
+
+    // Calibrate the TSC before anything measures time with it
+    clock_init();
+    vdso_init();
+
+    // The LAPIC timer takes over the scheduler tick; the PIT keeps the clock
+    if (irq_using_apic()) apic_timer_start(pit_get_hz());
+
+    // Bring up the application processors; the IPI sequence sleeps on the PIT
+    smp_init();
     
     // Test syscall system (using direct calls)
     test_syscalls();
@@ -339,6 +354,8 @@ void kernel_main(volatile u32 magic, u32 mb2_info) {
     
     CLDTEST_RUN_SUITE("memory_tests");
     CLDTEST_RUN_SUITE("malloc_tests");
+    CLDTEST_RUN_SUITE("sched_tests");
+    CLDTEST_RUN_SUITE("syscall_tests");
     CLDTEST_RUN_SUITE("cldramfs_tests");
     CLDTEST_RUN_SUITE("tty_tests");
     
@@ -368,9 +385,10 @@ void kernel_main(volatile u32 magic, u32 mb2_info) {
         
         // Main shell loop
         while(cldramfs_shell_is_running()) {
-            __asm__ volatile("hlt"); // Wait for interrupts
+            sched_idle_wait(); // Run other processes or wait for interrupts
             // Run any deferred tasks outside IRQ context
             deferred_process_all();
+            sched_reap();
         }
         
         vga_printf("Shell exited\n");
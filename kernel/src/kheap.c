@@ -2,10 +2,21 @@
 #include <memory_mapper.h>
 #include <vgaio.h>
 #include <ldinfo.h>
+#include <pmm.h>
+#include <clock.h>
 
 #define KHEAP_VIRT_BASE 0xFFFFA00000000000ULL
+// Virtual window reserved for the heap; only grown segments are mapped
+#define KHEAP_WINDOW_SIZE (1ULL << 40)
+#define KHEAP_SEGMENT_GAP PAGE_2M
+#define KHEAP_GROW_MIN_SIZE (4ULL << 20)
+// Frame allocator memory kheap_init leaves untouched
+#define KHEAP_PMM_RESERVE (32ULL << 20)
+// Segment slots kept free for kheap_grow
+#define KHEAP_GROW_SEGMENTS 16
 
 static kheap_info_t kernel_heap = {0};
+static u64 kheap_next_virt = KHEAP_VIRT_BASE;
 
 static inline u64 align_up_u64(u64 v, u64 a) {
     return (v + (a - 1)) & ~(a - 1);
@@ -79,108 +90,155 @@ u64 kheap_reserve_from_memory_info(struct memory_info* minfo, size_t bytes_requi
 }
 
 static u8 kheap_map_range(u64 virt, u64 phys, u64 size) {
-    u64 off = 0;
-    while (off < size) {
-        u64 v = virt + off;
-        u64 p = phys + off;
-        u64 remaining = size - off;
-
-        if ((v & (PAGE_2M - 1ULL)) == 0 &&
-            (p & (PAGE_2M - 1ULL)) == 0 &&
-            remaining >= PAGE_2M) {
-            if (!mm_map(v, p, PTE_RW | PTE_PRESENT | PTE_HUGE, PAGE_2M)) {
-                vga_printf("kheap: Failed to map 2M heap page virt=0x%llx phys=0x%llx\n", v, p);
-                return 0;
-            }
-            off += PAGE_2M;
-        } else {
-            if (!mm_map(v, p, PTE_RW | PTE_PRESENT, PAGE_4K)) {
-                vga_printf("kheap: Failed to map 4K heap page virt=0x%llx phys=0x%llx\n", v, p);
-                return 0;
-            }
-            off += PAGE_4K;
-        }
+    // Largest pages the alignment allows; 1G when the CPU supports them
+    if (!mm_map_range(virt, phys, size, PTE_RW | PTE_PRESENT | PTE_HUGE)) {
+        vga_printf("kheap: Failed to map heap virt=0x%llx phys=0x%llx size=%llu KB\n",
+                  virt, phys, size / 1024);
+        return 0;
     }
     return 1;
 }
 
-u8 kheap_init(struct memory_info* minfo) {
-    if (kernel_heap.initialized) {
-        vga_printf("kheap: Already initialized\n");
-        return 0;
-    }
-    
-    if (!minfo) {
-        vga_printf("kheap: Invalid memory info\n");
-        return 0;
+// Map a physical block into the next free stretch of the heap window and
+// record it as a segment. Segments are separated by an unmapped gap so no
+// allocator block can ever straddle two of them.
+static kheap_segment_t* kheap_add_segment(u64 phys, u64 size, u32 order) {
+    if (kernel_heap.segment_count >= KHEAP_MAX_SEGMENTS) {
+        vga_printf("kheap: Too many heap segments\n");
+        return NULL;
     }
 
-    size_t heap_size = kheap_compute_required_size(minfo);
-    if (heap_size == 0) {
-        vga_printf("kheap: No usable system RAM left for heap\n");
-        return 0;
+    // Give 1 GiB blocks a matching virtual alignment so they map as 1G pages
+    u64 align = (size >= PAGE_1G && mm_has_1g_pages()) ? PAGE_1G : PAGE_2M;
+    u64 segment_virt = align_up_u64(kheap_next_virt, align) + (phys & (align - 1ULL));
+    if (segment_virt + size > KHEAP_VIRT_BASE + KHEAP_WINDOW_SIZE) {
+        vga_printf("kheap: Heap window exhausted\n");
+        return NULL;
     }
+    if (!kheap_map_range(segment_virt, phys, size)) return NULL;
 
-    u64 next_virt = KHEAP_VIRT_BASE;
-    size_t segment_count = 0;
-    size_t total_mapped = 0;
+    kheap_segment_t* seg = &kernel_heap.segments[kernel_heap.segment_count++];
+    seg->base_virt = (void*)segment_virt;
+    seg->base_phys = phys;
+    seg->size = (size_t)size;
+    seg->order = order;
+    kernel_heap.total_size += (size_t)size;
 
-    for (size_t i = 0; i < minfo->count && i < MEMORY_INFO_MAX; ++i) {
-        struct memory_region *r = &minfo->regions[i];
-        if (!(r->flags & MEMORY_INFO_SYSTEM_RAM) || r->size == 0) continue;
+    kheap_next_virt = segment_virt + size + KHEAP_SEGMENT_GAP;
+    return seg;
+}
 
-        u64 phys_start = align_up_u64(r->addr_start, PAGE_4K);
-        u64 phys_end = align_down_u64(r->addr_end + 1ULL, PAGE_4K);
-        if (phys_end <= phys_start) {
-            r->size = 0;
-            r->addr_end = r->addr_start;
-            continue;
+// Take blocks from the frame allocator until the heap holds `target` bytes,
+// largest first, never dipping into the reserve. A target beyond free memory
+// takes everything but the reserve.
+static void kheap_fill(u64 target) {
+    while (kernel_heap.total_size < target &&
+           kernel_heap.segment_count < KHEAP_MAX_SEGMENTS - KHEAP_GROW_SEGMENTS) {
+        // Blocks may overshoot a reachable target by less than 2M
+        u64 remaining = target - kernel_heap.total_size;
+        u64 max_block = remaining < pmm_free_bytes() ? remaining + PAGE_2M : ~0ULL;
+        int order = pmm_largest_free_order();
+        while (order >= PMM_ORDER_2M &&
+               ((PMM_PAGE_SIZE << order) > max_block ||
+                pmm_free_bytes() < (PMM_PAGE_SIZE << order) + KHEAP_PMM_RESERVE)) {
+            order--;
         }
+        if (order < PMM_ORDER_2M) break;
 
-        u64 segment_size = phys_end - phys_start;
-        u64 segment_virt = align_up_u64(next_virt, PAGE_2M) + (phys_start & (PAGE_2M - 1ULL));
-        if (segment_virt < next_virt) segment_virt += PAGE_2M;
-
-        if (segment_count >= KHEAP_MAX_SEGMENTS) {
-            vga_printf("kheap: Too many heap segments\n");
-            return 0;
+        u64 phys = pmm_alloc_pages((u32)order);
+        if (!phys) break;
+        if (!kheap_add_segment(phys, PMM_PAGE_SIZE << order, (u32)order)) {
+            pmm_free_pages(phys, (u32)order);
+            break;
         }
+    }
+}
 
-        if (!kheap_map_range(segment_virt, phys_start, segment_size)) return 0;
-
-        kernel_heap.segments[segment_count].base_virt = (void*)segment_virt;
-        kernel_heap.segments[segment_count].base_phys = phys_start;
-        kernel_heap.segments[segment_count].size = (size_t)segment_size;
-        segment_count++;
-        total_mapped += (size_t)segment_size;
-
-        next_virt = segment_virt + segment_size;
-
-        // This RAM is now owned by the allocator.
-        r->addr_start = phys_end;
-        r->addr_end = phys_end;
-        r->size = 0;
+u8 kheap_init(struct memory_info* minfo) {
+    (void)minfo; // RAM is owned by the frame allocator by now
+    if (kernel_heap.initialized) {
+        vga_printf("kheap: Already initialized\n");
+        return 0;
     }
 
-    if (segment_count == 0 || total_mapped == 0) {
-        vga_printf("kheap: No heap segments mapped\n");
+    if (pmm_total_bytes() == 0) {
+        vga_printf("kheap: Frame allocator not initialized\n");
         return 0;
     }
 
+    u64 start = clock_cycles();
+    u64 tables_before = mm_table_pages_in_use();
+
+    kheap_next_virt = KHEAP_VIRT_BASE;
+    kernel_heap.segment_count = 0;
+    kernel_heap.total_size = 0;
+
+#ifdef KHEAP_EAGER
+    kheap_fill(~0ULL);
+#else
+    // Only a small initial heap is mapped; kheap_grow adds the rest of the
+    // window on demand.
+    kheap_fill(KHEAP_INITIAL_SIZE);
+#endif
+
+    if (kernel_heap.segment_count == 0) {
+        // Small machines: settle for a single block below the reserve
+        u64 phys = pmm_alloc_pages(PMM_ORDER_2M);
+        if (!phys || !kheap_add_segment(phys, PMM_PAGE_SIZE << PMM_ORDER_2M, PMM_ORDER_2M)) {
+            vga_printf("kheap: No heap segments mapped\n");
+            return 0;
+        }
+    }
+
     // Initialize heap structure
     kernel_heap.base_virt = kernel_heap.segments[0].base_virt;
     kernel_heap.base_phys = kernel_heap.segments[0].base_phys;
-    kernel_heap.total_size = total_mapped;
     kernel_heap.used_size = 0;
-    kernel_heap.segment_count = segment_count;
+    kernel_heap.grow_count = 0;
+    kernel_heap.init_cycles = clock_cycles() - start;
+    kernel_heap.init_table_pages = mm_table_pages_in_use() - tables_before;
+    kernel_heap.init_size = kernel_heap.total_size;
     kernel_heap.initialized = 1;
     
-    vga_printf("kheap: Initialized size=%llu MB using %llu RAM segments\n",
-              (u64)kernel_heap.total_size >> 20, (u64)segment_count);
+    vga_printf("kheap: Initialized size=%llu MB using %llu segments (%llu MB left in frame allocator)\n",
+              (u64)kernel_heap.total_size >> 20, (u64)kernel_heap.segment_count,
+              pmm_free_bytes() >> 20);
+    vga_printf("kheap: Boot mapping took %llu cycles and %llu page-table pages\n",
+              kernel_heap.init_cycles, kernel_heap.init_table_pages);
     
     return 1;
 }
 
+kheap_segment_t* kheap_grow(size_t min_bytes) {
+    if (!kernel_heap.initialized) return NULL;
+
+    // Grow geometrically so a handful of segments covers a large heap
+    u64 want = (u64)kernel_heap.total_size / 2;
+    if (want < KHEAP_GROW_MIN_SIZE) want = KHEAP_GROW_MIN_SIZE;
+    if (want < min_bytes) want = min_bytes;
+
+    u32 need = pmm_order_for_size(min_bytes);
+    u32 order = pmm_order_for_size(want);
+    if (need < PMM_ORDER_2M) need = PMM_ORDER_2M;
+    if (need > PMM_MAX_ORDER) return NULL;
+    if (order > PMM_MAX_ORDER) order = PMM_MAX_ORDER;
+
+    u64 phys = 0;
+    for (; order >= need; order--) {
+        phys = pmm_alloc_pages(order);
+        if (phys) break;
+    }
+    if (!phys) return NULL;
+
+    kheap_segment_t* seg = kheap_add_segment(phys, PMM_PAGE_SIZE << order, order);
+    if (!seg) {
+        pmm_free_pages(phys, order);
+        return NULL;
+    }
+    kernel_heap.grow_count++;
+    return seg;
+}
+
 kheap_info_t* kheap_get_info(void) {
     return kernel_heap.initialized ? &kernel_heap : NULL;
 }
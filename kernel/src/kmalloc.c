@@ -1,27 +1,112 @@
 #include <kmalloc.h>
 #include <kheap.h>
+#include <pmm.h>
+#include <memory_mapper.h>
 #include <cldtypes.h>
 #include <vgaio.h>
 #include <string.h>
 #include <dlmalloc/malloc.h>
+#include <pit/pit.h>
+#include <spinlock.h>
 
-// dlmalloc memory space for kernel heap
-static mspace kernel_mspace = 0;
-
-// Simple allocator (temporary fallback)
+// Segment backend selection (see KMALLOC_BACKEND in the top-level Makefile):
+//  - default: address-ordered first-fit free list
+//  - KMALLOC_BACKEND_DLMALLOC: one dlmalloc mspace per kheap segment
+#ifdef KMALLOC_BACKEND_DLMALLOC
+static mspace kernel_mspaces[KHEAP_MAX_SEGMENTS];
+static size_t kernel_mspace_count = 0;
+#else
 static free_block_t* g_free_list = NULL;
+#endif
 
 #define MIN_BLOCK_SIZE sizeof(free_block_t)
 #define ALIGNMENT 16
 
+// Every allocation is preceded by a 16-byte header so payloads stay 16-byte
+// aligned. The first word holds the block size for segment blocks, or the
+// owning slab pointer tagged with KSLAB_TAG for slab objects, or the mapped
+// length tagged with KLARGE_TAG for large objects.
+#define BLOCK_HEADER_SIZE ALIGNMENT
+#define KSLAB_TAG 0x1ULL
+#define KLARGE_TAG 0x2ULL
+
+// Size-class slab front end: 16..2048 byte objects carved from 32 KiB slabs
+// that are themselves ordinary segment blocks.
+#define KSLAB_MIN_SHIFT 4
+#define KSLAB_CLASS_COUNT 8
+#define KSLAB_MAX_SIZE (1U << (KSLAB_MIN_SHIFT + KSLAB_CLASS_COUNT - 1))
+#define KSLAB_SLAB_BYTES (32 * 1024)
+
+typedef struct kslab {
+    struct kslab* prev;
+    struct kslab* next;
+    void* free_objs;        // Singly linked through the object payloads
+    u32 class_idx;
+    u32 inuse;
+    u32 capacity;
+    u32 on_partial;
+} kslab_t;
+
+typedef struct {
+    size_t obj_size;
+    kslab_t* partial;       // Slabs with at least one free object
+    u32 empty_slabs;        // Fully free slabs still on the partial list
+    u64 slab_count;
+    u64 live_objs;
+} kslab_class_t;
+
+static kslab_class_t g_slab_classes[KSLAB_CLASS_COUNT];
+static u8 g_slab_enabled = 1;
+
+// Optional allocation-site tracking. The second header word of a live block
+// holds its site index + 1, or 0 when the block was not tracked. The last
+// site slot collects callers that no longer fit in the table.
+#define KTRACK_SITES 128
+#define KTRACK_SIZE_BUCKETS 18  // 16 B .. 1 MiB, last bucket is larger
+
+typedef struct {
+    uintptr_t caller;
+    u64 live_allocs;
+    u64 live_bytes;
+    u64 total_allocs;
+} ktrack_site_t;
+
+// Large objects bypass the segment lists: each one is a 2M-aligned run of
+// frames mapped with huge pages at KLARGE_VIRT_BASE + phys, just past the
+// heap window, and goes straight back to the frame allocator on free.
+#define KLARGE_THRESHOLD (1024 * 1024)
+#define KLARGE_VIRT_BASE 0xFFFFA10000000000ULL
+
+static u64 g_large_live = 0;
+static u64 g_large_bytes = 0;
+static u64 g_large_total = 0;
+
+static ktrack_site_t g_track_sites[KTRACK_SITES];
+static u64 g_track_size_buckets[KTRACK_SIZE_BUCKETS];
+static u8 g_track_enabled = 0;
+
+// Guards the heap segments, the large-object list and the tracking tables.
+// Not taken with interrupts off: kmalloc is not for interrupt handlers.
+static spinlock_t g_heap_lock = SPINLOCK_INIT("heap");
+
+static kmalloc_stats_t g_stats;
+static u64 g_stats_last_allocs = 0;
+static u64 g_stats_last_tick = 0;
+
 static size_t align_size(size_t size) {
     return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
 }
 
 // Forward declarations
+static int ptr_in_heap_segment(kheap_info_t* heap_info, uintptr_t addr, size_t size);
+static void* segment_alloc(kheap_info_t* heap_info, size_t size);
+static void segment_free(kheap_info_t* heap_info, void* ptr);
+static size_t segment_largest_free(kheap_info_t* heap_info);
+static int segment_resize(kheap_info_t* heap_info, void* ptr, size_t size);
+
+#ifndef KMALLOC_BACKEND_DLMALLOC
 static void insert_free_block(free_block_t* block);
 static void merge_free_blocks(void);
-static int ptr_in_heap_segment(kheap_info_t* heap_info, uintptr_t addr, size_t size);
 
 static free_block_t* find_free_block(size_t size) {
     free_block_t* current = g_free_list;
@@ -84,6 +169,243 @@ static void insert_free_block(free_block_t* block) {
 }
 
 
+static int segment_backend_add(kheap_info_t* heap_info, size_t index) {
+    if (heap_info->segments[index].size < MIN_BLOCK_SIZE) return 0;
+    free_block_t* block = (free_block_t*)heap_info->segments[index].base_virt;
+    block->size = heap_info->segments[index].size;
+    block->next = NULL;
+    insert_free_block(block);
+    return 1;
+}
+
+static int segment_backend_init(kheap_info_t* heap_info) {
+    g_free_list = NULL;
+    for (size_t i = 0; i < heap_info->segment_count; i++) {
+        segment_backend_add(heap_info, i);
+    }
+    return g_free_list != NULL;
+}
+
+static void* segment_alloc(kheap_info_t* heap_info, size_t size) {
+    size_t aligned_size = align_size(size + BLOCK_HEADER_SIZE);
+    if (aligned_size < MIN_BLOCK_SIZE) {
+        aligned_size = MIN_BLOCK_SIZE;
+    }
+    
+    free_block_t* block = find_free_block(aligned_size);
+    if (!block) {
+        return NULL;
+    }
+    
+    split_block(block, aligned_size);
+    
+    *(size_t*)block = block->size;
+    heap_info->used_size += block->size;
+    
+    return (void*)((char*)block + BLOCK_HEADER_SIZE);
+}
+
+static void segment_free(kheap_info_t* heap_info, void* ptr) {
+    char* block_start = (char*)ptr - BLOCK_HEADER_SIZE;
+    size_t block_size = *(size_t*)block_start;
+    
+    if (!ptr_in_heap_segment(heap_info, (uintptr_t)block_start, block_size)) {
+        return;
+    }
+    
+    free_block_t* free_block = (free_block_t*)block_start;
+    free_block->size = block_size;
+    
+    heap_info->used_size -= block_size;
+    insert_free_block(free_block);
+}
+
+// Resize a block without moving it: shrink by splitting off the tail, or
+// grow by absorbing the free block that starts right after it. Returns 1 if
+// the block now holds at least `size` bytes.
+static int segment_resize(kheap_info_t* heap_info, void* ptr, size_t size) {
+    char* block_start = (char*)ptr - BLOCK_HEADER_SIZE;
+    size_t old_size = *(size_t*)block_start;
+    size_t new_size = align_size(size + BLOCK_HEADER_SIZE);
+    if (new_size < MIN_BLOCK_SIZE) {
+        new_size = MIN_BLOCK_SIZE;
+    }
+    
+    if (new_size > old_size) {
+        char* block_end = block_start + old_size;
+        free_block_t* current = g_free_list;
+        free_block_t* prev = NULL;
+        
+        // The list is address ordered, so stop at the first block past our end
+        while (current && (char*)current < block_end) {
+            prev = current;
+            current = current->next;
+        }
+        if (!current || (char*)current != block_end ||
+            old_size + current->size < new_size) {
+            return 0;
+        }
+        
+        if (prev) {
+            prev->next = current->next;
+        } else {
+            g_free_list = current->next;
+        }
+        old_size += current->size;
+        heap_info->used_size += current->size;
+    }
+    
+    free_block_t* block = (free_block_t*)block_start;
+    block->size = old_size;
+    size_t before = block->size;
+    split_block(block, new_size);
+    heap_info->used_size -= before - block->size;
+    *(size_t*)block_start = block->size;
+    return 1;
+}
+
+static size_t segment_largest_free(kheap_info_t* heap_info) {
+    (void)heap_info;
+    size_t largest = 0;
+    for (free_block_t* b = g_free_list; b; b = b->next) {
+        if (b->size > largest) largest = b->size;
+    }
+    return largest;
+}
+
+#else // KMALLOC_BACKEND_DLMALLOC
+
+static int segment_backend_add(kheap_info_t* heap_info, size_t index) {
+    kernel_mspaces[index] = create_mspace_with_base(heap_info->segments[index].base_virt,
+                                                    heap_info->segments[index].size, 0);
+    if (!kernel_mspaces[index]) {
+        vga_printf("kmalloc: segment %llu too small for an mspace\n", (u64)index);
+        return 0;
+    }
+    kernel_mspace_count++;
+    return 1;
+}
+
+static int segment_backend_init(kheap_info_t* heap_info) {
+    kernel_mspace_count = 0;
+    for (size_t i = 0; i < heap_info->segment_count; i++) {
+        segment_backend_add(heap_info, i);
+    }
+    return kernel_mspace_count != 0;
+}
+
+// Segments and mspaces share an index; unusable segments have no mspace.
+static mspace segment_mspace_for(kheap_info_t* heap_info, uintptr_t addr) {
+    for (size_t i = 0; i < heap_info->segment_count; i++) {
+        uintptr_t seg_base = (uintptr_t)heap_info->segments[i].base_virt;
+        if (addr >= seg_base && addr < seg_base + heap_info->segments[i].size) {
+            return kernel_mspaces[i];
+        }
+    }
+    return NULL;
+}
+
+static void* segment_alloc(kheap_info_t* heap_info, size_t size) {
+    size_t request = align_size(size + BLOCK_HEADER_SIZE);
+    for (size_t i = 0; i < heap_info->segment_count; i++) {
+        if (!kernel_mspaces[i]) continue;
+        char* raw = (char*)mspace_malloc(kernel_mspaces[i], request);
+        if (!raw) continue;
+        // Record the usable size rounded down so the header keeps its low
+        // bits clear (bit 0 marks slab objects).
+        size_t block_size = mspace_usable_size(raw) & ~(size_t)(ALIGNMENT - 1);
+        *(size_t*)raw = block_size;
+        heap_info->used_size += block_size;
+        return raw + BLOCK_HEADER_SIZE;
+    }
+    return NULL;
+}
+
+static void segment_free(kheap_info_t* heap_info, void* ptr) {
+    char* raw = (char*)ptr - BLOCK_HEADER_SIZE;
+    mspace msp = segment_mspace_for(heap_info, (uintptr_t)raw);
+    if (!msp) {
+        return;
+    }
+    heap_info->used_size -= *(size_t*)raw;
+    mspace_free(msp, raw);
+}
+
+// mspace_realloc_in_place either extends into the following chunk or
+// trims the tail; it never moves the block.
+static int segment_resize(kheap_info_t* heap_info, void* ptr, size_t size) {
+    char* raw = (char*)ptr - BLOCK_HEADER_SIZE;
+    mspace msp = segment_mspace_for(heap_info, (uintptr_t)raw);
+    if (!msp || !mspace_realloc_in_place(msp, raw, align_size(size + BLOCK_HEADER_SIZE))) {
+        return 0;
+    }
+    size_t block_size = mspace_usable_size(raw) & ~(size_t)(ALIGNMENT - 1);
+    heap_info->used_size = heap_info->used_size - *(size_t*)raw + block_size;
+    *(size_t*)raw = block_size;
+    return 1;
+}
+
+// mallinfo does not expose the largest free chunk; the top chunk of each
+// mspace is the best available lower bound.
+static size_t segment_largest_free(kheap_info_t* heap_info) {
+    size_t largest = 0;
+    for (size_t i = 0; i < heap_info->segment_count; i++) {
+        if (!kernel_mspaces[i]) continue;
+        struct mallinfo mi = mspace_mallinfo(kernel_mspaces[i]);
+        if (mi.keepcost > largest) largest = mi.keepcost;
+    }
+    return largest;
+}
+
+#endif // KMALLOC_BACKEND_DLMALLOC
+
+// Room for backend bookkeeping (mspace header, chunk overhead) in a segment
+// added by kheap_grow.
+#define KMALLOC_GROW_SLACK 4096
+
+static void* segment_alloc_grow(kheap_info_t* heap_info, size_t size) {
+    void* ptr = segment_alloc(heap_info, size);
+    if (ptr) return ptr;
+
+    kheap_segment_t* seg = kheap_grow(size + BLOCK_HEADER_SIZE + KMALLOC_GROW_SLACK);
+    if (!seg || !segment_backend_add(heap_info, (size_t)(seg - heap_info->segments))) {
+        return NULL;
+    }
+    return segment_alloc(heap_info, size);
+}
+
+static int large_owns(uintptr_t addr) {
+    return addr >= KLARGE_VIRT_BASE && addr < KLARGE_VIRT_BASE + PMM_PHYS_LIMIT;
+}
+
+static void* large_alloc(size_t size) {
+    u64 bytes = ((u64)size + BLOCK_HEADER_SIZE + PAGE_2M - 1) & ~(PAGE_2M - 1);
+    if (bytes < (u64)size) return NULL;
+
+    // A power-of-two block of at least 2M is naturally 2M aligned
+    u64 phys = pmm_alloc_contiguous(bytes);
+    if (!phys) return NULL;
+    u64 virt = KLARGE_VIRT_BASE + phys;
+    if (!mm_map_range(virt, phys, bytes, PTE_RW | PTE_PRESENT | PTE_HUGE)) {
+        pmm_free_contiguous(phys, bytes);
+        return NULL;
+    }
+
+    *(u64*)(uintptr_t)virt = bytes | KLARGE_TAG;
+    g_large_live++;
+    g_large_bytes += bytes;
+    g_large_total++;
+    return (void*)(uintptr_t)(virt + BLOCK_HEADER_SIZE);
+}
+
+static void large_free(void* ptr, u64 bytes) {
+    u64 virt = (u64)(uintptr_t)ptr - BLOCK_HEADER_SIZE;
+    mm_unmap_range(virt, bytes);
+    pmm_free_contiguous(virt - KLARGE_VIRT_BASE, bytes);
+    g_large_live--;
+    g_large_bytes -= bytes;
+}
+
 void kmalloc_init(struct memory_info* minfo) {
     vga_printf("kmalloc_init: Initializing dynamic allocator\n");
     
@@ -100,41 +422,332 @@ void kmalloc_init(struct memory_info* minfo) {
         return;
     }
     
-    g_free_list = NULL;
-    for (size_t i = 0; i < heap_info->segment_count; i++) {
-        if (heap_info->segments[i].size < MIN_BLOCK_SIZE) continue;
-        free_block_t* block = (free_block_t*)heap_info->segments[i].base_virt;
-        block->size = heap_info->segments[i].size;
-        block->next = NULL;
-        insert_free_block(block);
+    if (!segment_backend_init(heap_info)) {
+        vga_printf("kmalloc_init: Failed to initialize heap backend\n");
+        return;
+    }
+    
+    for (u32 i = 0; i < KSLAB_CLASS_COUNT; i++) {
+        g_slab_classes[i].obj_size = (size_t)1 << (KSLAB_MIN_SHIFT + i);
+        g_slab_classes[i].partial = NULL;
+        g_slab_classes[i].empty_slabs = 0;
+        g_slab_classes[i].slab_count = 0;
+        g_slab_classes[i].live_objs = 0;
     }
     
     vga_printf("kmalloc_init: Dynamic allocator ready (%llu KB available)\n",
               (u64)heap_info->total_size / 1024);
 }
 
-void* kmalloc(size_t size) {
+static u32 slab_class_index(size_t size) {
+    u32 idx = 0;
+    while (((size_t)1 << (KSLAB_MIN_SHIFT + idx)) < size) idx++;
+    return idx;
+}
+
+static void slab_partial_push(kslab_class_t* cls, kslab_t* slab) {
+    slab->prev = NULL;
+    slab->next = cls->partial;
+    if (cls->partial) cls->partial->prev = slab;
+    cls->partial = slab;
+    slab->on_partial = 1;
+}
+
+static void slab_partial_remove(kslab_class_t* cls, kslab_t* slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else cls->partial = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->prev = slab->next = NULL;
+    slab->on_partial = 0;
+}
+
+static kslab_t* slab_create(kheap_info_t* heap_info, u32 class_idx) {
+    kslab_t* slab = (kslab_t*)segment_alloc_grow(heap_info, KSLAB_SLAB_BYTES);
+    if (!slab) return NULL;
+
+    size_t slot_size = g_slab_classes[class_idx].obj_size + BLOCK_HEADER_SIZE;
+    size_t first = align_size(sizeof(kslab_t));
+    u32 capacity = (u32)((KSLAB_SLAB_BYTES - first) / slot_size);
+
+    slab->prev = slab->next = NULL;
+    slab->free_objs = NULL;
+    slab->class_idx = class_idx;
+    slab->inuse = 0;
+    slab->capacity = capacity;
+    slab->on_partial = 0;
+
+    // Thread the free list back to front so objects are handed out in
+    // address order.
+    for (u32 i = capacity; i > 0; i--) {
+        char* slot = (char*)slab + first + (size_t)(i - 1) * slot_size;
+        *(u64*)slot = (u64)(uintptr_t)slab | KSLAB_TAG;
+        void* obj = slot + BLOCK_HEADER_SIZE;
+        *(void**)obj = slab->free_objs;
+        slab->free_objs = obj;
+    }
+
+    g_slab_classes[class_idx].slab_count++;
+    return slab;
+}
+
+static void* slab_alloc(kheap_info_t* heap_info, size_t size) {
+    kslab_class_t* cls = &g_slab_classes[slab_class_index(size)];
+    kslab_t* slab = cls->partial;
+    if (!slab) {
+        slab = slab_create(heap_info, (u32)(cls - g_slab_classes));
+        if (!slab) return NULL;
+        slab_partial_push(cls, slab);
+        cls->empty_slabs++;
+    }
+
+    void* obj = slab->free_objs;
+    slab->free_objs = *(void**)obj;
+    if (slab->inuse++ == 0) cls->empty_slabs--;
+    if (!slab->free_objs) slab_partial_remove(cls, slab);
+    cls->live_objs++;
+    return obj;
+}
+
+static void slab_free(kheap_info_t* heap_info, kslab_t* slab, void* obj) {
+    kslab_class_t* cls = &g_slab_classes[slab->class_idx];
+
+    *(void**)obj = slab->free_objs;
+    slab->free_objs = obj;
+    if (!slab->on_partial) slab_partial_push(cls, slab);
+    cls->live_objs--;
+
+    if (--slab->inuse == 0) {
+        // Keep one empty slab per class cached to avoid thrashing the
+        // segment allocator; release the rest.
+        if (cls->empty_slabs > 0) {
+            slab_partial_remove(cls, slab);
+            cls->slab_count--;
+            segment_free(heap_info, slab);
+        } else {
+            cls->empty_slabs++;
+        }
+    }
+}
+
+static size_t block_usable_size(void* ptr) {
+    u64 header = *(u64*)((char*)ptr - BLOCK_HEADER_SIZE);
+    if (header & KSLAB_TAG) {
+        kslab_t* slab = (kslab_t*)(uintptr_t)(header & ~KSLAB_TAG);
+        return g_slab_classes[slab->class_idx].obj_size;
+    }
+    if (header & KLARGE_TAG) {
+        return (size_t)(header & ~KLARGE_TAG) - BLOCK_HEADER_SIZE;
+    }
+    return (size_t)header - BLOCK_HEADER_SIZE;
+}
+
+static u32 track_size_bucket(size_t size) {
+    u32 bucket = 0;
+    while (bucket < KTRACK_SIZE_BUCKETS - 1 && ((size_t)16 << bucket) < size) bucket++;
+    return bucket;
+}
+
+static u64* track_slot(void* ptr) {
+    return (u64*)((char*)ptr - BLOCK_HEADER_SIZE) + 1;
+}
+
+static u32 track_site_index(uintptr_t caller) {
+    u32 idx = (u32)((caller >> 4) % (KTRACK_SITES - 1));
+    for (u32 probe = 0; probe < KTRACK_SITES - 1; probe++) {
+        ktrack_site_t* site = &g_track_sites[idx];
+        if (site->caller == caller) return idx;
+        if (site->caller == 0) {
+            site->caller = caller;
+            return idx;
+        }
+        idx = (idx + 1) % (KTRACK_SITES - 1);
+    }
+    return KTRACK_SITES - 1;
+}
+
+static void track_alloc(void* ptr, uintptr_t caller) {
+    size_t size = block_usable_size(ptr);
+    g_stats.alloc_calls++;
+    g_stats.bytes_allocated += size;
+    if (!g_track_enabled) {
+        *track_slot(ptr) = 0;
+        return;
+    }
+    u32 idx = track_site_index(caller);
+    ktrack_site_t* site = &g_track_sites[idx];
+    site->live_allocs++;
+    site->live_bytes += size;
+    site->total_allocs++;
+    g_track_size_buckets[track_size_bucket(size)]++;
+    *track_slot(ptr) = (u64)idx + 1;
+}
+
+static void track_free(void* ptr) {
+    g_stats.free_calls++;
+    u64 tag = *track_slot(ptr);
+    if (tag == 0 || tag > KTRACK_SITES) return;
+    size_t size = block_usable_size(ptr);
+    ktrack_site_t* site = &g_track_sites[tag - 1];
+    if (site->live_allocs) site->live_allocs--;
+    site->live_bytes = (site->live_bytes > size) ? site->live_bytes - size : 0;
+    u32 bucket = track_size_bucket(size);
+    if (g_track_size_buckets[bucket]) g_track_size_buckets[bucket]--;
+}
+
+// A block resized in place keeps its site; only the byte count moves.
+static void track_resize(void* ptr, size_t old_size) {
+    u64 tag = *track_slot(ptr);
+    if (tag == 0 || tag > KTRACK_SITES) return;
+    size_t new_size = block_usable_size(ptr);
+    ktrack_site_t* site = &g_track_sites[tag - 1];
+    site->live_bytes = site->live_bytes + new_size - old_size;
+    g_track_size_buckets[track_size_bucket(old_size)]--;
+    g_track_size_buckets[track_size_bucket(new_size)]++;
+}
+
+static void* kmalloc_from(size_t size, uintptr_t caller) {
     kheap_info_t* heap_info = kheap_get_info();
     if (!heap_info || !heap_info->initialized || size == 0) {
         return NULL;
     }
     
-    size_t aligned_size = align_size(size + sizeof(size_t));
-    if (aligned_size < MIN_BLOCK_SIZE) {
-        aligned_size = MIN_BLOCK_SIZE;
+    void* ptr = NULL;
+    if (g_slab_enabled && size <= KSLAB_MAX_SIZE) {
+        ptr = slab_alloc(heap_info, size);
+    } else if (size >= KLARGE_THRESHOLD) {
+        ptr = large_alloc(size);
     }
-    
-    free_block_t* block = find_free_block(aligned_size);
-    if (!block) {
+    if (!ptr) {
+        ptr = segment_alloc_grow(heap_info, size);
+    }
+    if (!ptr) {
+        g_stats.failed_allocs++;
         return NULL;
     }
     
-    split_block(block, aligned_size);
+    track_alloc(ptr, caller);
+    return ptr;
+}
+
+void* kmalloc(size_t size) {
+    spin_lock(&g_heap_lock);
+    void* ptr = kmalloc_from(size, (uintptr_t)__builtin_return_address(0));
+    spin_unlock(&g_heap_lock);
+    return ptr;
+}
+
+void kmalloc_set_tracking(int enabled) {
+    g_track_enabled = enabled ? 1 : 0;
+}
+
+int kmalloc_tracking_enabled(void) {
+    return g_track_enabled;
+}
+
+void kmalloc_get_stats(kmalloc_stats_t* out) {
+    if (out) *out = g_stats;
+}
+
+size_t kmalloc_largest_free_block(void) {
+    kheap_info_t* heap_info = kheap_get_info();
+    if (!heap_info) return 0;
+    spin_lock(&g_heap_lock);
+    size_t largest = segment_largest_free(heap_info);
+    spin_unlock(&g_heap_lock);
+    return largest;
+}
+
+#define KHEAPSTAT_MAX_SITES 16  // Most sites kmalloc_heapstat lists
+
+void kmalloc_heapstat(u32 top_sites) {
+    kheap_info_t* heap_info = kheap_get_info();
+    if (!heap_info) {
+        vga_printf("=== Kernel Heap Not Initialized ===\n");
+        return;
+    }
+    if (top_sites > KHEAPSTAT_MAX_SITES) top_sites = KHEAPSTAT_MAX_SITES;
     
-    *(size_t*)block = block->size;
-    heap_info->used_size += block->size;
+    // Snapshot everything under the lock; printing happens after it is dropped
+    ktrack_site_t sites[KHEAPSTAT_MAX_SITES];
+    int site_idx[KHEAPSTAT_MAX_SITES];
+    u64 buckets[KTRACK_SIZE_BUCKETS];
+    u8 shown[KTRACK_SITES] = {0};
+    u32 site_count = 0;
+    
+    spin_lock(&g_heap_lock);
+    u64 total = (u64)heap_info->total_size;
+    u64 used = (u64)heap_info->used_size;
+    u64 largest = (u64)segment_largest_free(heap_info);
+    kmalloc_stats_t stats = g_stats;
+    u64 now = pit_ticks();
+    u64 elapsed = now - g_stats_last_tick;
+    u64 allocs = stats.alloc_calls - g_stats_last_allocs;
+    int have_rate = g_stats_last_tick != 0 && elapsed != 0;
+    g_stats_last_tick = now;
+    g_stats_last_allocs = stats.alloc_calls;
+    u8 tracking = g_track_enabled;
+    
+    while (site_count < top_sites) {
+        int best = -1;
+        for (u32 i = 0; i < KTRACK_SITES; i++) {
+            if (shown[i] || g_track_sites[i].live_bytes == 0) continue;
+            if (best < 0 || g_track_sites[i].live_bytes > g_track_sites[best].live_bytes) best = (int)i;
+        }
+        if (best < 0) break;
+        shown[best] = 1;
+        site_idx[site_count] = best;
+        sites[site_count++] = g_track_sites[best];
+    }
+    memcpy(buckets, g_track_size_buckets, sizeof(buckets));
+    spin_unlock(&g_heap_lock);
+    
+    u64 free_bytes = total > used ? total - used : 0;
+    u64 frag = free_bytes ? 100 - (largest * 100) / free_bytes : 0;
+    
+    vga_printf("=== Heap profile ===\n");
+    vga_printf("Heap: %llu KB total, %llu KB used, %llu KB free\n",
+              total / 1024, used / 1024, free_bytes / 1024);
+    vga_printf("Largest free block: %llu KB, fragmentation: %llu%%\n", largest / 1024, frag);
+    vga_printf("Calls: kmalloc=%llu kfree=%llu failed=%llu, %llu KB handed out\n",
+              stats.alloc_calls, stats.free_calls, stats.failed_allocs,
+              stats.bytes_allocated / 1024);
     
-    return (void*)((char*)block + sizeof(size_t));
+    if (have_rate) {
+        vga_printf("Rate: %llu allocs/s over the last %llu ms\n", (allocs * 1000) / elapsed, elapsed);
+    }
+    
+    vga_printf("Tracking: %s\n", tracking ? "on" : "off");
+    
+    for (u32 n = 0; n < site_count; n++) {
+        if (n == 0) vga_printf("Top allocation sites by live bytes:\n");
+        const ktrack_site_t* site = &sites[n];
+        if (site_idx[n] == KTRACK_SITES - 1) {
+            vga_printf("  (other)");
+        } else {
+            vga_printf("  0x%llx", (u64)site->caller);
+        }
+        vga_printf(": %llu KB in %llu blocks, %llu allocs total\n",
+                  site->live_bytes / 1024, site->live_allocs, site->total_allocs);
+    }
+    
+    u32 printed = 0;
+    for (u32 b = 0; b < KTRACK_SIZE_BUCKETS; b++) {
+        if (buckets[b] == 0) continue;
+        if (printed++ == 0) vga_printf("Tracked live blocks by size:\n");
+        if (b == KTRACK_SIZE_BUCKETS - 1) {
+            vga_printf("  > %llu B: %llu live\n", (u64)16 << (b - 1), buckets[b]);
+        } else {
+            vga_printf("  <= %llu B: %llu live\n", (u64)16 << b, buckets[b]);
+        }
+    }
+}
+
+void kmalloc_set_slab_enabled(int enabled) {
+    g_slab_enabled = enabled ? 1 : 0;
+}
+
+int kmalloc_slab_enabled(void) {
+    return g_slab_enabled;
 }
 
 
@@ -150,42 +763,67 @@ static int ptr_in_heap_segment(kheap_info_t* heap_info, uintptr_t addr, size_t s
     return 0;
 }
 
-void kfree(void* ptr) {
+static void kfree_block(void* ptr) {
     kheap_info_t* heap_info = kheap_get_info();
     if (!ptr || !heap_info || !heap_info->initialized) {
         return;
     }
     
-    char* block_start = (char*)ptr - sizeof(size_t);
-    size_t block_size = *(size_t*)block_start;
-    
-    if (!ptr_in_heap_segment(heap_info, (uintptr_t)block_start, block_size)) {
+    u64 header = *(u64*)((char*)ptr - BLOCK_HEADER_SIZE);
+    if (header & KSLAB_TAG) {
+        kslab_t* slab = (kslab_t*)(uintptr_t)(header & ~KSLAB_TAG);
+        if (!ptr_in_heap_segment(heap_info, (uintptr_t)slab, KSLAB_SLAB_BYTES)) {
+            return;
+        }
+        track_free(ptr);
+        slab_free(heap_info, slab, ptr);
+        return;
+    }
+    if (header & KLARGE_TAG) {
+        if (!large_owns((uintptr_t)ptr)) {
+            return;
+        }
+        track_free(ptr);
+        large_free(ptr, header & ~KLARGE_TAG);
         return;
     }
     
-    free_block_t* free_block = (free_block_t*)block_start;
-    free_block->size = block_size;
-    
-    heap_info->used_size -= block_size;
-    insert_free_block(free_block);
+    track_free(ptr);
+    segment_free(heap_info, ptr);
 }
 
+void kfree(void* ptr) {
+    spin_lock(&g_heap_lock);
+    kfree_block(ptr);
+    spin_unlock(&g_heap_lock);
+}
 
-void* krealloc(void* ptr, size_t size) {
+static void* krealloc_from(void* ptr, size_t size, uintptr_t caller) {
     if (!ptr) {
-        return kmalloc(size);
+        return kmalloc_from(size, caller);
     }
     
     if (size == 0) {
-        kfree(ptr);
+        kfree_block(ptr);
         return NULL;
     }
     
-    char* block_start = (char*)ptr - sizeof(size_t);
-    size_t old_size = *(size_t*)block_start;
-    size_t old_data_size = old_size - sizeof(size_t);
+    size_t old_data_size = block_usable_size(ptr);
+    u64 header = *(u64*)((char*)ptr - BLOCK_HEADER_SIZE);
+    if (header & (KSLAB_TAG | KLARGE_TAG)) {
+        // Slab and large objects that still fit their block are kept in place
+        if (size <= old_data_size) {
+            return ptr;
+        }
+    } else {
+        kheap_info_t* heap_info = kheap_get_info();
+        if (heap_info && segment_resize(heap_info, ptr, size)) {
+            track_resize(ptr, old_data_size);
+            return ptr;
+        }
+    }
     
-    void* new_ptr = kmalloc(size);
+    void* new_ptr = kmalloc_from(size, caller);
     if (!new_ptr) {
         return NULL;
     }
@@ -193,7 +831,14 @@ void* krealloc(void* ptr, size_t size) {
     size_t copy_size = (size < old_data_size) ? size : old_data_size;
     memcpy(new_ptr, ptr, copy_size);
     
-    kfree(ptr);
+    kfree_block(ptr);
+    return new_ptr;
+}
+
+void* krealloc(void* ptr, size_t size) {
+    spin_lock(&g_heap_lock);
+    void* new_ptr = krealloc_from(ptr, size, (uintptr_t)__builtin_return_address(0));
+    spin_unlock(&g_heap_lock);
     return new_ptr;
 }
 
@@ -205,6 +850,9 @@ u64 kmalloc_virt_to_phys(void* virt_ptr) {
     }
     
     uintptr_t virt_addr = (uintptr_t)virt_ptr;
+    if (large_owns(virt_addr)) {
+        return (u64)virt_addr - KLARGE_VIRT_BASE;
+    }
 
     for (size_t i = 0; i < heap_info->segment_count; i++) {
         uintptr_t seg_base = (uintptr_t)heap_info->segments[i].base_virt;
@@ -232,24 +880,64 @@ void kmalloc_debug_info(void) {
         return;
     }
     
+    // Snapshot under the lock, print after dropping it
+    spin_lock(&g_heap_lock);
+    kheap_info_t heap = *heap_info;
+    kslab_class_t classes[KSLAB_CLASS_COUNT];
+    memcpy(classes, g_slab_classes, sizeof(classes));
+    u8 slab_enabled = g_slab_enabled;
+    u64 large_live = g_large_live;
+    u64 large_bytes = g_large_bytes;
+    u64 large_total = g_large_total;
+    spin_unlock(&g_heap_lock);
+    
     vga_printf("=== Kernel Heap Info ===\n");
     vga_printf("Base: 0x%llx, Total Size: %llu KB, Used: %llu KB, Segments: %llu\n",
-              (u64)heap_info->base_virt,
-              heap_info->total_size / 1024,
-              heap_info->used_size / 1024,
-              (u64)heap_info->segment_count);
+              (u64)heap.base_virt,
+              heap.total_size / 1024,
+              heap.used_size / 1024,
+              (u64)heap.segment_count);
+    vga_printf("Grown %llu times; boot mapping %llu cycles, %llu page-table pages\n",
+              heap.grow_count, heap.init_cycles, heap.init_table_pages);
 
-    for (size_t i = 0; i < heap_info->segment_count; i++) {
+    for (size_t i = 0; i < heap.segment_count; i++) {
         vga_printf("  segment %llu: virt=0x%llx phys=0x%llx size=%llu KB\n",
                   (u64)i,
-                  (u64)heap_info->segments[i].base_virt,
-                  heap_info->segments[i].base_phys,
-                  heap_info->segments[i].size / 1024);
+                  (u64)heap.segments[i].base_virt,
+                  heap.segments[i].base_phys,
+                  heap.segments[i].size / 1024);
     }
     
-    if (kernel_mspace) {
-        vga_printf("dlmalloc memory space initialized\n");
-    } else {
-        vga_printf("dlmalloc memory space NOT initialized\n");
+    vga_printf("Slab classes (%s):\n", slab_enabled ? "enabled" : "disabled");
+    for (u32 i = 0; i < KSLAB_CLASS_COUNT; i++) {
+        const kslab_class_t* cls = &classes[i];
+        if (cls->slab_count == 0) continue;
+        vga_printf("  %llu B: slabs=%llu live=%llu\n",
+                  (u64)cls->obj_size, cls->slab_count, cls->live_objs);
+    }
+    
+    vga_printf("Large objects (>= %llu KB, 2M pages): live=%llu mapped=%llu KB total=%llu\n",
+              (u64)KLARGE_THRESHOLD / 1024, large_live, large_bytes / 1024, large_total);
+    
+#ifdef KMALLOC_BACKEND_DLMALLOC
+    vga_printf("Backend: dlmalloc (%llu mspaces)\n", (u64)kernel_mspace_count);
+    for (size_t i = 0; i < heap.segment_count; i++) {
+        // mallinfo walks every chunk; one mspace per lock hold
+        spin_lock(&g_heap_lock);
+        int present = kernel_mspaces[i] != 0;
+        struct mallinfo mi;
+        if (present) mi = mspace_mallinfo(kernel_mspaces[i]);
+        spin_unlock(&g_heap_lock);
+        if (!present) continue;
+        vga_printf("  mspace %llu: arena=%llu KB used=%llu KB free=%llu KB free_chunks=%llu top=%llu KB\n",
+                  (u64)i,
+                  (u64)mi.arena / 1024,
+                  (u64)mi.uordblks / 1024,
+                  (u64)mi.fordblks / 1024,
+                  (u64)mi.ordblks,
+                  (u64)mi.keepcost / 1024);
     }
+#else
+    vga_printf("Backend: first-fit free list\n");
+#endif
 }
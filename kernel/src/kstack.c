@@ -0,0 +1,121 @@
+#include <kstack.h>
+#include <memory_mapper.h>
+#include <pmm.h>
+#include <spinlock.h>
+#include <vgaio.h>
+
+// One slot per stack; everything in a slot below the stack stays unmapped
+// and acts as the guard region.
+#define KSTACK_VIRT_BASE 0xFFFFA20000000000ULL
+#define KSTACK_SLOT_SIZE (1ULL << 20)
+
+extern char __stack_top_hh[];
+extern char __stack_bottom_hh[];
+
+static kstack_t g_boot_stack;
+static kstack_t g_stacks[KSTACK_MAX_COUNT];
+static size_t g_retired_peak = 0;     // Deepest usage of any freed stack
+static spinlock_t g_kstack_lock = SPINLOCK_INIT("kstack");   // Guards g_stacks
+
+static void kstack_paint(u64 from, u64 to) {
+    for (u64* p = (u64*)(uintptr_t)from; p < (u64*)(uintptr_t)to; p++) {
+        *p = KSTACK_POISON;
+    }
+}
+
+void kstack_init(void) {
+    u64 rsp;
+    __asm__ volatile("mov %%rsp, %0" : "=r"(rsp));
+
+    g_boot_stack.base = (u64)(uintptr_t)__stack_top_hh;
+    g_boot_stack.top = (u64)(uintptr_t)__stack_bottom_hh;
+    g_boot_stack.size = (size_t)(g_boot_stack.top - g_boot_stack.base);
+    g_boot_stack.phys = 0;
+    g_boot_stack.owner = "boot";
+    g_boot_stack.in_use = 1;
+
+    // Leave a margin below the live frame for this function's own calls
+    kstack_paint(g_boot_stack.base, (rsp - 512) & ~7ULL);
+}
+
+kstack_t* kstack_alloc(size_t size, const char* owner) {
+    if (size == 0) size = KSTACK_DEFAULT_SIZE;
+    size = (size + PAGE_4K - 1) & ~(size_t)(PAGE_4K - 1);
+    if (size > KSTACK_MAX_SIZE) return NULL;
+
+    spin_lock(&g_kstack_lock);
+    u32 slot = 0;
+    while (slot < KSTACK_MAX_COUNT && g_stacks[slot].in_use) slot++;
+    if (slot == KSTACK_MAX_COUNT) {
+        spin_unlock(&g_kstack_lock);
+        vga_printf("kstack: No free stack slots\n");
+        return NULL;
+    }
+
+    u64 phys = pmm_alloc_contiguous(size);
+    u64 top = KSTACK_VIRT_BASE + (u64)(slot + 1) * KSTACK_SLOT_SIZE;
+    u64 base = top - size;
+    if (!phys || !mm_map_range(base, phys, size, PTE_RW | PTE_PRESENT)) {
+        if (phys) pmm_free_contiguous(phys, size);
+        spin_unlock(&g_kstack_lock);
+        return NULL;
+    }
+
+    kstack_t* stack = &g_stacks[slot];
+    stack->base = base;
+    stack->top = top;
+    stack->size = size;
+    stack->phys = phys;
+    stack->owner = owner ? owner : "unknown";
+    kstack_paint(base, top);
+    stack->in_use = 1;
+    spin_unlock(&g_kstack_lock);
+    return stack;
+}
+
+void kstack_free(kstack_t* stack) {
+    if (!stack || !stack->in_use || stack == &g_boot_stack) return;
+
+    spin_lock(&g_kstack_lock);
+    size_t peak = kstack_high_water(stack);
+    if (peak > g_retired_peak) g_retired_peak = peak;
+    // The slot's address range is reused as soon as it is marked free
+    mm_unmap_range(stack->base, stack->size);
+    pmm_free_contiguous(stack->phys, stack->size);
+    stack->in_use = 0;
+    spin_unlock(&g_kstack_lock);
+}
+
+size_t kstack_high_water(const kstack_t* stack) {
+    if (!stack || !stack->in_use) return 0;
+    const u64* p = (const u64*)(uintptr_t)stack->base;
+    const u64* end = (const u64*)(uintptr_t)stack->top;
+    while (p < end && *p == KSTACK_POISON) p++;
+    return (size_t)(stack->top - (u64)(uintptr_t)p);
+}
+
+kstack_t* kstack_guard_owner(u64 addr) {
+    if (addr < KSTACK_VIRT_BASE || addr >= KSTACK_VIRT_BASE + KSTACK_MAX_COUNT * KSTACK_SLOT_SIZE) {
+        return NULL;
+    }
+    kstack_t* stack = &g_stacks[(addr - KSTACK_VIRT_BASE) / KSTACK_SLOT_SIZE];
+    if (!stack->in_use || addr >= stack->base) return NULL;
+    return stack;
+}
+
+static void kstack_print(const kstack_t* stack) {
+    size_t peak = kstack_high_water(stack);
+    vga_printf("  %s: %llu KB, peak %llu KB (%llu%%) at 0x%llx\n",
+              stack->owner, (u64)stack->size / 1024, (u64)peak / 1024,
+              stack->size ? ((u64)peak * 100) / stack->size : 0, stack->base);
+}
+
+void kstack_debug_info(void) {
+    vga_printf("=== Kernel stacks ===\n");
+    if (g_boot_stack.in_use) kstack_print(&g_boot_stack);
+    for (u32 i = 0; i < KSTACK_MAX_COUNT; i++) {
+        if (g_stacks[i].in_use) kstack_print(&g_stacks[i]);
+    }
+    vga_printf("Deepest freed stack: %llu KB (default size %llu KB)\n",
+              (u64)g_retired_peak / 1024, (u64)KSTACK_DEFAULT_SIZE / 1024);
+}
@@ -0,0 +1,21 @@
+; kstack_switch.asm - Run a function on another kernel stack
+section .text
+
+global kstack_call
+
+; long kstack_call(u64 stack_top, long (*fn)(void*), void* arg)
+; rdi = new stack top (16-byte aligned), rsi = fn, rdx = arg
+kstack_call:
+    push rbp
+    mov rbp, rsp
+
+    ; Switch stacks; the caller's rsp is kept in rbp (callee-saved)
+    mov rsp, rdi
+    mov rax, rsi
+    mov rdi, rdx
+    call rax
+
+    ; Back to the caller's stack with fn's return value in rax
+    mov rsp, rbp
+    pop rbp
+    ret
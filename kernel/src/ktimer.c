@@ -0,0 +1,238 @@
+#include <ktimer.h>
+#include <pit/pit.h>
+#include <apic/apic.h>
+#include <vgaio.h>
+
+#define RFLAGS_IF (1ULL << 9)
+
+#define WHEEL_MASK (KTIMER_WHEEL_SLOTS - 1)
+#define WHEEL_SPAN (1ULL << (KTIMER_WHEEL_BITS * KTIMER_WHEEL_LEVELS))
+
+static ktimer_t* g_wheel[KTIMER_WHEEL_LEVELS][KTIMER_WHEEL_SLOTS];
+static u64 g_occupied[KTIMER_WHEEL_LEVELS];    // Non-empty bucket bitmaps
+static u64 g_wheel_tick = 0;                    // Next tick the wheel processes
+static u32 g_count = 0;
+static u64 g_fired = 0;
+static u64 g_cascaded = 0;
+static u64 g_idle_halts = 0;
+static u64 g_tickless_halts = 0;
+static u64 g_tickless_ticks = 0;
+
+static inline u64 ktimer_irq_save(void) {
+    u64 flags;
+    __asm__ volatile ("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void ktimer_irq_restore(u64 flags) {
+    if (flags & RFLAGS_IF) __asm__ volatile ("sti" ::: "memory");
+}
+
+static u64 ktimer_ms_to_ticks(u64 ms) {
+    u32 hz = pit_get_hz();
+    if (hz == 0) hz = 1000;
+    u64 ticks = (ms * hz + 999) / 1000ULL;
+    return ticks ? ticks : 1;
+}
+
+static void list_push(ktimer_t** head, ktimer_t* timer) {
+    timer->next = *head;
+    if (*head) (*head)->pprev = &timer->next;
+    *head = timer;
+    timer->pprev = head;
+}
+
+// Level 0 buckets hold the next 64 ticks one tick each; a level L bucket
+// covers 64^L ticks and is cascaded into lower levels when the wheel
+// reaches the start of its range.
+static void wheel_add(ktimer_t* timer) {
+    u64 expires = timer->deadline;
+    if (expires < g_wheel_tick) expires = g_wheel_tick;
+    u64 delta = expires - g_wheel_tick;
+    if (delta >= WHEEL_SPAN) {
+        expires = g_wheel_tick + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+    u32 level = 0;
+    while (delta >> (KTIMER_WHEEL_BITS * (level + 1))) level++;
+    u32 idx = (u32)(expires >> (KTIMER_WHEEL_BITS * level)) & WHEEL_MASK;
+
+    list_push(&g_wheel[level][idx], timer);
+    timer->slot = level * KTIMER_WHEEL_SLOTS + idx + 1;
+    g_occupied[level] |= 1ULL << idx;
+}
+
+static void wheel_remove(ktimer_t* timer) {
+    u32 level = (timer->slot - 1) / KTIMER_WHEEL_SLOTS;
+    u32 idx = (timer->slot - 1) % KTIMER_WHEEL_SLOTS;
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    if (!g_wheel[level][idx]) g_occupied[level] &= ~(1ULL << idx);
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->slot = 0;
+}
+
+// Move a bucket onto a private list. Its timers keep their slot, so
+// ktimer_cancel still unlinks them while they wait there.
+static void wheel_take(u32 level, u32 idx, ktimer_t** list) {
+    *list = g_wheel[level][idx];
+    if (*list) (*list)->pprev = list;
+    g_wheel[level][idx] = NULL;
+    g_occupied[level] &= ~(1ULL << idx);
+}
+
+static void wheel_cascade(u64 tick) {
+    for (u32 level = 1; level < KTIMER_WHEEL_LEVELS; level++) {
+        u32 shift = KTIMER_WHEEL_BITS * level;
+        if (tick & ((1ULL << shift) - 1)) break;
+        ktimer_t* list;
+        wheel_take(level, (u32)(tick >> shift) & WHEEL_MASK, &list);
+        while (list) {
+            ktimer_t* timer = list;
+            wheel_remove(timer);
+            wheel_add(timer);
+            g_cascaded++;
+        }
+    }
+}
+
+void ktimer_init(ktimer_t* timer, ktimer_fn_t fn, void* arg) {
+    timer->deadline = 0;
+    timer->period = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->slot = 0;
+}
+
+static void ktimer_arm(ktimer_t* timer, u64 deadline, u64 period) {
+    u64 flags = ktimer_irq_save();
+    if (timer->slot) wheel_remove(timer);
+    else g_count++;
+    timer->deadline = deadline;
+    timer->period = period;
+    wheel_add(timer);
+    ktimer_irq_restore(flags);
+}
+
+void ktimer_start(ktimer_t* timer, u64 delay_ms, u64 period_ms) {
+    u64 period = period_ms ? ktimer_ms_to_ticks(period_ms) : 0;
+    ktimer_arm(timer, pit_ticks() + ktimer_ms_to_ticks(delay_ms), period);
+}
+
+void ktimer_start_at(ktimer_t* timer, u64 deadline) {
+    ktimer_arm(timer, deadline, 0);
+}
+
+int ktimer_cancel(ktimer_t* timer) {
+    u64 flags = ktimer_irq_save();
+    int was_pending = timer->slot != 0;
+    if (was_pending) {
+        wheel_remove(timer);
+        g_count--;
+    }
+    ktimer_irq_restore(flags);
+    return was_pending;
+}
+
+u64 ktimer_next_deadline(void) {
+    u64 best = KTIMER_NEVER;
+    for (u32 level = 0; level < KTIMER_WHEEL_LEVELS; level++) {
+        u64 bits = g_occupied[level];
+        if (!bits) continue;
+        // First bucket at or after the wheel position that is processed
+        // (level 0) or cascaded (higher levels)
+        u32 shift = KTIMER_WHEEL_BITS * level;
+        u64 block = g_wheel_tick >> shift;
+        if (g_wheel_tick & ((1ULL << shift) - 1)) block++;
+        u32 rot = (u32)block & WHEEL_MASK;
+        if (rot) bits = (bits >> rot) | (bits << (KTIMER_WHEEL_SLOTS - rot));
+        u64 tick = (block + (u64)__builtin_ctzll(bits)) << shift;
+        if (tick < best) best = tick;
+    }
+    return best;
+}
+
+void ktimer_run_expired(u64 now) {
+    while (g_wheel_tick <= now) {
+        // Skip straight to the next tick with a due bucket or a cascade
+        u64 next = ktimer_next_deadline();
+        if (next > now) {
+            g_wheel_tick = now + 1;
+            break;
+        }
+        if (next > g_wheel_tick) g_wheel_tick = next;
+
+        u64 tick = g_wheel_tick;
+        wheel_cascade(tick);
+        ktimer_t* list;
+        wheel_take(0, (u32)tick & WHEEL_MASK, &list);
+        // Timers armed by the callbacks below land on later ticks
+        g_wheel_tick = tick + 1;
+
+        while (list) {
+            ktimer_t* timer = list;
+            wheel_remove(timer);
+            if (timer->deadline > tick) {
+                // Parked beyond the wheel span; file it again
+                wheel_add(timer);
+                continue;
+            }
+            if (timer->period) {
+                // Re-arm before the callback so it may cancel itself. A
+                // timer that fell behind skips the missed periods.
+                timer->deadline += timer->period;
+                if (timer->deadline <= tick) timer->deadline = tick + timer->period;
+                wheel_add(timer);
+            } else {
+                g_count--;
+            }
+            g_fired++;
+            timer->fn(timer->arg);
+        }
+    }
+}
+
+void ktimer_idle(void) {
+    g_idle_halts++;
+    u64 now = pit_ticks();
+    u64 next = ktimer_next_deadline();
+    u64 wait = next == KTIMER_NEVER ? KTIMER_NEVER : (next > now ? next - now : 0);
+
+    // One tick or less away: the periodic tick is already the right wakeup
+    if (wait <= 1 || !pit_oneshot_begin(wait)) {
+        __asm__ volatile ("sti; hlt; cli" ::: "memory");
+        return;
+    }
+
+    // Nothing else is runnable, so the scheduler tick has nothing to do
+    apic_timer_pause();
+    g_tickless_halts++;
+    __asm__ volatile ("sti; hlt; cli" ::: "memory");
+    pit_oneshot_end();
+    g_tickless_ticks += pit_ticks() - now;
+    apic_timer_resume();
+}
+
+void ktimer_debug_info(void) {
+    u64 flags = ktimer_irq_save();
+    u32 count = g_count;
+    u64 next = ktimer_next_deadline();
+    u32 buckets[KTIMER_WHEEL_LEVELS];
+    for (u32 level = 0; level < KTIMER_WHEEL_LEVELS; level++) {
+        buckets[level] = (u32)__builtin_popcountll(g_occupied[level]);
+    }
+    ktimer_irq_restore(flags);
+
+    vga_printf("=== Timers ===\n");
+    vga_printf("Armed: %u  fired: %llu  cascaded: %llu\n", count, g_fired, g_cascaded);
+    vga_printf("Wheel buckets in use: %u/%u/%u/%u (1, 64, 4096, 262144 ticks each)\n",
+              buckets[0], buckets[1], buckets[2], buckets[3]);
+    if (next != KTIMER_NEVER) {
+        vga_printf("Next deadline in %llu ticks\n", next > pit_ticks() ? next - pit_ticks() : 0);
+    }
+    vga_printf("Idle halts: %llu (%llu tickless, %llu ticks slept)\n",
+              g_idle_halts, g_tickless_halts, g_tickless_ticks);
+}
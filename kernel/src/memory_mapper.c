@@ -1,5 +1,10 @@
 #include "memory_mapper.h"
 #include "cldtypes.h"
+#include "pmm.h"
+#include "cpu.h"
+#include "spinlock.h"
+#include "smp.h"
+#include <apic/apic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -19,39 +24,203 @@ static struct {
     u64 table_virt_base_pending; // Stored for later use
     size_t table_size;
     size_t next_free;
+    pte_t *free_tables;     // Released tables from the bootstrap region
+    u64 pmm_tables;         // Tables currently borrowed from the frame allocator
     pte_t *pml4;
+    u64 pml4_phys;
+    u8 has_1g_pages;
+    u64 page_flushes;
+    u64 full_flushes;
+    u64 shootdowns;
     u8 initialized;
 } mm = {0};
 
+// Guards the kernel page tables, the user spaces' tables and the table-page pool
+static spinlock_t mm_lock = SPINLOCK_INIT("mm");
+
+// Kernel-table shootdowns: the initiator bumps g_tlb_gen and waits until
+// every other online CPU has flushed and recorded it in cpu_t.tlb_gen.
+// tlb_lock keeps one shootdown in flight at a time.
+static volatile u64 g_tlb_gen = 0;
+static spinlock_t tlb_lock = SPINLOCK_INIT("tlb");
+
+// Batched invalidation: individual invlpg up to this many pages, one full
+// flush of the current address space beyond it.
+#define MM_INVLPG_THRESHOLD 32
+
+// Tables live either in the bootstrap region reserved by mm_init or in
+// frames from the buddy allocator, which are reached via the identity map.
+static inline u8 in_bootstrap_region(u64 phys) {
+    return phys >= mm.table_phys_base && phys < mm.table_phys_base + mm.table_size;
+}
 static inline void *phys_to_virt(u64 phys) {
-    if (!mm.table_virt_base) return (void *)(uintptr_t)phys;
+    if (!mm.table_virt_base || !in_bootstrap_region(phys)) return (void *)(uintptr_t)phys;
     return (void *)((uintptr_t)mm.table_virt_base + (phys - mm.table_phys_base));
 }
 static inline u64 virt_to_phys(void *vptr) {
-    if (!mm.table_virt_base) return (u64)(uintptr_t)vptr;
-    return mm.table_phys_base + ((uintptr_t)vptr - (uintptr_t)mm.table_virt_base);
+    uintptr_t v = (uintptr_t)vptr;
+    uintptr_t base = (uintptr_t)mm.table_virt_base;
+    if (!mm.table_virt_base || v < base || v >= base + mm.table_size) return (u64)v;
+    return mm.table_phys_base + (v - base);
 }
 
 static pte_t *alloc_table_page(void) {
     if (!mm.initialized) return NULL;
+    if (mm.free_tables) {
+        pte_t *t = mm.free_tables;
+        mm.free_tables = *(pte_t **)t;
+        memset(t, 0, _PAGE_SIZE_4K);
+        return t;
+    }
     size_t off = (mm.next_free + (_PAGE_SIZE_4K - 1)) & ~((size_t)(_PAGE_SIZE_4K - 1));
-    if (off + _PAGE_SIZE_4K > mm.table_size) return NULL;
+    if (off + _PAGE_SIZE_4K > mm.table_size) {
+        // Bootstrap region exhausted: fall back to the frame allocator
+        u64 phys = pmm_alloc_pages(0);
+        if (!phys) return NULL;
+        void *v = pmm_phys_to_virt(phys);
+        memset(v, 0, _PAGE_SIZE_4K);
+        mm.pmm_tables++;
+        return (pte_t *)v;
+    }
     void *v = phys_to_virt(mm.table_phys_base + off);
     memset(v, 0, _PAGE_SIZE_4K);
     mm.next_free = off + _PAGE_SIZE_4K;
     return (pte_t *)v;
 }
 
-static pte_t *get_or_alloc_next_table(pte_t *parent_table, unsigned idx) {
+static void free_table_page(pte_t *table) {
+    u64 phys = virt_to_phys(table);
+    if (in_bootstrap_region(phys)) {
+        *(pte_t **)table = mm.free_tables;
+        mm.free_tables = table;
+        return;
+    }
+    pmm_free_pages(phys, 0);
+    mm.pmm_tables--;
+}
+
+static inline u8 table_is_empty(const pte_t *table) {
+    for (unsigned i = 0; i < 512; i++) {
+        if (table[i] & PTE_PRESENT) return 0;
+    }
+    return 1;
+}
+
+static inline void flush_tlb_page(u64 virtual_addr) {
+    __asm__ volatile ("invlpg (%0)" :: "r"(virtual_addr) : "memory");
+    mm.page_flushes++;
+}
+
+// Flush every non-global translation of the running address space
+static void flush_tlb_all(void) {
+    mm.full_flushes++;
+    write_cr3(read_cr3());
+}
+
+typedef struct {
+    u64 addrs[MM_INVLPG_THRESHOLD];
+    u32 count;
+    u8 overflow;
+    u8 shared;              // Kernel tables, cached by every CPU
+    pte_t *freed_tables;    // Emptied tables, released after the flush
+} tlb_batch_t;
+
+static void tlb_batch_add(tlb_batch_t *batch, u64 virtual_addr) {
+    if (batch->overflow) return;
+    if (batch->count == MM_INVLPG_THRESHOLD) {
+        batch->overflow = 1;
+        return;
+    }
+    batch->addrs[batch->count++] = virtual_addr;
+}
+
+static void tlb_batch_free_table(tlb_batch_t *batch, pte_t *table) {
+    *(pte_t **)table = batch->freed_tables;
+    batch->freed_tables = table;
+}
+
+void mm_tlb_poll(void) {
+    u64 gen = __atomic_load_n(&g_tlb_gen, __ATOMIC_ACQUIRE);
+    if (gen == 0) return;
+    cpu_t *cpu = this_cpu();
+    if (__atomic_load_n(&cpu->tlb_gen, __ATOMIC_RELAXED) == gen) return;
+    // With interrupts off so the flush IPI cannot nest in here and record
+    // an older generation after a newer one
+    u64 flags;
+    __asm__ volatile ("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    gen = __atomic_load_n(&g_tlb_gen, __ATOMIC_ACQUIRE);
+    write_cr3(read_cr3());
+    __atomic_store_n(&cpu->tlb_gen, gen, __ATOMIC_RELEASE);
+    if (flags & (1ULL << 9)) __asm__ volatile ("sti" ::: "memory");
+}
+
+// Make every other online CPU flush its TLB and paging-structure caches.
+// The kernel tables are shared by all CPUs, so this runs before anything
+// unmapped from them or a table emptied in them is reused. Caller holds
+// mm_lock with interrupts off and has already flushed locally.
+static void tlb_shootdown(void) {
+    u32 count = smp_cpu_count();
+    if (count <= 1) return;
+    spin_lock(&tlb_lock);
+    cpu_t *self = this_cpu();
+    u64 gen = g_tlb_gen + 1;
+    self->tlb_gen = gen;
+    __atomic_store_n(&g_tlb_gen, gen, __ATOMIC_RELEASE);
+    for (u32 i = 0; i < count; i++) {
+        cpu_t *cpu = smp_cpu(i);
+        if (cpu && cpu != self && cpu->online) apic_send_ipi(cpu->apic_id, APIC_TLB_VECTOR);
+    }
+    // A CPU running a task with interrupts off answers once it finishes
+    // or spins on a lock
+    for (u32 i = 0; i < count; i++) {
+        cpu_t *cpu = smp_cpu(i);
+        if (!cpu || cpu == self || !cpu->online) continue;
+        while (__atomic_load_n(&cpu->tlb_gen, __ATOMIC_ACQUIRE) < gen) __asm__ volatile ("pause");
+    }
+    mm.shootdowns++;
+    spin_unlock(&tlb_lock);
+}
+
+static void tlb_batch_finish(tlb_batch_t *batch) {
+    // invlpg also drops cached paging-structure entries, so freed tables are
+    // only released once one of the two flushes below has run, here and on
+    // every other CPU for the kernel tables.
+    if (batch->overflow || (batch->freed_tables && batch->count == 0)) {
+        flush_tlb_all();
+    } else {
+        for (u32 i = 0; i < batch->count; i++) flush_tlb_page(batch->addrs[i]);
+    }
+    if (batch->shared && (batch->count || batch->overflow || batch->freed_tables)) {
+        tlb_shootdown();
+    }
+    while (batch->freed_tables) {
+        pte_t *t = batch->freed_tables;
+        batch->freed_tables = *(pte_t **)t;
+        free_table_page(t);
+    }
+}
+
+static inline void set_entry(pte_t *slot, pte_t entry, u64 virtual_addr, tlb_batch_t *batch) {
+    pte_t old = *slot;
+    *slot = entry;
+    if (old & PTE_PRESENT) tlb_batch_add(batch, virtual_addr);
+}
+
+static pte_t *get_or_alloc_next_table(pte_t *parent_table, unsigned idx, u64 flags) {
+    // User pages need PTE_USER at every level; kernel mappings never set it
+    pte_t user = flags & PTE_USER;
     pte_t entry = parent_table[idx];
     if (entry & PTE_PRESENT) {
+        // A large page already covers this range; there is no table below
+        if (entry & PTE_HUGE) return NULL;
+        parent_table[idx] = entry | user;
         u64 child_phys = entry & 0x000FFFFFFFFFF000ULL;
         return (pte_t *)phys_to_virt(child_phys);
     }
     pte_t *child = alloc_table_page();
     if (!child) return NULL;
     u64 child_phys = virt_to_phys(child) & 0x000FFFFFFFFFF000ULL;
-    parent_table[idx] = (pte_t)(child_phys | PTE_PRESENT | PTE_RW);
+    parent_table[idx] = (pte_t)(child_phys | PTE_PRESENT | PTE_RW | user);
     return child;
 }
 
@@ -139,6 +308,7 @@ u64 mm_init(struct memory_info* minfo, u64 table_virt_base) {
     mm.next_free = 0;
     mm.pml4 = NULL;
     mm.table_virt_base = NULL;
+    mm.has_1g_pages = cpu_has_pdpe1gb();
     mm.initialized = 1;
     pte_t *p = alloc_table_page();
     if (!p) {
@@ -146,9 +316,19 @@ u64 mm_init(struct memory_info* minfo, u64 table_virt_base) {
         return 0;
     }
     mm.pml4 = p;
+
+    // Every kernel-half PDPT exists from the start, so the PML4 entries that
+    // address spaces copy never change (1 MiB of tables)
+    for (unsigned i = 256; i < 512; i++) {
+        if (!get_or_alloc_next_table(mm.pml4, i, 0)) {
+            mm.initialized = 0;
+            return 0;
+        }
+    }
     
     // Calculate PML4 physical address while still using physical addressing
     u64 pml4_phys = virt_to_phys((void *)mm.pml4) & 0x000FFFFFFFFFF000ULL;
+    mm.pml4_phys = pml4_phys;
 
     // Store the table virtual base for later use but keep using physical for now
     mm.table_virt_base_pending = table_virt_base;
@@ -162,10 +342,8 @@ u8 mm_enable_virtual_tables(void) {
     if (!mm.initialized || !mm.table_virt_base_pending) return 0;
     
     // Map the entire page table area to virtual space
-    for (u64 offset = 0; offset < mm.table_size; offset += PAGE_4K) {
-        if (!mm_map(mm.table_virt_base_pending + offset, mm.table_phys_base + offset, PTE_PRESENT | PTE_RW, PAGE_4K)) {
-            return 0;
-        }
+    if (!mm_map_range(mm.table_virt_base_pending, mm.table_phys_base, mm.table_size, PTE_PRESENT | PTE_RW)) {
+        return 0;
     }
     
     // Now switch to virtual addressing
@@ -174,12 +352,14 @@ u8 mm_enable_virtual_tables(void) {
     return 1; // Success
 }
 
-u8 mm_map(u64 virtual_addr, u64 physical_addr, u64 flags, size_t page_size) {
+static u8 map_page(u64 virtual_addr, u64 physical_addr, u64 flags, size_t page_size,
+                   tlb_batch_t *batch) {
     if (!mm.initialized) return 0;
     if (!is_canonical(virtual_addr) || !is_canonical(physical_addr)) return 0;
     u8 huge = (flags & PTE_HUGE) ? 1 : 0;
-    if (huge) page_size = PAGE_2M;
-    if (page_size != PAGE_4K && page_size != PAGE_2M) return 0;
+    if (huge && page_size != PAGE_1G) page_size = PAGE_2M;
+    if (page_size == PAGE_1G && !mm.has_1g_pages) return 0;
+    if (page_size != PAGE_4K && page_size != PAGE_2M && page_size != PAGE_1G) return 0;
     if (!is_aligned(virtual_addr, page_size) || !is_aligned(physical_addr, page_size)) return 0;
     pte_t *pml4 = mm.pml4;
     if (!pml4) return 0;
@@ -187,31 +367,40 @@ u8 mm_map(u64 virtual_addr, u64 physical_addr, u64 flags, size_t page_size) {
     unsigned i_pdpt = IDX_PDPT(virtual_addr);
     unsigned i_pd   = IDX_PD(virtual_addr);
     unsigned i_pt   = IDX_PT(virtual_addr);
-    pte_t *pdpt = get_or_alloc_next_table(pml4, i_pml4);
+    pte_t *pdpt = get_or_alloc_next_table(pml4, i_pml4, flags);
     if (!pdpt) return 0;
-    pte_t *pd = get_or_alloc_next_table(pdpt, i_pdpt);
+    if (page_size == PAGE_1G) {
+        // Refuse to silently drop a directory that is already populated
+        if ((pdpt[i_pdpt] & PTE_PRESENT) && !(pdpt[i_pdpt] & PTE_HUGE)) return 0;
+        u64 paddr_field = physical_addr & 0x000FFFFFC0000000ULL;
+        pte_t entry = (pte_t)(paddr_field | (flags & ~(PTE_HUGE)) | PTE_PRESENT | PTE_HUGE);
+        if (flags & PTE_NX) entry |= PTE_NX;
+        set_entry(&pdpt[i_pdpt], entry, virtual_addr, batch);
+        return 1;
+    }
+    pte_t *pd = get_or_alloc_next_table(pdpt, i_pdpt, flags);
     if (!pd) return 0;
     if (page_size == PAGE_2M) {
         u64 paddr_field = physical_addr & 0x000FFFFFFFFFF000ULL;
         pte_t entry = (pte_t)(paddr_field | (flags & ~(PTE_HUGE)) | PTE_PRESENT | PTE_HUGE);
         if (flags & PTE_NX) entry |= PTE_NX;
-        pd[i_pd] = entry;
+        set_entry(&pd[i_pd], entry, virtual_addr, batch);
         return 1;
     } else {
-        pte_t *pt = get_or_alloc_next_table(pd, i_pd);
+        pte_t *pt = get_or_alloc_next_table(pd, i_pd, flags);
         if (!pt) return 0;
         u64 paddr_field = physical_addr & 0x000FFFFFFFFFF000ULL;
         pte_t entry = (pte_t)(paddr_field | (flags & ~(PTE_HUGE)) | PTE_PRESENT);
         if (flags & PTE_NX) entry |= PTE_NX;
-        pt[i_pt] = entry;
+        set_entry(&pt[i_pt], entry, virtual_addr, batch);
         return 1;
     }
 }
 
-u8 mm_unmap(u64 virtual_addr, size_t page_size) {
+static u8 unmap_page(u64 virtual_addr, size_t page_size, tlb_batch_t *batch) {
     if (!mm.initialized) return 0;
     if (!is_canonical(virtual_addr)) return 0;
-    if (page_size != PAGE_4K && page_size != PAGE_2M) return 0;
+    if (page_size != PAGE_4K && page_size != PAGE_2M && page_size != PAGE_1G) return 0;
     if (!is_aligned(virtual_addr, page_size)) return 0;
     pte_t *pml4 = mm.pml4;
     if (!pml4) return 0;
@@ -224,18 +413,315 @@ u8 mm_unmap(u64 virtual_addr, size_t page_size) {
     pte_t *pdpt = (pte_t *)phys_to_virt(e_pml4 & 0x000FFFFFFFFFF000ULL);
     pte_t e_pdpt = pdpt[i_pdpt];
     if (!(e_pdpt & PTE_PRESENT)) return 0;
+    if (page_size == PAGE_1G) {
+        if (!(e_pdpt & PTE_HUGE)) return 0;
+        pdpt[i_pdpt] = 0;
+        tlb_batch_add(batch, virtual_addr);
+        if (i_pml4 >= 256 || !table_is_empty(pdpt)) return 1;
+        pml4[i_pml4] = 0;
+        tlb_batch_free_table(batch, pdpt);
+        return 1;
+    }
+    if (e_pdpt & PTE_HUGE) return 0;
     pte_t *pd = (pte_t *)phys_to_virt(e_pdpt & 0x000FFFFFFFFFF000ULL);
     pte_t e_pd = pd[i_pd];
     if (!(e_pd & PTE_PRESENT)) return 0;
     if (page_size == PAGE_2M) {
+        if (!(e_pd & PTE_HUGE)) return 0;
         pd[i_pd] = 0;
-        return 1;
+        tlb_batch_add(batch, virtual_addr);
     } else {
+        if (e_pd & PTE_HUGE) return 0;
         pte_t *pt = (pte_t *)phys_to_virt(e_pd & 0x000FFFFFFFFFF000ULL);
         pte_t e_pt = pt[i_pt];
         if (!(e_pt & PTE_PRESENT)) return 0;
         pt[i_pt] = 0;
-        return 1;
+        // Emptied tables are only handed out again after the flush
+        tlb_batch_add(batch, virtual_addr);
+        if (!table_is_empty(pt)) return 1;
+        pd[i_pd] = 0;
+        tlb_batch_free_table(batch, pt);
+    }
+    if (!table_is_empty(pd)) return 1;
+    pdpt[i_pdpt] = 0;
+    tlb_batch_free_table(batch, pd);
+    // Kernel-half PML4 entries stay fixed so copies of them remain valid
+    if (i_pml4 >= 256 || !table_is_empty(pdpt)) return 1;
+    pml4[i_pml4] = 0;
+    tlb_batch_free_table(batch, pdpt);
+    return 1;
+}
+
+u8 mm_map(u64 virtual_addr, u64 physical_addr, u64 flags, size_t page_size) {
+    tlb_batch_t batch = {0};
+    batch.shared = 1;
+    u64 irq = spin_lock_irqsave(&mm_lock);
+    u8 ok = map_page(virtual_addr, physical_addr, flags, page_size, &batch);
+    tlb_batch_finish(&batch);
+    spin_unlock_irqrestore(&mm_lock, irq);
+    return ok;
+}
+
+u8 mm_unmap(u64 virtual_addr, size_t page_size) {
+    tlb_batch_t batch = {0};
+    batch.shared = 1;
+    u64 irq = spin_lock_irqsave(&mm_lock);
+    u8 ok = unmap_page(virtual_addr, page_size, &batch);
+    tlb_batch_finish(&batch);
+    spin_unlock_irqrestore(&mm_lock, irq);
+    return ok;
+}
+
+// Span of virtual memory covered by one entry at each level (0 = PT)
+static inline u64 level_span(int level) {
+    return 1ULL << (12 + 9 * level);
+}
+
+static u8 map_range_in_table(pte_t *table, int level, u64 va, u64 end,
+                             u64 phys, u64 flags, tlb_batch_t *batch) {
+    u64 span = level_span(level);
+    u8 allow_large = (flags & PTE_HUGE) &&
+                     (level == 1 || (level == 2 && mm.has_1g_pages));
+    while (va < end) {
+        unsigned idx = (unsigned)((va >> (12 + 9 * level)) & 0x1FF);
+        u64 next = (va | (span - 1)) + 1;
+        if (next == 0 || next > end) next = end;
+
+        if (level == 0 || (allow_large && next - va == span &&
+                           is_aligned(va, span) && is_aligned(phys, span))) {
+            pte_t old = table[idx];
+            if (level > 0 && (old & PTE_PRESENT) && !(old & PTE_HUGE)) return 0;
+            pte_t entry = (pte_t)((phys & 0x000FFFFFFFFFF000ULL) | (flags & ~PTE_HUGE) | PTE_PRESENT);
+            if (level > 0) entry |= PTE_HUGE;
+            table[idx] = entry;
+            if (old & PTE_PRESENT) tlb_batch_add(batch, va);
+        } else {
+            pte_t *child = get_or_alloc_next_table(table, idx, flags);
+            if (!child) return 0;
+            if (!map_range_in_table(child, level - 1, va, next, phys, flags, batch)) return 0;
+        }
+        phys += next - va;
+        va = next;
+    }
+    return 1;
+}
+
+static void unmap_range_in_table(pte_t *table, int level, u64 va, u64 end, tlb_batch_t *batch) {
+    u64 span = level_span(level);
+    while (va < end) {
+        unsigned idx = (unsigned)((va >> (12 + 9 * level)) & 0x1FF);
+        u64 next = (va | (span - 1)) + 1;
+        if (next == 0 || next > end) next = end;
+        pte_t entry = table[idx];
+
+        if (!(entry & PTE_PRESENT)) {
+            // Nothing mapped here
+        } else if (level == 0 || (entry & PTE_HUGE)) {
+            // Large pages are only removed when fully covered
+            if (next - va == span && is_aligned(va, span)) {
+                table[idx] = 0;
+                tlb_batch_add(batch, va);
+            }
+        } else {
+            pte_t *child = (pte_t *)phys_to_virt(entry & 0x000FFFFFFFFFF000ULL);
+            unmap_range_in_table(child, level - 1, va, next, batch);
+            // Kernel-half PML4 entries stay fixed so copies of them remain valid
+            u8 keep = (level == 3 && idx >= 256);
+            if (!keep && table_is_empty(child)) {
+                table[idx] = 0;
+                tlb_batch_free_table(batch, child);
+            }
+        }
+        va = next;
+    }
+}
+
+u8 mm_map_range(u64 virtual_addr, u64 physical_addr, u64 size, u64 flags) {
+    if (!mm.initialized || !mm.pml4 || size == 0) return 0;
+    if (!is_canonical(virtual_addr) || !is_canonical(virtual_addr + size - 1)) return 0;
+    if (!is_aligned(virtual_addr, PAGE_4K) || !is_aligned(physical_addr, PAGE_4K) ||
+        !is_aligned(size, PAGE_4K)) return 0;
+    tlb_batch_t batch = {0};
+    batch.shared = 1;
+    u64 irq = spin_lock_irqsave(&mm_lock);
+    u8 ok = map_range_in_table(mm.pml4, 3, virtual_addr, virtual_addr + size,
+                               physical_addr, flags, &batch);
+    tlb_batch_finish(&batch);
+    spin_unlock_irqrestore(&mm_lock, irq);
+    return ok;
+}
+
+u8 mm_unmap_range(u64 virtual_addr, u64 size) {
+    if (!mm.initialized || !mm.pml4 || size == 0) return 0;
+    if (!is_canonical(virtual_addr) || !is_canonical(virtual_addr + size - 1)) return 0;
+    if (!is_aligned(virtual_addr, PAGE_4K) || !is_aligned(size, PAGE_4K)) return 0;
+    tlb_batch_t batch = {0};
+    batch.shared = 1;
+    u64 irq = spin_lock_irqsave(&mm_lock);
+    unmap_range_in_table(mm.pml4, 3, virtual_addr, virtual_addr + size, &batch);
+    tlb_batch_finish(&batch);
+    spin_unlock_irqrestore(&mm_lock, irq);
+    return 1;
+}
+
+static inline u8 user_range_ok(u64 va, u64 size) {
+    return is_aligned(va, PAGE_4K) && is_aligned(size, PAGE_4K) && size != 0 &&
+           va >= USER_SPACE_BASE && va < USER_SPACE_TOP && size <= USER_SPACE_TOP - va;
+}
+
+// Share the identity map and the kernel half. Caller holds mm_lock.
+static void space_copy_kernel(mm_space_t *space) {
+    pte_t *pml4 = (pte_t *)phys_to_virt(space->pml4_phys);
+    pml4[0] = mm.pml4[0];
+    for (unsigned i = 256; i < 512; i++) pml4[i] = mm.pml4[i];
+}
+
+// Leaf entry for va in a user space, or NULL. Caller holds mm_lock.
+static pte_t *space_walk(const mm_space_t *space, u64 va) {
+    pte_t *table = (pte_t *)phys_to_virt(space->pml4_phys);
+    for (int level = 3; level > 0; level--) {
+        pte_t entry = table[(va >> (12 + 9 * level)) & 0x1FF];
+        if (!(entry & PTE_PRESENT) || (entry & PTE_HUGE)) return NULL;
+        table = (pte_t *)phys_to_virt(entry & 0x000FFFFFFFFFF000ULL);
     }
+    pte_t *leaf = &table[IDX_PT(va)];
+    return (*leaf & PTE_PRESENT) ? leaf : NULL;
+}
+
+// Free a user table and everything below it. User pages are always 4K.
+static u64 space_free_table(pte_t *table, int level) {
+    u64 freed = 0;
+    for (unsigned i = 0; i < 512; i++) {
+        pte_t entry = table[i];
+        if (!(entry & PTE_PRESENT)) continue;
+        u64 phys = entry & 0x000FFFFFFFFFF000ULL;
+        if (level == 0) {
+            if (entry & PTE_OWNED) {
+                pmm_free_pages(phys, 0);
+                freed++;
+            }
+        } else if (!(entry & PTE_HUGE)) {
+            freed += space_free_table((pte_t *)phys_to_virt(phys), level - 1);
+        }
+    }
+    free_table_page(table);
+    return freed;
+}
+
+u8 mm_space_create(mm_space_t *space) {
+    if (!mm.initialized || !space) return 0;
+    u64 irq = spin_lock_irqsave(&mm_lock);
+    pte_t *pml4 = alloc_table_page();
+    if (pml4) {
+        space->pml4_phys = virt_to_phys(pml4) & 0x000FFFFFFFFFF000ULL;
+        space->owned_pages = 0;
+        space_copy_kernel(space);
+    }
+    spin_unlock_irqrestore(&mm_lock, irq);
+    return pml4 ? 1 : 0;
+}
+
+void mm_space_destroy(mm_space_t *space) {
+    if (!space || !space->pml4_phys) return;
+    u64 irq = spin_lock_irqsave(&mm_lock);
+    pte_t *pml4 = (pte_t *)phys_to_virt(space->pml4_phys);
+    for (unsigned i = 1; i < 256; i++) {
+        if (!(pml4[i] & PTE_PRESENT)) continue;
+        space->owned_pages -= space_free_table((pte_t *)phys_to_virt(pml4[i] & 0x000FFFFFFFFFF000ULL), 2);
+    }
+    free_table_page(pml4);
+    space->pml4_phys = 0;
+    spin_unlock_irqrestore(&mm_lock, irq);
+}
+
+u8 mm_space_alloc(mm_space_t *space, u64 va, u64 size, u64 flags) {
+    if (!space || !space->pml4_phys || !user_range_ok(va, size)) return 0;
+    flags = (flags & ~PTE_HUGE) | PTE_USER | PTE_OWNED;
+    for (u64 off = 0; off < size; off += PAGE_4K) {
+        u64 phys = pmm_alloc_pages(0);
+        if (!phys) return 0;
+        memset(pmm_phys_to_virt(phys), 0, PAGE_4K);
+        tlb_batch_t batch = {0};
+        u64 irq = spin_lock_irqsave(&mm_lock);
+        u8 ok = map_range_in_table((pte_t *)phys_to_virt(space->pml4_phys), 3, va + off,
+                                   va + off + PAGE_4K, phys, flags, &batch);
+        tlb_batch_finish(&batch);
+        if (ok) space->owned_pages++;
+        spin_unlock_irqrestore(&mm_lock, irq);
+        if (!ok) {
+            pmm_free_pages(phys, 0);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+u8 mm_space_map(mm_space_t *space, u64 va, u64 pa, u64 size, u64 flags) {
+    if (!space || !space->pml4_phys || !user_range_ok(va, size) || !is_aligned(pa, PAGE_4K)) return 0;
+    flags = (flags & ~(PTE_HUGE | PTE_OWNED)) | PTE_USER;
+    tlb_batch_t batch = {0};
+    u64 irq = spin_lock_irqsave(&mm_lock);
+    u8 ok = map_range_in_table((pte_t *)phys_to_virt(space->pml4_phys), 3, va, va + size,
+                               pa, flags, &batch);
+    tlb_batch_finish(&batch);
+    spin_unlock_irqrestore(&mm_lock, irq);
+    return ok;
+}
+
+u64 mm_space_translate(const mm_space_t *space, u64 va) {
+    if (!space || !space->pml4_phys || va < USER_SPACE_BASE || va >= USER_SPACE_TOP) return 0;
+    u64 irq = spin_lock_irqsave(&mm_lock);
+    pte_t *leaf = space_walk(space, va);
+    u64 phys = leaf ? (*leaf & 0x000FFFFFFFFFF000ULL) | (va & (PAGE_4K - 1)) : 0;
+    spin_unlock_irqrestore(&mm_lock, irq);
+    return phys;
+}
+
+u8 mm_space_check(const mm_space_t *space, u64 va, u64 size, u8 write) {
+    if (!space || !space->pml4_phys) return 0;
+    if (size == 0) size = 1;
+    if (va < USER_SPACE_BASE || va >= USER_SPACE_TOP || size > USER_SPACE_TOP - va) return 0;
+    pte_t need = PTE_PRESENT | PTE_USER | (write ? PTE_RW : 0);
+    u8 ok = 1;
+    u64 irq = spin_lock_irqsave(&mm_lock);
+    for (u64 page = va & ~(PAGE_4K - 1); page < va + size; page += PAGE_4K) {
+        pte_t *leaf = space_walk(space, page);
+        if (!leaf || (*leaf & need) != need) {
+            ok = 0;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&mm_lock, irq);
+    return ok;
+}
+
+void mm_space_activate(mm_space_t *space) {
+    u64 cr3 = mm.pml4_phys;
+    if (space && space->pml4_phys) cr3 = space->pml4_phys;
+    // Spaces are not PCID-tagged: the reload drops the previous space's entries
+    if ((read_cr3() & 0x000FFFFFFFFFF000ULL) != cr3) write_cr3(cr3);
+}
+
+void mm_tlb_stats(u64 *page_flushes, u64 *full_flushes) {
+    if (page_flushes) *page_flushes = mm.page_flushes;
+    if (full_flushes) *full_flushes = mm.full_flushes;
+}
+
+u64 mm_tlb_shootdowns(void) {
+    return mm.shootdowns;
+}
+
+u8 mm_has_1g_pages(void) {
+    return mm.has_1g_pages;
+}
+
+u64 mm_table_pages_from_pmm(void) {
+    return mm.pmm_tables;
+}
+
+u64 mm_table_pages_in_use(void) {
+    u64 bootstrap = mm.next_free / _PAGE_SIZE_4K;
+    for (pte_t *t = mm.free_tables; t; t = *(pte_t **)t) bootstrap--;
+    return bootstrap + mm.pmm_tables;
 }
 
@@ -0,0 +1,279 @@
+#include <pmm.h>
+#include <vgaio.h>
+#include <string.h>
+#include <spinlock.h>
+
+// Per-frame state byte. Only the first frame of a free block is tagged, with
+// its order, so the buddy of a block can be checked in O(1) when freeing.
+#define PMM_FRAME_FREE 0x80
+
+typedef struct pmm_free_block {
+    struct pmm_free_block* prev;
+    struct pmm_free_block* next;
+} pmm_free_block_t;
+
+static struct {
+    pmm_free_block_t* free_lists[PMM_MAX_ORDER + 1];
+    u64 free_counts[PMM_MAX_ORDER + 1];
+    u8* frame_state;        // One byte per frame in [base_pfn, end_pfn)
+    u64 base_pfn;
+    u64 end_pfn;
+    u64 total_pages;
+    u64 free_pages;
+    u8 initialized;
+} pmm = {0};
+
+// Guards the free lists and frame states. Taken with interrupts off, as the
+// lists are short work and callers may already hold other locks.
+static spinlock_t pmm_lock = SPINLOCK_INIT("pmm");
+
+static inline u64 align_up_u64(u64 v, u64 a) {
+    return (v + (a - 1)) & ~(a - 1);
+}
+
+static inline u64 align_down_u64(u64 v, u64 a) {
+    return v & ~(a - 1);
+}
+
+static inline pmm_free_block_t* pfn_to_block(u64 pfn) {
+    return (pmm_free_block_t*)pmm_phys_to_virt(pfn << PMM_PAGE_SHIFT);
+}
+
+static inline u64 block_to_pfn(pmm_free_block_t* block) {
+    return (u64)(uintptr_t)block >> PMM_PAGE_SHIFT;
+}
+
+static void free_list_push(u32 order, u64 pfn) {
+    pmm_free_block_t* block = pfn_to_block(pfn);
+    block->prev = NULL;
+    block->next = pmm.free_lists[order];
+    if (block->next) block->next->prev = block;
+    pmm.free_lists[order] = block;
+    pmm.free_counts[order]++;
+    pmm.frame_state[pfn - pmm.base_pfn] = (u8)(PMM_FRAME_FREE | order);
+}
+
+static void free_list_remove(u32 order, u64 pfn) {
+    pmm_free_block_t* block = pfn_to_block(pfn);
+    if (block->prev) block->prev->next = block->next;
+    else pmm.free_lists[order] = block->next;
+    if (block->next) block->next->prev = block->prev;
+    pmm.free_counts[order]--;
+    pmm.frame_state[pfn - pmm.base_pfn] = 0;
+}
+
+// Return a block to the free lists, merging with its buddy while possible.
+static void free_block(u64 pfn, u32 order) {
+    while (order < PMM_MAX_ORDER) {
+        u64 buddy = pfn ^ (1ULL << order);
+        if (buddy < pmm.base_pfn || buddy >= pmm.end_pfn) break;
+        if (pmm.frame_state[buddy - pmm.base_pfn] != (u8)(PMM_FRAME_FREE | order)) break;
+        free_list_remove(order, buddy);
+        if (buddy < pfn) pfn = buddy;
+        order++;
+    }
+    free_list_push(order, pfn);
+}
+
+// Hand [start_pfn, end_pfn) to the allocator as maximal aligned blocks.
+static void free_range(u64 start_pfn, u64 end_pfn) {
+    while (start_pfn < end_pfn) {
+        u32 order = PMM_MAX_ORDER;
+        while (order > 0 &&
+               ((start_pfn & ((1ULL << order) - 1)) != 0 ||
+                start_pfn + (1ULL << order) > end_pfn)) {
+            order--;
+        }
+        free_block(start_pfn, order);
+        pmm.free_pages += 1ULL << order;
+        start_pfn += 1ULL << order;
+    }
+}
+
+// Usable page-aligned bounds of a RAM region clipped to the identity map.
+static int region_bounds(const struct memory_region* r, u64* start, u64* end) {
+    if (!(r->flags & MEMORY_INFO_SYSTEM_RAM) || r->size == 0) return 0;
+    u64 s = align_up_u64(r->addr_start, PMM_PAGE_SIZE);
+    u64 e = align_down_u64(r->addr_end + 1ULL, PMM_PAGE_SIZE);
+    if (e > PMM_PHYS_LIMIT) e = PMM_PHYS_LIMIT;
+    if (e <= s) return 0;
+    *start = s;
+    *end = e;
+    return 1;
+}
+
+static u64 reserve_frame_state(struct memory_info* minfo, u64 bytes) {
+    for (size_t i = 0; i < minfo->count && i < MEMORY_INFO_MAX; ++i) {
+        struct memory_region* r = &minfo->regions[i];
+        u64 start, end;
+        if (!region_bounds(r, &start, &end)) continue;
+        if (end - start < bytes) continue;
+        r->addr_start = start + bytes;
+        r->size = (r->addr_end + 1ULL > r->addr_start) ? r->addr_end + 1ULL - r->addr_start : 0;
+        return start;
+    }
+    return 0;
+}
+
+u8 pmm_init(struct memory_info* minfo) {
+    if (!minfo || pmm.initialized) return 0;
+
+    u64 lowest = ~0ULL;
+    u64 highest = 0;
+    for (size_t i = 0; i < minfo->count && i < MEMORY_INFO_MAX; ++i) {
+        u64 start, end;
+        if (!region_bounds(&minfo->regions[i], &start, &end)) {
+            if ((minfo->regions[i].flags & MEMORY_INFO_SYSTEM_RAM) &&
+                minfo->regions[i].addr_start >= PMM_PHYS_LIMIT) {
+                vga_printf("pmm: Ignoring RAM above identity map at 0x%llx\n",
+                          minfo->regions[i].addr_start);
+            }
+            continue;
+        }
+        if (start < lowest) lowest = start;
+        if (end > highest) highest = end;
+    }
+    if (highest == 0) {
+        vga_printf("pmm: No usable system RAM\n");
+        return 0;
+    }
+
+    // Align the tracked span to the largest order so buddies of any block
+    // always fall inside frame_state.
+    pmm.base_pfn = align_down_u64(lowest >> PMM_PAGE_SHIFT, 1ULL << PMM_MAX_ORDER);
+    pmm.end_pfn = align_up_u64(highest >> PMM_PAGE_SHIFT, 1ULL << PMM_MAX_ORDER);
+    u64 state_bytes = align_up_u64(pmm.end_pfn - pmm.base_pfn, PMM_PAGE_SIZE);
+
+    u64 state_phys = reserve_frame_state(minfo, state_bytes);
+    if (state_phys == 0) {
+        vga_printf("pmm: Cannot reserve %llu KB for frame state\n", state_bytes / 1024);
+        return 0;
+    }
+    pmm.frame_state = (u8*)pmm_phys_to_virt(state_phys);
+    memset(pmm.frame_state, 0, (size_t)state_bytes);
+
+    for (size_t i = 0; i < minfo->count && i < MEMORY_INFO_MAX; ++i) {
+        struct memory_region* r = &minfo->regions[i];
+        u64 start, end;
+        if (!region_bounds(r, &start, &end)) continue;
+        free_range(start >> PMM_PAGE_SHIFT, end >> PMM_PAGE_SHIFT);
+        pmm.total_pages += (end - start) >> PMM_PAGE_SHIFT;
+
+        // This RAM is now owned by the frame allocator.
+        r->addr_start = end;
+        r->addr_end = end;
+        r->size = 0;
+    }
+
+    pmm.initialized = 1;
+    vga_printf("pmm: Managing %llu MB in buddy orders 0-%d (%llu KB frame state)\n",
+              (pmm.total_pages << PMM_PAGE_SHIFT) >> 20, PMM_MAX_ORDER, state_bytes / 1024);
+    return 1;
+}
+
+static u64 pmm_take_block(u32 order) {
+    if (!pmm.initialized || order > PMM_MAX_ORDER) return 0;
+
+    u32 found = order;
+    while (found <= PMM_MAX_ORDER && !pmm.free_lists[found]) found++;
+    if (found > PMM_MAX_ORDER) return 0;
+
+    u64 pfn = block_to_pfn(pmm.free_lists[found]);
+    free_list_remove(found, pfn);
+
+    // Split down to the requested order, returning the upper halves
+    while (found > order) {
+        found--;
+        free_list_push(found, pfn + (1ULL << found));
+    }
+
+    pmm.free_pages -= 1ULL << order;
+    return pfn << PMM_PAGE_SHIFT;
+}
+
+static void pmm_put_block(u64 phys, u32 order) {
+    if (!pmm.initialized || order > PMM_MAX_ORDER || phys == 0) return;
+    u64 pfn = phys >> PMM_PAGE_SHIFT;
+    if ((pfn & ((1ULL << order) - 1)) != 0) return;
+    if (pfn < pmm.base_pfn || pfn + (1ULL << order) > pmm.end_pfn) return;
+    if (pmm.frame_state[pfn - pmm.base_pfn] & PMM_FRAME_FREE) {
+        vga_printf("pmm: Double free of 0x%llx\n", phys);
+        return;
+    }
+    pmm.free_pages += 1ULL << order;
+    free_block(pfn, order);
+}
+
+u64 pmm_alloc_pages(u32 order) {
+    u64 flags = spin_lock_irqsave(&pmm_lock);
+    u64 phys = pmm_take_block(order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return phys;
+}
+
+void pmm_free_pages(u64 phys, u32 order) {
+    u64 flags = spin_lock_irqsave(&pmm_lock);
+    pmm_put_block(phys, order);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+u64 pmm_alloc_contiguous(u64 bytes) {
+    if (bytes == 0) return 0;
+    u32 order = pmm_order_for_size(bytes);
+    u64 flags = spin_lock_irqsave(&pmm_lock);
+    u64 phys = pmm_take_block(order);
+    if (phys) {
+        // Give the unused tail of the power-of-two block straight back
+        u64 pfn = phys >> PMM_PAGE_SHIFT;
+        u64 used = align_up_u64(bytes, PMM_PAGE_SIZE) >> PMM_PAGE_SHIFT;
+        free_range(pfn + used, pfn + (1ULL << order));
+    }
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return phys;
+}
+
+void pmm_free_contiguous(u64 phys, u64 bytes) {
+    if (!pmm.initialized || phys == 0 || bytes == 0) return;
+    u64 pfn = phys >> PMM_PAGE_SHIFT;
+    u64 pages = align_up_u64(bytes, PMM_PAGE_SIZE) >> PMM_PAGE_SHIFT;
+    if (pfn < pmm.base_pfn || pfn + pages > pmm.end_pfn) return;
+    u64 flags = spin_lock_irqsave(&pmm_lock);
+    free_range(pfn, pfn + pages);
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+u32 pmm_order_for_size(u64 bytes) {
+    u32 order = 0;
+    while (order <= PMM_MAX_ORDER && (PMM_PAGE_SIZE << order) < bytes) order++;
+    return order;
+}
+
+u64 pmm_total_bytes(void) {
+    return pmm.total_pages << PMM_PAGE_SHIFT;
+}
+
+u64 pmm_free_bytes(void) {
+    return pmm.free_pages << PMM_PAGE_SHIFT;
+}
+
+int pmm_largest_free_order(void) {
+    for (int order = PMM_MAX_ORDER; order >= 0; order--) {
+        if (pmm.free_lists[order]) return order;
+    }
+    return -1;
+}
+
+void pmm_debug_info(void) {
+    if (!pmm.initialized) {
+        vga_printf("=== Physical Memory Not Initialized ===\n");
+        return;
+    }
+    vga_printf("=== Physical Memory (buddy) ===\n");
+    vga_printf("Total: %llu KB, Free: %llu KB\n",
+              pmm_total_bytes() / 1024, pmm_free_bytes() / 1024);
+    for (u32 order = 0; order <= PMM_MAX_ORDER; order++) {
+        if (pmm.free_counts[order] == 0) continue;
+        vga_printf("  order %u (%llu KB): %llu free\n",
+                  order, (PMM_PAGE_SIZE << order) / 1024, pmm.free_counts[order]);
+    }
+}
@@ -2,13 +2,22 @@
 #include <vgaio.h>
 #include <string.h>
 #include <kmalloc.h>
+#include <spinlock.h>
 
-// Process table
+// Process table. The lock covers slot allocation, pid lookup and state
+// changes made here; the scheduler owns the run queue links.
 static process_t process_table[MAX_PROCESSES];
 static u32 next_pid = 1;
+static spinlock_t process_lock = SPINLOCK_INIT("process");
 
-// Current running process ID (0 = kernel/shell)
-u32 current_pid = 0;
+static process_t* process_find_locked(u32 pid) {
+    for (u32 i = 0; i < MAX_PROCESSES; i++) {
+        if (process_table[i].pid == pid && process_table[i].state != PROCESS_UNUSED) {
+            return &process_table[i];
+        }
+    }
+    return NULL;
+}
 
 void process_init(void) {
     // Initialize all process entries as unused
@@ -20,65 +29,69 @@ void process_init(void) {
     vga_printf("[PROCESS] Process management initialized\n");
 }
 
-u32 process_create(const char* name, void* entry_point, void* return_addr, void* elf_base, u64 elf_size) {
-    // Find unused process slot
+u32 process_create(const char* name, void* entry_point, void* return_addr) {
+    u32 parent = current_pid;
+    u64 flags = spin_lock_irqsave(&process_lock);
+    // Find an unused slot, or one whose exited process has been reaped
     for (u32 i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].state == PROCESS_UNUSED) {
-            process_t* proc = &process_table[i];
-            
+        process_t* proc = &process_table[i];
+        if (proc->state == PROCESS_UNUSED ||
+            (proc->state == PROCESS_EXITED && !proc->kstack && !proc->run_next &&
+             !proc->space.pml4_phys && !proc->uring)) {
             proc->pid = next_pid++;
-            proc->state = PROCESS_RUNNING;
+            proc->state = PROCESS_READY;
             strncpy(proc->name, name ? name : "unknown", PROCESS_NAME_LEN - 1);
             proc->name[PROCESS_NAME_LEN - 1] = '\0';
             proc->entry_point = entry_point;
             proc->return_address = return_addr;
             proc->stack_pointer = NULL; // Will be set when we switch
             proc->exit_status = 0;
-            proc->elf_base = elf_base;
-            proc->elf_size = elf_size;
-            proc->parent_pid = current_pid;  // Set parent to current process
-            
-            vga_printf("[PROCESS] Created process %u: %s (parent: %u)\n", proc->pid, proc->name, proc->parent_pid);
-            return proc->pid;
+            memset(&proc->space, 0, sizeof(proc->space));
+            proc->uring = NULL;
+            proc->parent_pid = parent;
+            proc->kstack = NULL;
+            proc->kstack_peak = 0;
+            proc->run_next = NULL;
+            proc->slice_left = 0;
+            proc->run_ticks = 0;
+            proc->switches = 0;
+            u32 pid = proc->pid;
+            spin_unlock_irqrestore(&process_lock, flags);
+
+            vga_printf("[PROCESS] Created process %u: %s (parent: %u)\n", pid, proc->name, parent);
+            return pid;
         }
     }
+    spin_unlock_irqrestore(&process_lock, flags);
     
     vga_printf("[PROCESS] Error: No free process slots\n");
     return 0; // No free slot
 }
 
 void process_exit(u32 pid, u64 status) {
-    process_t* proc = process_get(pid);
+    u64 flags = spin_lock_irqsave(&process_lock);
+    process_t* proc = process_find_locked(pid);
     if (!proc) {
+        spin_unlock_irqrestore(&process_lock, flags);
         vga_printf("[PROCESS] Error: Process %u not found for exit\n", pid);
         return;
     }
     
-    vga_printf("[PROCESS] Process %u (%s) exiting with status %llu\n", 
-               proc->pid, proc->name, status);
-    
+    // The address space goes with the kernel stack in sched_reap, once
+    // nothing runs on either
     proc->state = PROCESS_EXITED;
     proc->exit_status = status;
-    
-    // Clean up ELF memory if allocated
-    if (proc->elf_base) {
-        // kfree(proc->elf_base);  // COMMENTED FOR NOW TO TEST
-        proc->elf_base = NULL;
-    }
-    
-    // Set current process back to kernel/shell
-    current_pid = 0;
-    
-    vga_printf("[PROCESS] Process %u cleaned up, returning to kernel\n", pid);
+    spin_unlock_irqrestore(&process_lock, flags);
+
+    vga_printf("[PROCESS] Process %u (%s) exiting with status %llu\n", 
+               pid, proc->name, status);
 }
 
 process_t* process_get(u32 pid) {
-    for (u32 i = 0; i < MAX_PROCESSES; i++) {
-        if (process_table[i].pid == pid && process_table[i].state != PROCESS_UNUSED) {
-            return &process_table[i];
-        }
-    }
-    return NULL;
+    u64 flags = spin_lock_irqsave(&process_lock);
+    process_t* proc = process_find_locked(pid);
+    spin_unlock_irqrestore(&process_lock, flags);
+    return proc;
 }
 
 process_t* process_get_current(void) {
@@ -88,43 +101,12 @@ process_t* process_get_current(void) {
     return process_get(current_pid);
 }
 
-void process_set_current(u32 pid) {
-    current_pid = pid;
-    vga_printf("[PROCESS] Switched to process %u\n", pid);
-}
-
-void process_save_context(u32 pid, execution_context_t* context) {
-    process_t* proc = process_get(pid);
-    if (proc) {
-        proc->saved_context = *context;
-        vga_printf("[PROCESS] Saved context for process %u\n", pid);
-    }
-}
-
-void process_restore_context(u32 pid) {
-    process_t* proc = process_get(pid);
-    if (proc) {
-        vga_printf("[PROCESS] Restoring context for process %u\n", pid);
-        // This would typically involve assembly code to restore registers
-        // For now, we'll implement a simpler approach
+void process_for_each(void (*fn)(process_t* proc)) {
+    u64 flags = spin_lock_irqsave(&process_lock);
+    for (u32 i = 0; i < MAX_PROCESSES; i++) {
+        if (process_table[i].state != PROCESS_UNUSED) {
+            fn(&process_table[i]);
+        }
     }
+    spin_unlock_irqrestore(&process_lock, flags);
 }
-
-void process_exit_and_restore_parent(u32 pid, u64 status) {
-    process_t* proc = process_get(pid);
-    if (!proc) {
-        vga_printf("[PROCESS] Error: Process %u not found for exit\n", pid);
-        return;
-    }
-    
-    u32 parent_pid = proc->parent_pid;
-    vga_printf("[PROCESS] Process %u exiting with status %llu, returning to parent %u\n", 
-               pid, status, parent_pid);
-    
-    // Clean up current process
-    process_exit(pid, status);
-    
-    // Switch back to parent process
-    current_pid = parent_pid;
-    vga_printf("[PROCESS] Restored control to parent process %u\n", parent_pid);
-}
\ No newline at end of file
@@ -0,0 +1,309 @@
+#include <sched.h>
+#include <process.h>
+#include <kstack.h>
+#include <uring.h>
+#include <ktimer.h>
+#include <pit/pit.h>
+#include <vgaio.h>
+#include <string.h>
+
+#define RFLAGS_IF (1ULL << 9)
+#define RFLAGS_INITIAL (RFLAGS_IF | (1ULL << 1))    // IF plus the reserved bit
+
+// The boot thread keeps running on the boot stack as pid 0.
+static process_t sched_boot;
+static process_t* sched_current = NULL;
+static u8 sched_fpu_initial[512] __attribute__((aligned(16)));
+static u8 sched_active = 0;
+static volatile u8 sched_need_resched = 0;
+static u64 sched_switches = 0;
+static u64 sched_preemptions = 0;
+
+static inline u64 sched_irq_save(void) {
+    u64 flags;
+    __asm__ volatile ("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void sched_irq_restore(u64 flags) {
+    if (flags & RFLAGS_IF) __asm__ volatile ("sti" ::: "memory");
+}
+
+void sched_init(void) {
+    memset(&sched_boot, 0, sizeof(sched_boot));
+    sched_boot.pid = 0;
+    sched_boot.state = PROCESS_RUNNING;
+    strcpy(sched_boot.name, "kernel");
+    sched_boot.slice_left = SCHED_TIMESLICE_TICKS;
+    sched_boot.run_next = &sched_boot;
+
+    // New processes start from a freshly initialised FPU with default MXCSR
+    __asm__ volatile ("fxsave %0" : "=m"(sched_boot.fpu_state));
+    __asm__ volatile ("fninit");
+    u32 mxcsr = 0x1F80;
+    __asm__ volatile ("ldmxcsr %0" :: "m"(mxcsr));
+    __asm__ volatile ("fxsave %0" : "=m"(sched_fpu_initial));
+    __asm__ volatile ("fxrstor %0" :: "m"(sched_boot.fpu_state));
+
+    sched_current = &sched_boot;
+    current_pid = 0;
+    sched_active = 1;
+    vga_printf("[SCHED] Round-robin scheduler started (%u tick slices)\n", SCHED_TIMESLICE_TICKS);
+}
+
+// Next ready process after the current one, or NULL if there is none.
+static process_t* sched_pick_next(void) {
+    for (process_t* p = sched_current->run_next; p != sched_current; p = p->run_next) {
+        if (p->state == PROCESS_READY) return p;
+    }
+    return NULL;
+}
+
+// Interrupts must be disabled.
+static void sched_switch_to(process_t* next) {
+    process_t* prev = sched_current;
+    if (prev->state == PROCESS_RUNNING) prev->state = PROCESS_READY;
+    next->state = PROCESS_RUNNING;
+    next->slice_left = SCHED_TIMESLICE_TICKS;
+    next->switches++;
+    sched_current = next;
+    current_pid = next->pid;
+    // SYSCALL and interrupts from user mode enter on the process's own
+    // kernel stack
+    u64 kstack_top = next->kstack ? next->kstack->top : 0;
+    this_cpu()->syscall_rsp = kstack_top;
+    this_cpu()->tss.rsp0 = kstack_top;
+    mm_space_activate(next->space.pml4_phys ? &next->space : NULL);
+    sched_switches++;
+    sched_need_resched = 0;
+    sched_context_switch(&prev->context, &next->context, prev->fpu_state, next->fpu_state);
+}
+
+// Interrupts must be disabled.
+static void sched_reschedule(void) {
+    process_t* next = sched_pick_next();
+    if (next) {
+        sched_switch_to(next);
+    } else {
+        sched_current->slice_left = SCHED_TIMESLICE_TICKS;
+        sched_need_resched = 0;
+    }
+}
+
+__attribute__((noreturn))
+static void sched_thread_start(process_t* proc, sched_fn_t fn) {
+    // Only rdi and rsi are loaded by the switch; the argument waits in rdx
+    void* arg = (void*)(uintptr_t)proc->context.rdx;
+    sched_exit(fn(arg));
+}
+
+int sched_start(u32 pid, sched_fn_t fn, void* arg, size_t stack_size) {
+    process_t* proc = process_get(pid);
+    if (!proc || !fn || proc->kstack || proc->state != PROCESS_READY) return -1;
+
+    kstack_t* stack = kstack_alloc(stack_size ? stack_size : SCHED_DEFAULT_STACK, proc->name);
+    if (!stack) return -1;
+
+    // Enter sched_thread_start as if called: rsp + 8 stays 16-byte aligned
+    u64 rsp = stack->top - 8;
+    *(u64*)(uintptr_t)rsp = 0;
+
+    memset(&proc->context, 0, sizeof(proc->context));
+    proc->context.rsp = rsp;
+    proc->context.rip = (u64)(uintptr_t)sched_thread_start;
+    proc->context.rflags = RFLAGS_INITIAL;
+    proc->context.rdi = (u64)(uintptr_t)proc;
+    proc->context.rsi = (u64)(uintptr_t)fn;
+    proc->context.rdx = (u64)(uintptr_t)arg;
+    memcpy(proc->fpu_state, sched_fpu_initial, sizeof(proc->fpu_state));
+    proc->kstack = stack;
+    proc->slice_left = SCHED_TIMESLICE_TICKS;
+
+    // Link in behind the current process so it runs after everyone else
+    u64 flags = sched_irq_save();
+    process_t* tail = sched_current;
+    while (tail->run_next != sched_current) tail = tail->run_next;
+    proc->run_next = sched_current;
+    tail->run_next = proc;
+    sched_irq_restore(flags);
+    return 0;
+}
+
+u32 sched_spawn(const char* name, sched_fn_t fn, void* arg, size_t stack_size) {
+    u32 pid = process_create(name, (void*)fn, NULL);
+    if (pid == 0) return 0;
+    if (sched_start(pid, fn, arg, stack_size) != 0) {
+        process_exit(pid, (u64)-1);
+        return 0;
+    }
+    return pid;
+}
+
+void sched_yield(void) {
+    if (!sched_active) return;
+    u64 flags = sched_irq_save();
+    sched_reschedule();
+    sched_irq_restore(flags);
+}
+
+void sched_idle_wait(void) {
+    u64 flags = sched_irq_save();
+    if (sched_active && sched_pick_next()) {
+        sched_reschedule();
+    } else if (flags & RFLAGS_IF) {
+        ktimer_idle();
+    }
+    sched_irq_restore(flags);
+}
+
+void sched_wake(process_t* proc) {
+    if (proc->state == PROCESS_BLOCKED) proc->state = PROCESS_READY;
+}
+
+static void sched_wake_timer(void* arg) {
+    sched_wake((process_t*)arg);
+}
+
+void sched_sleep_ticks(u64 ticks) {
+    if (!sched_active) {
+        u64 until = pit_ticks() + ticks;
+        while (pit_ticks() < until) __asm__ volatile ("hlt");
+        return;
+    }
+
+    process_t* proc = sched_current;
+    ktimer_t timer;
+    ktimer_init(&timer, sched_wake_timer, proc);
+
+    // Arm and block with interrupts off so the wakeup cannot be missed
+    u64 flags = sched_irq_save();
+    ktimer_start_at(&timer, pit_ticks() + ticks);
+    proc->state = PROCESS_BLOCKED;
+    while (proc->state == PROCESS_BLOCKED) {
+        process_t* next = sched_pick_next();
+        if (next) {
+            sched_switch_to(next);
+        } else {
+            ktimer_idle();
+        }
+    }
+    // Woken while idling here rather than switched back in
+    proc->state = PROCESS_RUNNING;
+    proc->slice_left = SCHED_TIMESLICE_TICKS;
+    sched_irq_restore(flags);
+}
+
+void sched_exit(long status) {
+    __asm__ volatile ("cli");
+    process_t* proc = sched_current;
+    if (proc == &sched_boot) {
+        vga_printf("[SCHED] Boot thread cannot exit\n");
+        for (;;) __asm__ volatile ("hlt");
+    }
+    proc->kstack_peak = kstack_high_water(proc->kstack);
+    process_exit(proc->pid, (u64)status);
+    // Nothing may be ready yet, e.g. the boot thread sleeping on a timer;
+    // an exited process is never switched back to
+    process_t* next;
+    while (!(next = sched_pick_next())) ktimer_idle();
+    sched_switch_to(next);
+    __builtin_unreachable();
+}
+
+long sched_wait(u32 pid) {
+    process_t* proc = process_get(pid);
+    if (!proc || proc == sched_current) return -1;
+    while (proc->pid == pid && proc->state != PROCESS_EXITED) {
+        sched_idle_wait();
+    }
+    if (proc->pid != pid) return -1;
+    long status = (long)proc->exit_status;
+    sched_reap();
+    return status;
+}
+
+void sched_reap(void) {
+    if (!sched_active) return;
+    for (;;) {
+        // Unlink one exited process at a time, then free its stack with
+        // interrupts back on
+        u64 flags = sched_irq_save();
+        process_t* prev = sched_current;
+        process_t* dead = NULL;
+        do {
+            process_t* p = prev->run_next;
+            if (p->state == PROCESS_EXITED && p != sched_current) {
+                prev->run_next = p->run_next;
+                dead = p;
+                break;
+            }
+            prev = p;
+        } while (prev != sched_current);
+        sched_irq_restore(flags);
+        if (!dead) return;
+
+        kstack_free(dead->kstack);
+        dead->kstack = NULL;
+        mm_space_destroy(&dead->space);
+        uring_destroy(dead);
+        dead->run_next = NULL;
+    }
+}
+
+void sched_tick(void) {
+    if (!sched_active) return;
+    process_t* cur = sched_current;
+    cur->run_ticks++;
+    if (cur->slice_left > 0) cur->slice_left--;
+    if (cur->slice_left > 0) return;
+    if (sched_preempt_count) {
+        sched_need_resched = 1;
+        return;
+    }
+    sched_preemptions++;
+    sched_reschedule();
+}
+
+void sched_preempt_enable(void) {
+    __asm__ volatile ("" ::: "memory");
+    if (sched_preempt_count == 0) return;
+    // Processes only run on the boot CPU; the others never switch
+    if (--sched_preempt_count == 0 && sched_need_resched && this_cpu()->index == 0) {
+        u64 flags;
+        __asm__ volatile ("pushfq; pop %0" : "=r"(flags));
+        if (flags & RFLAGS_IF) sched_yield();
+    }
+}
+
+u64 sched_switch_count(void) {
+    return sched_switches;
+}
+
+static const char* sched_state_name(process_state_t state) {
+    switch (state) {
+        case PROCESS_READY: return "ready";
+        case PROCESS_RUNNING: return "running";
+        case PROCESS_BLOCKED: return "blocked";
+        case PROCESS_EXITED: return "exited";
+        default: return "unused";
+    }
+}
+
+static void sched_print_process(process_t* proc) {
+    u64 stack_kb = proc->kstack ? (u64)proc->kstack->size / 1024 : 0;
+    u64 peak = proc->kstack ? (u64)kstack_high_water(proc->kstack) : proc->kstack_peak;
+    vga_printf("  %u %s [%s] ticks=%llu switches=%llu stack=%llu/%llu KB",
+              proc->pid, proc->name, sched_state_name(proc->state), proc->run_ticks,
+              proc->switches, peak / 1024, stack_kb);
+    if (proc->space.pml4_phys) {
+        vga_printf(" user=%llu KB", proc->space.owned_pages * 4);
+    }
+    vga_printf("\n");
+}
+
+void sched_debug_info(void) {
+    vga_printf("=== Processes ===\n");
+    sched_print_process(&sched_boot);
+    process_for_each(sched_print_process);
+    vga_printf("Context switches: %llu (%llu preemptions)\n", sched_switches, sched_preemptions);
+}
@@ -0,0 +1,57 @@
+; sched_switch.asm - Switch between two execution contexts
+section .text
+
+global sched_context_switch
+
+; execution_context_t field offsets (see process.h)
+%define CTX_RBX     8
+%define CTX_RSI     32
+%define CTX_RDI     40
+%define CTX_RBP     48
+%define CTX_RSP     56
+%define CTX_R12     96
+%define CTX_R13     104
+%define CTX_R14     112
+%define CTX_R15     120
+%define CTX_RIP     128
+%define CTX_RFLAGS  136
+
+; void sched_context_switch(execution_context_t* from, execution_context_t* to,
+;                           void* from_fpu, const void* to_fpu)
+; rdi = from, rsi = to, rdx = from FXSAVE area, rcx = to FXSAVE area
+; Called with interrupts disabled. Caller-saved registers are dead across the
+; call, so only the callee-saved set, rsp, rip and rflags are stored.
+sched_context_switch:
+    mov [rdi + CTX_RBX], rbx
+    mov [rdi + CTX_RBP], rbp
+    mov [rdi + CTX_R12], r12
+    mov [rdi + CTX_R13], r13
+    mov [rdi + CTX_R14], r14
+    mov [rdi + CTX_R15], r15
+    mov [rdi + CTX_RSP], rsp
+    lea rax, [rel .resume]
+    mov [rdi + CTX_RIP], rax
+    pushfq
+    pop qword [rdi + CTX_RFLAGS]
+
+    fxsave [rdx]
+    fxrstor [rcx]
+
+    mov rbx, [rsi + CTX_RBX]
+    mov rbp, [rsi + CTX_RBP]
+    mov r12, [rsi + CTX_R12]
+    mov r13, [rsi + CTX_R13]
+    mov r14, [rsi + CTX_R14]
+    mov r15, [rsi + CTX_R15]
+    mov rsp, [rsi + CTX_RSP]
+    push qword [rsi + CTX_RFLAGS]
+    popfq
+
+    ; rdi/rsi carry the entry arguments of a process that has never run
+    mov rax, [rsi + CTX_RIP]
+    mov rdi, [rsi + CTX_RDI]
+    mov rsi, [rsi + CTX_RSI]
+    jmp rax
+
+.resume:
+    ret
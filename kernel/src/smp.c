@@ -0,0 +1,219 @@
+#include <smp.h>
+#include <acpi.h>
+#include <cpu.h>
+#include <idt.h>
+#include <kstack.h>
+#include <pit/pit.h>
+#include <apic/apic.h>
+#include <task.h>
+#include <syscalls.h>
+#include <vgaio.h>
+#include <string.h>
+
+#define SMP_AP_BOOT_TIMEOUT_MS 100
+
+// Filled in by the boot CPU before each SIPI (ap_trampoline.asm)
+typedef struct {
+    u64 cr3;
+    u64 stack_top;
+    u64 entry;
+    u64 cpu;
+} __attribute__((packed)) ap_boot_params_t;
+
+extern u8 ap_trampoline_start[];
+extern u8 ap_trampoline_end[];
+extern u8 ap_trampoline_params[];
+
+static cpu_t g_cpus[SMP_MAX_CPUS];
+static u32 g_cpu_count = 1;
+static u64 g_boot_cr0 = 0;
+static u64 g_boot_cr4 = 0;
+static u64 g_boot_efer = 0;
+
+// Null, 64-bit kernel code, kernel data, user data, 64-bit user code; the
+// TSS descriptor is filled in per CPU
+static const u64 g_gdt_template[] = {
+    0x0000000000000000ULL,
+    0x00AF9A000000FFFFULL,
+    0x00AF92000000FFFFULL,
+    0x00CFF2000000FFFFULL,
+    0x00AFFA000000FFFFULL,
+};
+
+_Static_assert(__builtin_offsetof(cpu_t, syscall_rsp) == CPU_OFFSET_SYSCALL_RSP, "cpu_t layout");
+_Static_assert(__builtin_offsetof(cpu_t, user_rsp) == CPU_OFFSET_USER_RSP, "cpu_t layout");
+
+static u32 smp_initial_apic_id(void) {
+    u32 a, b, c, d;
+    cpuid(1, 0, &a, &b, &c, &d);
+    return b >> 24;
+}
+
+static void smp_cpu_setup(cpu_t* cpu, u32 index, u32 apic_id) {
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->self = cpu;
+    cpu->index = index;
+    cpu->apic_id = apic_id;
+    memcpy(cpu->gdt, g_gdt_template, sizeof(g_gdt_template));
+
+    // No I/O permission bitmap, so port access from user mode faults
+    cpu->tss.iomap_base = sizeof(cpu->tss);
+    u64 base = (u64)(uintptr_t)&cpu->tss;
+    u64 limit = sizeof(cpu->tss) - 1;
+    cpu->gdt[GDT_TSS / 8] = (limit & 0xFFFF) | ((base & 0xFFFFFF) << 16) |
+                            (0x89ULL << 40) |                // Present, available 64-bit TSS
+                            (((limit >> 16) & 0xF) << 48) | (((base >> 24) & 0xFF) << 56);
+    cpu->gdt[GDT_TSS / 8 + 1] = base >> 32;
+
+    // "cpuN" names the AP stacks in kstack_debug_info
+    char* p = cpu->name;
+    *p++ = 'c'; *p++ = 'p'; *p++ = 'u';
+    if (index >= 10) *p++ = (char)('0' + index / 10);
+    *p++ = (char)('0' + index % 10);
+    *p = '\0';
+}
+
+// Switch to the CPU's own GDT, reload every segment register, load the TSS
+// and point the GS base at the cpu_t. The GS base must be written after gs
+// is reloaded; the user GS base starts out as 0 in KERNEL_GS_BASE.
+static void smp_load_tables(cpu_t* cpu) {
+    struct {
+        u16 limit;
+        u64 base;
+    } __attribute__((packed)) gdtr = { sizeof(cpu->gdt) - 1, (u64)(uintptr_t)cpu->gdt };
+
+    __asm__ volatile (
+        "lgdt %0\n\t"
+        "pushq %1\n\t"
+        "leaq 1f(%%rip), %%rax\n\t"
+        "pushq %%rax\n\t"
+        "lretq\n"
+        "1:\n\t"
+        "movl %2, %%eax\n\t"
+        "movw %%ax, %%ds\n\t"
+        "movw %%ax, %%es\n\t"
+        "movw %%ax, %%ss\n\t"
+        "movw %%ax, %%fs\n\t"
+        "movw %%ax, %%gs\n\t"
+        :: "m"(gdtr), "i"(GDT_KERNEL_CODE), "i"(GDT_KERNEL_DATA)
+        : "rax", "memory");
+    __asm__ volatile ("ltr %w0" :: "r"(GDT_TSS) : "memory");
+
+    wrmsr(MSR_GS_BASE, (u64)(uintptr_t)cpu);
+    wrmsr(MSR_KERNEL_GS_BASE, 0);
+}
+
+void smp_init_bsp(void) {
+    cpu_t* cpu = &g_cpus[0];
+    smp_cpu_setup(cpu, 0, smp_initial_apic_id());
+    smp_load_tables(cpu);
+    cpu->online = 1;
+}
+
+__attribute__((noreturn))
+static void smp_ap_main(cpu_t* cpu) {
+    // Match the boot CPU's control state: FPU/SSE, global pages, NX
+    wrmsr(MSR_EFER, g_boot_efer);
+    write_cr0(g_boot_cr0);
+    write_cr4(g_boot_cr4);
+    __asm__ volatile ("fninit");
+
+    smp_load_tables(cpu);
+    idt_load();
+    apic_init_ap();
+    syscalls_init_cpu();
+    cpu->online = 1;
+
+    // Processes stay on the boot CPU; the others serve the task pool
+    task_worker_loop();
+}
+
+static int smp_boot_ap(cpu_t* cpu) {
+    apic_send_ipi(cpu->apic_id, APIC_ICR_INIT | APIC_ICR_LEVEL_ASSERT);
+    sleep_ms(10);
+
+    // Second SIPI only if the first was missed. The spec asks for a 200 us
+    // gap; the PIT gives us 1 ms.
+    for (int i = 0; i < 2 && !cpu->online; i++) {
+        apic_send_ipi(cpu->apic_id, APIC_ICR_STARTUP | (SMP_TRAMPOLINE_PHYS >> 12));
+        sleep_ms(1);
+    }
+    for (u32 waited = 0; !cpu->online && waited < SMP_AP_BOOT_TIMEOUT_MS; waited++) {
+        sleep_ms(1);
+    }
+    return cpu->online ? 0 : -1;
+}
+
+void smp_init(void) {
+    const acpi_madt_t* madt = acpi_madt();
+    if (!madt || madt->cpu_count <= 1 || !apic_available()) {
+        vga_printf("[SMP] Single processor\n");
+        return;
+    }
+
+    // The trampoline loads CR3 from 32-bit protected mode
+    u64 cr3 = read_cr3() & ~0xFFFULL;
+    if (cr3 >> 32) {
+        vga_printf("[SMP] PML4 above 4 GiB, application processors not started\n");
+        return;
+    }
+
+    g_boot_cr0 = read_cr0();
+    g_boot_cr4 = read_cr4();
+    g_boot_efer = rdmsr(MSR_EFER);
+
+    // Low memory is never handed to the frame allocator, so the page at
+    // SMP_TRAMPOLINE_PHYS is free for the trampoline
+    memcpy((void*)(uintptr_t)SMP_TRAMPOLINE_PHYS, ap_trampoline_start,
+           (size_t)(ap_trampoline_end - ap_trampoline_start));
+    ap_boot_params_t* params = (ap_boot_params_t*)(uintptr_t)
+        (SMP_TRAMPOLINE_PHYS + (u64)(ap_trampoline_params - ap_trampoline_start));
+    params->cr3 = cr3;
+    params->entry = (u64)(uintptr_t)smp_ap_main;
+
+    u32 bsp_apic_id = this_cpu()->apic_id;
+    for (u32 i = 0; i < madt->cpu_count; i++) {
+        u32 apic_id = madt->cpus[i].apic_id;
+        if (apic_id == bsp_apic_id) continue;
+        if (g_cpu_count >= SMP_MAX_CPUS) {
+            vga_printf("[SMP] Ignoring CPUs beyond %u\n", SMP_MAX_CPUS);
+            break;
+        }
+
+        cpu_t* cpu = &g_cpus[g_cpu_count];
+        smp_cpu_setup(cpu, g_cpu_count, apic_id);
+        cpu->kstack = kstack_alloc(SMP_AP_STACK_SIZE, cpu->name);
+        if (!cpu->kstack) {
+            vga_printf("[SMP] No stack for CPU %u\n", g_cpu_count);
+            break;
+        }
+        params->stack_top = cpu->kstack->top;
+        params->cpu = (u64)(uintptr_t)cpu;
+
+        if (smp_boot_ap(cpu) != 0) {
+            // A late riser would still use this entry and stack, so stop here
+            vga_printf("[SMP] CPU with APIC ID %u did not start\n", apic_id);
+            break;
+        }
+        g_cpu_count++;
+    }
+
+    vga_printf("[SMP] %u of %u CPUs online\n", g_cpu_count, madt->cpu_count);
+}
+
+u32 smp_cpu_count(void) {
+    return g_cpu_count;
+}
+
+cpu_t* smp_cpu(u32 index) {
+    return index < g_cpu_count ? &g_cpus[index] : NULL;
+}
+
+void smp_debug_info(void) {
+    vga_printf("=== CPUs ===\n");
+    for (u32 i = 0; i < g_cpu_count; i++) {
+        cpu_t* cpu = &g_cpus[i];
+        vga_printf("  %s apic=%u %s pid=%u\n", cpu->name, cpu->apic_id,
+                  cpu->online ? "online" : "offline", cpu->running_pid);
+    }
+}
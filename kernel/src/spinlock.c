@@ -0,0 +1,205 @@
+#include <spinlock.h>
+#include <memory_mapper.h>
+#include <vgaio.h>
+
+#define RFLAGS_IF (1ULL << 9)
+
+// Locks taken at least once, newest first. Entries are only ever added.
+static lock_stats_t* volatile g_locks = NULL;
+
+static inline u64 lock_irq_save(void) {
+    u64 flags;
+    __asm__ volatile ("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void lock_irq_restore(u64 flags) {
+    if (flags & RFLAGS_IF) __asm__ volatile ("sti" ::: "memory");
+}
+
+static void lock_register(lock_stats_t* stats) {
+    if (__atomic_load_n(&stats->registered, __ATOMIC_RELAXED)) return;
+    if (__atomic_exchange_n(&stats->registered, 1, __ATOMIC_ACQ_REL)) return;
+    lock_stats_t* head = __atomic_load_n(&g_locks, __ATOMIC_RELAXED);
+    do {
+        stats->next = head;
+    } while (!__atomic_compare_exchange_n(&g_locks, &head, stats, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static void lock_stats_init(lock_stats_t* stats, const char* name) {
+    stats->name = name;
+    stats->acquisitions = 0;
+    stats->contended = 0;
+    stats->spins = 0;
+    stats->next = NULL;
+    stats->registered = 0;
+}
+
+void spin_init(spinlock_t* lock, const char* name) {
+    lock->next = 0;
+    lock->serving = 0;
+    lock_stats_init(&lock->stats, name);
+}
+
+static void spin_acquire(spinlock_t* lock) {
+    u32 ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    u64 spins = 0;
+    while (__atomic_load_n(&lock->serving, __ATOMIC_ACQUIRE) != ticket) {
+        // A shootdown may be waiting on us while interrupts are off
+        mm_tlb_poll();
+        __asm__ volatile ("pause");
+        spins++;
+    }
+    // Counters are only written by the holder
+    lock->stats.acquisitions++;
+    if (spins) {
+        lock->stats.contended++;
+        lock->stats.spins += spins;
+    }
+    lock_register(&lock->stats);
+}
+
+static void spin_release(spinlock_t* lock) {
+    __atomic_store_n(&lock->serving, lock->serving + 1, __ATOMIC_RELEASE);
+}
+
+void spin_lock(spinlock_t* lock) {
+    sched_preempt_disable();
+    spin_acquire(lock);
+}
+
+void spin_unlock(spinlock_t* lock) {
+    spin_release(lock);
+    sched_preempt_enable();
+}
+
+int spin_trylock(spinlock_t* lock) {
+    sched_preempt_disable();
+    u32 ticket = __atomic_load_n(&lock->serving, __ATOMIC_RELAXED);
+    // Only succeeds if nobody holds or waits for the lock
+    if (!__atomic_compare_exchange_n(&lock->next, &ticket, ticket + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        sched_preempt_enable();
+        return 0;
+    }
+    lock->stats.acquisitions++;
+    lock_register(&lock->stats);
+    return 1;
+}
+
+u64 spin_lock_irqsave(spinlock_t* lock) {
+    u64 flags = lock_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t* lock, u64 flags) {
+    spin_release(lock);
+    // Interrupts first, so a switch that came due can happen on enable
+    lock_irq_restore(flags);
+    sched_preempt_enable();
+}
+
+void rwlock_init(rwlock_t* lock, const char* name) {
+    lock->state = 0;
+    lock->writers_waiting = 0;
+    lock_stats_init(&lock->stats, name);
+}
+
+static void rwlock_account(rwlock_t* lock, u64 spins) {
+    __atomic_fetch_add(&lock->stats.acquisitions, 1, __ATOMIC_RELAXED);
+    if (spins) {
+        __atomic_fetch_add(&lock->stats.contended, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&lock->stats.spins, spins, __ATOMIC_RELAXED);
+    }
+    lock_register(&lock->stats);
+}
+
+void read_lock(rwlock_t* lock) {
+    sched_preempt_disable();
+    u64 spins = 0;
+    for (;;) {
+        u32 state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if (!(state & RWLOCK_WRITER) &&
+            !__atomic_load_n(&lock->writers_waiting, __ATOMIC_RELAXED) &&
+            __atomic_compare_exchange_n(&lock->state, &state, state + 1, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        mm_tlb_poll();
+        __asm__ volatile ("pause");
+        spins++;
+    }
+    rwlock_account(lock, spins);
+}
+
+void read_unlock(rwlock_t* lock) {
+    __atomic_fetch_sub(&lock->state, 1, __ATOMIC_RELEASE);
+    sched_preempt_enable();
+}
+
+void write_lock(rwlock_t* lock) {
+    sched_preempt_disable();
+    __atomic_fetch_add(&lock->writers_waiting, 1, __ATOMIC_RELAXED);
+    u64 spins = 0;
+    for (;;) {
+        u32 state = 0;
+        if (__atomic_compare_exchange_n(&lock->state, &state, RWLOCK_WRITER, 1,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+        mm_tlb_poll();
+        __asm__ volatile ("pause");
+        spins++;
+    }
+    __atomic_fetch_sub(&lock->writers_waiting, 1, __ATOMIC_RELAXED);
+    rwlock_account(lock, spins);
+}
+
+void write_unlock(rwlock_t* lock) {
+    __atomic_store_n(&lock->state, 0, __ATOMIC_RELEASE);
+    sched_preempt_enable();
+}
+
+void rspin_lock(rspinlock_t* lock) {
+    u32 self = this_cpu()->index + 1;
+    // Only this CPU can have stored its own index, so no race here
+    if (__atomic_load_n(&lock->owner, __ATOMIC_RELAXED) == self) {
+        lock->depth++;
+        return;
+    }
+    spin_lock(&lock->lock);
+    __atomic_store_n(&lock->owner, self, __ATOMIC_RELAXED);
+    lock->depth = 1;
+}
+
+void rspin_unlock(rspinlock_t* lock) {
+    if (--lock->depth) return;
+    __atomic_store_n(&lock->owner, 0, __ATOMIC_RELAXED);
+    spin_unlock(&lock->lock);
+}
+
+u64 rspin_lock_irqsave(rspinlock_t* lock) {
+    u64 flags = lock_irq_save();
+    rspin_lock(lock);
+    return flags;
+}
+
+void rspin_unlock_irqrestore(rspinlock_t* lock, u64 flags) {
+    if (--lock->depth) {
+        lock_irq_restore(flags);
+        return;
+    }
+    __atomic_store_n(&lock->owner, 0, __ATOMIC_RELAXED);
+    spin_unlock_irqrestore(&lock->lock, flags);
+}
+
+void lock_debug_info(void) {
+    vga_printf("=== Locks ===\n");
+    for (lock_stats_t* s = __atomic_load_n(&g_locks, __ATOMIC_ACQUIRE); s; s = s->next) {
+        u64 avg = s->contended ? s->spins / s->contended : 0;
+        vga_printf("  %s: acquired=%llu contended=%llu spins=%llu (avg %llu per wait)\n",
+                  s->name ? s->name : "?", s->acquisitions, s->contended, s->spins, avg);
+    }
+}
@@ -1,28 +1,30 @@
-; syscall_handler.asm - Assembly wrapper for 0x80 syscall interrupt
+; syscall_handler.asm - Entry stubs for `int 0x80` and the SYSCALL instruction
 section .text
 
 extern syscall_dispatch
+extern syscall_bad_return
 
 global syscall_interrupt_handler
+global syscall_entry
+global user_enter
 
-; Debug console output helper
-%macro DEBUG_CHAR 1
-    push rax
-    push rdx
-    mov al, %1
-    mov dx, 0xe9        ; QEMU debug console port
-    out dx, al
-    pop rdx
-    pop rax
-%endmacro
+; cpu_t field offsets (see smp.h)
+%define CPU_SYSCALL_RSP 8
+%define CPU_USER_RSP    16
+
+; Ring-3 selectors (see smp.h)
+%define USER_DATA_SEL   (0x18 | 3)
+%define USER_CODE_SEL   (0x20 | 3)
 
 ; 0x80 interrupt handler
 ; Syscall number in rax
 ; Arguments in rdi, rsi, rdx, rcx, r8, r9 (System V ABI)
 syscall_interrupt_handler:
-    ; Debug: Write '[' to debug console to show we entered
-    DEBUG_CHAR '['
-    
+    ; From user mode the kernel GS base has to be swapped in
+    test byte [rsp + 8], 3
+    jz .kernel_gs
+    swapgs
+.kernel_gs:
     ; Save all caller-saved registers
     push rax
     push rcx
@@ -33,7 +35,7 @@ syscall_interrupt_handler:
     push r9
     push r10
     push r11
-    
+
     ; Set up arguments for syscall_dispatch(syscall_num, arg1, arg2, arg3, arg4, arg5, arg6)
     ; syscall_num (from rax) goes to rdi
     ; arg1 (from rdi) goes to rsi
@@ -42,7 +44,7 @@ syscall_interrupt_handler:
     ; arg4 (from rcx) goes to r8
     ; arg5 (from r8) goes to r9
     ; arg6 (from r9) goes to stack
-    
+
     push r9         ; arg6 on stack
     mov r9, r8      ; arg5
     mov r8, rcx     ; arg4
@@ -50,21 +52,15 @@ syscall_interrupt_handler:
     mov rdx, rsi    ; arg2
     mov rsi, rdi    ; arg1
     mov rdi, rax    ; syscall_num
-    
-    ; Debug: Write 'C' to show we're about to call C dispatcher
-    DEBUG_CHAR 'C'
-    
+
     ; Call the C dispatcher
     call syscall_dispatch
-    
-    ; Debug: Write 'R' to show C dispatcher returned
-    DEBUG_CHAR 'R'
-    
+
     ; Clean up stack (arg6)
     add rsp, 8
-    
+
     ; Return value is in rax - keep it there
-    
+
     ; Restore caller-saved registers (except rax which has return value)
     pop r11
     pop r10
@@ -75,9 +71,134 @@ syscall_interrupt_handler:
     pop rdx
     pop rcx
     add rsp, 8      ; Skip saved rax - return value is already in rax
-    
-    ; Debug: Write ']' to show we're about to iretq
-    DEBUG_CHAR ']'
-    
+
     ; Return from interrupt
-    iretq
\ No newline at end of file
+    test byte [rsp + 8], 3
+    jz .kernel_ret
+    swapgs
+.kernel_ret:
+    iretq
+
+; SYSCALL entry (LSTAR)
+; Syscall number in rax
+; Arguments in rdi, rsi, rdx, r10, r8, r9; the CPU put the return address
+; in rcx and RFLAGS in r11, and cleared IF/DF/TF/AC through FMASK.
+;
+; SYSCALL does not record the caller's privilege level, so the return
+; address decides: user code lives in the lower half and gets swapgs, the
+; per-CPU kernel stack and SYSRET. Kernel code calling in (syscall_test.h)
+; keeps its stack and returns with a plain jump, since SYSRET always drops
+; to ring 3. SYSRET faults in ring 0 on a non-canonical rcx, which only a
+; SYSCALL in the last bytes below USER_SPACE_TOP would leave behind. That
+; page is never mapped (elf_loader.h); should it ever be, the program is
+; killed rather than returned to.
+syscall_entry:
+    bt rcx, 63
+    jc .from_kernel
+    swapgs
+    mov [gs:CPU_USER_RSP], rsp
+    mov rsp, [gs:CPU_SYSCALL_RSP]
+    ; Keep the user stack on the kernel stack in case this process is
+    ; switched out and another one enters here meanwhile
+    push qword [gs:CPU_USER_RSP]
+    jmp .dispatch
+
+.from_kernel:
+    ; Step over the caller's red zone before using its stack
+    lea rsp, [rsp - 128]
+    push rsp
+    add qword [rsp], 128        ; Caller's rsp; RFLAGS are safe in r11
+
+.dispatch:
+    ; [rsp] holds the caller's stack pointer
+    push rbp
+    mov rbp, rsp
+    and rsp, -16
+    push rcx                    ; Return address
+    push r11                    ; Caller's RFLAGS
+    push rdi
+    push rsi
+    push rdx
+    push r10
+    push r8
+    push r9
+
+    ; syscall_dispatch(syscall_num, arg1, ..., arg6) with arg6 on the stack;
+    ; the padding keeps the stack 16-byte aligned at the call
+    sub rsp, 8
+    push r9                     ; arg6
+    mov r9, r8                  ; arg5
+    mov r8, r10                 ; arg4
+    mov rcx, rdx                ; arg3
+    mov rdx, rsi                ; arg2
+    mov rsi, rdi                ; arg1
+    mov edi, eax                ; syscall_num
+    call syscall_dispatch
+    add rsp, 16
+
+    pop r9
+    pop r8
+    pop r10
+    pop rdx
+    pop rsi
+    pop rdi
+    pop r11
+    pop rcx
+    mov rsp, rbp
+    pop rbp
+
+    bt rcx, 63
+    jc .to_kernel
+    ; A context switch inside the call may have turned interrupts back on
+    cli
+    ; pop leaves the flags of the shift alone
+    push rcx
+    shr rcx, 47
+    pop rcx
+    jnz .bad_return
+    mov rsp, [rsp]
+    swapgs
+    o64 sysret
+
+.bad_return:
+    ; Still on the kernel stack and GS; syscall_bad_return does not return
+    mov rdi, rcx
+    and rsp, -16
+    call syscall_bad_return
+
+.to_kernel:
+    ; RFLAGS first, while still on our frame, then back to the caller
+    push r11
+    popfq
+    mov rsp, [rsp]
+    jmp rcx
+
+; user_enter(rip, rsp): drop to ring 3 at rip with the given stack and
+; interrupts on. Never returns; the kernel stack it leaves is reused from
+; the top by the next entry from user mode.
+user_enter:
+    cli
+    push USER_DATA_SEL          ; ss
+    push rsi                    ; rsp
+    push 0x202                  ; rflags: IF and the reserved bit
+    push USER_CODE_SEL          ; cs
+    push rdi                    ; rip
+
+    ; Leave nothing of the kernel's behind in registers
+    xor eax, eax
+    xor ebx, ebx
+    xor ecx, ecx
+    xor edx, edx
+    xor esi, esi
+    xor edi, edi
+    xor ebp, ebp
+    xor r8d, r8d
+    xor r9d, r9d
+    xor r10d, r10d
+    xor r11d, r11d
+    xor r12d, r12d
+    xor r13d, r13d
+    xor r14d, r14d
+    xor r15d, r15d
+    swapgs
+    iretq
@@ -9,6 +9,10 @@ void test_syscalls(void) {
     long pid = syscall0(SYSCALL_GETPID);
     vga_printf("[TEST] getpid() returned: %ld\n", pid);
     
+    // Same call through the SYSCALL entry
+    long fast_pid = fast_syscall0(SYSCALL_GETPID);
+    vga_printf("[TEST] getpid() via syscall returned: %ld\n", fast_pid);
+    
     // Test write syscall (syscall 4) - write "Hello from syscall!" to stdout
     const char* msg = "Hello from syscall!\n";
     long len = 0;
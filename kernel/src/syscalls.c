@@ -2,17 +2,36 @@
 #include <vgaio.h>
 #include <string.h>
 #include <process.h>
+#include <sched.h>
+#include <smp.h>
+#include <cpu.h>
+#include <clock.h>
+#include <uring.h>
 
 #include <cldattrs.h>
 
+// Interrupts, direction, trap and alignment-check flags are cleared on
+// SYSCALL entry
+#define SYSCALL_FMASK ((1ULL << 9) | (1ULL << 10) | (1ULL << 8) | (1ULL << 18))
+
+// Constant-folds away above SYSCALL_TRACE_MAX
+#define SYSCALL_TRACE(level, ...) \
+    do { \
+        if ((level) <= SYSCALL_TRACE_MAX && (level) <= g_trace_level) vga_printf(__VA_ARGS__); \
+    } while (0)
+
+extern void syscall_entry(void);
+
 // Syscall table
 static struct syscall_entry syscall_table[MAX_SYSCALLS];
 static u32 registered_syscalls = 0;
+static u64 g_out_of_range = 0;
+static u32 g_trace_level = SYSCALL_TRACE_ERRORS;
 
 // Default invalid syscall handler
 static long sys_invalid(long arg1, long arg2, long arg3, long arg4, long arg5, long arg6) {
-    vga_printf("[SYSCALL] Invalid syscall called with args: %ld, %ld, %ld, %ld, %ld, %ld\n", 
-               arg1, arg2, arg3, arg4, arg5, arg6);
+    SYSCALL_TRACE(SYSCALL_TRACE_ERRORS, "[SYSCALL] Invalid syscall called with args: %ld, %ld, %ld, %ld, %ld, %ld\n",
+                  arg1, arg2, arg3, arg4, arg5, arg6);
     return -1; // EPERM equivalent
 }
 
@@ -22,6 +41,8 @@ void syscalls_init(void) {
         syscall_table[i].handler = sys_invalid;
         syscall_table[i].name = "invalid";
         syscall_table[i].arg_count = 0;
+        syscall_table[i].calls = 0;
+        syscall_table[i].cycles = 0;
     }
     
     // Register default syscalls
@@ -29,10 +50,23 @@ void syscalls_init(void) {
     register_syscall(SYSCALL_WRITE, sys_write, "write", 3);
     register_syscall(SYSCALL_READ, sys_read, "read", 3);
     register_syscall(SYSCALL_GETPID, sys_getpid, "getpid", 0);
+    register_syscall(SYSCALL_URING_SETUP, sys_uring_setup, "uring_setup", 1);
+    register_syscall(SYSCALL_URING_ENTER, sys_uring_enter, "uring_enter", 2);
     
+    syscalls_init_cpu();
     vga_printf("[SYSCALL] System initialized with %u syscalls\n", registered_syscalls);
 }
 
+void syscalls_init_cpu(void) {
+    // SYSCALL loads CS from STAR[47:32] and SS from the entry after it;
+    // SYSRET loads SS from STAR[63:48] + 8 and CS from STAR[63:48] + 16
+    u64 star = ((u64)(GDT_USER_DATA - 8) << 48) | ((u64)GDT_KERNEL_CODE << 32);
+    wrmsr(MSR_STAR, star);
+    wrmsr(MSR_LSTAR, (u64)(uintptr_t)syscall_entry);
+    wrmsr(MSR_FMASK, SYSCALL_FMASK);
+    wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_SCE);
+}
+
 int register_syscall(u32 syscall_num, syscall_handler_t handler, const char* name, u8 arg_count) {
     if (syscall_num >= MAX_SYSCALLS) {
         vga_printf("[SYSCALL] Error: syscall number %u out of range\n", syscall_num);
@@ -44,16 +78,13 @@ int register_syscall(u32 syscall_num, syscall_handler_t handler, const char* nam
         return -1;
     }
     
-    syscall_table[syscall_num].handler = handler;
-    syscall_table[syscall_num].name = name ? name : "unnamed";
-    syscall_table[syscall_num].arg_count = arg_count;
-    
-    if (syscall_table[syscall_num].handler != sys_invalid) {
+    if (syscall_table[syscall_num].handler == sys_invalid) {
         registered_syscalls++;
     }
     
-    vga_printf("[SYSCALL] Registered syscall %u: %s (%u args)\n", 
-               syscall_num, syscall_table[syscall_num].name, arg_count);
+    syscall_table[syscall_num].handler = handler;
+    syscall_table[syscall_num].name = name ? name : "unnamed";
+    syscall_table[syscall_num].arg_count = arg_count;
     return 0;
 }
 
@@ -64,42 +95,86 @@ const struct syscall_entry* get_syscall_info(u32 syscall_num) {
     return &syscall_table[syscall_num];
 }
 
-// Syscall dispatcher - called from assembly interrupt handler
+int syscall_set_trace_level(u32 level) {
+    if (level > SYSCALL_TRACE_MAX) return -1;
+    g_trace_level = level;
+    return 0;
+}
+
+u32 syscall_trace_level(void) {
+    return g_trace_level;
+}
+
+// Syscall dispatcher - called from both entry stubs
 long syscall_dispatch(u32 syscall_num, long arg1, long arg2, long arg3, long arg4, long arg5, long arg6) {
-    // Debug: Add minimal debug info for loaded programs
-    if (syscall_num == 4) { // write syscall from loaded program
-        vga_printf("[SYSCALL-DEBUG] Write syscall from loaded program\n");
-    } else if (syscall_num == 1) { // exit syscall
-        vga_printf("[SYSCALL-DEBUG] Exit syscall from loaded program\n");
-    }
-    
     if (syscall_num >= MAX_SYSCALLS) {
-        vga_printf("[SYSCALL] Invalid syscall number: %u\n", syscall_num);
+        __atomic_fetch_add(&g_out_of_range, 1, __ATOMIC_RELAXED);
+        SYSCALL_TRACE(SYSCALL_TRACE_ERRORS, "[SYSCALL] Invalid syscall number: %u\n", syscall_num);
         return -1;
     }
     
-    const struct syscall_entry* entry = &syscall_table[syscall_num];
+    struct syscall_entry* entry = &syscall_table[syscall_num];
     
-    // Call the syscall handler
-    long result = entry->handler(arg1, arg2, arg3, arg4, arg5, arg6);
+    // Counted before the call: exit never comes back
+    __atomic_fetch_add(&entry->calls, 1, __ATOMIC_RELAXED);
+    SYSCALL_TRACE(SYSCALL_TRACE_CALLS, "[SYSCALL] pid %u: %s(%ld, %ld, %ld)\n",
+                  current_pid, entry->name, arg1, arg2, arg3);
     
-    if (syscall_num == 4) { // write syscall
-        vga_printf("[SYSCALL-DEBUG] Write syscall completed\n");
-    } else if (syscall_num == 1) { // exit syscall
-        vga_printf("[SYSCALL-DEBUG] Exit syscall completed\n");
-    }
+    u64 start = clock_cycles();
+    long result = entry->handler(arg1, arg2, arg3, arg4, arg5, arg6);
+    __atomic_fetch_add(&entry->cycles, clock_cycles() - start, __ATOMIC_RELAXED);
     
+    SYSCALL_TRACE(SYSCALL_TRACE_CALLS, "[SYSCALL] pid %u: %s = %ld\n",
+                  current_pid, entry->name, result);
     return result;
 }
 
+// syscall_entry comes here instead of SYSRET when the return address is not
+// canonical. Unreachable while the top user page stays unmapped.
+void syscall_bad_return(u64 rip) {
+    process_t* proc = process_get_current();
+    vga_printf("[PROCESS] %u (%s) killed: syscall return to non-canonical 0x%llx\n",
+               current_pid, proc ? proc->name : "?", rip);
+    sched_exit(128 + 13);
+}
+
+void syscall_debug_info(void) {
+    vga_printf("=== Syscalls ===\n");
+    for (u32 i = 0; i < MAX_SYSCALLS; i++) {
+        const struct syscall_entry* entry = &syscall_table[i];
+        if (entry->handler == sys_invalid && entry->calls == 0) continue;
+        u64 avg = entry->calls ? entry->cycles / entry->calls : 0;
+        vga_printf("  %u %s: calls=%llu cycles=%llu (avg %llu)\n",
+                  i, entry->name, entry->calls, entry->cycles, avg);
+    }
+    vga_printf("Out of range: %llu, trace level %u (max %u)\n",
+              g_out_of_range, g_trace_level, (u32)SYSCALL_TRACE_MAX);
+}
+
+void syscall_reset_stats(void) {
+    for (u32 i = 0; i < MAX_SYSCALLS; i++) {
+        __atomic_store_n(&syscall_table[i].calls, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&syscall_table[i].cycles, 0, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&g_out_of_range, 0, __ATOMIC_RELAXED);
+}
+
+u8 syscall_user_ok(long ptr, long size, u8 write) {
+    if (size < 0) return 0;
+    process_t* current = process_get_current();
+    if (!current || !current->space.pml4_phys) return 1;
+    return mm_space_check(&current->space, (u64)ptr, (u64)size, write);
+}
+
 // Default syscall implementations
 long sys_write(long fd, long buf, long count, long A_UNUSED unused1, long A_UNUSED unused2, long A_UNUSED unused3) {
     // Simple implementation - just write to VGA console for fd 1 (stdout)
     if (fd == 1) {
+        if (!syscall_user_ok(buf, count, 0)) return -1;
         const char* str = (const char*)buf;
-        for (long i = 0; i < count && str[i]; i++) {
-            vga_putchar(str[i]);
-        }
+        long len = 0;
+        while (len < count && str[len]) len++;
+        vga_write(str, (u64)len);
         return count;
     }
     return -1; // Invalid fd
@@ -107,49 +182,20 @@ long sys_write(long fd, long buf, long count, long A_UNUSED unused1, long A_UNUS
 
 long sys_read(long fd, long buf, long count, long A_UNUSED unused1, long A_UNUSED unused2, long A_UNUSED unused3) {
     // Stub implementation - not implemented yet
-    vga_printf("[SYSCALL] sys_read not implemented (fd=%ld, buf=%p, count=%ld)\n", fd, (void*)buf, count);
+    SYSCALL_TRACE(SYSCALL_TRACE_ERRORS, "[SYSCALL] sys_read not implemented (fd=%ld, buf=%p, count=%ld)\n",
+                  fd, (void*)buf, count);
     return 0;
 }
 
-// Global variable to store exit status from programs
-volatile long program_exit_status = 0;
-volatile int program_should_exit = 0;
-
-// Simple jump target for sys_exit to return to elf_execute
-volatile void* exit_jump_target = NULL;
-
-// Assembly function to perform context switch (we'll implement this)
-extern void process_context_switch_exit(u64 exit_status);
-
 long sys_exit(long status, long A_UNUSED unused1, long A_UNUSED unused2, long A_UNUSED unused3, long A_UNUSED unused4, long A_UNUSED unused5) {
-    vga_printf("[SYSCALL] sys_exit called with status: %ld\n", status);
-    
     process_t* current = process_get_current();
     
     if (current) {
-        vga_printf("[SYSCALL] Process %u exit with status: %ld\n", current->pid, status);
-        
-        // Use the proper process exit mechanism
-        process_exit_and_restore_parent(current->pid, status);
-        
-        vga_printf("[SYSCALL] Process terminated, control should be restored to parent\n");
-        
-        // This syscall should NEVER return normally to the calling program
-        // Instead, we need to jump back to the parent context
-        // For now, we'll use a simple longjmp-like mechanism
-        
-        // Set global flags for the ELF execution loop to detect
-        program_should_exit = 1;
-        program_exit_status = status;
-        
-        // The key insight: we need to NOT return to the program that called int 0x80
-        // Instead, we need to return control to the parent process (shell)
-        
-        // We'll implement this by modifying the interrupt return address
-        // For now, return normally but set flags for cleanup
-        return status;
+        // The program runs on its own kernel stack, so it can be switched
+        // away from right here; this call never returns to it
+        sched_exit(status);
     } else {
-        vga_printf("[SYSCALL] Exit called from kernel context with status: %ld\n", status);
+        SYSCALL_TRACE(SYSCALL_TRACE_ERRORS, "[SYSCALL] Exit called from kernel context with status: %ld\n", status);
         return status;
     }
 }
@@ -162,3 +208,13 @@ long sys_getpid(long A_UNUSED unused1, long A_UNUSED unused2, long A_UNUSED unus
         return 0; // Kernel/shell process
     }
 }
+
+long sys_uring_setup(long entries, long A_UNUSED unused1, long A_UNUSED unused2, long A_UNUSED unused3, long A_UNUSED unused4, long A_UNUSED unused5) {
+    if (entries <= 0) return -1;
+    return uring_setup(process_get_current(), (u32)entries);
+}
+
+long sys_uring_enter(long to_submit, long min_complete, long A_UNUSED unused1, long A_UNUSED unused2, long A_UNUSED unused3, long A_UNUSED unused4) {
+    if (to_submit < 0 || min_complete < 0) return -1;
+    return uring_enter(process_get_current(), (u32)to_submit, (u32)min_complete);
+}
@@ -0,0 +1,197 @@
+#include <task.h>
+#include <smp.h>
+#include <deferred.h>
+#include <apic/apic.h>
+#include <memory_mapper.h>
+#include <vgaio.h>
+
+#define RFLAGS_IF (1ULL << 9)
+
+// Chase-Lev deque (Le et al., "Correct and Efficient Work-Stealing for
+// Weak Memory Models"). The owner pushes and takes at bottom, thieves CAS
+// top forward; the two ends only race for the last task. Indices only grow,
+// so a slot is reused only after the whole ring has gone round.
+typedef struct {
+    volatile i64 top;
+    u8 pad0[56];                    // Keep thieves off the owner's line
+    volatile i64 bottom;
+    u8 pad1[56];
+    task_t* volatile slots[TASK_DEQUE_SIZE];
+    u64 spawned;
+    u64 run;
+    u64 stolen;
+    u64 inline_runs;
+} __attribute__((aligned(64))) task_deque_t;
+
+static task_deque_t g_deques[SMP_MAX_CPUS];
+static volatile u32 g_idle_mask = 0;   // CPUs halted in task_worker_loop
+
+static void task_drain(void* arg);
+static deferred_work_t g_drain_work = DEFERRED_WORK_INIT(task_drain, 0, DEFERRED_PRIO_LOW);
+
+// Owner operations run with interrupts off so that a preempting process on
+// the same CPU cannot become a second owner halfway through.
+static inline u64 task_irq_save(void) {
+    u64 flags;
+    __asm__ volatile ("pushfq; pop %0; cli" : "=r"(flags) :: "memory");
+    return flags;
+}
+
+static inline void task_irq_restore(u64 flags) {
+    if (flags & RFLAGS_IF) __asm__ volatile ("sti" ::: "memory");
+}
+
+static int deque_push(task_deque_t* d, task_t* task) {
+    i64 b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED);
+    i64 t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    if (b - t >= TASK_DEQUE_SIZE) return 0;
+    __atomic_store_n(&d->slots[b % TASK_DEQUE_SIZE], task, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+static task_t* deque_take(task_deque_t* d) {
+    i64 b = __atomic_load_n(&d->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&d->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    i64 t = __atomic_load_n(&d->top, __ATOMIC_RELAXED);
+
+    if (t > b) {
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    task_t* task = __atomic_load_n(&d->slots[b % TASK_DEQUE_SIZE], __ATOMIC_RELAXED);
+    if (t == b) {
+        // Last task: race the thieves for it
+        if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = NULL;
+        }
+        __atomic_store_n(&d->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+static task_t* deque_steal(task_deque_t* d) {
+    i64 t = __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    i64 b = __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) return NULL;
+
+    task_t* task = __atomic_load_n(&d->slots[t % TASK_DEQUE_SIZE], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&d->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;                // Lost to the owner or another thief
+    }
+    return task;
+}
+
+static void task_run(task_t* task) {
+    task->fn(task->arg);
+    // The waiter may release the task_t as soon as this is visible
+    __atomic_store_n(&task->done, 1, __ATOMIC_RELEASE);
+}
+
+static void task_drain(void* arg) {
+    (void)arg;
+    while (task_run_one()) {}
+}
+
+// Hand new work to one halted worker, if any.
+static void task_wake_idle(u32 self) {
+    // Pairs with the fetch_or in task_worker_loop: either the worker sees
+    // the pushed task or we see its idle bit
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    u32 mask = __atomic_load_n(&g_idle_mask, __ATOMIC_RELAXED) & ~(1U << self);
+    if (!mask) return;
+    u32 bit = 1U << __builtin_ctz(mask);
+    if (!(__atomic_fetch_and(&g_idle_mask, ~bit, __ATOMIC_ACQ_REL) & bit)) return;
+    cpu_t* cpu = smp_cpu((u32)__builtin_ctz(bit));
+    if (cpu) apic_send_wake(cpu->apic_id);
+}
+
+void task_spawn(task_t* task, task_fn_t fn, void* arg) {
+    task->fn = fn;
+    task->arg = arg;
+    task->done = 0;
+
+    u64 flags = task_irq_save();
+    u32 self = this_cpu()->index;
+    task_deque_t* d = &g_deques[self];
+    int queued = deque_push(d, task);
+    if (queued) d->spawned++;
+    else d->inline_runs++;
+    task_irq_restore(flags);
+
+    if (!queued) {
+        task_run(task);
+        return;
+    }
+    task_wake_idle(self);
+    // The main loop picks it up if nobody waits for it first
+    if (self == 0) deferred_queue(&g_drain_work);
+}
+
+int task_run_one(void) {
+    u64 flags = task_irq_save();
+    u32 self = this_cpu()->index;
+    task_deque_t* d = &g_deques[self];
+    task_t* task = deque_take(d);
+    if (!task) {
+        u32 count = smp_cpu_count();
+        for (u32 i = 1; i < count && !task; i++) {
+            task = deque_steal(&g_deques[(self + i) % count]);
+        }
+        if (task) d->stolen++;
+    }
+    if (task) d->run++;
+    task_irq_restore(flags);
+
+    // With the caller's flags: long tasks must not hold off the clock tick
+    if (!task) return 0;
+    task_run(task);
+    return 1;
+}
+
+void task_wait(task_t* task) {
+    while (!task_done(task)) {
+        // Helping keeps a single CPU from deadlocking on its own deque
+        if (!task_run_one()) {
+            mm_tlb_poll();
+            __asm__ volatile ("pause");
+        }
+    }
+}
+
+void task_worker_loop(void) {
+    u32 bit = 1U << this_cpu()->index;
+    __asm__ volatile ("cli");
+    for (;;) {
+        if (task_run_one()) continue;
+
+        __atomic_fetch_or(&g_idle_mask, bit, __ATOMIC_SEQ_CST);
+        // A spawn racing with the failed search above may not have seen
+        // the idle bit; look once more before sleeping
+        if (task_run_one()) {
+            __atomic_fetch_and(&g_idle_mask, ~bit, __ATOMIC_RELAXED);
+            continue;
+        }
+        // sti takes effect after hlt starts, so a wakeup IPI already
+        // pending cannot slip in between
+        __asm__ volatile ("sti; hlt; cli" ::: "memory");
+        __atomic_fetch_and(&g_idle_mask, ~bit, __ATOMIC_RELAXED);
+    }
+}
+
+void task_debug_info(void) {
+    vga_printf("=== Task pool ===\n");
+    u32 idle = g_idle_mask;
+    for (u32 i = 0; i < smp_cpu_count(); i++) {
+        task_deque_t* d = &g_deques[i];
+        i64 queued = d->bottom - d->top;
+        vga_printf("CPU%u: queued=%lld spawned=%llu run=%llu stolen=%llu inline=%llu%s\n",
+                  i, queued > 0 ? queued : 0, d->spawned, d->run, d->stolen,
+                  d->inline_runs, (idle & (1U << i)) ? " idle" : "");
+    }
+}
@@ -0,0 +1,238 @@
+#include <uring.h>
+#include <process.h>
+#include <syscalls.h>
+#include <sched.h>
+#include <pmm.h>
+#include <kmalloc.h>
+#include <string.h>
+#include <pit/pit.h>
+#include <cldramfs/cldramfs.h>
+
+typedef struct uring_file {
+    char* path;                     // NULL when the slot is free
+    u32 pos;                        // For URING_OFF_CURRENT reads
+} uring_file_t;
+
+typedef struct uring_sleep {
+    u64 deadline;                   // pit_ticks() value
+    u64 user_data;
+} uring_sleep_t;
+
+typedef struct uring {
+    uring_header_t* hdr;            // Kernel view of the shared region
+    uring_sqe_t* sqes;
+    uring_cqe_t* cqes;
+    u64 phys;
+    u32 order;
+    u32 sq_entries;
+    u32 cq_entries;
+    u32 sq_head;                    // Authoritative copies of the kernel's indices
+    u32 cq_tail;
+    uring_file_t files[URING_MAX_FILES];
+    uring_sleep_t* sleeps;          // Pending sleeps, unordered, cq_entries slots
+    u32 sleeps_pending;
+} uring_t;
+
+// User pointers are used directly, so they have to belong to the address
+// space that is loaded: the rings are only entered by their own process.
+static u8 uring_buf_ok(process_t* proc, u64 addr, u32 len, u8 write) {
+    if (!proc->space.pml4_phys) return 1;
+    return mm_space_check(&proc->space, addr, len, write);
+}
+
+static void uring_post(uring_t* ring, u64 user_data, i64 res) {
+    uring_cqe_t* cqe = &ring->cqes[ring->cq_tail & (ring->cq_entries - 1)];
+    cqe->user_data = user_data;
+    cqe->res = res;
+    ring->cq_tail++;
+    __atomic_store_n(&ring->hdr->cq_tail, ring->cq_tail, __ATOMIC_RELEASE);
+}
+
+// Completions the program has not consumed yet
+static u32 uring_cq_used(const uring_t* ring) {
+    u32 used = ring->cq_tail - __atomic_load_n(&ring->hdr->cq_head, __ATOMIC_ACQUIRE);
+    return used > ring->cq_entries ? ring->cq_entries : used;
+}
+
+// Post every sleep that is due. Returns the earliest deadline left, or 0.
+static u64 uring_post_due(uring_t* ring) {
+    u64 now = pit_ticks();
+    u64 next = 0;
+    for (u32 i = 0; i < ring->sleeps_pending;) {
+        uring_sleep_t* s = &ring->sleeps[i];
+        if (s->deadline <= now) {
+            uring_post(ring, s->user_data, 0);
+            *s = ring->sleeps[--ring->sleeps_pending];
+            continue;
+        }
+        if (!next || s->deadline < next) next = s->deadline;
+        i++;
+    }
+    return next;
+}
+
+static i64 uring_open(process_t* proc, uring_t* ring, const uring_sqe_t* sqe) {
+    if (sqe->len == 0 || sqe->len >= URING_PATH_MAX || !uring_buf_ok(proc, sqe->addr, sqe->len, 0)) {
+        return -1;
+    }
+    u32 slot = 0;
+    while (slot < URING_MAX_FILES && ring->files[slot].path) slot++;
+    if (slot == URING_MAX_FILES) return -1;
+
+    char* path = (char*)kmalloc(sqe->len + 1);
+    if (!path) return -1;
+    memcpy(path, (const void*)(uintptr_t)sqe->addr, sqe->len);
+    path[sqe->len] = '\0';
+    if (cldramfs_read_file(path, 0, NULL, 0) < 0) {
+        kfree(path);
+        return -1;
+    }
+    ring->files[slot].path = path;
+    ring->files[slot].pos = 0;
+    return URING_FD_BASE + slot;
+}
+
+static uring_file_t* uring_get_file(uring_t* ring, i32 fd) {
+    if (fd < URING_FD_BASE || fd >= URING_FD_BASE + URING_MAX_FILES) return NULL;
+    uring_file_t* file = &ring->files[fd - URING_FD_BASE];
+    return file->path ? file : NULL;
+}
+
+static i64 uring_read(process_t* proc, uring_t* ring, const uring_sqe_t* sqe) {
+    if (sqe->fd < URING_FD_BASE) {
+        return sys_read(sqe->fd, (long)sqe->addr, sqe->len, 0, 0, 0);
+    }
+    uring_file_t* file = uring_get_file(ring, sqe->fd);
+    if (!file || !uring_buf_ok(proc, sqe->addr, sqe->len, 1)) return -1;
+
+    u32 off = sqe->off == URING_OFF_CURRENT ? file->pos : sqe->off;
+    i64 n = cldramfs_read_file(file->path, off, (void*)(uintptr_t)sqe->addr, sqe->len);
+    if (n > 0 && sqe->off == URING_OFF_CURRENT) file->pos += (u32)n;
+    return n;
+}
+
+static i64 uring_run(process_t* proc, uring_t* ring, const uring_sqe_t* sqe) {
+    if (sqe->flags) return -1;
+    switch (sqe->opcode) {
+        case URING_OP_NOP:
+            return 0;
+        case URING_OP_WRITE:
+            return sys_write(sqe->fd, (long)sqe->addr, sqe->len, 0, 0, 0);
+        case URING_OP_READ:
+            return uring_read(proc, ring, sqe);
+        case URING_OP_OPEN:
+            return uring_open(proc, ring, sqe);
+        case URING_OP_CLOSE: {
+            uring_file_t* file = uring_get_file(ring, sqe->fd);
+            if (!file) return -1;
+            kfree(file->path);
+            file->path = NULL;
+            return 0;
+        }
+        default:
+            return -1;
+    }
+}
+
+static void uring_free(uring_t* ring) {
+    for (u32 i = 0; i < URING_MAX_FILES; i++) {
+        if (ring->files[i].path) kfree(ring->files[i].path);
+    }
+    if (ring->phys) pmm_free_pages(ring->phys, ring->order);
+    if (ring->sleeps) kfree(ring->sleeps);
+    kfree(ring);
+}
+
+long uring_setup(process_t* proc, u32 entries) {
+    if (!proc || proc->uring || entries == 0 || entries > URING_MAX_ENTRIES) return -1;
+    u32 sq_entries = 1;
+    while (sq_entries < entries) sq_entries <<= 1;
+    u32 cq_entries = sq_entries * 2;
+
+    u64 bytes = sizeof(uring_header_t) + sq_entries * sizeof(uring_sqe_t) +
+                cq_entries * sizeof(uring_cqe_t);
+    u32 order = 0;
+    while ((PAGE_4K << order) < bytes) order++;
+
+    uring_t* ring = (uring_t*)kmalloc(sizeof(uring_t));
+    if (!ring) return -1;
+    memset(ring, 0, sizeof(*ring));
+    ring->order = order;
+    ring->sleeps = (uring_sleep_t*)kmalloc(cq_entries * sizeof(uring_sleep_t));
+    ring->phys = pmm_alloc_pages(order);
+    if (!ring->sleeps || !ring->phys) {
+        uring_free(ring);
+        return -1;
+    }
+    ring->sq_entries = sq_entries;
+    ring->cq_entries = cq_entries;
+
+    u8* base = (u8*)pmm_phys_to_virt(ring->phys);
+    memset(base, 0, PAGE_4K << order);
+    ring->hdr = (uring_header_t*)base;
+    ring->hdr->sq_entries = sq_entries;
+    ring->hdr->sq_mask = sq_entries - 1;
+    ring->hdr->cq_entries = cq_entries;
+    ring->hdr->cq_mask = cq_entries - 1;
+    ring->hdr->sq_off = sizeof(uring_header_t);
+    ring->hdr->cq_off = sizeof(uring_header_t) + sq_entries * sizeof(uring_sqe_t);
+    ring->sqes = (uring_sqe_t*)(base + ring->hdr->sq_off);
+    ring->cqes = (uring_cqe_t*)(base + ring->hdr->cq_off);
+
+    // Kernel threads share the kernel's view; programs see it at a fixed
+    // address. The mapping is not owned by the space: uring_destroy frees it.
+    long addr = (long)(uintptr_t)base;
+    if (proc->space.pml4_phys) {
+        if (!mm_space_map(&proc->space, URING_USER_BASE, ring->phys, PAGE_4K << order, PTE_RW)) {
+            uring_free(ring);
+            return -1;
+        }
+        addr = (long)URING_USER_BASE;
+    }
+    proc->uring = ring;
+    return addr;
+}
+
+long uring_enter(process_t* proc, u32 to_submit, u32 min_complete) {
+    uring_t* ring = proc ? proc->uring : NULL;
+    if (!ring) return -1;
+
+    uring_post_due(ring);
+
+    long submitted = 0;
+    u32 sq_tail = __atomic_load_n(&ring->hdr->sq_tail, __ATOMIC_ACQUIRE);
+    while ((u32)submitted < to_submit && ring->sq_head != sq_tail) {
+        // Every taken entry needs a completion slot, sleeps included
+        if (uring_cq_used(ring) + ring->sleeps_pending >= ring->cq_entries) break;
+
+        // Copy first: the program may rewrite the slot meanwhile
+        uring_sqe_t sqe = ring->sqes[ring->sq_head & (ring->sq_entries - 1)];
+        ring->sq_head++;
+        __atomic_store_n(&ring->hdr->sq_head, ring->sq_head, __ATOMIC_RELEASE);
+        submitted++;
+
+        if (sqe.opcode == URING_OP_SLEEP && !sqe.flags) {
+            u64 ticks = ((u64)sqe.len * pit_get_hz() + 999) / 1000;
+            uring_sleep_t* s = &ring->sleeps[ring->sleeps_pending++];
+            s->deadline = pit_ticks() + ticks;
+            s->user_data = sqe.user_data;
+            continue;
+        }
+        uring_post(ring, sqe.user_data, uring_run(proc, ring, &sqe));
+    }
+
+    for (;;) {
+        u64 next = uring_post_due(ring);
+        if (uring_cq_used(ring) >= min_complete || !next) break;
+        u64 now = pit_ticks();
+        if (next > now) sched_sleep_ticks(next - now);
+    }
+    return submitted;
+}
+
+void uring_destroy(process_t* proc) {
+    uring_t* ring = proc ? proc->uring : NULL;
+    if (!ring) return;
+    uring_free(ring);
+    proc->uring = NULL;
+}
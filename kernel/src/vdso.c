@@ -0,0 +1,46 @@
+#include <vdso.h>
+#include <pmm.h>
+#include <clock.h>
+#include <pit/pit.h>
+#include <string.h>
+#include <vgaio.h>
+
+static u64 g_vdso_phys = 0;
+static vdso_data_t* g_vdso = NULL;
+
+void vdso_init(void) {
+    u64 phys = pmm_alloc_pages(0);
+    if (!phys) {
+        vga_printf("[VDSO] Failed to allocate the clock page\n");
+        return;
+    }
+    vdso_data_t* data = (vdso_data_t*)pmm_phys_to_virt(phys);
+    memset(data, 0, PAGE_4K);
+    data->tick_hz = pit_get_hz();
+    data->tsc_hz = clock_tsc_hz();
+    clock_params(&data->tsc_base, &data->ns_base, &data->ns_mult);
+    data->ticks = pit_ticks();
+
+    g_vdso_phys = phys;
+    __atomic_store_n(&g_vdso, data, __ATOMIC_RELEASE);
+}
+
+void vdso_set_ticks(u64 ticks) {
+    vdso_data_t* data = __atomic_load_n(&g_vdso, __ATOMIC_ACQUIRE);
+    if (data) data->ticks = ticks;
+}
+
+const vdso_data_t* vdso_data(void) {
+    return g_vdso;
+}
+
+int vdso_map(mm_space_t* space, u32 pid, u32 parent_pid) {
+    if (!g_vdso_phys) return -1;
+    if (!mm_space_map(space, VDSO_USER_BASE, g_vdso_phys, PAGE_4K, 0)) return -1;
+    if (!mm_space_alloc(space, VDSO_PROC_BASE, PAGE_4K, 0)) return -1;
+
+    vdso_proc_t* proc = (vdso_proc_t*)pmm_phys_to_virt(mm_space_translate(space, VDSO_PROC_BASE));
+    proc->pid = pid;
+    proc->parent_pid = parent_pid;
+    return 0;
+}
@@ -0,0 +1,114 @@
+; syscall_bench.asm - Round-trip cost of `int 0x80` versus `syscall`
+; Calls getpid ITERATIONS times through each kernel entry path and prints
+; the average number of TSC cycles per call.
+; Assembles to a relocatable object file (.o)
+
+%define SYS_EXIT    1
+%define SYS_WRITE   4
+%define SYS_GETPID  20
+%define ITERATIONS  100000
+
+section .rodata
+int_msg:    db 'int 0x80: '
+int_len     equ $ - int_msg
+sys_msg:    db 'syscall:  '
+sys_len     equ $ - sys_msg
+unit_msg:   db ' cycles/call', 10
+unit_len    equ $ - unit_msg
+
+section .text
+global _start
+
+_start:
+    ; Warm up both paths so the first timed call does not pay for misses
+    mov eax, SYS_GETPID
+    int 0x80
+    mov eax, SYS_GETPID
+    syscall
+
+    ; int 0x80
+    call read_tsc
+    mov r12, rax
+    mov ebx, ITERATIONS
+.int_loop:
+    mov eax, SYS_GETPID
+    int 0x80
+    dec ebx
+    jnz .int_loop
+    call read_tsc
+    sub rax, r12
+    mov r13, rax
+    mov rsi, int_msg
+    mov rdx, int_len
+    call print_result
+
+    ; syscall (clobbers rcx and r11 only)
+    call read_tsc
+    mov r12, rax
+    mov ebx, ITERATIONS
+.sys_loop:
+    mov eax, SYS_GETPID
+    syscall
+    dec ebx
+    jnz .sys_loop
+    call read_tsc
+    sub rax, r12
+    mov r13, rax
+    mov rsi, sys_msg
+    mov rdx, sys_len
+    call print_result
+
+    ; sys_exit(0)
+    mov rax, SYS_EXIT
+    xor edi, edi
+    int 0x80
+
+    ; sys_exit should never return, but just in case:
+    mov rax, 0
+    ret
+
+; rax = TSC, ordered after earlier instructions
+read_tsc:
+    lfence
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    ret
+
+; Print the label in rsi/rdx, then r13 / ITERATIONS and the unit
+print_result:
+    mov rax, SYS_WRITE
+    mov rdi, 1
+    int 0x80
+
+    mov rax, r13
+    xor edx, edx
+    mov rcx, ITERATIONS
+    div rcx
+
+    ; Decimal digits, built backwards in a stack buffer
+    sub rsp, 32
+    lea rsi, [rsp + 32]
+    mov rcx, 10
+.digit:
+    xor edx, edx
+    div rcx
+    add dl, '0'
+    dec rsi
+    mov [rsi], dl
+    test rax, rax
+    jnz .digit
+
+    lea rdx, [rsp + 32]
+    sub rdx, rsi
+    mov rax, SYS_WRITE
+    mov rdi, 1
+    int 0x80
+    add rsp, 32
+
+    mov rax, SYS_WRITE
+    mov rdi, 1
+    mov rsi, unit_msg
+    mov rdx, unit_len
+    int 0x80
+    ret
@@ -0,0 +1,174 @@
+; uring_bench.asm - Throughput of batched ring submission versus `int 0x80`
+; Issues ITERATIONS empty writes to stdout one trap each, then the same
+; writes queued BATCH at a time on the syscall rings (see kernel uring.h)
+; with one trap per batch, and prints the average TSC cycles per write.
+; Both paths run the same write handler, so only the way in differs.
+; Assembles to a relocatable object file (.o)
+
+%define SYS_EXIT        1
+%define SYS_WRITE       4
+%define SYS_URING_SETUP 32
+%define SYS_URING_ENTER 33
+%define ITERATIONS      65536
+%define BATCH           256         ; Ring size; ITERATIONS is a multiple
+
+; uring.h layout
+%define URING_OP_WRITE  1
+%define SQ_TAIL         4
+%define SQ_MASK         8
+%define CQ_HEAD         16
+%define CQ_TAIL         20
+%define SQ_OFF          32
+%define SQE_SHIFT       5           ; 32-byte entries
+
+section .rodata
+int_msg:    db 'int 0x80: '
+int_len     equ $ - int_msg
+ring_msg:   db 'uring:    '
+ring_len    equ $ - ring_msg
+unit_msg:   db ' cycles/write', 10
+unit_len    equ $ - unit_msg
+fail_msg:   db 'uring: setup or submission failed', 10
+fail_len    equ $ - fail_msg
+
+section .text
+global _start
+
+_start:
+    mov rax, SYS_URING_SETUP
+    mov rdi, BATCH
+    int 0x80
+    test rax, rax
+    js .failed
+    mov r14, rax                ; Ring header
+    mov eax, [r14 + SQ_OFF]
+    lea r15, [r14 + rax]        ; Submission entries
+    mov rbp, unit_msg           ; Any valid buffer; nothing is printed
+
+    ; Warm up the write path
+    mov rax, SYS_WRITE
+    mov rdi, 1
+    mov rsi, rbp
+    xor edx, edx
+    int 0x80
+
+    ; int 0x80, one trap per write
+    call read_tsc
+    mov r12, rax
+    mov ebx, ITERATIONS
+.int_loop:
+    mov rax, SYS_WRITE
+    mov rdi, 1
+    mov rsi, rbp
+    xor edx, edx
+    int 0x80
+    dec ebx
+    jnz .int_loop
+    call read_tsc
+    sub rax, r12
+    mov r13, rax
+    mov rsi, int_msg
+    mov rdx, int_len
+    call print_result
+
+    ; Rings, one trap per BATCH writes
+    call read_tsc
+    mov r12, rax
+    mov ebx, ITERATIONS / BATCH
+.batch:
+    mov edx, [r14 + SQ_TAIL]
+    mov ecx, BATCH
+.fill:
+    mov eax, edx
+    and eax, [r14 + SQ_MASK]
+    shl eax, SQE_SHIFT
+    lea rdi, [r15 + rax]
+    mov dword [rdi], URING_OP_WRITE     ; opcode, flags, reserved
+    mov dword [rdi + 4], 1              ; fd
+    mov [rdi + 8], rbp                  ; addr
+    mov qword [rdi + 16], 0             ; len, off
+    mov [rdi + 24], rdx                 ; user_data
+    inc edx
+    dec ecx
+    jnz .fill
+    mov [r14 + SQ_TAIL], edx
+
+    ; uring_enter(BATCH, BATCH)
+    mov rax, SYS_URING_ENTER
+    mov rdi, BATCH
+    mov rsi, BATCH
+    int 0x80
+    cmp rax, BATCH
+    jne .failed
+    ; Every completion is in; consume them all
+    mov eax, [r14 + CQ_TAIL]
+    mov [r14 + CQ_HEAD], eax
+    dec ebx
+    jnz .batch
+    call read_tsc
+    sub rax, r12
+    mov r13, rax
+    mov rsi, ring_msg
+    mov rdx, ring_len
+    call print_result
+
+    ; sys_exit(0)
+    mov rax, SYS_EXIT
+    xor edi, edi
+    int 0x80
+
+.failed:
+    mov rax, SYS_WRITE
+    mov rdi, 1
+    mov rsi, fail_msg
+    mov rdx, fail_len
+    int 0x80
+    mov rax, SYS_EXIT
+    mov rdi, 1
+    int 0x80
+
+; rax = TSC, ordered after earlier instructions
+read_tsc:
+    lfence
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    ret
+
+; Print the label in rsi/rdx, then r13 / ITERATIONS and the unit
+print_result:
+    mov rax, SYS_WRITE
+    mov rdi, 1
+    int 0x80
+
+    mov rax, r13
+    xor edx, edx
+    mov rcx, ITERATIONS
+    div rcx
+
+    ; Decimal digits, built backwards in a stack buffer
+    sub rsp, 32
+    lea rsi, [rsp + 32]
+    mov rcx, 10
+.digit:
+    xor edx, edx
+    div rcx
+    add dl, '0'
+    dec rsi
+    mov [rsi], dl
+    test rax, rax
+    jnz .digit
+
+    lea rdx, [rsp + 32]
+    sub rdx, rsi
+    mov rax, SYS_WRITE
+    mov rdi, 1
+    int 0x80
+    add rsp, 32
+
+    mov rax, SYS_WRITE
+    mov rdi, 1
+    mov rsi, unit_msg
+    mov rdx, unit_len
+    int 0x80
+    ret
@@ -0,0 +1,156 @@
+; vdso_bench.asm - getpid through the vDSO page versus `int 0x80`
+; Checks that both agree, times ITERATIONS calls of each and prints the
+; average TSC cycles per call and the uptime read from the clock page.
+; Assembles to a relocatable object file (.o)
+
+%define SYS_EXIT    1
+%define SYS_WRITE   4
+%define SYS_GETPID  20
+%define ITERATIONS  100000
+
+section .rodata
+pid_msg:    db 'pid '
+pid_len     equ $ - pid_msg
+int_msg:    db 'int 0x80: '
+int_len     equ $ - int_msg
+vdso_msg:   db 'vdso:     '
+vdso_len    equ $ - vdso_msg
+unit_msg:   db ' cycles/call'
+unit_len    equ $ - unit_msg
+up_msg:     db 'uptime '
+up_len      equ $ - up_msg
+ms_msg:     db ' ms'
+ms_len      equ $ - ms_msg
+nl_msg:     db 10
+bad_msg:    db 'vdso: pid does not match getpid', 10
+bad_len     equ $ - bad_msg
+
+section .text
+global _start
+
+_start:
+    mov eax, SYS_GETPID
+    int 0x80
+    mov rbx, rax
+    call vdso_getpid
+    cmp rax, rbx
+    jne .mismatch
+    mov rsi, pid_msg
+    mov rdx, pid_len
+    call print
+    mov rax, rbx
+    call print_number
+    call print_newline
+
+    ; int 0x80
+    call read_tsc
+    mov r12, rax
+    mov ebx, ITERATIONS
+.int_loop:
+    mov eax, SYS_GETPID
+    int 0x80
+    dec ebx
+    jnz .int_loop
+    call read_tsc
+    sub rax, r12
+    mov r13, rax
+    mov rsi, int_msg
+    mov rdx, int_len
+    call print_result
+
+    ; vDSO
+    call read_tsc
+    mov r12, rax
+    mov ebx, ITERATIONS
+.vdso_loop:
+    call vdso_getpid
+    dec ebx
+    jnz .vdso_loop
+    call read_tsc
+    sub rax, r12
+    mov r13, rax
+    mov rsi, vdso_msg
+    mov rdx, vdso_len
+    call print_result
+
+    mov rsi, up_msg
+    mov rdx, up_len
+    call print
+    call vdso_clock_ns
+    xor edx, edx
+    mov rcx, 1000000
+    div rcx
+    call print_number
+    mov rsi, ms_msg
+    mov rdx, ms_len
+    call print
+    call print_newline
+
+    ; sys_exit(0)
+    mov rax, SYS_EXIT
+    xor edi, edi
+    int 0x80
+
+.mismatch:
+    mov rsi, bad_msg
+    mov rdx, bad_len
+    call print
+    mov rax, SYS_EXIT
+    mov rdi, 1
+    int 0x80
+
+; rax = TSC, ordered after earlier instructions
+read_tsc:
+    lfence
+    rdtsc
+    shl rdx, 32
+    or rax, rdx
+    ret
+
+; Write rdx bytes at rsi to stdout
+print:
+    mov rax, SYS_WRITE
+    mov rdi, 1
+    int 0x80
+    ret
+
+print_newline:
+    mov rsi, nl_msg
+    mov rdx, 1
+    jmp print
+
+; Print rax in decimal
+print_number:
+    ; Digits, built backwards in a stack buffer
+    sub rsp, 32
+    lea rsi, [rsp + 32]
+    mov rcx, 10
+.digit:
+    xor edx, edx
+    div rcx
+    add dl, '0'
+    dec rsi
+    mov [rsi], dl
+    test rax, rax
+    jnz .digit
+
+    lea rdx, [rsp + 32]
+    sub rdx, rsi
+    call print
+    add rsp, 32
+    ret
+
+; Print the label in rsi/rdx, then r13 / ITERATIONS and the unit
+print_result:
+    call print
+    mov rax, r13
+    xor edx, edx
+    mov rcx, ITERATIONS
+    div rcx
+    call print_number
+    mov rsi, unit_msg
+    mov rdx, unit_len
+    call print
+    jmp print_newline
+
+%include "vdso.inc"
@@ -1,6 +1,7 @@
 time = time or {}
 
 time.time = __c_time
+time.ns = __c_time_ns
 time.sleep = __c_time_sleep
 
 return time
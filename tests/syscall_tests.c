@@ -0,0 +1,122 @@
+#include <cldtest.h>
+#include <syscalls.h>
+#include <syscall_test.h>
+#include <process.h>
+#include <uring.h>
+#include <vdso.h>
+#include <pmm.h>
+#include <kmalloc.h>
+#include <string.h>
+#include <pit/pit.h>
+#include "../drivers/cldramfs/cldramfs.h"
+
+CLDTEST_SUITE(syscall_tests) {}
+
+CLDTEST_WITH_SUITE("Syscall counters test", syscall_counters_test, syscall_tests) {
+    const struct syscall_entry* getpid = get_syscall_info(SYSCALL_GETPID);
+    u32 level = syscall_trace_level();
+    u64 calls = getpid->calls;
+
+    // Both entry paths land in the same counters
+    assert(syscall0(SYSCALL_GETPID) == (long)current_pid);
+    assert(fast_syscall0(SYSCALL_GETPID) == (long)current_pid);
+    assert(getpid->calls == calls + 2);
+    assert(getpid->cycles > 0);
+
+    // Out-of-range numbers fail quietly below the errors level
+    assert(syscall_set_trace_level(SYSCALL_TRACE_OFF) == 0);
+    long bad = syscall0(MAX_SYSCALLS);
+    syscall_set_trace_level(level);
+    assert(bad == -1);
+    assert(syscall_set_trace_level(SYSCALL_TRACE_MAX + 1) == -1);
+    assert(syscall_trace_level() == level);
+}
+
+CLDTEST_WITH_SUITE("Uring batched submission test", uring_batch_test, syscall_tests) {
+    cldramfs_init();
+    Node *file = cldramfs_create_node("uring.txt", FILE_NODE, ramfs_root);
+    cldramfs_add_child(ramfs_root, file);
+    kfree(file->content);
+    file->content = (char*)kmalloc(12);
+    memcpy(file->content, "hello uring", 12);
+    file->content_size = 11;
+
+    // A process that never runs is enough: the rings belong to it
+    u32 pid = process_create("uring-test", NULL, NULL);
+    process_t* proc = process_get(pid);
+    assert(proc != NULL);
+    uring_header_t* hdr = (uring_header_t*)uring_setup(proc, 3);
+    assert((long)hdr != -1);
+    assert(hdr->sq_entries == 4 && hdr->cq_entries == 8);
+    assert(uring_setup(proc, 4) == -1);
+
+    uring_sqe_t* sq = (uring_sqe_t*)((u8*)hdr + hdr->sq_off);
+    uring_cqe_t* cq = (uring_cqe_t*)((u8*)hdr + hdr->cq_off);
+    static const char path[] = "/uring.txt";
+    char buf[16] = {0};
+
+    sq[0] = (uring_sqe_t){ .opcode = URING_OP_SLEEP, .len = 5, .user_data = 1 };
+    sq[1] = (uring_sqe_t){ .opcode = URING_OP_OPEN, .addr = (u64)(uintptr_t)path,
+                           .len = sizeof(path) - 1, .user_data = 2 };
+    sq[2] = (uring_sqe_t){ .opcode = URING_OP_READ, .fd = URING_FD_BASE, .addr = (u64)(uintptr_t)buf,
+                           .len = 5, .off = URING_OFF_CURRENT, .user_data = 3 };
+    sq[3] = (uring_sqe_t){ .opcode = 0xFF, .user_data = 4 };
+    hdr->sq_tail = 4;
+    u64 start = pit_ticks();
+    assert(uring_enter(proc, 4, 4) == 4);
+    assert(pit_ticks() - start >= (5ULL * pit_get_hz() + 999) / 1000);
+    assert(hdr->sq_head == 4 && hdr->cq_tail == 4);
+
+    // Everything else completes at once; the sleep comes in last
+    assert(cq[0].user_data == 2 && cq[0].res == URING_FD_BASE);
+    assert(cq[1].user_data == 3 && cq[1].res == 5);
+    assert(cq[2].user_data == 4 && cq[2].res == -1);
+    assert(cq[3].user_data == 1 && cq[3].res == 0);
+    assert(memcmp(buf, "hello", 5) == 0);
+    hdr->cq_head = 4;
+
+    // Reads go on from the file position; a closed fd is gone
+    sq[0] = (uring_sqe_t){ .opcode = URING_OP_READ, .fd = URING_FD_BASE, .addr = (u64)(uintptr_t)buf,
+                           .len = sizeof(buf), .off = URING_OFF_CURRENT, .user_data = 5 };
+    sq[1] = (uring_sqe_t){ .opcode = URING_OP_CLOSE, .fd = URING_FD_BASE, .user_data = 6 };
+    sq[2] = (uring_sqe_t){ .opcode = URING_OP_READ, .fd = URING_FD_BASE, .addr = (u64)(uintptr_t)buf,
+                           .len = sizeof(buf), .user_data = 7 };
+    hdr->sq_tail = 7;
+    assert(uring_enter(proc, 3, 0) == 3);
+    assert(cq[4].user_data == 5 && cq[4].res == 6);
+    assert(memcmp(buf, " uring", 6) == 0);
+    assert(cq[5].user_data == 6 && cq[5].res == 0);
+    assert(cq[6].user_data == 7 && cq[6].res == -1);
+
+    uring_destroy(proc);
+    assert(proc->uring == NULL);
+    process_exit(pid, 0);
+    cldramfs_free_node(ramfs_root);
+}
+
+CLDTEST_WITH_SUITE("vDSO page test", vdso_page_test, syscall_tests) {
+    const vdso_data_t* data = vdso_data();
+    assert(data != NULL);
+    assert(data->tick_hz == pit_get_hz());
+    u64 seen = data->ticks;
+    u64 now = pit_ticks();
+    assert(seen <= now && now - seen <= 1);
+
+    u64 free_before = pmm_free_bytes();
+    mm_space_t space;
+    assert(mm_space_create(&space));
+    assert(vdso_map(&space, 7, 3) == 0);
+
+    // Both pages are readable but not writable from user mode
+    assert(mm_space_check(&space, VDSO_USER_BASE, sizeof(vdso_data_t), 0));
+    assert(!mm_space_check(&space, VDSO_USER_BASE, sizeof(vdso_data_t), 1));
+    assert(!mm_space_check(&space, VDSO_PROC_BASE, sizeof(vdso_proc_t), 1));
+    assert(pmm_phys_to_virt(mm_space_translate(&space, VDSO_USER_BASE)) == (const void*)data);
+    const vdso_proc_t* proc = (const vdso_proc_t*)pmm_phys_to_virt(mm_space_translate(&space, VDSO_PROC_BASE));
+    assert(proc->pid == 7 && proc->parent_pid == 3);
+
+    // Only the process page belongs to the space
+    assert(space.owned_pages == 1);
+    mm_space_destroy(&space);
+    assert(pmm_free_bytes() == free_before);
+}
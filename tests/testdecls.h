@@ -4,6 +4,12 @@
 // Forward declarations for all test functions
 extern void mm_simple_test(void);
 extern void mm_alignment_test(void);
+extern void mm_1g_page_test(void);
+extern void mm_range_test(void);
+extern void mm_shootdown_test(void);
+extern void pmm_buddy_test(void);
+extern void kstack_test(void);
+extern void mm_space_test(void);
 extern void strlen_test(void);
 extern void strcmp_test(void);
 extern void strcpy_test(void);
@@ -19,14 +25,35 @@ extern void kmalloc_zero_size_test(void);
 extern void kmalloc_free_reuse_test(void);
 extern void krealloc_test(void);
 extern void kernel_malloc_test(void);
+extern void kmalloc_slab_classes_test(void);
+extern void krealloc_slab_test(void);
+extern void kmalloc_stats_test(void);
+extern void krealloc_in_place_test(void);
+extern void karena_test(void);
+extern void kmalloc_large_test(void);
+extern void kheap_init_size_test(void);
+
+// Scheduler test functions
+extern void sched_round_robin_test(void);
+extern void ktimer_sleep_test(void);
+extern void deferred_priority_test(void);
+extern void task_pool_test(void);
+extern void spinlock_test(void);
 
 #define CLDTEST_INIT() do { \
     cldtest_register_suite("memory_tests", 0); \
     cldtest_register_suite("string_tests", 0); \
     cldtest_register_suite("system_tests", 0); \
     cldtest_register_suite("malloc_tests", 0); \
+    cldtest_register_suite("sched_tests", 0); \
     cldtest_register_test("Memory map/unmap test", mm_simple_test, "memory_tests"); \
     cldtest_register_test("Memory alignment test", mm_alignment_test, "memory_tests"); \
+    cldtest_register_test("1G page map/unmap test", mm_1g_page_test, "memory_tests"); \
+    cldtest_register_test("Range map/unmap test", mm_range_test, "memory_tests"); \
+    cldtest_register_test("TLB shootdown test", mm_shootdown_test, "memory_tests"); \
+    cldtest_register_test("Buddy frame allocator test", pmm_buddy_test, "memory_tests"); \
+    cldtest_register_test("Guarded kernel stack test", kstack_test, "memory_tests"); \
+    cldtest_register_test("User address space test", mm_space_test, "memory_tests"); \
     cldtest_register_test("String length test", strlen_test, "string_tests"); \
     cldtest_register_test("String compare test", strcmp_test, "string_tests"); \
     cldtest_register_test("String copy test", strcpy_test, "string_tests"); \
@@ -40,6 +67,18 @@ extern void kernel_malloc_test(void);
     cldtest_register_test("Kmalloc free and reuse test", kmalloc_free_reuse_test, "malloc_tests"); \
     cldtest_register_test("Krealloc test", krealloc_test, "malloc_tests"); \
     cldtest_register_test("Kernel malloc test", kernel_malloc_test, "malloc_tests"); \
+    cldtest_register_test("Slab size class test", kmalloc_slab_classes_test, "malloc_tests"); \
+    cldtest_register_test("Slab krealloc across classes test", krealloc_slab_test, "malloc_tests"); \
+    cldtest_register_test("Kmalloc accounting test", kmalloc_stats_test, "malloc_tests"); \
+    cldtest_register_test("In-place krealloc test", krealloc_in_place_test, "malloc_tests"); \
+    cldtest_register_test("Scratch arena test", karena_test, "malloc_tests"); \
+    cldtest_register_test("Large object kmalloc test", kmalloc_large_test, "malloc_tests"); \
+    cldtest_register_test("Boot heap size test", kheap_init_size_test, "malloc_tests"); \
+    cldtest_register_test("Round-robin scheduling test", sched_round_robin_test, "sched_tests"); \
+    cldtest_register_test("Timer deadline and sleep test", ktimer_sleep_test, "sched_tests"); \
+    cldtest_register_test("Deferred work priority test", deferred_priority_test, "sched_tests"); \
+    cldtest_register_test("Task pool spawn and wait test", task_pool_test, "sched_tests"); \
+    cldtest_register_test("Spinlock and rwlock test", spinlock_test, "sched_tests"); \
 } while(0)
 
 #endif // TESTDECLS_H
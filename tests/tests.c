@@ -1,7 +1,18 @@
 #include <cldtest.h>
 #include <memory_mapper.h>
+#include <pmm.h>
+#include <kstack.h>
 #include <string.h>
 #include <kmalloc.h>
+#include <kheap.h>
+#include <karena.h>
+#include <sched.h>
+#include <ktimer.h>
+#include <deferred.h>
+#include <task.h>
+#include <spinlock.h>
+#include <smp.h>
+#include <pit/pit.h>
 
 #include <vgaio.h>
 
@@ -30,6 +41,162 @@ CLDTEST_WITH_SUITE("Memory alignment test", mm_alignment_test, memory_tests) {
     assert(is_canonical(test_addr));
 }
 
+CLDTEST_WITH_SUITE("1G page map/unmap test", mm_1g_page_test, memory_tests) {
+    if (!mm_has_1g_pages()) return;
+    
+    // Alias the GiB holding a fresh frame through one PDPT entry
+    u64 vaddr = 0xffffb00000000000ULL;
+    u64 *probe = (u64 *)pmm_phys_to_virt(pmm_alloc_pages(0));
+    assert(probe != NULL);
+    *probe = 0x1122334455667788ULL;
+    u64 phys_base = (u64)(uintptr_t)probe & ~(PAGE_1G - 1);
+    
+    assert(mm_map(vaddr, phys_base, PTE_RW | PTE_HUGE, PAGE_1G));
+    assert(*(u64 *)(vaddr + ((u64)(uintptr_t)probe - phys_base)) == 0x1122334455667788ULL);
+    // No 4K mapping can be placed inside a 1G page
+    assert(!mm_map(vaddr + PAGE_4K, 0x1000ULL, PTE_RW, PAGE_4K));
+    assert(mm_unmap(vaddr, PAGE_1G));
+    
+    pmm_free_pages((u64)(uintptr_t)probe, 0);
+}
+
+CLDTEST_WITH_SUITE("Range map/unmap test", mm_range_test, memory_tests) {
+    u64 vaddr = 0xffffb00000000000ULL;
+    u64 phys = pmm_alloc_pages(3);
+    assert(phys != 0);
+    u64 tables_before = mm_table_pages_in_use();
+    
+    assert(mm_map_range(vaddr, phys, 8 * PAGE_4K, PTE_RW));
+    for (u64 i = 0; i < 8; i++) {
+        *(u64 *)(vaddr + i * PAGE_4K) = i;
+        assert(*(u64 *)pmm_phys_to_virt(phys + i * PAGE_4K) == i);
+    }
+    assert(mm_unmap_range(vaddr, 8 * PAGE_4K));
+    
+    // Emptied PT/PD were released; kernel-half PDPTs exist from mm_init
+    assert(mm_table_pages_in_use() == tables_before);
+    pmm_free_pages(phys, 3);
+}
+
+CLDTEST_WITH_SUITE("TLB shootdown test", mm_shootdown_test, memory_tests) {
+    u64 vaddr = 0xffffb00000000000ULL;
+    u64 phys = pmm_alloc_pages(0);
+    assert(phys != 0);
+    u64 before = mm_tlb_shootdowns();
+    
+    // Adding a mapping needs no flush anywhere
+    assert(mm_map(vaddr, phys, PTE_RW, PAGE_4K));
+    assert(mm_tlb_shootdowns() == before);
+    
+    // Removing it does, and every online CPU has flushed by the time it returns
+    assert(mm_unmap(vaddr, PAGE_4K));
+    if (smp_cpu_count() > 1) {
+        assert(mm_tlb_shootdowns() == before + 1);
+        u64 gen = this_cpu()->tlb_gen;
+        for (u32 i = 0; i < smp_cpu_count(); i++) {
+            cpu_t *cpu = smp_cpu(i);
+            if (cpu && cpu->online) assert(cpu->tlb_gen >= gen);
+        }
+    } else {
+        assert(mm_tlb_shootdowns() == before);
+    }
+    pmm_free_pages(phys, 0);
+}
+
+CLDTEST_WITH_SUITE("Buddy frame allocator test", pmm_buddy_test, memory_tests) {
+    u64 free_before = pmm_free_bytes();
+    
+    u64 page = pmm_alloc_pages(0);
+    assert(page != 0);
+    assert((page & (PMM_PAGE_SIZE - 1)) == 0);
+    
+    u64 block = pmm_alloc_pages(PMM_ORDER_2M);
+    assert(block != 0);
+    assert((block & (PAGE_2M - 1)) == 0);
+    assert(pmm_free_bytes() == free_before - PMM_PAGE_SIZE - PAGE_2M);
+    
+    // Memory handed out is reachable through the identity map
+    memset(pmm_phys_to_virt(block), 0xA5, PAGE_2M);
+    
+    pmm_free_pages(block, PMM_ORDER_2M);
+    pmm_free_pages(page, 0);
+    assert(pmm_free_bytes() == free_before);
+    
+    u64 buf = pmm_alloc_contiguous(3 * PMM_PAGE_SIZE);
+    assert(buf != 0);
+    assert(pmm_free_bytes() == free_before - 3 * PMM_PAGE_SIZE);
+    pmm_free_contiguous(buf, 3 * PMM_PAGE_SIZE);
+    assert(pmm_free_bytes() == free_before);
+}
+
+static long kstack_test_deep(void* arg) {
+    volatile u8 frame[8192];
+    for (u32 i = 0; i < sizeof(frame); i++) frame[i] = (u8)i;
+    return (long)(uintptr_t)arg + frame[100];
+}
+
+CLDTEST_WITH_SUITE("Guarded kernel stack test", kstack_test, memory_tests) {
+    kstack_t *stack = kstack_alloc(16 * 1024, "test");
+    assert(stack != NULL);
+    assert(stack->top - stack->base == 16 * 1024);
+    assert((stack->top & 15) == 0);
+    assert(kstack_high_water(stack) == 0);
+    
+    // The pages right below the stack belong to its guard region
+    assert(kstack_guard_owner(stack->base - 8) == stack);
+    assert(kstack_guard_owner(stack->base) == NULL);
+    
+    // Running on the stack moves its high-water mark past the frame used
+    assert(kstack_call(stack->top, kstack_test_deep, (void*)1) == 101);
+    size_t peak = kstack_high_water(stack);
+    assert(peak >= 8192 && peak < 16 * 1024);
+    
+    kstack_free(stack);
+    assert(kstack_guard_owner(stack->base - 8) == NULL);
+}
+
+CLDTEST_WITH_SUITE("User address space test", mm_space_test, memory_tests) {
+    u64 free_before = pmm_free_bytes();
+    u64 va = USER_SPACE_BASE + 0x400000ULL;
+    mm_space_t space;
+    assert(mm_space_create(&space));
+    
+    assert(mm_space_alloc(&space, va, 2 * PAGE_4K, PTE_RW));
+    assert(mm_space_alloc(&space, va + 4 * PAGE_4K, PAGE_4K, 0));
+    assert(space.owned_pages == 3);
+    assert(mm_space_translate(&space, va + 8) != 0);
+    assert(mm_space_translate(&space, va + 2 * PAGE_4K) == 0);
+    // Kernel addresses are never user addresses
+    assert(!mm_space_alloc(&space, 0xffffb00000000000ULL, PAGE_4K, PTE_RW));
+    
+    assert(mm_space_check(&space, va + 100, PAGE_4K, 1));
+    assert(!mm_space_check(&space, va + PAGE_4K, 2 * PAGE_4K, 0));
+    assert(mm_space_check(&space, va + 4 * PAGE_4K, 16, 0));
+    assert(!mm_space_check(&space, va + 4 * PAGE_4K, 16, 1));
+    
+    // The kernel stays mapped while the space is loaded
+    sched_preempt_disable();
+    mm_space_activate(&space);
+    *(volatile u64 *)va = 0x5555AAAA5555AAAAULL;
+    // and sees kernel mappings made after it was created
+    u64 kva = 0xffffc00000000000ULL;
+    u64 kphys = pmm_alloc_pages(0);
+    assert(kphys != 0);
+    assert(mm_map(kva, kphys, PTE_RW, PAGE_4K));
+    *(volatile u64 *)kva = 0x1234;
+    mm_space_activate(NULL);
+    sched_preempt_enable();
+    assert(*(u64 *)pmm_phys_to_virt(mm_space_translate(&space, va)) == 0x5555AAAA5555AAAAULL);
+    assert(*(u64 *)pmm_phys_to_virt(kphys) == 0x1234);
+    assert(mm_unmap(kva, PAGE_4K));
+    pmm_free_pages(kphys, 0);
+    
+    mm_space_destroy(&space);
+    assert(space.pml4_phys == 0);
+    assert(space.owned_pages == 0);
+    assert(pmm_free_bytes() == free_before);
+}
+
 CLDTEST_SUITE(malloc_tests) {}
 
 CLDTEST_WITH_SUITE("Basic kmalloc test", kmalloc_basic_test, malloc_tests) {
@@ -155,5 +322,366 @@ CLDTEST_WITH_SUITE("Kernel malloc test", kernel_malloc_test, malloc_tests) {
     kfree(ptr);
 }
 
+CLDTEST_WITH_SUITE("Slab size class test", kmalloc_slab_classes_test, malloc_tests) {
+    void *small[64];
+    
+    for (int i = 0; i < 64; i++) {
+        small[i] = kmalloc(16 + (i % 8) * 32);
+        assert(small[i] != NULL);
+        assert(((uintptr_t)small[i] & 15) == 0);
+        memset(small[i], i, 16 + (i % 8) * 32);
+    }
+    
+    for (int i = 0; i < 64; i++) {
+        assert(((u8*)small[i])[0] == (u8)i);
+        assert(((u8*)small[i])[15 + (i % 8) * 32] == (u8)i);
+    }
+    
+    for (int i = 0; i < 64; i += 2) kfree(small[i]);
+    
+    // Freed slab objects are handed out again without disturbing live ones
+    for (int i = 0; i < 64; i += 2) {
+        small[i] = kmalloc(16 + (i % 8) * 32);
+        assert(small[i] != NULL);
+    }
+    for (int i = 1; i < 64; i += 2) {
+        assert(((u8*)small[i])[0] == (u8)i);
+    }
+    
+    for (int i = 0; i < 64; i++) kfree(small[i]);
+}
+
+CLDTEST_WITH_SUITE("Slab krealloc across classes test", krealloc_slab_test, malloc_tests) {
+    char *ptr = (char*)kmalloc(24);
+    assert(ptr != NULL);
+    strcpy(ptr, "slab-object");
+    
+    // Shrinking within the class keeps the object in place
+    assert(krealloc(ptr, 20) == ptr);
+    
+    char *grown = (char*)krealloc(ptr, 3000);
+    assert(grown != NULL);
+    assert(strcmp(grown, "slab-object") == 0);
+    
+    char *back = (char*)krealloc(grown, 100);
+    assert(back != NULL);
+    assert(strcmp(back, "slab-object") == 0);
+    kfree(back);
+}
 
+CLDTEST_WITH_SUITE("Kmalloc accounting test", kmalloc_stats_test, malloc_tests) {
+    kmalloc_stats_t before, after;
+    int tracking = kmalloc_tracking_enabled();
+    kmalloc_set_tracking(1);
+    kmalloc_get_stats(&before);
+    
+    void *a = kmalloc(100);
+    void *b = kmalloc(5000);
+    assert(a != NULL && b != NULL);
+    b = krealloc(b, 9000);
+    assert(b != NULL);
+    kfree(a);
+    kfree(b);
+    
+    kmalloc_get_stats(&after);
+    assert(after.alloc_calls - before.alloc_calls >= 2);
+    assert(after.free_calls - before.free_calls >= 2);
+    assert(after.bytes_allocated - before.bytes_allocated >= 5100);
+    assert(kmalloc_largest_free_block() > 0);
+    kmalloc_set_tracking(tracking);
+}
+
+CLDTEST_WITH_SUITE("In-place krealloc test", krealloc_in_place_test, malloc_tests) {
+    char *ptr = (char*)kmalloc(8192);
+    assert(ptr != NULL);
+    strcpy(ptr, "grow-me");
+    
+    // Shrinking a segment block splits off the tail without moving it
+    assert(krealloc(ptr, 4096) == ptr);
+    
+    // The tail just released is adjacent, so growing again stays in place
+    char *grown = (char*)krealloc(ptr, 6144);
+    assert(grown == ptr);
+    assert(strcmp(grown, "grow-me") == 0);
+    
+    // Growth that has to move the block still preserves the contents
+    char *neighbour = (char*)kmalloc(4096);
+    assert(neighbour != NULL);
+    char *moved = (char*)krealloc(grown, 64 * 1024);
+    assert(moved != NULL);
+    assert(strcmp(moved, "grow-me") == 0);
+    
+    kfree(neighbour);
+    kfree(moved);
+}
 
+CLDTEST_WITH_SUITE("Scratch arena test", karena_test, malloc_tests) {
+    KARENA_DEFINE(arena, 256);
+    
+    karena_mark_t outer = karena_begin(&arena);
+    char *a = karena_strdup(&arena, "outer");
+    assert(a != NULL);
+    assert(((uintptr_t)a & (KARENA_ALIGN - 1)) == 0);
+    
+    // A nested scope rolls back only what it allocated
+    karena_mark_t inner = karena_begin(&arena);
+    char *b = (char*)karena_alloc(&arena, 32);
+    assert(b != NULL && b != a);
+    size_t used = arena.used;
+    karena_reset(&arena, inner);
+    assert(arena.used < used);
+    assert(karena_alloc(&arena, 32) == b);
+    
+    // The newest block grows in place while it is the top of the arena
+    char *g = (char*)karena_alloc(&arena, 16);
+    assert(karena_grow(&arena, g, 16, 64) == g);
+    
+    // Oversized requests spill to the heap and are released at depth 0
+    char *big = (char*)karena_alloc(&arena, 4096);
+    assert(big != NULL);
+    assert(arena.spill != NULL);
+    assert(strcmp(a, "outer") == 0);
+    karena_reset(&arena, outer);
+    assert(arena.used == 0);
+    assert(arena.spill == NULL);
+    assert(arena.depth == 0);
+}
+
+CLDTEST_WITH_SUITE("Large object kmalloc test", kmalloc_large_test, malloc_tests) {
+    u64 free_before = pmm_free_bytes();
+    size_t size = 3 * 1024 * 1024;
+    
+    // Large requests get their own 2M-aligned mapping behind the header
+    char *buf = (char*)kmalloc(size);
+    assert(buf != NULL);
+    assert((((uintptr_t)buf - 16) & (PAGE_2M - 1)) == 0);
+    assert(pmm_free_bytes() + 4 * 1024 * 1024 <= free_before);
+    
+    u64 phys = kmalloc_virt_to_phys(buf);
+    assert(phys != 0);
+    assert(((phys - 16) & (PAGE_2M - 1)) == 0);
+    
+    buf[0] = 'L';
+    buf[size - 1] = 'R';
+    assert(krealloc(buf, size / 2) == buf);
+    assert(buf[0] == 'L' && buf[size - 1] == 'R');
+    
+    // Freeing returns the whole range to the frame allocator; only a
+    // page-table page or two may stay behind
+    kfree(buf);
+    assert(pmm_free_bytes() + 4 * PAGE_4K >= free_before);
+}
+
+CLDTEST_WITH_SUITE("Boot heap size test", kheap_init_size_test, malloc_tests) {
+    const kheap_info_t *info = kheap_get_info();
+#ifdef KHEAP_EAGER
+    // Eager mode maps all free memory but a reserve, not just the lazy start
+    assert(info->init_size > KHEAP_INITIAL_SIZE);
+#else
+    assert(info->init_size <= KHEAP_INITIAL_SIZE + PAGE_2M);
+#endif
+    assert(info->total_size >= info->init_size);
+}
+
+CLDTEST_SUITE(sched_tests) {}
+
+static volatile u32 sched_test_trace[64];
+static volatile u32 sched_test_pos;
+
+static long sched_test_worker(void* arg) {
+    u32 id = (u32)(uintptr_t)arg;
+    volatile double acc = id;
+    for (u32 i = 0; i < 8; i++) {
+        if (sched_test_pos < 64) sched_test_trace[sched_test_pos++] = id;
+        acc = acc * 2.0 + 0.5;
+        sched_yield();
+    }
+    // FPU state must survive the switches in between
+    return acc == id * 256.0 + 127.5 ? (long)id : -1;
+}
+
+CLDTEST_WITH_SUITE("Round-robin scheduling test", sched_round_robin_test, sched_tests) {
+    sched_test_pos = 0;
+    u64 free_before = pmm_free_bytes();
+    u32 a = sched_spawn("test-a", sched_test_worker, (void*)1, 16 * 1024);
+    u32 b = sched_spawn("test-b", sched_test_worker, (void*)2, 16 * 1024);
+    assert(a != 0 && b != 0);
+    
+    assert(sched_wait(a) == 1);
+    assert(sched_wait(b) == 2);
+    assert(sched_test_pos == 16);
+    
+    // Both workers got turns before either one finished
+    u32 switches = 0;
+    for (u32 i = 1; i < 16; i++) {
+        if (sched_test_trace[i] != sched_test_trace[i - 1]) switches++;
+    }
+    assert(switches >= 8);
+    
+    // Exited processes hand their stacks back once reaped
+    assert(process_get(a)->state == PROCESS_EXITED);
+    assert(process_get(a)->kstack == NULL);
+    assert(pmm_free_bytes() + 4 * PAGE_4K >= free_before);
+}
+
+static volatile u32 timer_test_order[4];
+static volatile u32 timer_test_fired;
+
+static void timer_test_fn(void* arg) {
+    if (timer_test_fired < 4) timer_test_order[timer_test_fired] = (u32)(uintptr_t)arg;
+    timer_test_fired++;
+}
+
+static void timer_test_count_fn(void* arg) {
+    (*(volatile u32*)arg)++;
+}
+
+CLDTEST_WITH_SUITE("Timer deadline and sleep test", ktimer_sleep_test, sched_tests) {
+    ktimer_t t1, t2, t3, cancelled;
+    timer_test_fired = 0;
+    ktimer_init(&t1, timer_test_fn, (void*)1);
+    ktimer_init(&t2, timer_test_fn, (void*)2);
+    ktimer_init(&t3, timer_test_fn, (void*)3);
+    ktimer_init(&cancelled, timer_test_fn, (void*)4);
+
+    // Armed out of order, they must fire by deadline
+    ktimer_start(&t3, 15, 0);
+    ktimer_start(&t1, 5, 0);
+    ktimer_start(&cancelled, 8, 0);
+    ktimer_start(&t2, 10, 0);
+    assert(ktimer_next_deadline() <= pit_ticks() + 5);
+    assert(ktimer_cancel(&cancelled) == 1);
+    assert(ktimer_cancel(&cancelled) == 0);
+
+    u64 start = pit_ticks();
+    sleep_ms(25);
+    assert(pit_ticks() - start >= 25);
+
+    assert(timer_test_fired == 3);
+    assert(timer_test_order[0] == 1 && timer_test_order[1] == 2 && timer_test_order[2] == 3);
+    assert(!ktimer_pending(&t1) && !ktimer_pending(&t2) && !ktimer_pending(&t3));
+
+    // Periodic timers stay armed; deadlines past the wheel span still park
+    volatile u32 periodic_count = 0;
+    ktimer_t periodic, far;
+    ktimer_init(&periodic, timer_test_count_fn, (void*)&periodic_count);
+    ktimer_init(&far, timer_test_fn, (void*)4);
+    ktimer_start(&periodic, 2, 2);
+    ktimer_start_at(&far, pit_ticks() + (1ULL << 30));
+    sleep_ms(20);
+    assert(ktimer_pending(&periodic) && ktimer_pending(&far));
+    assert(ktimer_cancel(&periodic) == 1);
+    assert(ktimer_cancel(&far) == 1);
+    assert(periodic_count >= 5);
+    assert(timer_test_fired == 3);
+}
+
+static volatile u32 deferred_test_order[4];
+static volatile u32 deferred_test_ran;
+static deferred_work_t deferred_test_requeue;
+
+static void deferred_test_fn(void* arg) {
+    if (deferred_test_ran < 4) deferred_test_order[deferred_test_ran] = (u32)(uintptr_t)arg;
+    deferred_test_ran++;
+    // Pending flag is clear while running, so work may queue itself again
+    if (arg == (void*)3 && deferred_test_ran < 4) assert(deferred_queue(&deferred_test_requeue) == 1);
+}
+
+CLDTEST_WITH_SUITE("Deferred work priority test", deferred_priority_test, sched_tests) {
+    deferred_work_t low, high;
+    deferred_test_ran = 0;
+    deferred_init_work(&low, deferred_test_fn, (void*)1, DEFERRED_PRIO_LOW);
+    deferred_init_work(&high, deferred_test_fn, (void*)2, DEFERRED_PRIO_HIGH);
+    deferred_init_work(&deferred_test_requeue, deferred_test_fn, (void*)3, DEFERRED_PRIO_LOW);
+
+    assert(deferred_queue(&low) == 1);
+    assert(deferred_queue(&deferred_test_requeue) == 1);
+    assert(deferred_queue(&high) == 1);
+    assert(deferred_queue(&high) == 0);
+    assert(deferred_work_pending(&high) && deferred_has_pending());
+
+    deferred_process_all();
+    // High priority first, then low in FIFO order, then the requeued item
+    assert(deferred_test_ran == 4);
+    assert(deferred_test_order[0] == 2 && deferred_test_order[1] == 1);
+    assert(deferred_test_order[2] == 3 && deferred_test_order[3] == 3);
+    assert(!deferred_work_pending(&low) && !deferred_work_pending(&deferred_test_requeue));
+}
+
+// More tasks than one deque holds, so the inline fallback runs too
+#define TASK_TEST_COUNT (TASK_DEQUE_SIZE + 16)
+static task_t task_test_tasks[TASK_TEST_COUNT];
+static u64 task_test_results[TASK_TEST_COUNT];
+
+static void task_test_square(void* arg) {
+    u64 i = (u64)(uintptr_t)arg;
+    task_test_results[i] = i * i;
+}
+
+CLDTEST_WITH_SUITE("Task pool spawn and wait test", task_pool_test, sched_tests) {
+    for (u32 i = 0; i < TASK_TEST_COUNT; i++) {
+        task_test_results[i] = ~0ULL;
+        task_spawn(&task_test_tasks[i], task_test_square, (void*)(uintptr_t)i);
+    }
+    for (u32 i = 0; i < TASK_TEST_COUNT; i++) task_wait(&task_test_tasks[i]);
+    for (u32 i = 0; i < TASK_TEST_COUNT; i++) {
+        assert(task_done(&task_test_tasks[i]));
+        assert(task_test_results[i] == (u64)i * i);
+    }
+    assert(!task_run_one());
+}
+
+#define LOCK_TEST_TASKS 16
+#define LOCK_TEST_ROUNDS 2000
+static spinlock_t lock_test_lock = SPINLOCK_INIT("test");
+static rwlock_t lock_test_rwlock = RWLOCK_INIT("test-rw");
+static task_t lock_test_tasks[LOCK_TEST_TASKS];
+static u64 lock_test_spin_count;
+static u64 lock_test_write_count;
+
+// Plain increments: any lost update means two CPUs were inside at once
+static void lock_test_increment(void* arg) {
+    (void)arg;
+    for (u32 i = 0; i < LOCK_TEST_ROUNDS; i++) {
+        spin_lock(&lock_test_lock);
+        lock_test_spin_count++;
+        spin_unlock(&lock_test_lock);
+
+        write_lock(&lock_test_rwlock);
+        lock_test_write_count++;
+        write_unlock(&lock_test_rwlock);
+    }
+}
+
+CLDTEST_WITH_SUITE("Spinlock and rwlock test", spinlock_test, sched_tests) {
+    u32 preempt = sched_preempt_count;
+
+    spin_lock(&lock_test_lock);
+    int nested = spin_trylock(&lock_test_lock);
+    u32 held_preempt = sched_preempt_count;
+    spin_unlock(&lock_test_lock);
+    assert(!nested);
+    assert(held_preempt == preempt + 1);
+    assert(spin_trylock(&lock_test_lock));
+    spin_unlock(&lock_test_lock);
+    assert(!spin_is_locked(&lock_test_lock));
+
+    // Readers share the lock
+    read_lock(&lock_test_rwlock);
+    read_lock(&lock_test_rwlock);
+    u32 readers = lock_test_rwlock.state;
+    read_unlock(&lock_test_rwlock);
+    read_unlock(&lock_test_rwlock);
+    assert(readers == 2 && lock_test_rwlock.state == 0);
+
+    lock_test_spin_count = 0;
+    lock_test_write_count = 0;
+    for (u32 i = 0; i < LOCK_TEST_TASKS; i++) {
+        task_spawn(&lock_test_tasks[i], lock_test_increment, NULL);
+    }
+    for (u32 i = 0; i < LOCK_TEST_TASKS; i++) task_wait(&lock_test_tasks[i]);
+    assert(lock_test_spin_count == (u64)LOCK_TEST_TASKS * LOCK_TEST_ROUNDS);
+    assert(lock_test_write_count == (u64)LOCK_TEST_TASKS * LOCK_TEST_ROUNDS);
+    assert(lock_test_lock.stats.acquisitions >= (u64)LOCK_TEST_TASKS * LOCK_TEST_ROUNDS);
+    assert(sched_preempt_count == preempt);
+}
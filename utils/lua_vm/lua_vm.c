@@ -8,7 +8,9 @@
 #include <ps2.h>
 #include <shell_control.h>
 #include <pit/pit.h>
+#include <clock.h>
 #include <gui/gui.h>
+#include <sched.h>
 
 #include <lua.h>
 
@@ -60,24 +62,14 @@ static void vm_key_getch(u8 sc, int is_extended, int is_pressed) {
     if (c) { vm_ch = c; vm_ch_ready = 1; vm_waiting_ch = 0; }
 }
 
+// Scripts run in their own process, so the main loop keeps rendering GUI
+// frames while they wait.
 static void vm_wait_for_interrupt(void) {
-    gui_pump_redraw();
-    __asm__ volatile("hlt");
+    sched_idle_wait();
 }
 
 static void vm_sleep_ms(u64 ms) {
-    u32 hz = pit_get_hz();
-    if (!hz) {
-        sleep_ms(ms);
-        return;
-    }
-    u64 target_ticks = (ms * (u64)hz) / 1000ULL;
-    if (target_ticks == 0) target_ticks = 1;
-    u64 until = pit_ticks() + target_ticks;
-    while (pit_ticks() < until) {
-        vm_wait_for_interrupt();
-    }
-    gui_pump_redraw();
+    sleep_ms(ms);
 }
 
 // ---- Lua C functions ----
@@ -416,10 +408,12 @@ static int l_keydown(lua_State *L) {
 }
 
 static int l_time(lua_State *L) {
-    u32 hz = pit_get_hz();
-    u64 ticks = pit_ticks();
-    if (!hz) lua_pushinteger(L, (lua_Integer)ticks);
-    else lua_pushinteger(L, (lua_Integer)((ticks * 1000ULL) / (u64)hz));
+    lua_pushinteger(L, (lua_Integer)(clock_ns() / 1000000ULL));
+    return 1;
+}
+
+static int l_time_ns(lua_State *L) {
+    lua_pushinteger(L, (lua_Integer)clock_ns());
     return 1;
 }
 
@@ -838,6 +832,7 @@ int cld_luavm_run_file_with_args(const char *path, int argc, const char **argv)
     lua_pushcfunction(L, l_file_remove); lua_setglobal(L, "__c_file_remove");
     lua_pushcfunction(L, l_random); lua_setglobal(L, "__c_random");
     lua_pushcfunction(L, l_time); lua_setglobal(L, "__c_time");
+    lua_pushcfunction(L, l_time_ns); lua_setglobal(L, "__c_time_ns");
     lua_pushcfunction(L, l_sleep); lua_setglobal(L, "__c_time_sleep");
     lua_pushcfunction(L, l_import); lua_setglobal(L, "import");
     lua_pushcfunction(L, l_import); lua_setglobal(L, "include");
@@ -989,3 +984,8 @@ void cld_luavm_run_deferred_with_args(void *arg) {
         shell_resume();
     }
 }
+
+long cld_luavm_thread_with_args(void *arg) {
+    cld_luavm_run_deferred_with_args(arg);
+    return 0;
+}
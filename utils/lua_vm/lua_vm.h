@@ -15,4 +15,8 @@ int cld_luavm_read_config_u32s(const char *path, const char **keys, u32 *out, in
 void cld_luavm_run_deferred(void *arg);
 void cld_luavm_run_deferred_with_args(void *arg);
 
+// Process entry for sched_spawn; runs a script concurrently with the shell
+#define CLD_LUAVM_STACK_SIZE (256 * 1024)
+long cld_luavm_thread_with_args(void *arg);
+
 #endif // CLD_LUA_VM_H
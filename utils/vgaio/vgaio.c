@@ -6,12 +6,20 @@
 #include <portio.h>
 #include <fb/fb_console.h>
 #include <kmalloc.h>
+#include <spinlock.h>
 
 
 static volatile char* vga_addr = (volatile char*) 0xb8000;
 static Cursor cursor = {0, 0};
 static u8 arrt = 0x07;
 
+// Cursor and escape state are shared by every CPU and process writing to the
+// console. vga_printf holds the lock across the whole call to keep one
+// call's output together, and prints through vga_putchar, so it is
+// recursive. Interrupt handlers print too, hence interrupts stay off while
+// it is held.
+static rspinlock_t console_lock = RSPINLOCK_INIT("console");
+
 // Optional sinks for GUI terminal redirection
 static vga_putchar_sink_t g_putchar_sink = NULL;
 static int g_putchar_sink_suppress = 0;
@@ -266,7 +274,7 @@ static void vga_handle_ansi_sequence(void) {
     ansi_buffer_pos = 0;
 }
 
-void vga_putchar(char c) {
+static void vga_emit(char c) {
     if (g_putchar_sink) {
         g_putchar_sink(c);
         if (g_putchar_sink_suppress) return;
@@ -367,6 +375,20 @@ void vga_putchar(char c) {
     #endif
 }
 
+void vga_putchar(char c) {
+    u64 flags = rspin_lock_irqsave(&console_lock);
+    vga_emit(c);
+    rspin_unlock_irqrestore(&console_lock, flags);
+}
+
+void vga_write(const char* s, u64 len) {
+    u64 flags = rspin_lock_irqsave(&console_lock);
+    for (u64 i = 0; i < len; i++) {
+        vga_emit(s[i]);
+    }
+    rspin_unlock_irqrestore(&console_lock, flags);
+}
+
 void vga_attr(u8 _arrt) {
     if (g_attr_sink) {
         g_attr_sink(_arrt);
@@ -526,6 +548,7 @@ int vga_printf(const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
     int count = 0;
+    u64 flags = rspin_lock_irqsave(&console_lock);
 
     while (*fmt) {
         if (*fmt == '%') {
@@ -638,6 +661,7 @@ int vga_printf(const char *fmt, ...) {
         fmt++;
     }
 
+    rspin_unlock_irqrestore(&console_lock, flags);
     va_end(args);
     return count;
 }
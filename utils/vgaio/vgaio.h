@@ -13,6 +13,8 @@ typedef struct {
 } Cursor;
 
 void vga_putchar(char);
+// Write len bytes under a single console lock.
+void vga_write(const char* s, u64 len);
 void vga_attr(u8);
 void vga_update_cursor(int x, int y);
 void vga_clear_screen(void);